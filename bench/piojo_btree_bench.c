@@ -0,0 +1,270 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2013 G. Elian Gidoni
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+
+#include <piojo_bench.h>
+#include <piojo/piojo_btree.h>
+
+#define BENCH_ENTRIES (1 << 21)
+#define BENCH_LOOKUPS (1 << 22)
+#define BENCH_RANGES (1 << 18)
+#define BENCH_RANGE_WIDTH 256
+
+/*
+ * Lookups and full scans of the same tree with different node fanouts,
+ * 0 selects the default cache line sized nodes.
+ */
+
+static void
+bench_fanout(size_t fanout, const int64_t *keys)
+{
+        piojo_btree_t *tree;
+        piojo_btree_cursor_t cursor;
+        char name[64], label[32];
+        size_t i, found = 0;
+        int64_t k, sum = 0;
+        double start;
+
+        if (fanout == 0){
+                snprintf(label, sizeof(label), "default");
+        }else{
+                snprintf(label, sizeof(label), "%zu", fanout);
+        }
+        tree = piojo_btree_alloc_cb_i64k(fanout, sizeof(int64_t),
+                                         piojo_alloc_default);
+        for (k = 0; k < BENCH_ENTRIES; ++k){
+                piojo_btree_insert(&keys[k], &k, tree);
+        }
+
+        start = piojo_bench_now();
+        for (i = 0; i < BENCH_LOOKUPS; ++i){
+                found += (piojo_btree_search(&keys[i % BENCH_ENTRIES],
+                                             tree) != NULL);
+        }
+        snprintf(name, sizeof(name), "btree %s search", label);
+        piojo_bench_report(name, BENCH_LOOKUPS, piojo_bench_now() - start);
+        if (found != BENCH_LOOKUPS){
+                fprintf(stderr, "Unexpected lookup misses.\n");
+                exit(EXIT_FAILURE);
+        }
+
+        start = piojo_bench_now();
+        for (i = 0; i < 8; ++i){
+                const void *key = piojo_btree_cursor_first(tree, &cursor);
+                while (key != NULL){
+                        sum += *(const int64_t*) key;
+                        key = piojo_btree_cursor_next(&cursor, tree);
+                }
+        }
+        snprintf(name, sizeof(name), "btree %s scan", label);
+        piojo_bench_report(name, 8 * BENCH_ENTRIES,
+                           piojo_bench_now() - start);
+        if (sum == 0){
+                fprintf(stderr, "Unexpected empty scan.\n");
+                exit(EXIT_FAILURE);
+        }
+
+        piojo_btree_free(tree);
+}
+
+static bool
+count_visit(const void *key, void *data, void *state)
+{
+        (void) data;
+        *(int64_t*) state += *(const int64_t*) key;
+        return true;
+}
+
+/* Short range scans over random keys, classic vs. B+ layout. */
+static void
+bench_range(const char *name, piojo_btree_mode_t mode, const int64_t *keys)
+{
+        piojo_btree_t *tree;
+        size_t i, visited = 0;
+        int64_t k, lo, hi, sum = 0;
+        int64_t span = (INT64_MAX / BENCH_ENTRIES) * BENCH_RANGE_WIDTH;
+        double start;
+
+        tree = piojo_btree_alloc_mode_i64k(mode, 0, sizeof(int64_t),
+                                           piojo_alloc_default);
+        for (k = 0; k < BENCH_ENTRIES; ++k){
+                piojo_btree_insert(&keys[k], &k, tree);
+        }
+
+        start = piojo_bench_now();
+        for (i = 0; i < BENCH_RANGES; ++i){
+                lo = keys[i % BENCH_ENTRIES];
+                hi = (lo < INT64_MAX - span) ? lo + span : INT64_MAX;
+                visited += piojo_btree_range(&lo, &hi, count_visit, &sum,
+                                             tree);
+        }
+        piojo_bench_report(name, visited, piojo_bench_now() - start);
+        if (sum == 0){
+                fprintf(stderr, "Unexpected empty scan.\n");
+                exit(EXIT_FAILURE);
+        }
+        piojo_btree_free(tree);
+}
+
+/* Order statistics over random keys, walked down by subtree counts. */
+static void
+bench_order(const int64_t *keys)
+{
+        piojo_btree_t *tree;
+        size_t i, sum = 0;
+        int64_t k, hi;
+        int64_t span = (INT64_MAX / BENCH_ENTRIES) * BENCH_RANGE_WIDTH;
+        double start;
+
+        tree = piojo_btree_alloc_i64k(sizeof(int64_t));
+        for (k = 0; k < BENCH_ENTRIES; ++k){
+                piojo_btree_insert(&keys[k], &k, tree);
+        }
+
+        start = piojo_bench_now();
+        for (i = 0; i < BENCH_LOOKUPS; ++i){
+                sum += piojo_btree_rank(&keys[i % BENCH_ENTRIES], tree);
+        }
+        piojo_bench_report("btree rank", BENCH_LOOKUPS,
+                           piojo_bench_now() - start);
+
+        start = piojo_bench_now();
+        for (i = 0; i < BENCH_LOOKUPS; ++i){
+                k = *(const int64_t*) piojo_btree_select(
+                        (size_t) keys[i % BENCH_ENTRIES] % BENCH_ENTRIES,
+                        tree, NULL);
+                sum += (size_t) k;
+        }
+        piojo_bench_report("btree select", BENCH_LOOKUPS,
+                           piojo_bench_now() - start);
+
+        start = piojo_bench_now();
+        for (i = 0; i < BENCH_RANGES; ++i){
+                k = keys[i % BENCH_ENTRIES];
+                hi = (k < INT64_MAX - span) ? k + span : INT64_MAX;
+                sum += piojo_btree_count_range(&k, &hi, tree);
+        }
+        piojo_bench_report("btree count range", BENCH_RANGES,
+                           piojo_bench_now() - start);
+        if (sum == 0){
+                fprintf(stderr, "Unexpected empty tree.\n");
+                exit(EXIT_FAILURE);
+        }
+        piojo_btree_free(tree);
+}
+
+/* Loading sorted keys one insertion at a time vs. bulk loading. */
+static void
+bench_build(void)
+{
+        piojo_btree_t *tree;
+        int64_t *sorted, k;
+        double start;
+
+        sorted = (int64_t*) malloc(BENCH_ENTRIES * sizeof(int64_t));
+        for (k = 0; k < BENCH_ENTRIES; ++k){
+                sorted[k] = k;
+        }
+
+        tree = piojo_btree_alloc_i64k(sizeof(int64_t));
+        start = piojo_bench_now();
+        for (k = 0; k < BENCH_ENTRIES; ++k){
+                piojo_btree_insert(&sorted[k], &sorted[k], tree);
+        }
+        piojo_bench_report("btree sorted inserts", BENCH_ENTRIES,
+                           piojo_bench_now() - start);
+        piojo_btree_free(tree);
+
+        tree = piojo_btree_alloc_i64k(sizeof(int64_t));
+        start = piojo_bench_now();
+        piojo_btree_build_sorted(sorted, sorted, BENCH_ENTRIES, 1.0f, tree);
+        piojo_bench_report("btree build sorted", BENCH_ENTRIES,
+                           piojo_bench_now() - start);
+        piojo_btree_free(tree);
+
+        free(sorted);
+}
+
+/* Full copies vs. shared snapshots, and writes that copy shared nodes. */
+static void
+bench_snapshot(const int64_t *keys)
+{
+        piojo_btree_t *tree, *copy, *snapshot;
+        int64_t k;
+        size_t i;
+        double start;
+
+        tree = piojo_btree_alloc_i64k(sizeof(int64_t));
+        for (k = 0; k < BENCH_ENTRIES; ++k){
+                piojo_btree_insert(&keys[k], &k, tree);
+        }
+
+        start = piojo_bench_now();
+        copy = piojo_btree_copy(tree);
+        piojo_bench_report("btree copy", 1, piojo_bench_now() - start);
+        piojo_btree_free(copy);
+
+        start = piojo_bench_now();
+        snapshot = piojo_btree_snapshot(tree);
+        piojo_bench_report("btree snapshot", 1, piojo_bench_now() - start);
+
+        start = piojo_bench_now();
+        for (i = 0; i < BENCH_ENTRIES; ++i){
+                k = keys[i] ^ 1;
+                piojo_btree_set(&k, &k, tree);
+        }
+        piojo_bench_report("btree sets after snapshot", BENCH_ENTRIES,
+                           piojo_bench_now() - start);
+        if (piojo_btree_size(snapshot) * 2 != piojo_btree_size(tree)){
+                fprintf(stderr, "Unexpected snapshot size.\n");
+                exit(EXIT_FAILURE);
+        }
+        piojo_btree_free(snapshot);
+        piojo_btree_free(tree);
+}
+
+int main(void)
+{
+        size_t fanouts[] = {8, 0, 128, 512};
+        int64_t *keys;
+        uint64_t state = 88172645463325252ULL;
+        size_t i;
+
+        keys = (int64_t*) malloc(BENCH_ENTRIES * sizeof(int64_t));
+        for (i = 0; i < BENCH_ENTRIES; ++i){
+                keys[i] = (int64_t) (piojo_bench_rand(&state) >> 1);
+        }
+
+        for (i = 0; i < sizeof(fanouts) / sizeof(fanouts[0]); ++i){
+                bench_fanout(fanouts[i], keys);
+        }
+        bench_range("btree classic range", PIOJO_BTREE_MODE_CLASSIC, keys);
+        bench_range("btree plus range", PIOJO_BTREE_MODE_PLUS, keys);
+        bench_order(keys);
+        bench_build();
+        bench_snapshot(keys);
+
+        free(keys);
+        return 0;
+}
@@ -0,0 +1,177 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2013 G. Elian Gidoni
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+
+#include <piojo_bench.h>
+#include <pthread.h>
+#include <piojo/piojo_btree.h>
+#include <piojo/piojo_cbtree.h>
+
+#define BENCH_ENTRIES (1 << 20)
+#define BENCH_THREAD_OPS (1 << 19)
+#define BENCH_MAX_THREADS 16
+
+/* YCSB-like workloads over uniformly random keys. */
+typedef struct {
+        const char *name;
+        /* Updates per 100 operations, the rest are searches. */
+        unsigned int update_pct;
+} workload_t;
+
+static const workload_t WORKLOADS[] = {
+        { "A (50% update)", 50 },
+        { "B (5% update)", 5 },
+        { "C (read only)", 0 },
+};
+
+typedef struct {
+        piojo_cbtree_t *cbtree;
+        piojo_btree_t *btree;
+        pthread_mutex_t *mutex;
+        unsigned int update_pct;
+        uint64_t seed;
+} worker_t;
+
+static void*
+cbtree_worker(void *arg)
+{
+        worker_t *worker = (worker_t*) arg;
+        uint64_t r, state = worker->seed;
+        int64_t key, value;
+        size_t i;
+
+        for (i = 0; i < BENCH_THREAD_OPS; ++i){
+                r = piojo_bench_rand(&state);
+                key = (r >> 8) % BENCH_ENTRIES;
+                if (r % 100 < worker->update_pct){
+                        piojo_cbtree_set(&key, &key, worker->cbtree);
+                }else{
+                        piojo_cbtree_search(&key, &value, worker->cbtree);
+                }
+        }
+        return NULL;
+}
+
+static void*
+mutex_worker(void *arg)
+{
+        worker_t *worker = (worker_t*) arg;
+        uint64_t r, state = worker->seed;
+        int64_t key;
+        size_t i;
+
+        for (i = 0; i < BENCH_THREAD_OPS; ++i){
+                r = piojo_bench_rand(&state);
+                key = (r >> 8) % BENCH_ENTRIES;
+                pthread_mutex_lock(worker->mutex);
+                if (r % 100 < worker->update_pct){
+                        piojo_btree_set(&key, &key, worker->btree);
+                }else{
+                        piojo_btree_search(&key, worker->btree);
+                }
+                pthread_mutex_unlock(worker->mutex);
+        }
+        return NULL;
+}
+
+/* Inserts new keys, all threads append to the right end of the tree. */
+static void*
+insert_worker(void *arg)
+{
+        worker_t *worker = (worker_t*) arg;
+        int64_t key = BENCH_ENTRIES + (int64_t) worker->seed;
+        size_t i;
+
+        for (i = 0; i < BENCH_THREAD_OPS; ++i){
+                piojo_cbtree_insert(&key, &key, worker->cbtree);
+                key += BENCH_MAX_THREADS;
+        }
+        return NULL;
+}
+
+static void
+bench_threads(const char *prefix, void* (*worker_cb)(void*),
+              worker_t *proto, size_t nthreads)
+{
+        pthread_t threads[BENCH_MAX_THREADS];
+        worker_t workers[BENCH_MAX_THREADS];
+        size_t i;
+        double start;
+        char name[64];
+
+        start = piojo_bench_now();
+        for (i = 0; i < nthreads; ++i){
+                workers[i] = *proto;
+                workers[i].seed += i;
+                pthread_create(&threads[i], NULL, worker_cb, &workers[i]);
+        }
+        for (i = 0; i < nthreads; ++i){
+                pthread_join(threads[i], NULL);
+        }
+        snprintf(name, sizeof(name), "%s %zu threads", prefix, nthreads);
+        piojo_bench_report(name, nthreads * BENCH_THREAD_OPS,
+                           piojo_bench_now() - start);
+}
+
+int main(void)
+{
+        pthread_mutex_t mutex;
+        worker_t proto;
+        int64_t k;
+        size_t n, w;
+        char prefix[64];
+
+        pthread_mutex_init(&mutex, NULL);
+        proto.cbtree = piojo_cbtree_alloc_i64k(sizeof(int64_t));
+        proto.btree = piojo_btree_alloc_i64k(sizeof(int64_t));
+        proto.mutex = &mutex;
+        for (k = 0; k < BENCH_ENTRIES; ++k){
+                piojo_cbtree_insert(&k, &k, proto.cbtree);
+                piojo_btree_insert(&k, &k, proto.btree);
+        }
+
+        for (w = 0; w < sizeof(WORKLOADS) / sizeof(WORKLOADS[0]); ++w){
+                proto.update_pct = WORKLOADS[w].update_pct;
+                for (n = 1; n <= BENCH_MAX_THREADS; n *= 2){
+                        proto.seed = 88172645463325252ULL;
+                        snprintf(prefix, sizeof(prefix), "mutex %s",
+                                 WORKLOADS[w].name);
+                        bench_threads(prefix, mutex_worker, &proto, n);
+                        snprintf(prefix, sizeof(prefix), "cbtree %s",
+                                 WORKLOADS[w].name);
+                        bench_threads(prefix, cbtree_worker, &proto, n);
+                }
+        }
+        for (n = 1; n <= BENCH_MAX_THREADS; n *= 2){
+                proto.seed = 0;
+                bench_threads("cbtree insert", insert_worker, &proto, n);
+                piojo_cbtree_free(proto.cbtree);
+                proto.cbtree = piojo_cbtree_alloc_i64k(sizeof(int64_t));
+        }
+
+        piojo_cbtree_free(proto.cbtree);
+        piojo_btree_free(proto.btree);
+        pthread_mutex_destroy(&mutex);
+        return 0;
+}
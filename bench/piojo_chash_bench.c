@@ -0,0 +1,136 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2013 G. Elian Gidoni
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+
+#include <piojo_bench.h>
+#include <pthread.h>
+#include <piojo/piojo_hash.h>
+#include <piojo/piojo_chash.h>
+
+#define BENCH_ENTRIES (1 << 20)
+#define BENCH_THREAD_OPS (1 << 22)
+#define BENCH_MAX_THREADS 16
+
+/* Read-mostly workload: one write every BENCH_WRITE_RATIO operations. */
+#define BENCH_WRITE_RATIO 10
+
+typedef struct {
+        piojo_chash_t *chash;
+        piojo_hash_t *hash;
+        pthread_mutex_t *mutex;
+        uint64_t seed;
+} worker_t;
+
+static void*
+chash_worker(void *arg)
+{
+        worker_t *worker = (worker_t*) arg;
+        uint64_t state = worker->seed;
+        int64_t key, value;
+        size_t i;
+
+        for (i = 0; i < BENCH_THREAD_OPS; ++i){
+                key = piojo_bench_rand(&state) % BENCH_ENTRIES;
+                if (i % BENCH_WRITE_RATIO == 0){
+                        piojo_chash_set(&key, &key, worker->chash);
+                }else{
+                        piojo_chash_search(&key, &value, worker->chash);
+                }
+        }
+        return NULL;
+}
+
+static void*
+mutex_worker(void *arg)
+{
+        worker_t *worker = (worker_t*) arg;
+        uint64_t state = worker->seed;
+        int64_t key;
+        size_t i;
+
+        for (i = 0; i < BENCH_THREAD_OPS; ++i){
+                key = piojo_bench_rand(&state) % BENCH_ENTRIES;
+                pthread_mutex_lock(worker->mutex);
+                if (i % BENCH_WRITE_RATIO == 0){
+                        piojo_hash_set(&key, &key, worker->hash);
+                }else{
+                        piojo_hash_search(&key, worker->hash);
+                }
+                pthread_mutex_unlock(worker->mutex);
+        }
+        return NULL;
+}
+
+static void
+bench_threads(const char *prefix, void* (*worker_cb)(void*),
+              worker_t *proto, size_t nthreads)
+{
+        pthread_t threads[BENCH_MAX_THREADS];
+        worker_t workers[BENCH_MAX_THREADS];
+        size_t i;
+        double start;
+        char name[64];
+
+        start = piojo_bench_now();
+        for (i = 0; i < nthreads; ++i){
+                workers[i] = *proto;
+                workers[i].seed = 88172645463325252ULL + i;
+                pthread_create(&threads[i], NULL, worker_cb, &workers[i]);
+        }
+        for (i = 0; i < nthreads; ++i){
+                pthread_join(threads[i], NULL);
+        }
+        snprintf(name, sizeof(name), "%s %zu threads", prefix, nthreads);
+        piojo_bench_report(name, nthreads * BENCH_THREAD_OPS,
+                           piojo_bench_now() - start);
+}
+
+int main(void)
+{
+        pthread_mutex_t mutex;
+        worker_t proto;
+        int64_t k;
+        size_t n;
+
+        pthread_mutex_init(&mutex, NULL);
+        proto.chash = piojo_chash_alloc_i64k(sizeof(int64_t));
+        proto.hash = piojo_hash_alloc_mode_i64k(PIOJO_HASH_MODE_FLAT,
+                                                sizeof(int64_t),
+                                                piojo_alloc_default);
+        proto.mutex = &mutex;
+        for (k = 0; k < BENCH_ENTRIES; ++k){
+                piojo_chash_insert(&k, &k, proto.chash);
+                piojo_hash_insert(&k, &k, proto.hash);
+        }
+
+        for (n = 1; n <= BENCH_MAX_THREADS; n *= 2){
+                bench_threads("mutex hash", mutex_worker, &proto, n);
+                bench_threads("chash", chash_worker, &proto, n);
+        }
+
+        piojo_chash_free(proto.chash);
+        piojo_hash_free(proto.hash);
+        pthread_mutex_destroy(&mutex);
+        return 0;
+}
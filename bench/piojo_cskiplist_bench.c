@@ -0,0 +1,148 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2013 G. Elian Gidoni
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+
+#include <piojo_bench.h>
+#include <pthread.h>
+#include <piojo/piojo_cskiplist.h>
+#include <piojo/piojo_skiplist.h>
+
+#define BENCH_KEYS (1 << 17)
+#define BENCH_THREAD_OPS (1 << 20)
+#define BENCH_MAX_THREADS 16
+
+/* Mixed workload: 80% searches, 10% insertions and 10% deletions. */
+typedef struct {
+        piojo_cskiplist_t *clist;
+        piojo_skiplist_t *list;
+        pthread_mutex_t *lock;
+        uint64_t seed;
+} worker_t;
+
+static void*
+cskiplist_worker(void *arg)
+{
+        worker_t *worker = (worker_t*) arg;
+        piojo_cskiplist_thread_t *thread;
+        uint64_t state = worker->seed, r;
+        int64_t key, value;
+        size_t i;
+
+        thread = piojo_cskiplist_register(worker->clist);
+        for (i = 0; i < BENCH_THREAD_OPS; ++i){
+                r = piojo_bench_rand(&state);
+                key = (r >> 8) % BENCH_KEYS;
+                if (r % 10 == 0){
+                        piojo_cskiplist_insert(&key, &key, thread,
+                                               worker->clist);
+                }else if (r % 10 == 1){
+                        piojo_cskiplist_delete(&key, thread, worker->clist);
+                }else{
+                        piojo_cskiplist_search(&key, &value, thread,
+                                               worker->clist);
+                }
+        }
+        piojo_cskiplist_unregister(thread, worker->clist);
+        return NULL;
+}
+
+static void*
+skiplist_worker(void *arg)
+{
+        worker_t *worker = (worker_t*) arg;
+        uint64_t state = worker->seed, r;
+        int64_t key, *value;
+        size_t i;
+
+        for (i = 0; i < BENCH_THREAD_OPS; ++i){
+                r = piojo_bench_rand(&state);
+                key = (r >> 8) % BENCH_KEYS;
+                pthread_mutex_lock(worker->lock);
+                if (r % 10 == 0){
+                        piojo_skiplist_insert(&key, &key, worker->list);
+                }else if (r % 10 == 1){
+                        piojo_skiplist_delete(&key, worker->list);
+                }else{
+                        value = (int64_t*) piojo_skiplist_search(&key,
+                                                                 worker->list);
+                        (void) value;
+                }
+                pthread_mutex_unlock(worker->lock);
+        }
+        return NULL;
+}
+
+static void
+bench_threads(const char *prefix, void* (*worker_cb)(void*),
+              worker_t *proto, size_t nthreads)
+{
+        pthread_t threads[BENCH_MAX_THREADS];
+        worker_t workers[BENCH_MAX_THREADS];
+        size_t i;
+        double start;
+        char name[64];
+
+        start = piojo_bench_now();
+        for (i = 0; i < nthreads; ++i){
+                workers[i] = *proto;
+                workers[i].seed = 88172645463325252ULL + i;
+                pthread_create(&threads[i], NULL, worker_cb, &workers[i]);
+        }
+        for (i = 0; i < nthreads; ++i){
+                pthread_join(threads[i], NULL);
+        }
+        snprintf(name, sizeof(name), "%s %zu threads", prefix, nthreads);
+        piojo_bench_report(name, nthreads * BENCH_THREAD_OPS,
+                           piojo_bench_now() - start);
+}
+
+int main(void)
+{
+        piojo_cskiplist_thread_t *thread;
+        pthread_mutex_t lock;
+        worker_t proto;
+        int64_t k;
+        size_t n;
+
+        pthread_mutex_init(&lock, NULL);
+        proto.lock = &lock;
+        proto.clist = piojo_cskiplist_alloc_i64k(sizeof(int64_t));
+        proto.list = piojo_skiplist_alloc_i64k(sizeof(int64_t));
+        thread = piojo_cskiplist_register(proto.clist);
+        for (k = 0; k < BENCH_KEYS; k += 2){
+                piojo_cskiplist_insert(&k, &k, thread, proto.clist);
+                piojo_skiplist_insert(&k, &k, proto.list);
+        }
+        piojo_cskiplist_unregister(thread, proto.clist);
+
+        for (n = 1; n <= BENCH_MAX_THREADS; n *= 2){
+                bench_threads("locked skiplist", skiplist_worker, &proto, n);
+                bench_threads("cskiplist", cskiplist_worker, &proto, n);
+        }
+
+        piojo_cskiplist_free(proto.clist);
+        piojo_skiplist_free(proto.list);
+        pthread_mutex_destroy(&lock);
+        return 0;
+}
@@ -0,0 +1,128 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2013 G. Elian Gidoni
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+
+#include <piojo_bench.h>
+#include <piojo/piojo_hash.h>
+
+#define BENCH_ENTRIES (1 << 21)
+#define BENCH_LOOKUPS (1 << 23)
+#define BENCH_BATCH 256
+
+static const char *MODE_NAMES[] = { "chain", "flat", "incr" };
+
+static void
+bench_mode(piojo_hash_mode_t mode, const int64_t *keys)
+{
+        piojo_hash_t *hash;
+        void *values[BENCH_BATCH];
+        size_t i, found = 0;
+        int64_t k;
+        double start;
+        char name[64];
+
+        hash = piojo_hash_alloc_mode_i64k(mode, sizeof(int64_t),
+                                          piojo_alloc_default);
+        for (k = 0; k < BENCH_ENTRIES; ++k){
+                piojo_hash_insert(&k, &k, hash);
+        }
+
+        start = piojo_bench_now();
+        for (i = 0; i < BENCH_LOOKUPS; ++i){
+                if (piojo_hash_search(&keys[i], hash) != NULL){
+                        ++found;
+                }
+        }
+        snprintf(name, sizeof(name), "%s search", MODE_NAMES[mode]);
+        piojo_bench_report(name, BENCH_LOOKUPS, piojo_bench_now() - start);
+
+        start = piojo_bench_now();
+        for (i = 0; i < BENCH_LOOKUPS; i += BENCH_BATCH){
+                found += piojo_hash_search_batch(&keys[i], BENCH_BATCH,
+                                                 values, hash);
+        }
+        snprintf(name, sizeof(name), "%s search_batch", MODE_NAMES[mode]);
+        piojo_bench_report(name, BENCH_LOOKUPS, piojo_bench_now() - start);
+
+        if (found != 2 * BENCH_LOOKUPS){
+                fprintf(stderr, "Unexpected lookup misses.\n");
+                exit(EXIT_FAILURE);
+        }
+        piojo_hash_free(hash);
+}
+
+static void
+bench_snapshot(void)
+{
+        const char *path = "piojo_hash_bench.snapshot";
+        piojo_hash_t *hash, *mapped;
+        int64_t k;
+        double start;
+
+        start = piojo_bench_now();
+        hash = piojo_hash_alloc_mode_i64k(PIOJO_HASH_MODE_FLAT,
+                                          sizeof(int64_t),
+                                          piojo_alloc_default);
+        for (k = 0; k < BENCH_ENTRIES; ++k){
+                piojo_hash_insert(&k, &k, hash);
+        }
+        piojo_bench_report("flat rebuild", 1, piojo_bench_now() - start);
+
+        if (! piojo_hash_save(path, hash)){
+                fprintf(stderr, "Can't write %s.\n", path);
+                exit(EXIT_FAILURE);
+        }
+        start = piojo_bench_now();
+        mapped = piojo_hash_open_mapped(path);
+        k = BENCH_ENTRIES - 1;
+        if (mapped == NULL || piojo_hash_search(&k, mapped) == NULL){
+                fprintf(stderr, "Can't map %s.\n", path);
+                exit(EXIT_FAILURE);
+        }
+        piojo_bench_report("flat open_mapped", 1, piojo_bench_now() - start);
+
+        piojo_hash_free(mapped);
+        piojo_hash_free(hash);
+        remove(path);
+}
+
+int main(void)
+{
+        int64_t *keys;
+        uint64_t state = 88172645463325252ULL;
+        size_t i;
+
+        keys = (int64_t*) malloc(BENCH_LOOKUPS * sizeof(int64_t));
+        for (i = 0; i < BENCH_LOOKUPS; ++i){
+                keys[i] = piojo_bench_rand(&state) % BENCH_ENTRIES;
+        }
+
+        bench_mode(PIOJO_HASH_MODE_CHAIN, keys);
+        bench_mode(PIOJO_HASH_MODE_FLAT, keys);
+        bench_mode(PIOJO_HASH_MODE_INCR, keys);
+        bench_snapshot();
+
+        free(keys);
+        return 0;
+}
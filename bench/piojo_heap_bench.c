@@ -0,0 +1,105 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2013 G. Elian Gidoni
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+
+#include <piojo_bench.h>
+#include <piojo/piojo_heap.h>
+
+#define BENCH_ENTRIES (1 << 18)
+#define BENCH_DECREASES (1 << 20)
+
+typedef struct {
+        uint64_t key;
+        piojo_heap_handle_t handle;
+} entry_t;
+
+static bool
+entry_leq(piojo_opaque_t e1, piojo_opaque_t e2)
+{
+        return ((entry_t*) e1)->key <= ((entry_t*) e2)->key;
+}
+
+/* Dijkstra-like workload, keys are found by value or by handle. */
+static void
+run(piojo_heap_mode_t mode, const char *name, entry_t *entries)
+{
+        piojo_heap_t *heap;
+        uint64_t state = 88172645463325252ULL;
+        entry_t *e;
+        size_t i;
+        double start;
+        char label[64];
+
+        for (i = 0; i < BENCH_ENTRIES; ++i){
+                entries[i].key = piojo_bench_rand(&state);
+        }
+        heap = piojo_heap_alloc_mode(mode, entry_leq, piojo_alloc_default);
+
+        start = piojo_bench_now();
+        for (i = 0; i < BENCH_ENTRIES; ++i){
+                e = &entries[i];
+                if (mode == PIOJO_HEAP_MODE_HANDLE){
+                        e->handle = piojo_heap_push_handle((piojo_opaque_t)e,
+                                                           heap);
+                }else{
+                        piojo_heap_push((piojo_opaque_t)e, heap);
+                }
+        }
+        snprintf(label, sizeof(label), "%s push", name);
+        piojo_bench_report(label, BENCH_ENTRIES, piojo_bench_now() - start);
+
+        start = piojo_bench_now();
+        for (i = 0; i < BENCH_DECREASES; ++i){
+                e = &entries[piojo_bench_rand(&state) % BENCH_ENTRIES];
+                e->key /= 2;
+                if (mode == PIOJO_HEAP_MODE_HANDLE){
+                        piojo_heap_decrease_handle(e->handle, heap);
+                }else{
+                        piojo_heap_decrease((piojo_opaque_t)e, heap);
+                }
+        }
+        snprintf(label, sizeof(label), "%s decrease", name);
+        piojo_bench_report(label, BENCH_DECREASES,
+                           piojo_bench_now() - start);
+
+        start = piojo_bench_now();
+        while (piojo_heap_size(heap) > 0){
+                piojo_heap_pop(heap);
+        }
+        snprintf(label, sizeof(label), "%s pop", name);
+        piojo_bench_report(label, BENCH_ENTRIES, piojo_bench_now() - start);
+
+        piojo_heap_free(heap);
+}
+
+int main(void)
+{
+        entry_t *entries;
+
+        entries = (entry_t*) malloc(BENCH_ENTRIES * sizeof(entry_t));
+        run(PIOJO_HEAP_MODE_DATA, "heap data", entries);
+        run(PIOJO_HEAP_MODE_HANDLE, "heap handle", entries);
+        free(entries);
+        return 0;
+}
@@ -0,0 +1,107 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2013 G. Elian Gidoni
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+
+#include <piojo_bench.h>
+#include <piojo/piojo_tree.h>
+#include <piojo/piojo_itree.h>
+
+#define BENCH_ENTRIES (1 << 18)
+#define BENCH_SCANS (1 << 10)
+#define BENCH_STABS (1 << 20)
+#define BENCH_RANGE (1 << 26)
+#define BENCH_LENGTH (1 << 10)
+
+static bool
+count_visit(const void *lo, const void *hi, void *data, void *state)
+{
+        PIOJO_UNUSED(lo);
+        PIOJO_UNUSED(hi);
+        PIOJO_UNUSED(data);
+        ++*(size_t*) state;
+        return TRUE;
+}
+
+/* Stabbing queries, interval tree against a scan of a tree keyed by low. */
+int main(void)
+{
+        piojo_tree_t *tree;
+        piojo_itree_t *itree;
+        int64_t *lows, *highs, point;
+        uint64_t state = 88172645463325252ULL;
+        const void *key;
+        void *data;
+        size_t i, scanhits = 0, stabhits = 0;
+        double start;
+
+        lows = (int64_t*) malloc(BENCH_ENTRIES * sizeof(int64_t));
+        highs = (int64_t*) malloc(BENCH_ENTRIES * sizeof(int64_t));
+        for (i = 0; i < BENCH_ENTRIES; ++i){
+                lows[i] = (int64_t) (piojo_bench_rand(&state) % BENCH_RANGE);
+                highs[i] = lows[i] + (int64_t)
+                        (piojo_bench_rand(&state) % BENCH_LENGTH);
+        }
+
+        tree = piojo_tree_alloc_i64k(sizeof(int64_t));
+        itree = piojo_itree_alloc_i64k(sizeof(bool));
+        start = piojo_bench_now();
+        for (i = 0; i < BENCH_ENTRIES; ++i){
+                piojo_itree_insert(&lows[i], &highs[i], NULL, itree);
+        }
+        piojo_bench_report("itree insert", BENCH_ENTRIES,
+                           piojo_bench_now() - start);
+        for (i = 0; i < BENCH_ENTRIES; ++i){
+                piojo_tree_set(&lows[i], &highs[i], tree);
+        }
+
+        start = piojo_bench_now();
+        for (i = 0; i < BENCH_SCANS; ++i){
+                point = lows[i % BENCH_ENTRIES];
+                key = piojo_tree_first(tree, &data);
+                while (key != NULL && *(int64_t*) key <= point){
+                        scanhits += (*(int64_t*) data >= point);
+                        key = piojo_tree_next(key, tree, &data);
+                }
+        }
+        piojo_bench_report("tree scan", BENCH_SCANS,
+                           piojo_bench_now() - start);
+
+        start = piojo_bench_now();
+        for (i = 0; i < BENCH_STABS; ++i){
+                point = lows[i % BENCH_ENTRIES];
+                piojo_itree_stab(&point, count_visit, &stabhits, itree);
+        }
+        piojo_bench_report("itree stab", BENCH_STABS,
+                           piojo_bench_now() - start);
+        if (stabhits < BENCH_STABS){
+                fprintf(stderr, "Unexpected stab misses.\n");
+                exit(EXIT_FAILURE);
+        }
+
+        piojo_itree_free(itree);
+        piojo_tree_free(tree);
+        free(highs);
+        free(lows);
+        return 0;
+}
@@ -0,0 +1,175 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2013 G. Elian Gidoni
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+
+#include <piojo_bench.h>
+#include <piojo/piojo_tree.h>
+#include <piojo/piojo_btree.h>
+#include <piojo/piojo_skiplist.h>
+#include <piojo/piojo_hash.h>
+
+#define BENCH_ENTRIES (1 << 18)
+#define BENCH_LOOKUPS (1 << 22)
+
+/*
+ * Integer keys allocated with *_i64k are compared inline, the same keys
+ * with a user comparison function go through a callback.
+ */
+
+static int
+user_cmp(const void *e1, const void *e2)
+{
+        int64_t v1 = *(const int64_t*) e1;
+        int64_t v2 = *(const int64_t*) e2;
+        return (v1 > v2) - (v1 < v2);
+}
+
+static bool
+user_eq(const void *e1, const void *e2)
+{
+        return *(const int64_t*) e1 == *(const int64_t*) e2;
+}
+
+static void
+check_found(size_t found)
+{
+        if (found != BENCH_LOOKUPS){
+                fprintf(stderr, "Unexpected lookup misses.\n");
+                exit(EXIT_FAILURE);
+        }
+}
+
+static void
+bench_tree(const char *name, piojo_tree_t *tree, const int64_t *keys)
+{
+        size_t i, found = 0;
+        int64_t k;
+        double start;
+
+        for (k = 0; k < BENCH_ENTRIES; ++k){
+                piojo_tree_insert(&k, &k, tree);
+        }
+        start = piojo_bench_now();
+        for (i = 0; i < BENCH_LOOKUPS; ++i){
+                found += (piojo_tree_search(&keys[i], tree) != NULL);
+        }
+        piojo_bench_report(name, BENCH_LOOKUPS, piojo_bench_now() - start);
+        check_found(found);
+        piojo_tree_free(tree);
+}
+
+static void
+bench_btree(const char *name, piojo_btree_t *tree, const int64_t *keys)
+{
+        size_t i, found = 0;
+        int64_t k;
+        double start;
+
+        for (k = 0; k < BENCH_ENTRIES; ++k){
+                piojo_btree_insert(&k, &k, tree);
+        }
+        start = piojo_bench_now();
+        for (i = 0; i < BENCH_LOOKUPS; ++i){
+                found += (piojo_btree_search(&keys[i], tree) != NULL);
+        }
+        piojo_bench_report(name, BENCH_LOOKUPS, piojo_bench_now() - start);
+        check_found(found);
+        piojo_btree_free(tree);
+}
+
+static void
+bench_skiplist(const char *name, piojo_skiplist_t *list,
+               const int64_t *keys)
+{
+        size_t i, found = 0;
+        int64_t k;
+        double start;
+
+        for (k = 0; k < BENCH_ENTRIES; ++k){
+                piojo_skiplist_insert(&k, &k, list);
+        }
+        start = piojo_bench_now();
+        for (i = 0; i < BENCH_LOOKUPS; ++i){
+                found += (piojo_skiplist_search(&keys[i], list) != NULL);
+        }
+        piojo_bench_report(name, BENCH_LOOKUPS, piojo_bench_now() - start);
+        check_found(found);
+        piojo_skiplist_free(list);
+}
+
+static void
+bench_hash(const char *name, piojo_hash_t *hash, const int64_t *keys)
+{
+        size_t i, found = 0;
+        int64_t k;
+        double start;
+
+        for (k = 0; k < BENCH_ENTRIES; ++k){
+                piojo_hash_insert(&k, &k, hash);
+        }
+        start = piojo_bench_now();
+        for (i = 0; i < BENCH_LOOKUPS; ++i){
+                found += (piojo_hash_search(&keys[i], hash) != NULL);
+        }
+        piojo_bench_report(name, BENCH_LOOKUPS, piojo_bench_now() - start);
+        check_found(found);
+        piojo_hash_free(hash);
+}
+
+int main(void)
+{
+        piojo_hasher_if hasher = { piojo_i64_hash, user_eq };
+        size_t esize = sizeof(int64_t);
+        int64_t *keys;
+        uint64_t state = 88172645463325252ULL;
+        size_t i;
+
+        keys = (int64_t*) malloc(BENCH_LOOKUPS * sizeof(int64_t));
+        for (i = 0; i < BENCH_LOOKUPS; ++i){
+                keys[i] = piojo_bench_rand(&state) % BENCH_ENTRIES;
+        }
+
+        bench_tree("tree i64k search", piojo_tree_alloc_i64k(esize), keys);
+        bench_tree("tree cmp search",
+                   piojo_tree_alloc_cmp(esize, user_cmp, esize), keys);
+        bench_btree("btree i64k search", piojo_btree_alloc_i64k(esize),
+                    keys);
+        bench_btree("btree cmp search",
+                    piojo_btree_alloc_cmp(esize, user_cmp, esize), keys);
+        bench_skiplist("skiplist i64k search",
+                       piojo_skiplist_alloc_i64k(esize), keys);
+        bench_skiplist("skiplist cmp search",
+                       piojo_skiplist_alloc_cmp(esize, user_cmp, esize),
+                       keys);
+        bench_hash("flat i64k search",
+                   piojo_hash_alloc_mode_i64k(PIOJO_HASH_MODE_FLAT, esize,
+                                              piojo_alloc_default), keys);
+        bench_hash("flat hasher search",
+                   piojo_hash_alloc_mode_hash(PIOJO_HASH_MODE_FLAT, esize,
+                                              hasher, esize,
+                                              piojo_alloc_default), keys);
+
+        free(keys);
+        return 0;
+}
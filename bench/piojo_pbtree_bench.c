@@ -0,0 +1,95 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2013 G. Elian Gidoni
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+
+#include <piojo_bench.h>
+#include <piojo/piojo_pbtree.h>
+
+#define BENCH_PATH "piojo_pbtree_bench.db"
+#define BENCH_ENTRIES (1 << 21)
+#define BENCH_SEARCHES (1 << 20)
+/* Entries inserted between commits. */
+#define BENCH_COMMIT_EVERY (1 << 16)
+
+static void
+bench_insert(const char *name, size_t framecnt)
+{
+        piojo_pbtree_t *tree;
+        uint64_t state = 88172645463325252ULL;
+        int64_t key;
+        size_t i;
+        double start;
+
+        remove(BENCH_PATH);
+        tree = piojo_pbtree_open_cb_i64k(BENCH_PATH, framecnt,
+                                         sizeof(int64_t),
+                                         piojo_alloc_default);
+        start = piojo_bench_now();
+        for (i = 0; i < BENCH_ENTRIES; ++i){
+                key = (int64_t) (piojo_bench_rand(&state) >> 1);
+                piojo_pbtree_insert(&key, &key, tree);
+                if ((i + 1) % BENCH_COMMIT_EVERY == 0){
+                        piojo_pbtree_commit(tree);
+                }
+        }
+        piojo_pbtree_commit(tree);
+        piojo_bench_report(name, BENCH_ENTRIES, piojo_bench_now() - start);
+        piojo_pbtree_close(tree);
+}
+
+static void
+bench_search(const char *name, size_t framecnt)
+{
+        piojo_pbtree_t *tree;
+        uint64_t state = 88172645463325252ULL;
+        int64_t key, value;
+        size_t i, found = 0;
+        double start;
+
+        tree = piojo_pbtree_open_cb_i64k(BENCH_PATH, framecnt,
+                                         sizeof(int64_t),
+                                         piojo_alloc_default);
+        start = piojo_bench_now();
+        for (i = 0; i < BENCH_SEARCHES; ++i){
+                /* Keys of the insert bench, in the same order. */
+                key = (int64_t) (piojo_bench_rand(&state) >> 1);
+                found += piojo_pbtree_search(&key, &value, tree);
+        }
+        piojo_bench_report(name, BENCH_SEARCHES, piojo_bench_now() - start);
+        if (found != BENCH_SEARCHES){
+                printf("unexpected misses: %zu\n", BENCH_SEARCHES - found);
+        }
+        piojo_pbtree_close(tree);
+}
+
+int main(void)
+{
+        /* The tree takes ~64MB (16K pages), the pool 1MB or 128MB. */
+        bench_insert("pbtree insert 1MB pool", 256);
+        bench_search("pbtree search 1MB pool", 256);
+        bench_search("pbtree search 8MB pool", 2048);
+        bench_search("pbtree search 128MB pool", 32768);
+        remove(BENCH_PATH);
+        return 0;
+}
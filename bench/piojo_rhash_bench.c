@@ -0,0 +1,119 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2013 G. Elian Gidoni
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+
+#include <piojo_bench.h>
+#include <pthread.h>
+#include <piojo/piojo_chash.h>
+#include <piojo/piojo_rhash.h>
+
+#define BENCH_ENTRIES (1 << 20)
+#define BENCH_THREAD_OPS (1 << 22)
+#define BENCH_MAX_THREADS 16
+
+typedef struct {
+        piojo_chash_t *chash;
+        piojo_rhash_t *rhash;
+        uint64_t seed;
+} worker_t;
+
+static void*
+chash_worker(void *arg)
+{
+        worker_t *worker = (worker_t*) arg;
+        uint64_t state = worker->seed;
+        int64_t key, value;
+        size_t i;
+
+        for (i = 0; i < BENCH_THREAD_OPS; ++i){
+                key = piojo_bench_rand(&state) % BENCH_ENTRIES;
+                piojo_chash_search(&key, &value, worker->chash);
+        }
+        return NULL;
+}
+
+static void*
+rhash_worker(void *arg)
+{
+        worker_t *worker = (worker_t*) arg;
+        piojo_rhash_reader_t *reader;
+        uint64_t state = worker->seed;
+        int64_t key, value;
+        size_t i;
+
+        reader = piojo_rhash_register(worker->rhash);
+        for (i = 0; i < BENCH_THREAD_OPS; ++i){
+                key = piojo_bench_rand(&state) % BENCH_ENTRIES;
+                piojo_rhash_search(&key, &value, reader, worker->rhash);
+        }
+        piojo_rhash_unregister(reader, worker->rhash);
+        return NULL;
+}
+
+static void
+bench_threads(const char *prefix, void* (*worker_cb)(void*),
+              worker_t *proto, size_t nthreads)
+{
+        pthread_t threads[BENCH_MAX_THREADS];
+        worker_t workers[BENCH_MAX_THREADS];
+        size_t i;
+        double start;
+        char name[64];
+
+        start = piojo_bench_now();
+        for (i = 0; i < nthreads; ++i){
+                workers[i] = *proto;
+                workers[i].seed = 88172645463325252ULL + i;
+                pthread_create(&threads[i], NULL, worker_cb, &workers[i]);
+        }
+        for (i = 0; i < nthreads; ++i){
+                pthread_join(threads[i], NULL);
+        }
+        snprintf(name, sizeof(name), "%s %zu threads", prefix, nthreads);
+        piojo_bench_report(name, nthreads * BENCH_THREAD_OPS,
+                           piojo_bench_now() - start);
+}
+
+int main(void)
+{
+        worker_t proto;
+        int64_t k;
+        size_t n;
+
+        proto.chash = piojo_chash_alloc_i64k(sizeof(int64_t));
+        proto.rhash = piojo_rhash_alloc_i64k(sizeof(int64_t));
+        for (k = 0; k < BENCH_ENTRIES; ++k){
+                piojo_chash_insert(&k, &k, proto.chash);
+                piojo_rhash_insert(&k, &k, proto.rhash);
+        }
+
+        for (n = 1; n <= BENCH_MAX_THREADS; n *= 2){
+                bench_threads("chash search", chash_worker, &proto, n);
+                bench_threads("rhash search", rhash_worker, &proto, n);
+        }
+
+        piojo_chash_free(proto.chash);
+        piojo_rhash_free(proto.rhash);
+        return 0;
+}
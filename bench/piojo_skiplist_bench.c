@@ -0,0 +1,106 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2013 G. Elian Gidoni
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+
+#include <piojo_bench.h>
+#include <piojo/piojo_skiplist.h>
+
+#define BENCH_ENTRIES (1 << 20)
+#define BENCH_LOOKUPS (1 << 21)
+
+/* Random inserts, lookups and deletes of int64_t keys. */
+int main(void)
+{
+        piojo_skiplist_t *list;
+        int64_t *keys;
+        uint64_t state = 88172645463325252ULL;
+        size_t i, n, hits = 0;
+        double start;
+
+        keys = (int64_t*) malloc(BENCH_ENTRIES * sizeof(int64_t));
+        for (i = 0; i < BENCH_ENTRIES; ++i){
+                keys[i] = (int64_t) (piojo_bench_rand(&state) >> 1);
+        }
+
+        list = piojo_skiplist_alloc_i64k(sizeof(int64_t));
+        start = piojo_bench_now();
+        for (i = 0; i < BENCH_ENTRIES; ++i){
+                piojo_skiplist_insert(&keys[i], &keys[i], list);
+        }
+        piojo_bench_report("skiplist insert", BENCH_ENTRIES,
+                           piojo_bench_now() - start);
+
+        start = piojo_bench_now();
+        for (i = 0; i < BENCH_LOOKUPS; ++i){
+                hits += (piojo_skiplist_search(&keys[i % BENCH_ENTRIES],
+                                               list) != NULL);
+        }
+        piojo_bench_report("skiplist search", BENCH_LOOKUPS,
+                           piojo_bench_now() - start);
+        if (hits != BENCH_LOOKUPS){
+                fprintf(stderr, "Unexpected lookup misses.\n");
+                exit(EXIT_FAILURE);
+        }
+
+        /* Positional access and ranks follow link widths. */
+        n = piojo_skiplist_size(list);
+        start = piojo_bench_now();
+        for (i = 0; i < BENCH_LOOKUPS; ++i){
+                hits += (piojo_skiplist_at(keys[i % BENCH_ENTRIES] % n,
+                                           list, NULL) != NULL);
+        }
+        piojo_bench_report("skiplist at", BENCH_LOOKUPS,
+                           piojo_bench_now() - start);
+
+        start = piojo_bench_now();
+        for (i = 0; i < BENCH_LOOKUPS; ++i){
+                hits += piojo_skiplist_rank(&keys[i % BENCH_ENTRIES],
+                                            list) < n;
+        }
+        piojo_bench_report("skiplist rank", BENCH_LOOKUPS,
+                           piojo_bench_now() - start);
+        if (hits != 3 * BENCH_LOOKUPS){
+                fprintf(stderr, "Unexpected position misses.\n");
+                exit(EXIT_FAILURE);
+        }
+
+        start = piojo_bench_now();
+        for (i = 0; i < BENCH_ENTRIES; ++i){
+                piojo_skiplist_delete(&keys[i], list);
+        }
+        piojo_bench_report("skiplist delete", BENCH_ENTRIES,
+                           piojo_bench_now() - start);
+
+        /* Reinserts reuse the deleted nodes. */
+        start = piojo_bench_now();
+        for (i = 0; i < BENCH_ENTRIES; ++i){
+                piojo_skiplist_insert(&keys[i], &keys[i], list);
+        }
+        piojo_bench_report("skiplist reinsert", BENCH_ENTRIES,
+                           piojo_bench_now() - start);
+
+        piojo_skiplist_free(list);
+        free(keys);
+        return 0;
+}
@@ -0,0 +1,120 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2013 G. Elian Gidoni
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+
+#include <piojo_bench.h>
+#include <piojo/piojo_tree.h>
+
+#define BENCH_ENTRIES (1 << 21)
+#define BENCH_LOOKUPS (1 << 22)
+
+/* Copy against snapshot of a persistent tree, and writes after it. */
+static void
+bench_snapshot(const int64_t *keys)
+{
+        piojo_tree_t *tree, *copy, *snapshot;
+        int64_t k;
+        size_t i;
+        double start;
+
+        tree = piojo_tree_alloc_mode_i64k(PIOJO_TREE_MODE_PERSISTENT,
+                                          sizeof(int64_t),
+                                          piojo_alloc_default);
+        start = piojo_bench_now();
+        for (i = 0; i < BENCH_ENTRIES; ++i){
+                piojo_tree_insert(&keys[i], &keys[i], tree);
+        }
+        piojo_bench_report("persistent tree insert", BENCH_ENTRIES,
+                           piojo_bench_now() - start);
+
+        start = piojo_bench_now();
+        copy = piojo_tree_copy(tree);
+        piojo_bench_report("tree copy", 1, piojo_bench_now() - start);
+        piojo_tree_free(copy);
+
+        start = piojo_bench_now();
+        snapshot = piojo_tree_snapshot(tree);
+        piojo_bench_report("tree snapshot", 1, piojo_bench_now() - start);
+
+        start = piojo_bench_now();
+        for (i = 0; i < BENCH_ENTRIES; ++i){
+                k = keys[i] ^ 1;
+                piojo_tree_set(&k, &k, tree);
+        }
+        piojo_bench_report("tree sets after snapshot", BENCH_ENTRIES,
+                           piojo_bench_now() - start);
+        if (piojo_tree_size(snapshot) * 2 != piojo_tree_size(tree)){
+                fprintf(stderr, "Unexpected snapshot size.\n");
+                exit(EXIT_FAILURE);
+        }
+        piojo_tree_free(snapshot);
+        piojo_tree_free(tree);
+}
+
+/* Random inserts, lookups and deletes of int64_t keys. */
+int main(void)
+{
+        piojo_tree_t *tree;
+        int64_t *keys;
+        uint64_t state = 88172645463325252ULL;
+        size_t i, hits = 0;
+        double start;
+
+        keys = (int64_t*) malloc(BENCH_ENTRIES * sizeof(int64_t));
+        for (i = 0; i < BENCH_ENTRIES; ++i){
+                keys[i] = (int64_t) (piojo_bench_rand(&state) >> 1);
+        }
+
+        tree = piojo_tree_alloc_i64k(sizeof(int64_t));
+        start = piojo_bench_now();
+        for (i = 0; i < BENCH_ENTRIES; ++i){
+                piojo_tree_insert(&keys[i], &keys[i], tree);
+        }
+        piojo_bench_report("tree insert", BENCH_ENTRIES,
+                           piojo_bench_now() - start);
+
+        start = piojo_bench_now();
+        for (i = 0; i < BENCH_LOOKUPS; ++i){
+                hits += (piojo_tree_search(&keys[i % BENCH_ENTRIES],
+                                           tree) != NULL);
+        }
+        piojo_bench_report("tree search", BENCH_LOOKUPS,
+                           piojo_bench_now() - start);
+        if (hits != BENCH_LOOKUPS){
+                fprintf(stderr, "Unexpected lookup misses.\n");
+                exit(EXIT_FAILURE);
+        }
+
+        start = piojo_bench_now();
+        for (i = 0; i < BENCH_ENTRIES; ++i){
+                piojo_tree_delete(&keys[i], tree);
+        }
+        piojo_bench_report("tree delete", BENCH_ENTRIES,
+                           piojo_bench_now() - start);
+
+        piojo_tree_free(tree);
+        bench_snapshot(keys);
+        free(keys);
+        return 0;
+}
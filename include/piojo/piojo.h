@@ -66,6 +66,13 @@ typedef int
 typedef bool
 (*piojo_eq_cb) (const void *e1, const void *e2);
 
+/**
+ * Returns a 64 bit hash of @a ksize bytes pointed by @a key,
+ * randomized by @a seed.
+ */
+typedef uint64_t
+(*piojo_hash_cb) (const void *key, size_t ksize, uint64_t seed);
+
 /** Allocates @a size bytes of memory. */
 typedef void*
 (*piojo_alloc_cb) (size_t size);
@@ -98,6 +105,18 @@ piojo_opaque_eq(const void *e1, const void *e2);
 bool
 piojo_id_eq(const void *e1, const void *e2);
 
+uint64_t
+piojo_bytes_hash(const void *key, size_t ksize, uint64_t seed);
+
+uint64_t
+piojo_i32_hash(const void *key, size_t ksize, uint64_t seed);
+
+uint64_t
+piojo_i64_hash(const void *key, size_t ksize, uint64_t seed);
+
+uint64_t
+piojo_siz_hash(const void *key, size_t ksize, uint64_t seed);
+
 bool
 piojo_safe_adduint_p(unsigned int v1, unsigned int v2);
 
@@ -66,6 +66,10 @@ piojo_bloom_t*
 piojo_bloom_alloc_cb_eq(size_t capacity, float false_positive_rate,
     size_t eksize, piojo_alloc_if allocator);
 
+piojo_bloom_t*
+piojo_bloom_alloc_cb_hash(size_t capacity, float false_positive_rate,
+    piojo_hash_cb keyhash, size_t eksize, piojo_alloc_if allocator);
+
 piojo_bloom_t*
 piojo_bloom_copy(const piojo_bloom_t *bloom);
 
@@ -24,11 +24,17 @@
  * Piojo B-tree API.
  */
 
+/**
+ * @file
+ * @addtogroup piojobtree
+ */
+
 #ifndef PIOJO_BTREE_H_
 #define PIOJO_BTREE_H_
 
 #include <piojo/piojo.h>
 #include <piojo/piojo_alloc.h>
+#include <piojo/piojo_array.h>
 
 #ifdef __cplusplus
 extern "C" {
@@ -37,6 +43,41 @@ extern "C" {
 typedef struct piojo_btree_t piojo_btree_t;
 extern const size_t piojo_btree_sizeof;
 
+/** @{ */
+/** B-tree layout. */
+typedef enum {
+        /** Entries are stored in all nodes. */
+        PIOJO_BTREE_MODE_CLASSIC,
+        /**
+         * Entries are stored in leaves chained in key order, internal
+         * nodes only hold separator keys (B+ tree).
+         */
+        PIOJO_BTREE_MODE_PLUS
+} piojo_btree_mode_t;
+
+/**
+ * Tree position, can be allocated on the stack.
+ * Invalidated by insertions and by deletions of other entries.
+ */
+typedef struct {
+        /** Current node (private). */
+        void *bnode;
+        /** Entry index in node (private). */
+        size_t eidx;
+} piojo_btree_cursor_t;
+/** @} */
+
+/**
+ * Returns @b TRUE and sets @a key and @a data to the next entry of a
+ * sorted input, @b FALSE when there are no more entries.
+ */
+typedef bool
+(*piojo_btree_pair_cb) (const void **key, const void **data, void *state);
+
+/** Visits an entry, returns @b FALSE to stop visiting entries. */
+typedef bool
+(*piojo_btree_visit_cb) (const void *key, void *data, void *state);
+
 piojo_btree_t*
 piojo_btree_alloc_i32k(size_t evsize);
 
@@ -47,28 +88,61 @@ piojo_btree_t*
 piojo_btree_alloc_sizk(size_t evsize);
 
 piojo_btree_t*
-piojo_btree_alloc_cb_i32k(uint8_t maxchildren, size_t evsize,
+piojo_btree_alloc_cb_i32k(size_t maxchildren, size_t evsize,
                          piojo_alloc_if allocator);
 
 piojo_btree_t*
-piojo_btree_alloc_cb_i64k(uint8_t maxchildren, size_t evsize,
+piojo_btree_alloc_cb_i64k(size_t maxchildren, size_t evsize,
                          piojo_alloc_if allocator);
 
 piojo_btree_t*
-piojo_btree_alloc_cb_sizk(uint8_t maxchildren, size_t evsize,
+piojo_btree_alloc_cb_sizk(size_t maxchildren, size_t evsize,
                          piojo_alloc_if allocator);
 
 piojo_btree_t*
 piojo_btree_alloc_cmp(size_t evsize, piojo_cmp_cb keycmp, size_t eksize);
 
 piojo_btree_t*
-piojo_btree_alloc_cb_cmp(uint8_t maxchildren, size_t evsize,
+piojo_btree_alloc_cb_cmp(size_t maxchildren, size_t evsize,
                         piojo_cmp_cb keycmp, size_t eksize,
                         piojo_alloc_if allocator);
 
+piojo_btree_t*
+piojo_btree_alloc_mode_i32k(piojo_btree_mode_t mode, size_t maxchildren,
+                            size_t evsize, piojo_alloc_if allocator);
+
+piojo_btree_t*
+piojo_btree_alloc_mode_i64k(piojo_btree_mode_t mode, size_t maxchildren,
+                            size_t evsize, piojo_alloc_if allocator);
+
+piojo_btree_t*
+piojo_btree_alloc_mode_sizk(piojo_btree_mode_t mode, size_t maxchildren,
+                            size_t evsize, piojo_alloc_if allocator);
+
+piojo_btree_t*
+piojo_btree_alloc_mode_cmp(piojo_btree_mode_t mode, size_t maxchildren,
+                           size_t evsize, piojo_cmp_cb keycmp,
+                           size_t eksize, piojo_alloc_if allocator);
+
 piojo_btree_t*
 piojo_btree_copy(const piojo_btree_t *tree);
 
+piojo_btree_t*
+piojo_btree_snapshot(const piojo_btree_t *tree);
+
+void
+piojo_btree_build_sorted(const void *keys, const void *values, size_t n,
+                         float fill, piojo_btree_t *tree);
+
+void
+piojo_btree_build_sorted_cb(piojo_btree_pair_cb next, void *state,
+                            float fill, piojo_btree_t *tree);
+
+void
+piojo_btree_build_sorted_array(const piojo_array_t *keys,
+                               const piojo_array_t *values, float fill,
+                               piojo_btree_t *tree);
+
 void
 piojo_btree_free(const piojo_btree_t *tree);
 
@@ -102,6 +176,48 @@ piojo_btree_next(const void *key, const piojo_btree_t *tree, void **data);
 const void*
 piojo_btree_prev(const void *key, const piojo_btree_t *tree, void **data);
 
+size_t
+piojo_btree_range(const void *lo, const void *hi, piojo_btree_visit_cb cb,
+                  void *state, const piojo_btree_t *tree);
+
+size_t
+piojo_btree_rank(const void *key, const piojo_btree_t *tree);
+
+const void*
+piojo_btree_select(size_t idx, const piojo_btree_t *tree, void **data);
+
+size_t
+piojo_btree_count_range(const void *lo, const void *hi,
+                        const piojo_btree_t *tree);
+
+const void*
+piojo_btree_cursor_first(const piojo_btree_t *tree,
+                         piojo_btree_cursor_t *cursor);
+
+const void*
+piojo_btree_cursor_last(const piojo_btree_t *tree,
+                        piojo_btree_cursor_t *cursor);
+
+const void*
+piojo_btree_cursor_seek(const void *key, const piojo_btree_t *tree,
+                        piojo_btree_cursor_t *cursor);
+
+const void*
+piojo_btree_cursor_next(piojo_btree_cursor_t *cursor,
+                        const piojo_btree_t *tree);
+
+const void*
+piojo_btree_cursor_prev(piojo_btree_cursor_t *cursor,
+                        const piojo_btree_t *tree);
+
+void*
+piojo_btree_cursor_value(const piojo_btree_cursor_t *cursor,
+                         const piojo_btree_t *tree);
+
+const void*
+piojo_btree_cursor_delete(piojo_btree_cursor_t *cursor,
+                          piojo_btree_t *tree);
+
 #ifdef __cplusplus
 }
 #endif
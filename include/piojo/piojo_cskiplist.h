@@ -0,0 +1,121 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2013 G. Elian Gidoni
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+
+/**
+ * @file
+ * @addtogroup piojocskiplist
+ */
+
+#ifndef PIOJO_CSKIPLIST_H_
+#define PIOJO_CSKIPLIST_H_
+
+#include <piojo/piojo.h>
+#include <piojo/piojo_alloc.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct piojo_cskiplist_t piojo_cskiplist_t;
+extern const size_t piojo_cskiplist_sizeof;
+
+/** Per-thread state, see piojo_cskiplist_register(). */
+typedef struct piojo_cskiplist_thread_t piojo_cskiplist_thread_t;
+
+piojo_cskiplist_t*
+piojo_cskiplist_alloc_i32k(size_t evsize);
+
+piojo_cskiplist_t*
+piojo_cskiplist_alloc_i64k(size_t evsize);
+
+piojo_cskiplist_t*
+piojo_cskiplist_alloc_sizk(size_t evsize);
+
+piojo_cskiplist_t*
+piojo_cskiplist_alloc_cb_i32k(size_t evsize, piojo_alloc_if allocator);
+
+piojo_cskiplist_t*
+piojo_cskiplist_alloc_cb_i64k(size_t evsize, piojo_alloc_if allocator);
+
+piojo_cskiplist_t*
+piojo_cskiplist_alloc_cb_sizk(size_t evsize, piojo_alloc_if allocator);
+
+piojo_cskiplist_t*
+piojo_cskiplist_alloc_cb_cmp(size_t evsize, piojo_cmp_cb keycmp,
+                             size_t eksize, piojo_alloc_if allocator);
+
+void
+piojo_cskiplist_free(const piojo_cskiplist_t *list);
+
+void
+piojo_cskiplist_clear(piojo_cskiplist_t *list);
+
+size_t
+piojo_cskiplist_size(const piojo_cskiplist_t *list);
+
+piojo_cskiplist_thread_t*
+piojo_cskiplist_register(piojo_cskiplist_t *list);
+
+void
+piojo_cskiplist_unregister(piojo_cskiplist_thread_t *thread,
+                           piojo_cskiplist_t *list);
+
+bool
+piojo_cskiplist_insert(const void *key, const void *data,
+                       piojo_cskiplist_thread_t *thread,
+                       piojo_cskiplist_t *list);
+
+bool
+piojo_cskiplist_set(const void *key, const void *data,
+                    piojo_cskiplist_thread_t *thread,
+                    piojo_cskiplist_t *list);
+
+bool
+piojo_cskiplist_search(const void *key, void *data,
+                       piojo_cskiplist_thread_t *thread,
+                       const piojo_cskiplist_t *list);
+
+bool
+piojo_cskiplist_delete(const void *key, piojo_cskiplist_thread_t *thread,
+                       piojo_cskiplist_t *list);
+
+bool
+piojo_cskiplist_first(void *key, void *data,
+                      piojo_cskiplist_thread_t *thread,
+                      const piojo_cskiplist_t *list);
+
+bool
+piojo_cskiplist_next(const void *key, void *nextkey, void *data,
+                     piojo_cskiplist_thread_t *thread,
+                     const piojo_cskiplist_t *list);
+
+void
+piojo_cskiplist_reclaim(piojo_cskiplist_thread_t *thread,
+                        piojo_cskiplist_t *list);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
@@ -24,6 +24,11 @@
  * Piojo Hash Table API.
  */
 
+/**
+ * @file
+ * @addtogroup piojohash
+ */
+
 #ifndef PIOJO_HASH_H_
 #define PIOJO_HASH_H_
 
@@ -37,6 +42,40 @@ extern "C" {
 typedef struct piojo_hash_t piojo_hash_t;
 extern const size_t piojo_hash_sizeof;
 
+/** @{ */
+/** Hash table layout. */
+typedef enum {
+        /** Separate chaining, entries are stable in memory. */
+        PIOJO_HASH_MODE_CHAIN,
+        /** Open addressing, entries are stored inline. */
+        PIOJO_HASH_MODE_FLAT,
+        /**
+         * Separate chaining, buckets are migrated in small steps
+         * after growing instead of all at once.
+         */
+        PIOJO_HASH_MODE_INCR
+} piojo_hash_mode_t;
+
+/** Key hashing interface. */
+typedef struct {
+        /** Hash callback. */
+        piojo_hash_cb hash_cb;
+        /** Key equality callback. */
+        piojo_eq_cb eq_cb;
+} piojo_hasher_if;
+
+/**
+ * Hash table position, can be allocated on the stack.
+ * Invalidated by insertions and by deletions of other entries.
+ */
+typedef struct {
+        /** Bucket or slot index (private). */
+        size_t bidx;
+        /** Current entry (private). */
+        void *entry;
+} piojo_hash_cursor_t;
+/** @} */
+
 piojo_hash_t*
 piojo_hash_alloc_i32k(size_t evsize);
 
@@ -62,6 +101,28 @@ piojo_hash_t*
 piojo_hash_alloc_cb_eq(size_t evsize, piojo_eq_cb keyeq, size_t eksize,
                        piojo_alloc_if allocator);
 
+piojo_hash_t*
+piojo_hash_alloc_mode_i32k(piojo_hash_mode_t mode, size_t evsize,
+                           piojo_alloc_if allocator);
+
+piojo_hash_t*
+piojo_hash_alloc_mode_i64k(piojo_hash_mode_t mode, size_t evsize,
+                           piojo_alloc_if allocator);
+
+piojo_hash_t*
+piojo_hash_alloc_mode_sizk(piojo_hash_mode_t mode, size_t evsize,
+                           piojo_alloc_if allocator);
+
+piojo_hash_t*
+piojo_hash_alloc_mode_eq(piojo_hash_mode_t mode, size_t evsize,
+                         piojo_eq_cb keyeq, size_t eksize,
+                         piojo_alloc_if allocator);
+
+piojo_hash_t*
+piojo_hash_alloc_mode_hash(piojo_hash_mode_t mode, size_t evsize,
+                           piojo_hasher_if hasher, size_t eksize,
+                           piojo_alloc_if allocator);
+
 piojo_hash_t*
 piojo_hash_copy(const piojo_hash_t *hash);
 
@@ -77,21 +138,72 @@ piojo_hash_size(const piojo_hash_t *hash);
 bool
 piojo_hash_insert(const void *key, const void *data, piojo_hash_t *hash);
 
+size_t
+piojo_hash_insert_batch(const void *keys, const void *data, size_t n,
+                        piojo_hash_t *hash);
+
 bool
 piojo_hash_set(const void *key, const void *data, piojo_hash_t *hash);
 
 void*
 piojo_hash_search(const void *key, const piojo_hash_t *hash);
 
+size_t
+piojo_hash_search_batch(const void *keys, size_t n, void **values,
+                        const piojo_hash_t *hash);
+
 bool
 piojo_hash_delete(const void *key, piojo_hash_t *hash);
 
+bool
+piojo_hash_rehash_step(size_t n, piojo_hash_t *hash);
+
+bool
+piojo_hash_save(const char *path, const piojo_hash_t *hash);
+
+piojo_hash_t*
+piojo_hash_open_mapped(const char *path);
+
+piojo_hash_t*
+piojo_hash_open_mapped_hash(const char *path, piojo_hasher_if hasher,
+                            piojo_alloc_if allocator);
+
+void
+piojo_hash_promote(piojo_hash_t *hash);
+
 const void*
 piojo_hash_first(const piojo_hash_t *hash, void **data);
 
 const void*
 piojo_hash_next(const void *key, const piojo_hash_t *hash, void **data);
 
+const void*
+piojo_hash_cursor_first(const piojo_hash_t *hash,
+                        piojo_hash_cursor_t *cursor);
+
+const void*
+piojo_hash_cursor_last(const piojo_hash_t *hash,
+                       piojo_hash_cursor_t *cursor);
+
+const void*
+piojo_hash_cursor_seek(const void *key, const piojo_hash_t *hash,
+                       piojo_hash_cursor_t *cursor);
+
+const void*
+piojo_hash_cursor_next(piojo_hash_cursor_t *cursor,
+                       const piojo_hash_t *hash);
+
+const void*
+piojo_hash_cursor_prev(piojo_hash_cursor_t *cursor,
+                       const piojo_hash_t *hash);
+
+void*
+piojo_hash_cursor_value(const piojo_hash_cursor_t *cursor,
+                        const piojo_hash_t *hash);
+
+const void*
+piojo_hash_cursor_delete(piojo_hash_cursor_t *cursor, piojo_hash_t *hash);
+
 #ifdef __cplusplus
 }
 #endif
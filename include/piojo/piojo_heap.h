@@ -49,6 +49,20 @@ typedef int piojo_heap_key_t;
 /** Returns @b TRUE if @a e1 is less or equal to @a e2, @b FALSE otherwise. */
 typedef bool
 (*piojo_heap_leq_cb) (piojo_opaque_t e1, piojo_opaque_t e2);
+
+/** Entry identifier returned by piojo_heap_push_handle(). */
+typedef size_t piojo_heap_handle_t;
+
+/** How entries are found by decrease/contain functions. */
+typedef enum {
+        /** Entries are found by value, which must be unique. */
+        PIOJO_HEAP_MODE_DATA,
+        /**
+         * Entries are found by the handle returned on push, handles are
+         * reused once their entry leaves the heap.
+         */
+        PIOJO_HEAP_MODE_HANDLE
+} piojo_heap_mode_t;
 /** @} */
 
 piojo_heap_t*
@@ -57,6 +71,10 @@ piojo_heap_alloc(piojo_heap_leq_cb leq);
 piojo_heap_t*
 piojo_heap_alloc_cb(piojo_heap_leq_cb leq, piojo_alloc_if allocator);
 
+piojo_heap_t*
+piojo_heap_alloc_mode(piojo_heap_mode_t mode, piojo_heap_leq_cb leq,
+                      piojo_alloc_if allocator);
+
 piojo_heap_t*
 piojo_heap_copy(const piojo_heap_t *heap);
 
@@ -87,6 +105,19 @@ piojo_heap_peek(const piojo_heap_t *heap);
 bool
 piojo_heap_contain_p(piojo_opaque_t data, const piojo_heap_t *heap);
 
+piojo_heap_handle_t
+piojo_heap_push_handle(piojo_opaque_t data, piojo_heap_t *heap);
+
+void
+piojo_heap_decrease_handle(piojo_heap_handle_t handle, piojo_heap_t *heap);
+
+void
+piojo_heap_remove_handle(piojo_heap_handle_t handle, piojo_heap_t *heap);
+
+bool
+piojo_heap_contain_handle_p(piojo_heap_handle_t handle,
+                            const piojo_heap_t *heap);
+
 #ifdef __cplusplus
 }
 #endif
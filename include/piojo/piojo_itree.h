@@ -0,0 +1,118 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2013 G. Elian Gidoni
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ * Piojo Interval Tree API.
+ */
+
+/**
+ * @file
+ * @addtogroup piojotree
+ */
+
+#ifndef PIOJO_ITREE_H_
+#define PIOJO_ITREE_H_
+
+#include <piojo/piojo.h>
+#include <piojo/piojo_alloc.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct piojo_itree_t piojo_itree_t;
+extern const size_t piojo_itree_sizeof;
+
+/** @{ */
+/**
+ * Visits the closed interval [@a lo, @a hi] and its value.
+ * Returns @b FALSE to stop the query.
+ */
+typedef bool
+(*piojo_itree_visit_cb) (const void *lo, const void *hi, void *data,
+                         void *state);
+/** @} */
+
+piojo_itree_t*
+piojo_itree_alloc_i32k(size_t evsize);
+
+piojo_itree_t*
+piojo_itree_alloc_i64k(size_t evsize);
+
+piojo_itree_t*
+piojo_itree_alloc_sizk(size_t evsize);
+
+piojo_itree_t*
+piojo_itree_alloc_cb_i32k(size_t evsize, piojo_alloc_if allocator);
+
+piojo_itree_t*
+piojo_itree_alloc_cb_i64k(size_t evsize, piojo_alloc_if allocator);
+
+piojo_itree_t*
+piojo_itree_alloc_cb_sizk(size_t evsize, piojo_alloc_if allocator);
+
+piojo_itree_t*
+piojo_itree_alloc_cmp(size_t evsize, piojo_cmp_cb epcmp, size_t epsize);
+
+piojo_itree_t*
+piojo_itree_alloc_cb_cmp(size_t evsize, piojo_cmp_cb epcmp, size_t epsize,
+                         piojo_alloc_if allocator);
+
+piojo_itree_t*
+piojo_itree_copy(const piojo_itree_t *itree);
+
+void
+piojo_itree_free(const piojo_itree_t *itree);
+
+void
+piojo_itree_clear(piojo_itree_t *itree);
+
+size_t
+piojo_itree_size(const piojo_itree_t *itree);
+
+bool
+piojo_itree_insert(const void *lo, const void *hi, const void *data,
+                   piojo_itree_t *itree);
+
+bool
+piojo_itree_set(const void *lo, const void *hi, const void *data,
+                piojo_itree_t *itree);
+
+void*
+piojo_itree_search(const void *lo, const void *hi,
+                   const piojo_itree_t *itree);
+
+bool
+piojo_itree_delete(const void *lo, const void *hi, piojo_itree_t *itree);
+
+size_t
+piojo_itree_stab(const void *point, piojo_itree_visit_cb cb, void *state,
+                 const piojo_itree_t *itree);
+
+size_t
+piojo_itree_overlap(const void *lo, const void *hi, piojo_itree_visit_cb cb,
+                    void *state, const piojo_itree_t *itree);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
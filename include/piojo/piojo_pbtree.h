@@ -0,0 +1,111 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2013 G. Elian Gidoni
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+
+/**
+ * @file
+ * @addtogroup piojopbtree
+ */
+
+#ifndef PIOJO_PBTREE_H_
+#define PIOJO_PBTREE_H_
+
+#include <piojo/piojo.h>
+#include <piojo/piojo_alloc.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct piojo_pbtree_t piojo_pbtree_t;
+extern const size_t piojo_pbtree_sizeof;
+
+piojo_pbtree_t*
+piojo_pbtree_open_i32k(const char *path, size_t evsize);
+
+piojo_pbtree_t*
+piojo_pbtree_open_i64k(const char *path, size_t evsize);
+
+piojo_pbtree_t*
+piojo_pbtree_open_sizk(const char *path, size_t evsize);
+
+piojo_pbtree_t*
+piojo_pbtree_open_cb_i32k(const char *path, size_t framecnt, size_t evsize,
+                          piojo_alloc_if allocator);
+
+piojo_pbtree_t*
+piojo_pbtree_open_cb_i64k(const char *path, size_t framecnt, size_t evsize,
+                          piojo_alloc_if allocator);
+
+piojo_pbtree_t*
+piojo_pbtree_open_cb_sizk(const char *path, size_t framecnt, size_t evsize,
+                          piojo_alloc_if allocator);
+
+piojo_pbtree_t*
+piojo_pbtree_open_cb_cmp(const char *path, size_t framecnt, size_t evsize,
+                         piojo_cmp_cb keycmp, size_t eksize,
+                         piojo_alloc_if allocator);
+
+void
+piojo_pbtree_close(piojo_pbtree_t *tree);
+
+bool
+piojo_pbtree_commit(piojo_pbtree_t *tree);
+
+bool
+piojo_pbtree_failed_p(const piojo_pbtree_t *tree);
+
+size_t
+piojo_pbtree_size(const piojo_pbtree_t *tree);
+
+bool
+piojo_pbtree_insert(const void *key, const void *data, piojo_pbtree_t *tree);
+
+bool
+piojo_pbtree_set(const void *key, const void *data, piojo_pbtree_t *tree);
+
+bool
+piojo_pbtree_search(const void *key, void *data, piojo_pbtree_t *tree);
+
+bool
+piojo_pbtree_delete(const void *key, piojo_pbtree_t *tree);
+
+bool
+piojo_pbtree_first(void *key, void *data, piojo_pbtree_t *tree);
+
+bool
+piojo_pbtree_last(void *key, void *data, piojo_pbtree_t *tree);
+
+bool
+piojo_pbtree_next(const void *key, void *nextkey, void *data,
+                  piojo_pbtree_t *tree);
+
+bool
+piojo_pbtree_prev(const void *key, void *prevkey, void *data,
+                  piojo_pbtree_t *tree);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
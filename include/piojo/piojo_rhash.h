@@ -0,0 +1,104 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2013 G. Elian Gidoni
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+
+/**
+ * @file
+ * @addtogroup piojorhash
+ */
+
+#ifndef PIOJO_RHASH_H_
+#define PIOJO_RHASH_H_
+
+#include <piojo/piojo.h>
+#include <piojo/piojo_alloc.h>
+#include <piojo/piojo_hash.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct piojo_rhash_t piojo_rhash_t;
+extern const size_t piojo_rhash_sizeof;
+
+/** Per-thread reader state, see piojo_rhash_register(). */
+typedef struct piojo_rhash_reader_t piojo_rhash_reader_t;
+
+piojo_rhash_t*
+piojo_rhash_alloc_i32k(size_t evsize);
+
+piojo_rhash_t*
+piojo_rhash_alloc_i64k(size_t evsize);
+
+piojo_rhash_t*
+piojo_rhash_alloc_sizk(size_t evsize);
+
+piojo_rhash_t*
+piojo_rhash_alloc_cb_i32k(size_t evsize, piojo_alloc_if allocator);
+
+piojo_rhash_t*
+piojo_rhash_alloc_cb_i64k(size_t evsize, piojo_alloc_if allocator);
+
+piojo_rhash_t*
+piojo_rhash_alloc_cb_sizk(size_t evsize, piojo_alloc_if allocator);
+
+piojo_rhash_t*
+piojo_rhash_alloc_cb_hash(size_t evsize, piojo_hasher_if hasher,
+                          size_t eksize, piojo_alloc_if allocator);
+
+void
+piojo_rhash_free(const piojo_rhash_t *rhash);
+
+void
+piojo_rhash_clear(piojo_rhash_t *rhash);
+
+size_t
+piojo_rhash_size(const piojo_rhash_t *rhash);
+
+piojo_rhash_reader_t*
+piojo_rhash_register(piojo_rhash_t *rhash);
+
+void
+piojo_rhash_unregister(piojo_rhash_reader_t *reader, piojo_rhash_t *rhash);
+
+bool
+piojo_rhash_insert(const void *key, const void *data, piojo_rhash_t *rhash);
+
+bool
+piojo_rhash_set(const void *key, const void *data, piojo_rhash_t *rhash);
+
+bool
+piojo_rhash_search(const void *key, void *data,
+                   piojo_rhash_reader_t *reader, const piojo_rhash_t *rhash);
+
+bool
+piojo_rhash_delete(const void *key, piojo_rhash_t *rhash);
+
+void
+piojo_rhash_reclaim(piojo_rhash_t *rhash);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
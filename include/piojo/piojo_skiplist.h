@@ -24,6 +24,11 @@
  * Piojo Skip List API.
  */
 
+/**
+ * @file
+ * @addtogroup piojolist
+ */
+
 #ifndef PIOJO_SKIPLIST_H_
 #define PIOJO_SKIPLIST_H_
 
@@ -39,6 +44,17 @@ typedef struct piojo_skiplist_node_t piojo_skiplist_node_t;
 typedef struct piojo_skiplist_t piojo_skiplist_t;
 extern const size_t piojo_skiplist_sizeof;
 
+/** @{ */
+/**
+ * List position, can be allocated on the stack.
+ * Invalidated by deletions of other entries.
+ */
+typedef struct {
+        /** Current node (private). */
+        piojo_skiplist_node_t *node;
+} piojo_skiplist_cursor_t;
+/** @} */
+
 piojo_skiplist_t*
 piojo_skiplist_alloc_i32k(size_t evsize);
 
@@ -104,6 +120,44 @@ piojo_skiplist_next(const void *key, const piojo_skiplist_t *list, void **data);
 const void*
 piojo_skiplist_prev(const void *key, const piojo_skiplist_t *list, void **data);
 
+const void*
+piojo_skiplist_at(size_t idx, const piojo_skiplist_t *list, void **data);
+
+size_t
+piojo_skiplist_rank(const void *key, const piojo_skiplist_t *list);
+
+size_t
+piojo_skiplist_count_range(const void *lo, const void *hi,
+                           const piojo_skiplist_t *list);
+
+const void*
+piojo_skiplist_cursor_first(const piojo_skiplist_t *list,
+                            piojo_skiplist_cursor_t *cursor);
+
+const void*
+piojo_skiplist_cursor_last(const piojo_skiplist_t *list,
+                           piojo_skiplist_cursor_t *cursor);
+
+const void*
+piojo_skiplist_cursor_seek(const void *key, const piojo_skiplist_t *list,
+                           piojo_skiplist_cursor_t *cursor);
+
+const void*
+piojo_skiplist_cursor_next(piojo_skiplist_cursor_t *cursor,
+                           const piojo_skiplist_t *list);
+
+const void*
+piojo_skiplist_cursor_prev(piojo_skiplist_cursor_t *cursor,
+                           const piojo_skiplist_t *list);
+
+void*
+piojo_skiplist_cursor_value(const piojo_skiplist_cursor_t *cursor,
+                            const piojo_skiplist_t *list);
+
+const void*
+piojo_skiplist_cursor_delete(piojo_skiplist_cursor_t *cursor,
+                             piojo_skiplist_t *list);
+
 #ifdef __cplusplus
 }
 #endif
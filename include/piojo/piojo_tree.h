@@ -24,6 +24,11 @@
  * Piojo Red-Black Tree API.
  */
 
+/**
+ * @file
+ * @addtogroup piojotree
+ */
+
 #ifndef PIOJO_TREE_H_
 #define PIOJO_TREE_H_
 
@@ -37,6 +42,28 @@ extern "C" {
 typedef struct piojo_tree_t piojo_tree_t;
 extern const size_t piojo_tree_sizeof;
 
+/** @{ */
+/** Node storage. */
+typedef enum {
+        /** Nodes are carved from per-tree slabs. */
+        PIOJO_TREE_MODE_POOLED,
+        /**
+         * Nodes are allocated one by one and shared between the tree and
+         * its snapshots (path copying).
+         */
+        PIOJO_TREE_MODE_PERSISTENT
+} piojo_tree_mode_t;
+
+/**
+ * Tree position, can be allocated on the stack.
+ * Invalidated by insertions and by deletions of other entries.
+ */
+typedef struct {
+        /** Current node (private). */
+        void *node;
+} piojo_tree_cursor_t;
+/** @} */
+
 piojo_tree_t*
 piojo_tree_alloc_i32k(size_t evsize);
 
@@ -66,9 +93,29 @@ piojo_tree_alloc_cb_cmp(size_t evsize,
                         piojo_cmp_cb keycmp, size_t eksize,
                         piojo_alloc_if allocator);
 
+piojo_tree_t*
+piojo_tree_alloc_mode_i32k(piojo_tree_mode_t mode, size_t evsize,
+                           piojo_alloc_if allocator);
+
+piojo_tree_t*
+piojo_tree_alloc_mode_i64k(piojo_tree_mode_t mode, size_t evsize,
+                           piojo_alloc_if allocator);
+
+piojo_tree_t*
+piojo_tree_alloc_mode_sizk(piojo_tree_mode_t mode, size_t evsize,
+                           piojo_alloc_if allocator);
+
+piojo_tree_t*
+piojo_tree_alloc_mode_cmp(piojo_tree_mode_t mode, size_t evsize,
+                          piojo_cmp_cb keycmp, size_t eksize,
+                          piojo_alloc_if allocator);
+
 piojo_tree_t*
 piojo_tree_copy(const piojo_tree_t *tree);
 
+piojo_tree_t*
+piojo_tree_snapshot(const piojo_tree_t *tree);
+
 void
 piojo_tree_free(const piojo_tree_t *tree);
 
@@ -102,6 +149,33 @@ piojo_tree_next(const void *key, const piojo_tree_t *tree, void **data);
 const void*
 piojo_tree_prev(const void *key, const piojo_tree_t *tree, void **data);
 
+const void*
+piojo_tree_cursor_first(const piojo_tree_t *tree,
+                        piojo_tree_cursor_t *cursor);
+
+const void*
+piojo_tree_cursor_last(const piojo_tree_t *tree,
+                       piojo_tree_cursor_t *cursor);
+
+const void*
+piojo_tree_cursor_seek(const void *key, const piojo_tree_t *tree,
+                       piojo_tree_cursor_t *cursor);
+
+const void*
+piojo_tree_cursor_next(piojo_tree_cursor_t *cursor,
+                       const piojo_tree_t *tree);
+
+const void*
+piojo_tree_cursor_prev(piojo_tree_cursor_t *cursor,
+                       const piojo_tree_t *tree);
+
+void*
+piojo_tree_cursor_value(const piojo_tree_cursor_t *cursor,
+                        const piojo_tree_t *tree);
+
+const void*
+piojo_tree_cursor_delete(piojo_tree_cursor_t *cursor, piojo_tree_t *tree);
+
 #ifdef __cplusplus
 }
 #endif
@@ -47,6 +47,90 @@ extern "C" {
 /* Note that this enforces a read when 'x' is volatile. */
 #define PIOJO_UNUSED(x) (void)(x)
 
+/* Hint a read of 'addr' into the cache, it's never dereferenced. */
+#if defined(__GNUC__) || defined(__clang__)
+#define PIOJO_PREFETCH(addr) __builtin_prefetch(addr)
+#else
+#define PIOJO_PREFETCH(addr) PIOJO_UNUSED(addr)
+#endif
+
+/* Fixed-width key types, compared inline instead of with a callback. */
+typedef enum {
+        PIOJO_KEY_CB,
+        PIOJO_KEY_I32,
+        PIOJO_KEY_I64,
+        PIOJO_KEY_SIZ
+} piojo_keytype_t;
+
+/*
+ * Expands fn(suffix, type) once per fixed-width key type, used to
+ * generate functions specialized for each type.
+ */
+#define PIOJO_KEYTYPE_EXPAND(fn)                                        \
+        fn(i32, int32_t)                                                \
+        fn(i64, int64_t)                                                \
+        fn(siz, size_t)
+
+/* Keys may be unaligned (e.g. in packed slots), they're loaded by copy. */
+#define PIOJO_DEFINE_KEY_FUNCS(suffix, type)                            \
+        static inline type                                              \
+        piojo_key_load_##suffix(const void *k)                          \
+        {                                                               \
+                type v;                                                 \
+                memcpy(&v, k, sizeof(type));                            \
+                return v;                                               \
+        }                                                               \
+        static inline int                                               \
+        piojo_key_cmp_##suffix(const void *k1, const void *k2)          \
+        {                                                               \
+                type v1, v2;                                            \
+                memcpy(&v1, k1, sizeof(type));                          \
+                memcpy(&v2, k2, sizeof(type));                          \
+                return (v1 > v2) - (v1 < v2);                           \
+        }                                                               \
+        static inline bool                                              \
+        piojo_key_eq_##suffix(const void *k1, const void *k2)           \
+        {                                                               \
+                type v1, v2;                                            \
+                memcpy(&v1, k1, sizeof(type));                          \
+                memcpy(&v2, k2, sizeof(type));                          \
+                return v1 == v2;                                        \
+        }
+
+PIOJO_KEYTYPE_EXPAND(PIOJO_DEFINE_KEY_FUNCS)
+
+/* Copies a key, fixed-width keys don't go through a variable memcpy. */
+static inline void
+piojo_key_copy(void *dst, const void *src, size_t ksize)
+{
+        switch (ksize){
+        case sizeof(int32_t):
+                memcpy(dst, src, sizeof(int32_t));
+                break;
+        case sizeof(int64_t):
+                memcpy(dst, src, sizeof(int64_t));
+                break;
+        default:
+                memcpy(dst, src, ksize);
+                break;
+        }
+}
+
+/* Atomic accessors: loads acquire, stores release, the rest are seq_cst. */
+#if defined(__GNUC__) || defined(__clang__)
+#define PIOJO_ATOMIC_LOAD(ptr) __atomic_load_n(ptr, __ATOMIC_ACQUIRE)
+#define PIOJO_ATOMIC_STORE(ptr, val)                                    \
+        __atomic_store_n(ptr, val, __ATOMIC_RELEASE)
+#define PIOJO_ATOMIC_ADD(ptr, val)                                      \
+        __atomic_fetch_add(ptr, val, __ATOMIC_SEQ_CST)
+#define PIOJO_ATOMIC_CAS(ptr, expected, val)                            \
+        __atomic_compare_exchange_n(ptr, expected, val, 0,              \
+                                    __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST)
+#define PIOJO_ATOMIC_FENCE() __atomic_thread_fence(__ATOMIC_SEQ_CST)
+/* Keeps loads before the fence from moving past loads after it. */
+#define PIOJO_ATOMIC_LOAD_FENCE() __atomic_thread_fence(__ATOMIC_ACQUIRE)
+#endif
+
 #ifndef PIOJO_DEBUG
 #define PIOJO_ASSERT(cond)                                              \
         do{                                                             \
@@ -60,6 +144,9 @@ extern "C" {
 #define PIOJO_ASSERT(cond) do{ assert(cond); } while(0)
 #endif
 
+uint64_t
+piojo_rand_seed(void);
+
 #ifdef __cplusplus
 }
 #endif
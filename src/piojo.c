@@ -31,6 +31,27 @@
 
 #include <piojo/piojo.h>
 #include <piojo_defs.h>
+#include <time.h>
+
+static const uint64_t WY_P0 = 0xa0761d6478bd642full;
+static const uint64_t WY_P1 = 0xe7037ed1a0b428dbull;
+static const uint64_t WY_P2 = 0x8ebc6af09c88c6e3ull;
+static const uint64_t WY_P3 = 0x589965cc75374cc3ull;
+
+static void
+mul128(uint64_t *lo, uint64_t *hi);
+
+static uint64_t
+mix64(uint64_t a, uint64_t b);
+
+static uint64_t
+fmix64(uint64_t v);
+
+static uint64_t
+read64(const uint8_t *p);
+
+static uint64_t
+read32(const uint8_t *p);
 
 /**
  * Equality function for opaque types.
@@ -60,6 +81,105 @@ piojo_id_eq(const void *e1, const void *e2)
         return (*v1 == *v2);
 }
 
+/**
+ * Hash function for arbitrary keys (wyhash).
+ * Reads 8 bytes at a time.
+ * @param[in] key
+ * @param[in] ksize Key size in bytes.
+ * @param[in] seed
+ * @return 64 bit hash of @a key.
+ */
+uint64_t
+piojo_bytes_hash(const void *key, size_t ksize, uint64_t seed)
+{
+        const uint8_t *p = (const uint8_t*) key;
+        uint64_t a, b, seed1, seed2;
+        size_t i = ksize;
+
+        seed ^= mix64(seed ^ WY_P0, WY_P1);
+        if (ksize <= 16){
+                if (ksize >= 4){
+                        a = (read32(p) << 32) | read32(p + ((ksize >> 3) << 2));
+                        b = (read32(p + ksize - 4) << 32) |
+                                read32(p + ksize - 4 - ((ksize >> 3) << 2));
+                }else if (ksize > 0){
+                        a = ((uint64_t)p[0] << 16) |
+                                ((uint64_t)p[ksize >> 1] << 8) | p[ksize - 1];
+                        b = 0;
+                }else{
+                        a = b = 0;
+                }
+        }else{
+                if (i > 48){
+                        seed1 = seed2 = seed;
+                        do{
+                                seed = mix64(read64(p) ^ WY_P1,
+                                             read64(p + 8) ^ seed);
+                                seed1 = mix64(read64(p + 16) ^ WY_P2,
+                                              read64(p + 24) ^ seed1);
+                                seed2 = mix64(read64(p + 32) ^ WY_P3,
+                                              read64(p + 40) ^ seed2);
+                                p += 48;
+                                i -= 48;
+                        }while (i > 48);
+                        seed ^= seed1 ^ seed2;
+                }
+                while (i > 16){
+                        seed = mix64(read64(p) ^ WY_P1, read64(p + 8) ^ seed);
+                        i -= 16;
+                        p += 16;
+                }
+                a = read64(p + i - 16);
+                b = read64(p + i - 8);
+        }
+        a ^= WY_P1;
+        b ^= seed;
+        mul128(&a, &b);
+        return mix64(a ^ WY_P0 ^ ksize, b ^ WY_P1);
+}
+
+/**
+ * Hash function for @b int32_t keys.
+ * @param[in] key
+ * @param[in] ksize Unused.
+ * @param[in] seed
+ * @return 64 bit hash of @a key.
+ */
+uint64_t
+piojo_i32_hash(const void *key, size_t ksize, uint64_t seed)
+{
+        PIOJO_UNUSED(ksize);
+        return fmix64((uint64_t)*(const uint32_t*) key ^ seed);
+}
+
+/**
+ * Hash function for @b int64_t keys.
+ * @param[in] key
+ * @param[in] ksize Unused.
+ * @param[in] seed
+ * @return 64 bit hash of @a key.
+ */
+uint64_t
+piojo_i64_hash(const void *key, size_t ksize, uint64_t seed)
+{
+        PIOJO_UNUSED(ksize);
+        return fmix64(*(const uint64_t*) key ^ seed);
+}
+
+/**
+ * Hash function for @b size_t keys.
+ * @param[in] key
+ * @param[in] ksize Unused.
+ * @param[in] seed
+ * @return 64 bit hash of @a key.
+ */
+uint64_t
+piojo_siz_hash(const void *key, size_t ksize, uint64_t seed)
+{
+        PIOJO_UNUSED(ksize);
+        return fmix64((uint64_t)*(const size_t*) key ^ seed);
+}
+
 /**
  * Checks addition overflow/wrap.
  * @param[in] v1
@@ -270,3 +390,81 @@ piojo_clampint(int val, int start, int end)
 }
 
 /** @} */
+
+/**
+ * Returns a new random seed for hash functions (private).
+ * @return Seed.
+ */
+uint64_t
+piojo_rand_seed(void)
+{
+        static uint64_t state = 0;
+        uint64_t seed;
+
+#if defined(__GNUC__)
+        seed = __atomic_add_fetch(&state, WY_P0, __ATOMIC_RELAXED);
+#else
+        seed = (state += WY_P0);
+#endif
+        seed ^= (uint64_t) time(NULL) ^ ((uint64_t) clock() << 32);
+        seed ^= (uint64_t)(uintptr_t) &seed;
+        return fmix64(seed);
+}
+
+/*
+ * Private functions.
+ */
+
+static void
+mul128(uint64_t *lo, uint64_t *hi)
+{
+#if defined(__SIZEOF_INT128__)
+        __extension__ typedef unsigned __int128 uint128_t;
+        uint128_t r = (uint128_t)*lo * *hi;
+        *lo = (uint64_t) r;
+        *hi = (uint64_t)(r >> 64);
+#else
+        uint64_t ha = *lo >> 32, hb = *hi >> 32;
+        uint64_t la = (uint32_t)*lo, lb = (uint32_t)*hi;
+        uint64_t rh = ha * hb, rm0 = ha * lb, rm1 = hb * la, rl = la * lb;
+        uint64_t t = rl + (rm0 << 32), c = t < rl;
+        *lo = t + (rm1 << 32);
+        c += *lo < t;
+        *hi = rh + (rm0 >> 32) + (rm1 >> 32) + c;
+#endif
+}
+
+static uint64_t
+mix64(uint64_t a, uint64_t b)
+{
+        mul128(&a, &b);
+        return a ^ b;
+}
+
+/* MurmurHash3 64 bit finalizer. */
+static uint64_t
+fmix64(uint64_t v)
+{
+        v ^= v >> 33;
+        v *= 0xff51afd7ed558ccdull;
+        v ^= v >> 33;
+        v *= 0xc4ceb9fe1a85ec53ull;
+        v ^= v >> 33;
+        return v;
+}
+
+static uint64_t
+read64(const uint8_t *p)
+{
+        uint64_t v;
+        memcpy(&v, p, sizeof(v));
+        return v;
+}
+
+static uint64_t
+read32(const uint8_t *p)
+{
+        uint32_t v;
+        memcpy(&v, p, sizeof(v));
+        return v;
+}
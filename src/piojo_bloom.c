@@ -35,14 +35,16 @@
 
 struct piojo_bloom_t {
         size_t eksize, hash_count;
+        uint64_t seed;
+        piojo_hash_cb hash_cb;
         piojo_bitset_t *bits;
         piojo_alloc_if allocator;
 };
 /** @hideinitializer Size of bloom filter in bytes */
 const size_t piojo_bloom_sizeof = sizeof(piojo_bloom_t);
 
-static uint32_t
-calc_hash(const unsigned char *buf, size_t len, uint32_t seed);
+static size_t
+calc_index(uint64_t hval, uint32_t i, const piojo_bloom_t *bloom);
 
 /**
  * Allocates a new bloom filter.
@@ -98,8 +100,8 @@ piojo_bloom_t*
 piojo_bloom_alloc_cb_i32k(size_t capacity, float false_positive_rate,
         piojo_alloc_if allocator)
 {
-        return piojo_bloom_alloc_cb_eq(capacity, false_positive_rate,
-                sizeof(int32_t), allocator);
+        return piojo_bloom_alloc_cb_hash(capacity, false_positive_rate,
+                piojo_i32_hash, sizeof(int32_t), allocator);
 }
 
 /**
@@ -114,8 +116,8 @@ piojo_bloom_t*
 piojo_bloom_alloc_cb_i64k(size_t capacity, float false_positive_rate,
         piojo_alloc_if allocator)
 {
-        return piojo_bloom_alloc_cb_eq(capacity, false_positive_rate,
-                sizeof(int64_t), allocator);
+        return piojo_bloom_alloc_cb_hash(capacity, false_positive_rate,
+                piojo_i64_hash, sizeof(int64_t), allocator);
 }
 
 /**
@@ -130,8 +132,8 @@ piojo_bloom_t*
 piojo_bloom_alloc_cb_sizk(size_t capacity, float false_positive_rate,
         piojo_alloc_if allocator)
 {
-        return piojo_bloom_alloc_cb_eq(capacity, false_positive_rate,
-                sizeof(size_t), allocator);
+        return piojo_bloom_alloc_cb_hash(capacity, false_positive_rate,
+                piojo_siz_hash, sizeof(size_t), allocator);
 }
 
 /**
@@ -151,6 +153,7 @@ piojo_bloom_alloc_eq(size_t capacity, float false_positive_rate, size_t eksize)
 
 /**
  * Allocates a new bloom filter.
+ * Keys are hashed with piojo_bytes_hash().
  * @param[in] capacity Bloom filter item capacity.
  * @param[in] false_positive_rate False positive rate.
  * @param[in] eksize Entry key size in bytes.
@@ -160,10 +163,29 @@ piojo_bloom_alloc_eq(size_t capacity, float false_positive_rate, size_t eksize)
 piojo_bloom_t*
 piojo_bloom_alloc_cb_eq(size_t capacity, float false_positive_rate,
         size_t eksize, piojo_alloc_if allocator)
+{
+        return piojo_bloom_alloc_cb_hash(capacity, false_positive_rate,
+                piojo_bytes_hash, eksize, allocator);
+}
+
+/**
+ * Allocates a new bloom filter.
+ * Each filter gets a random seed for @a keyhash.
+ * @param[in] capacity Bloom filter item capacity.
+ * @param[in] false_positive_rate False positive rate.
+ * @param[in] keyhash Entry key hash function.
+ * @param[in] eksize Entry key size in bytes.
+ * @param[in] allocator Allocator to be used.
+ * @return New bloom filter.
+ */
+piojo_bloom_t*
+piojo_bloom_alloc_cb_hash(size_t capacity, float false_positive_rate,
+        piojo_hash_cb keyhash, size_t eksize, piojo_alloc_if allocator)
 {
         piojo_bloom_t *bloom;
         piojo_bitset_t *bits;
         PIOJO_ASSERT(capacity > 0 && false_positive_rate > 0.0f);
+        PIOJO_ASSERT(keyhash);
 
         uint32_t bitsize = (uint32_t) ceil(-(capacity * log(false_positive_rate) /
                                   (log(2.0) * log(2.0))));
@@ -180,6 +202,8 @@ piojo_bloom_alloc_cb_eq(size_t capacity, float false_positive_rate,
         bloom->bits = bits;
         bloom->hash_count = hash_count;
         bloom->eksize = eksize;
+        bloom->hash_cb = keyhash;
+        bloom->seed = piojo_rand_seed();
         return bloom;
 }
 
@@ -205,6 +229,8 @@ piojo_bloom_copy(const piojo_bloom_t *bloom)
         newbloom->bits = bits;
         newbloom->hash_count = bloom->hash_count;
         newbloom->eksize = bloom->eksize;
+        newbloom->hash_cb = bloom->hash_cb;
+        newbloom->seed = bloom->seed;
         return newbloom;
 }
 
@@ -241,10 +267,9 @@ piojo_bloom_insert(const void *key, piojo_bloom_t *bloom)
 {
         PIOJO_ASSERT(bloom);
         PIOJO_ASSERT(key);
+        uint64_t hval = bloom->hash_cb(key, bloom->eksize, bloom->seed);
         for (uint32_t i = 0; i < bloom->hash_count; i++) {
-                size_t index = calc_hash((const unsigned char *)key,
-                        bloom->eksize, i) % piojo_bitset_size(bloom->bits);
-                piojo_bitset_set(index, bloom->bits);
+                piojo_bitset_set(calc_index(hval, i, bloom), bloom->bits);
         }
 }
 
@@ -259,10 +284,10 @@ piojo_bloom_search(const void *key, const piojo_bloom_t *bloom)
 {
         PIOJO_ASSERT(bloom);
         PIOJO_ASSERT(key);
+        uint64_t hval = bloom->hash_cb(key, bloom->eksize, bloom->seed);
         for (uint32_t i = 0; i < bloom->hash_count; i++) {
-                size_t index = calc_hash((const unsigned char *)key,
-                        bloom->eksize, i) % piojo_bitset_size(bloom->bits);
-                if (!piojo_bitset_set_p(index, bloom->bits)) {
+                if (!piojo_bitset_set_p(calc_index(hval, i, bloom),
+                                        bloom->bits)) {
                         return FALSE;
                 }
         }
@@ -273,18 +298,13 @@ piojo_bloom_search(const void *key, const piojo_bloom_t *bloom)
  * Private functions.
  */
 
-/* 32 bit Fowler/Noll/Vo FNV-1a hash on a buffer. */
-static uint32_t
-calc_hash(const unsigned char *buf, size_t len, uint32_t seed)
+/*
+ * Derives the i-th index from a single hash (Kirsch-Mitzenmacher double
+ * hashing), the two 32 bit halves of @a hval act as independent hashes.
+ */
+static size_t
+calc_index(uint64_t hval, uint32_t i, const piojo_bloom_t *bloom)
 {
-        uint32_t hval = (uint32_t)0x811c9dc5 + seed;
-        unsigned char *bp = (unsigned char *)buf;
-        unsigned char *be = bp + len;
-        while (bp < be) {
-                /* xor the bottom with the current octet */
-                hval ^= (uint32_t)*bp++;
-                /* multiply by the 32 bit FNV magic prime mod 2^32 */
-                hval *= (uint32_t)0x01000193;
-        }
-        return hval;
+        uint32_t h1 = (uint32_t) hval, h2 = (uint32_t)(hval >> 32);
+        return (size_t)(h1 + i * h2) % piojo_bitset_size(bloom->bits);
 }
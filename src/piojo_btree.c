@@ -27,12 +27,23 @@
  * @addtogroup piojobtree Piojo B-tree
  * @{
  * Piojo B-tree implementation.
- * Use @a maxchildren >= @b 8 for good performance.
+ * Default node fanout sizes each key array to whole cache lines.
+ * Nodes count the entries below each child, for rank/select queries.
+ * Snapshots share nodes with their tree, writers copy the shared nodes on
+ * their path before changing them.
  */
 
 #include <piojo/piojo_btree.h>
 #include <piojo_defs.h>
 
+#if (defined(__GNUC__) || defined(__clang__)) && \
+        (defined(__x86_64__) || defined(__i386__))
+#define PIOJO_BTREE_SIMD 1
+#include <immintrin.h>
+#else
+#define PIOJO_BTREE_SIMD 0
+#endif
+
 typedef struct {
         void *value;
 } kv_t;
@@ -40,35 +51,97 @@ typedef struct {
 typedef struct bnode_t bnode_t;
 struct bnode_t {
         bool leaf_p;
-        uint8_t ecnt, pidx;
+        size_t ecnt, pidx;
         uint8_t *keys;
         kv_t *kvs;
         bnode_t **children, *parent;
+        /* Entries in each child subtree (separators aren't entries). */
+        size_t *counts;
+        /* Leaf siblings in B+ mode. */
+        bnode_t *next, *prev;
+        /*
+         * Trees and nodes pointing to this node, shared nodes are never
+         * changed and their links only describe the writable tree.
+         */
+        size_t refs;
 };
 
+/* Returns number of keys less than @a key in @a keys[0, cnt). */
+typedef size_t
+(*count_less_cb) (const void *key, const uint8_t *keys, size_t cnt);
+
 typedef struct {
-        uint8_t eidx;
+        size_t eidx;
         bnode_t *bnode;
         const piojo_btree_t *tree;
 } iter_t;
 
+/* Levels are at least twice as wide as the level above. */
+#define TREE_HEIGHT_MAX 64
+
+/* Right spine of a tree being bulk loaded, from leaf to root. */
+typedef struct {
+        bnode_t *spine[TREE_HEIGHT_MAX];
+        size_t height, target;
+        void *lastkey;
+        piojo_btree_t *tree;
+} build_t;
+
 struct piojo_btree_t {
         bnode_t *root;
         size_t eksize, evsize, ecount, cmin, cmax;
         piojo_cmp_cb cmp_cb;
+        piojo_keytype_t keytype;
+        count_less_cb count_less;
+        piojo_btree_mode_t mode;
+        bool snapshot_p;
         piojo_alloc_if allocator;
 };
 /** @hideinitializer Size of tree in bytes */
 const size_t piojo_btree_sizeof = sizeof(piojo_btree_t);
 
-static const uint8_t TREE_CHILDREN_MAX = 8;
+/* Smallest and largest node fanout. */
+static const size_t TREE_CHILDREN_MIN = 4;
+static const size_t TREE_CHILDREN_MAX = 65534;
+/* Default fanout fills this many bytes of key array per node. */
+static const size_t TREE_KEYS_BYTES = 16 * 64;
+/*
+ * Integer node searches scan this many bytes of keys linearly, wider
+ * nodes are first narrowed down with a binary search.
+ */
+static const size_t TREE_SCAN_BYTES = 16 * 64;
 
 static bnode_t*
 alloc_bnode(const piojo_btree_t *tree);
 
+static void
+build_begin(float fill, piojo_btree_t *tree, build_t *build);
+
+static bnode_t*
+build_push(size_t level, const void *key, const void *data,
+           build_t *build);
+
+static void
+build_entry(const void *key, const void *data, build_t *build);
+
+static void
+build_end(build_t *build);
+
 static void
 free_bnode(const bnode_t *bnode, const piojo_btree_t *tree);
 
+static void
+release_bnode(bnode_t *bnode, piojo_btree_t *tree);
+
+static bool
+shared_p(const bnode_t *bnode);
+
+static bnode_t*
+own_bnode(bnode_t *bnode, piojo_btree_t *tree);
+
+static bnode_t*
+own_spine(bnode_t *bnode, bool right_p, piojo_btree_t *tree);
+
 static void
 split_bnode(piojo_btree_t *tree, size_t pidx, bnode_t *bnode,
             bnode_t *parent);
@@ -76,6 +149,12 @@ split_bnode(piojo_btree_t *tree, size_t pidx, bnode_t *bnode,
 static void
 split_root(piojo_btree_t *tree);
 
+static bool
+plus_leaf_p(const bnode_t *bnode, const piojo_btree_t *tree);
+
+static void
+clear_bnode(bnode_t *bnode, piojo_btree_t *tree);
+
 static void
 merge_bnodes(piojo_btree_t *tree, size_t pidx, bnode_t *lbnode,
              bnode_t *rbnode, bnode_t *parent);
@@ -95,22 +174,43 @@ rebalance_bnode(piojo_btree_t *tree, size_t pidx, bnode_t *bnode,
                 bnode_t *parent);
 
 static void
-move_child(bnode_t *child, uint8_t toidx, bnode_t *to);
+move_child(bnode_t *child, size_t toidx, bnode_t *to);
+
+static bool
+counted_p(const bnode_t *bnode, const piojo_btree_t *tree);
+
+static size_t
+sum_counts(const bnode_t *bnode, size_t cnt);
+
+static size_t
+subtree_count(const bnode_t *bnode, const piojo_btree_t *tree);
+
+static size_t
+count_bnode(bnode_t *bnode, const piojo_btree_t *tree);
+
+static void
+adjust_counts(const bnode_t *bnode, bool inc_p);
+
+static size_t
+rank_key(const void *key, const piojo_btree_t *tree, bool *found_p);
+
+static iter_t
+select_node(size_t idx, const piojo_btree_t *tree);
 
 static void
-copy_bentry(uint8_t eidx, const bnode_t *bnode, uint8_t toidx,
+copy_bentry(size_t eidx, const bnode_t *bnode, size_t toidx,
             const bnode_t *to, const piojo_btree_t *tree);
 
 static void*
-entry_key(uint8_t eidx, const bnode_t *bnode,
+entry_key(size_t eidx, const bnode_t *bnode,
           const piojo_btree_t *tree);
 
 static void*
-entry_val(uint8_t eidx, const bnode_t *bnode,
+entry_val(size_t eidx, const bnode_t *bnode,
           const piojo_btree_t *tree);
 
 static void
-init_entry(const void *key, const void *data, uint8_t eidx,
+init_entry(const void *key, const void *data, size_t eidx,
            const bnode_t *bnode, const piojo_btree_t *tree);
 
 static void
@@ -128,13 +228,73 @@ insert_node(const void *key, const void *data, piojo_btree_t *tree);
 static iter_t
 search_node(const void *key, const piojo_btree_t *tree);
 
+static iter_t
+search_lower(const void *key, const piojo_btree_t *tree);
+
+static iter_t
+search_adjacent(const void *key, bool next_p, const piojo_btree_t *tree);
+
+static bool
+step_snapshot(iter_t *iter, bool next_p);
+
+static bnode_t*
+search_leaf(const void *key, const piojo_btree_t *tree);
+
+static bool
+next_entry(iter_t *iter);
+
+static size_t
+range_leaves(iter_t *iter, const void *hi, piojo_btree_visit_cb cb,
+             void *state);
+
+static bool
+prev_entry(iter_t *iter);
+
+static const void*
+cursor_key(const iter_t *iter, piojo_btree_cursor_t *cursor);
+
 static bool
 delete_node(const void *key, bnode_t *bnode, piojo_btree_t *tree);
 
+static bool
+delete_leaf_node(const void *key, piojo_btree_t *tree);
+
 static size_t
 bin_search(const void *key, const piojo_btree_t *tree,
            bnode_t *bnode, bool *found_p);
 
+static int
+key_cmp(const void *k1, const void *k2, const piojo_btree_t *tree);
+
+static piojo_keytype_t
+key_type(piojo_cmp_cb keycmp);
+
+static size_t
+default_children(size_t eksize);
+
+static count_less_cb
+count_less_fn(piojo_keytype_t keytype);
+
+static size_t
+count_less_i32(const void *key, const uint8_t *keys, size_t cnt);
+
+static size_t
+count_less_i64(const void *key, const uint8_t *keys, size_t cnt);
+
+#if PIOJO_BTREE_SIMD
+static size_t
+count_less_i32_sse(const void *key, const uint8_t *keys, size_t cnt);
+
+static size_t
+count_less_i64_sse(const void *key, const uint8_t *keys, size_t cnt);
+
+static size_t
+count_less_i32_avx2(const void *key, const uint8_t *keys, size_t cnt);
+
+static size_t
+count_less_i64_avx2(const void *key, const uint8_t *keys, size_t cnt);
+#endif
+
 static int
 i32_cmp(const void *e1, const void *e2);
 
@@ -153,7 +313,7 @@ siz_cmp(const void *e1, const void *e2);
 piojo_btree_t*
 piojo_btree_alloc_i32k(size_t evsize)
 {
-        return piojo_btree_alloc_cb_i32k(TREE_CHILDREN_MAX, evsize,
+        return piojo_btree_alloc_cb_i32k(0, evsize,
                                         piojo_alloc_default);
 }
 
@@ -166,7 +326,7 @@ piojo_btree_alloc_i32k(size_t evsize)
 piojo_btree_t*
 piojo_btree_alloc_i64k(size_t evsize)
 {
-        return piojo_btree_alloc_cb_i64k(TREE_CHILDREN_MAX, evsize,
+        return piojo_btree_alloc_cb_i64k(0, evsize,
                                         piojo_alloc_default);
 }
 
@@ -179,21 +339,22 @@ piojo_btree_alloc_i64k(size_t evsize)
 piojo_btree_t*
 piojo_btree_alloc_sizk(size_t evsize)
 {
-        return piojo_btree_alloc_cb_sizk(TREE_CHILDREN_MAX, evsize,
+        return piojo_btree_alloc_cb_sizk(0, evsize,
                                         piojo_alloc_default);
 }
 
 /**
  * Allocates a new tree.
  * Uses key size of @b int32_t.
- * @param[in] maxchildren Maximum children in each node (from 4 to 254,
- *            and multiple of 2).
+ * @param[in] maxchildren Maximum children in each node (from 4 to 65534,
+ *            and multiple of 2), or @b 0 to size node keys to whole
+ *            cache lines.
  * @param[in] evsize Entry value size in bytes.
  * @param[in] allocator Allocator to be used.
  * @return New tree.
  */
 piojo_btree_t*
-piojo_btree_alloc_cb_i32k(uint8_t maxchildren, size_t evsize,
+piojo_btree_alloc_cb_i32k(size_t maxchildren, size_t evsize,
                          piojo_alloc_if allocator)
 {
         return piojo_btree_alloc_cb_cmp(maxchildren, evsize,
@@ -203,14 +364,15 @@ piojo_btree_alloc_cb_i32k(uint8_t maxchildren, size_t evsize,
 /**
  * Allocates a new tree.
  * Uses key size of @b int64_t.
- * @param[in] maxchildren Maximum children in each node (from 4 to 254,
- *            and multiple of 2).
+ * @param[in] maxchildren Maximum children in each node (from 4 to 65534,
+ *            and multiple of 2), or @b 0 to size node keys to whole
+ *            cache lines.
  * @param[in] evsize Entry value size in bytes.
  * @param[in] allocator Allocator to be used.
  * @return New tree.
  */
 piojo_btree_t*
-piojo_btree_alloc_cb_i64k(uint8_t maxchildren, size_t evsize,
+piojo_btree_alloc_cb_i64k(size_t maxchildren, size_t evsize,
                          piojo_alloc_if allocator)
 {
         return piojo_btree_alloc_cb_cmp(maxchildren, evsize,
@@ -220,14 +382,15 @@ piojo_btree_alloc_cb_i64k(uint8_t maxchildren, size_t evsize,
 /**
  * Allocates a new tree.
  * Uses key size of @b size_t.
- * @param[in] maxchildren Maximum children in each node (from 4 to 254,
- *            and multiple of 2).
+ * @param[in] maxchildren Maximum children in each node (from 4 to 65534,
+ *            and multiple of 2), or @b 0 to size node keys to whole
+ *            cache lines.
  * @param[in] evsize Entry value size in bytes.
  * @param[in] allocator Allocator to be used.
  * @return New tree.
  */
 piojo_btree_t*
-piojo_btree_alloc_cb_sizk(uint8_t maxchildren, size_t evsize,
+piojo_btree_alloc_cb_sizk(size_t maxchildren, size_t evsize,
                          piojo_alloc_if allocator)
 {
         return piojo_btree_alloc_cb_cmp(maxchildren, evsize,
@@ -245,14 +408,15 @@ piojo_btree_alloc_cb_sizk(uint8_t maxchildren, size_t evsize,
 piojo_btree_t*
 piojo_btree_alloc_cmp(size_t evsize, piojo_cmp_cb keycmp, size_t eksize)
 {
-        return piojo_btree_alloc_cb_cmp(TREE_CHILDREN_MAX, evsize,
+        return piojo_btree_alloc_cb_cmp(0, evsize,
                                        keycmp, eksize, piojo_alloc_default);
 }
 
 /**
  * Allocates a new tree.
- * @param[in] maxchildren Maximum children in each node (from 4 to 254,
- *            and multiple of 2).
+ * @param[in] maxchildren Maximum children in each node (from 4 to 65534,
+ *            and multiple of 2), or @b 0 to size node keys to whole
+ *            cache lines.
  * @param[in] evsize Entry value size in bytes.
  * @param[in] keycmp Entry key comparison function.
  * @param[in] eksize Entry key size.
@@ -260,14 +424,102 @@ piojo_btree_alloc_cmp(size_t evsize, piojo_cmp_cb keycmp, size_t eksize)
  * @return New tree.
  */
 piojo_btree_t*
-piojo_btree_alloc_cb_cmp(uint8_t maxchildren, size_t evsize,
+piojo_btree_alloc_cb_cmp(size_t maxchildren, size_t evsize,
                         piojo_cmp_cb keycmp, size_t eksize,
                         piojo_alloc_if allocator)
+{
+        return piojo_btree_alloc_mode_cmp(PIOJO_BTREE_MODE_CLASSIC,
+                                          maxchildren, evsize, keycmp,
+                                          eksize, allocator);
+}
+
+/**
+ * Allocates a new tree with the given layout.
+ * Uses key size of @b int32_t.
+ * @param[in] mode Tree layout.
+ * @param[in] maxchildren Maximum children in each node (from 4 to 65534,
+ *            and multiple of 2), or @b 0 to size node keys to whole
+ *            cache lines.
+ * @param[in] evsize Entry value size in bytes.
+ * @param[in] allocator Allocator to be used.
+ * @return New tree.
+ */
+piojo_btree_t*
+piojo_btree_alloc_mode_i32k(piojo_btree_mode_t mode, size_t maxchildren,
+                            size_t evsize, piojo_alloc_if allocator)
+{
+        return piojo_btree_alloc_mode_cmp(mode, maxchildren, evsize,
+                                          i32_cmp, sizeof(int32_t),
+                                          allocator);
+}
+
+/**
+ * Allocates a new tree with the given layout.
+ * Uses key size of @b int64_t.
+ * @param[in] mode Tree layout.
+ * @param[in] maxchildren Maximum children in each node (from 4 to 65534,
+ *            and multiple of 2), or @b 0 to size node keys to whole
+ *            cache lines.
+ * @param[in] evsize Entry value size in bytes.
+ * @param[in] allocator Allocator to be used.
+ * @return New tree.
+ */
+piojo_btree_t*
+piojo_btree_alloc_mode_i64k(piojo_btree_mode_t mode, size_t maxchildren,
+                            size_t evsize, piojo_alloc_if allocator)
+{
+        return piojo_btree_alloc_mode_cmp(mode, maxchildren, evsize,
+                                          i64_cmp, sizeof(int64_t),
+                                          allocator);
+}
+
+/**
+ * Allocates a new tree with the given layout.
+ * Uses key size of @b size_t.
+ * @param[in] mode Tree layout.
+ * @param[in] maxchildren Maximum children in each node (from 4 to 65534,
+ *            and multiple of 2), or @b 0 to size node keys to whole
+ *            cache lines.
+ * @param[in] evsize Entry value size in bytes.
+ * @param[in] allocator Allocator to be used.
+ * @return New tree.
+ */
+piojo_btree_t*
+piojo_btree_alloc_mode_sizk(piojo_btree_mode_t mode, size_t maxchildren,
+                            size_t evsize, piojo_alloc_if allocator)
+{
+        return piojo_btree_alloc_mode_cmp(mode, maxchildren, evsize,
+                                          siz_cmp, sizeof(size_t),
+                                          allocator);
+}
+
+/**
+ * Allocates a new tree with the given layout.
+ * @param[in] mode Tree layout.
+ * @param[in] maxchildren Maximum children in each node (from 4 to 65534,
+ *            and multiple of 2), or @b 0 to size node keys to whole
+ *            cache lines.
+ * @param[in] evsize Entry value size in bytes.
+ * @param[in] keycmp Entry key comparison function.
+ * @param[in] eksize Entry key size.
+ * @param[in] allocator Allocator to be used.
+ * @return New tree.
+ */
+piojo_btree_t*
+piojo_btree_alloc_mode_cmp(piojo_btree_mode_t mode, size_t maxchildren,
+                           size_t evsize, piojo_cmp_cb keycmp,
+                           size_t eksize, piojo_alloc_if allocator)
 {
         piojo_btree_t * tree;
         PIOJO_ASSERT(evsize > 0 && eksize > 0);
-        PIOJO_ASSERT(maxchildren > 2 && maxchildren < 255 &&
+        if (maxchildren == 0){
+                maxchildren = default_children(eksize);
+        }
+        PIOJO_ASSERT(maxchildren >= TREE_CHILDREN_MIN &&
+                     maxchildren <= TREE_CHILDREN_MAX &&
                      maxchildren % 2 == 0);
+        PIOJO_ASSERT(mode == PIOJO_BTREE_MODE_CLASSIC ||
+                     mode == PIOJO_BTREE_MODE_PLUS);
 
         tree = (piojo_btree_t *) allocator.alloc_cb(sizeof(piojo_btree_t));
         PIOJO_ASSERT(tree);
@@ -279,6 +531,10 @@ piojo_btree_alloc_cb_cmp(uint8_t maxchildren, size_t evsize,
         tree->cmax = maxchildren;
         tree->ecount = 0;
         tree->cmp_cb = keycmp;
+        tree->keytype = key_type(keycmp);
+        tree->count_less = count_less_fn(tree->keytype);
+        tree->mode = mode;
+        tree->snapshot_p = FALSE;
         tree->root = alloc_bnode(tree);
         tree->root->leaf_p = TRUE;
 
@@ -294,23 +550,138 @@ piojo_btree_t*
 piojo_btree_copy(const piojo_btree_t *tree)
 {
         piojo_btree_t *newtree;
+        piojo_btree_cursor_t cursor;
         const void *key;
         void *data;
         PIOJO_ASSERT(tree);
 
-        newtree = piojo_btree_alloc_cb_cmp(tree->cmax, tree->evsize,
-                                          tree->cmp_cb, tree->eksize,
-                                          tree->allocator);
+        newtree = piojo_btree_alloc_mode_cmp(tree->mode, tree->cmax,
+                                            tree->evsize, tree->cmp_cb,
+                                            tree->eksize, tree->allocator);
         newtree->ecount = tree->ecount;
 
-        key = piojo_btree_first(tree, &data);
+        key = piojo_btree_cursor_first(tree, &cursor);
         while (key != NULL){
+                data = piojo_btree_cursor_value(&cursor, tree);
                 insert_node(key, data, newtree);
-                key = piojo_btree_next(key, tree, &data);
+                key = piojo_btree_cursor_next(&cursor, tree);
         }
         return newtree;
 }
 
+/**
+ * Takes a read-only snapshot of @a tree in O(1), nodes are shared until
+ * @a tree changes them. Writes to @a tree copy only the shared nodes on
+ * their path, and snapshot readers never wait for @a tree writers.
+ * Snapshot cursors and ranges search each step from the root.
+ * While snapshots are alive, values of @a tree must be replaced with
+ * piojo_btree_set() instead of being written in place.
+ * Must not run concurrently with writes to @a tree.
+ * @param[in] tree Tree being read.
+ * @return New read-only tree (freed with piojo_btree_free()).
+ */
+piojo_btree_t*
+piojo_btree_snapshot(const piojo_btree_t *tree)
+{
+        piojo_btree_t *snapshot;
+        PIOJO_ASSERT(tree);
+
+        snapshot = ((piojo_btree_t *)
+                    tree->allocator.alloc_cb(sizeof(piojo_btree_t)));
+        PIOJO_ASSERT(snapshot);
+
+        *snapshot = *tree;
+        snapshot->snapshot_p = TRUE;
+        PIOJO_ATOMIC_ADD(&tree->root->refs, 1);
+        return snapshot;
+}
+
+/**
+ * Builds @a tree from @a n entries sorted by key, without searching.
+ * Nodes are packed bottom-up, faster than @a n insertions and denser.
+ * @param[in] keys Array of @a n unique keys in ascending order.
+ * @param[in] values Array of @a n values, or @b NULL to insert @b TRUE
+ *            for each key.
+ * @param[in] n Number of entries.
+ * @param[in] fill Fraction of each node filled, from @b 0 to @b 1
+ *            (nodes are never left less than half full).
+ * @param[out] tree Empty tree.
+ */
+void
+piojo_btree_build_sorted(const void *keys, const void *values, size_t n,
+                         float fill, piojo_btree_t *tree)
+{
+        build_t build;
+        size_t i;
+        const uint8_t *kptr = (const uint8_t*) keys;
+        const uint8_t *vptr = (const uint8_t*) values;
+        PIOJO_ASSERT(tree);
+        PIOJO_ASSERT(keys || n == 0);
+
+        build_begin(fill, tree, &build);
+        for (i = 0; i < n; ++i){
+                build_entry(&kptr[i * tree->eksize],
+                            (vptr != NULL ? &vptr[i * tree->evsize] : NULL),
+                            &build);
+        }
+        build_end(&build);
+}
+
+/**
+ * Builds @a tree from the entries returned by @a next, without searching.
+ * @param[in] next Returns entries sorted by unique key.
+ * @param[in] state Passed to @a next.
+ * @param[in] fill Fraction of each node filled, from @b 0 to @b 1
+ *            (nodes are never left less than half full).
+ * @param[out] tree Empty tree.
+ */
+void
+piojo_btree_build_sorted_cb(piojo_btree_pair_cb next, void *state,
+                            float fill, piojo_btree_t *tree)
+{
+        build_t build;
+        const void *key, *data;
+        PIOJO_ASSERT(tree);
+        PIOJO_ASSERT(next);
+
+        build_begin(fill, tree, &build);
+        while (next(&key, &data, state)){
+                build_entry(key, data, &build);
+        }
+        build_end(&build);
+}
+
+/**
+ * Builds @a tree from arrays of entries, without searching.
+ * @param[in] keys Array of unique keys in ascending order.
+ * @param[in] values Array of values (same size as @a keys), or @b NULL
+ *            to insert @b TRUE for each key.
+ * @param[in] fill Fraction of each node filled, from @b 0 to @b 1
+ *            (nodes are never left less than half full).
+ * @param[out] tree Empty tree.
+ */
+void
+piojo_btree_build_sorted_array(const piojo_array_t *keys,
+                               const piojo_array_t *values, float fill,
+                               piojo_btree_t *tree)
+{
+        build_t build;
+        size_t i, n;
+        PIOJO_ASSERT(tree);
+        PIOJO_ASSERT(keys);
+
+        n = piojo_array_size(keys);
+        PIOJO_ASSERT(values == NULL || piojo_array_size(values) == n);
+
+        build_begin(fill, tree, &build);
+        for (i = 0; i < n; ++i){
+                build_entry(piojo_array_at(i, keys),
+                            (values != NULL ? piojo_array_at(i, values) :
+                             NULL), &build);
+        }
+        build_end(&build);
+}
+
 /**
  * Frees @a tree and all its entries.
  * @param[in] tree Tree being freed.
@@ -322,8 +693,7 @@ piojo_btree_free(const piojo_btree_t *tree)
         PIOJO_ASSERT(tree);
 
         t = (piojo_btree_t*) tree;
-        piojo_btree_clear(t);
-        free_bnode(t->root, t);
+        release_bnode(t->root, t);
         tree->allocator.free_cb(t);
 }
 
@@ -335,17 +705,17 @@ piojo_btree_free(const piojo_btree_t *tree)
 void
 piojo_btree_clear(piojo_btree_t *tree)
 {
-        void *key;
         PIOJO_ASSERT(tree);
+        PIOJO_ASSERT(! tree->snapshot_p);
 
-        key = tree->allocator.alloc_cb(tree->eksize);
-        PIOJO_ASSERT(key);
-        while (tree->ecount > 0){
-                memcpy(key, entry_key(0, tree->root, tree), tree->eksize);
-                delete_node(key, tree->root, tree);
-                --tree->ecount;
+        if (shared_p(tree->root)){
+                release_bnode(tree->root, tree);
+                tree->root = alloc_bnode(tree);
+        }else{
+                clear_bnode(tree->root, tree);
         }
-        tree->allocator.free_cb(key);
+        tree->root->leaf_p = TRUE;
+        tree->ecount = 0;
 }
 
 /**
@@ -374,6 +744,7 @@ piojo_btree_insert(const void *key, const void *data, piojo_btree_t *tree)
         iter_t iter;
         PIOJO_ASSERT(tree);
         PIOJO_ASSERT(key);
+        PIOJO_ASSERT(! tree->snapshot_p);
         PIOJO_ASSERT(tree->ecount < SIZE_MAX);
         PIOJO_ASSERT(data || tree->evsize == sizeof(bool));
 
@@ -398,6 +769,7 @@ piojo_btree_set(const void *key, const void *data, piojo_btree_t *tree)
 {
         iter_t iter;
         PIOJO_ASSERT(tree);
+        PIOJO_ASSERT(! tree->snapshot_p);
         PIOJO_ASSERT(key);
         PIOJO_ASSERT(data || tree->evsize == sizeof(bool));
 
@@ -445,6 +817,7 @@ bool
 piojo_btree_delete(const void *key, piojo_btree_t *tree)
 {
         PIOJO_ASSERT(tree);
+        PIOJO_ASSERT(! tree->snapshot_p);
         PIOJO_ASSERT(key);
 
         if (delete_node(key, tree->root, tree)){
@@ -522,23 +895,7 @@ piojo_btree_next(const void *key, const piojo_btree_t *tree, void **data)
         iter = search_node(key, tree);
         PIOJO_ASSERT(iter.bnode != NULL);
 
-        if (! iter.bnode->leaf_p && iter.eidx < iter.bnode->ecnt){
-                iter.bnode = iter.bnode->children[iter.eidx + 1];
-                iter.eidx = 0;
-                search_min(&iter);
-        }else if (iter.eidx + 1 < iter.bnode->ecnt){
-                ++iter.eidx;
-        }else{
-                while (iter.bnode->parent != NULL){
-                        iter.eidx = iter.bnode->pidx;
-                        iter.bnode = iter.bnode->parent;
-                        if (iter.eidx < iter.bnode->ecnt){
-                                if (data != NULL){
-                                        *data = entry_val(iter.eidx, iter.bnode, tree);
-                                }
-                                return entry_key(iter.eidx, iter.bnode, tree);
-                        }
-                }
+        if (! next_entry(&iter)){
                 return NULL;
         }
         if (data != NULL){
@@ -564,24 +921,7 @@ piojo_btree_prev(const void *key, const piojo_btree_t *tree, void **data)
         iter = search_node(key, tree);
         PIOJO_ASSERT(iter.bnode != NULL);
 
-        if (! iter.bnode->leaf_p && iter.eidx < iter.bnode->ecnt + 1){
-                iter.bnode = iter.bnode->children[iter.eidx];
-                iter.eidx = iter.bnode->ecnt;
-                search_max(&iter);
-        }else if (iter.eidx > 0){
-                --iter.eidx;
-        }else{
-                while (iter.bnode->parent != NULL){
-                        iter.eidx = iter.bnode->pidx;
-                        iter.bnode = iter.bnode->parent;
-                        if (iter.eidx > 0){
-                                --iter.eidx;
-                                if (data != NULL){
-                                        *data = entry_val(iter.eidx, iter.bnode, tree);
-                                }
-                                return entry_key(iter.eidx, iter.bnode, tree);
-                        }
-                }
+        if (! prev_entry(&iter)){
                 return NULL;
         }
         if (data != NULL){
@@ -590,60 +930,639 @@ piojo_btree_prev(const void *key, const piojo_btree_t *tree, void **data)
         return entry_key(iter.eidx, iter.bnode, tree);
 }
 
-/** @}
- * Private functions.
+/**
+ * Positions @a cursor at the first key (order given by @a keycmp function).
+ * @param[in] tree
+ * @param[out] cursor Tree cursor.
+ * @return first key or @b NULL if @a tree is empty.
  */
-
-static bnode_t*
-alloc_bnode(const piojo_btree_t *tree)
+const void*
+piojo_btree_cursor_first(const piojo_btree_t *tree,
+                         piojo_btree_cursor_t *cursor)
 {
-        piojo_alloc_if ator = tree->allocator;
-        bnode_t *bnode;
-        size_t keysiz = tree->eksize * (tree->cmax - 1);
-        size_t kvsize = sizeof(kv_t) * (tree->cmax - 1);
-        size_t childrensiz = sizeof(bnode_t*) * tree->cmax;
-        size_t bnodesiz = sizeof(bnode_t);
-
-        bnode = ((bnode_t*)
-                 ator.alloc_cb(bnodesiz + keysiz + kvsize + childrensiz));
-        PIOJO_ASSERT(bnode);
-
-        bnode->keys = (uint8_t*) bnode + bnodesiz;
-        bnode->kvs = (kv_t*)((uint8_t*) bnode->keys + keysiz);
-        bnode->children = ((bnode_t**)
-                           ((uint8_t*) bnode->kvs + kvsize));
-        bnode->ecnt = bnode->pidx = 0;
-        bnode->leaf_p = FALSE;
-        bnode->parent = NULL;
+        iter_t iter;
+        PIOJO_ASSERT(tree);
+        PIOJO_ASSERT(cursor);
 
-        return bnode;
+        iter.tree = tree;
+        iter.bnode = NULL;
+        if (tree->ecount > 0){
+                iter.eidx = 0;
+                iter.bnode = tree->root;
+                search_min(&iter);
+        }
+        return cursor_key(&iter, cursor);
 }
 
-static void
-free_bnode(const bnode_t *bnode, const piojo_btree_t *tree)
+/**
+ * Positions @a cursor at the last key (order given by @a keycmp function).
+ * @param[in] tree
+ * @param[out] cursor Tree cursor.
+ * @return last key or @b NULL if @a tree is empty.
+ */
+const void*
+piojo_btree_cursor_last(const piojo_btree_t *tree,
+                        piojo_btree_cursor_t *cursor)
 {
-        tree->allocator.free_cb(bnode);
+        iter_t iter;
+        PIOJO_ASSERT(tree);
+        PIOJO_ASSERT(cursor);
+
+        iter.tree = tree;
+        iter.bnode = NULL;
+        if (tree->ecount > 0){
+                iter.eidx = tree->root->ecnt;
+                iter.bnode = tree->root;
+                search_max(&iter);
+        }
+        return cursor_key(&iter, cursor);
 }
 
-static void
-move_child(bnode_t *child, uint8_t toidx, bnode_t *to)
+/**
+ * Positions @a cursor at the first key not less than @a key.
+ * @param[in] key
+ * @param[in] tree
+ * @param[out] cursor Tree cursor.
+ * @return found key or @b NULL if all keys are less than @a key.
+ */
+const void*
+piojo_btree_cursor_seek(const void *key, const piojo_btree_t *tree,
+                        piojo_btree_cursor_t *cursor)
 {
-        to->children[toidx] = child;
-        child->parent = to;
-        child->pidx = toidx;
+        iter_t iter;
+        PIOJO_ASSERT(tree);
+        PIOJO_ASSERT(key);
+        PIOJO_ASSERT(cursor);
+
+        iter = search_lower(key, tree);
+        return cursor_key(&iter, cursor);
 }
 
-static void
-split_root(piojo_btree_t *tree)
+/**
+ * Moves @a cursor to the next key (order given by @a keycmp function).
+ * @param[in,out] cursor Tree cursor.
+ * @param[in] tree
+ * @return next key or @b NULL if @a cursor was at the last key.
+ */
+const void*
+piojo_btree_cursor_next(piojo_btree_cursor_t *cursor,
+                        const piojo_btree_t *tree)
 {
-        bnode_t *newroot;
-        PIOJO_ASSERT(tree->root->ecnt == tree->cmax - 1);
+        iter_t iter;
+        PIOJO_ASSERT(tree);
+        PIOJO_ASSERT(cursor && cursor->bnode);
 
-        newroot = alloc_bnode(tree);
-        newroot->leaf_p = FALSE;
-        move_child(tree->root, 0, newroot);
+        iter.tree = tree;
+        iter.bnode = (bnode_t*) cursor->bnode;
+        iter.eidx = cursor->eidx;
+        if (! next_entry(&iter)){
+                iter.bnode = NULL;
+        }
+        return cursor_key(&iter, cursor);
+}
 
-        split_bnode(tree, 0, tree->root, newroot);
+/**
+ * Moves @a cursor to the previous key (order given by @a keycmp function).
+ * @param[in,out] cursor Tree cursor.
+ * @param[in] tree
+ * @return previous key or @b NULL if @a cursor was at the first key.
+ */
+const void*
+piojo_btree_cursor_prev(piojo_btree_cursor_t *cursor,
+                        const piojo_btree_t *tree)
+{
+        iter_t iter;
+        PIOJO_ASSERT(tree);
+        PIOJO_ASSERT(cursor && cursor->bnode);
+
+        iter.tree = tree;
+        iter.bnode = (bnode_t*) cursor->bnode;
+        iter.eidx = cursor->eidx;
+        if (! prev_entry(&iter)){
+                iter.bnode = NULL;
+        }
+        return cursor_key(&iter, cursor);
+}
+
+/**
+ * Returns the entry value at @a cursor.
+ * @param[in] cursor Tree cursor.
+ * @param[in] tree
+ * @return Entry value.
+ */
+void*
+piojo_btree_cursor_value(const piojo_btree_cursor_t *cursor,
+                         const piojo_btree_t *tree)
+{
+        PIOJO_ASSERT(tree);
+        PIOJO_ASSERT(cursor && cursor->bnode);
+
+        return entry_val(cursor->eidx, (bnode_t*) cursor->bnode, tree);
+}
+
+/**
+ * Deletes the entry at @a cursor and moves it to the next key.
+ * Nodes may be merged or rotated, so the next key is searched again.
+ * @param[in,out] cursor Tree cursor.
+ * @param[out] tree
+ * @return next key or @b NULL if the deleted key was the last one.
+ */
+const void*
+piojo_btree_cursor_delete(piojo_btree_cursor_t *cursor,
+                          piojo_btree_t *tree)
+{
+        iter_t iter;
+        void *key;
+        PIOJO_ASSERT(tree);
+        PIOJO_ASSERT(! tree->snapshot_p);
+        PIOJO_ASSERT(cursor && cursor->bnode);
+
+        key = tree->allocator.alloc_cb(tree->eksize);
+        PIOJO_ASSERT(key);
+        memcpy(key, entry_key(cursor->eidx, (bnode_t*) cursor->bnode, tree),
+               tree->eksize);
+
+        delete_node(key, tree->root, tree);
+        --tree->ecount;
+
+        iter = search_lower(key, tree);
+        tree->allocator.free_cb(key);
+        return cursor_key(&iter, cursor);
+}
+
+/**
+ * Calls @a cb for each entry with key in [@a lo, @a hi], in key order.
+ * In @b PIOJO_BTREE_MODE_PLUS the scan runs through the leaf chain
+ * (snapshots search each step from the root).
+ * @param[in] lo Lowest key.
+ * @param[in] hi Highest key.
+ * @param[in] cb Entry visitor, returning @b FALSE stops the scan.
+ * @param[in] state Passed to @a cb.
+ * @param[in] tree
+ * @return Number of entries visited.
+ */
+size_t
+piojo_btree_range(const void *lo, const void *hi, piojo_btree_visit_cb cb,
+                  void *state, const piojo_btree_t *tree)
+{
+        iter_t iter;
+        const void *key;
+        size_t cnt = 0;
+        PIOJO_ASSERT(tree);
+        PIOJO_ASSERT(lo && hi);
+        PIOJO_ASSERT(cb);
+
+        iter = search_lower(lo, tree);
+        if (tree->mode == PIOJO_BTREE_MODE_PLUS && ! tree->snapshot_p){
+                return range_leaves(&iter, hi, cb, state);
+        }
+        while (iter.bnode != NULL){
+                key = entry_key(iter.eidx, iter.bnode, tree);
+                if (key_cmp(key, hi, tree) > 0){
+                        break;
+                }
+                ++cnt;
+                if (! cb(key, entry_val(iter.eidx, iter.bnode, tree),
+                         state) || ! next_entry(&iter)){
+                        break;
+                }
+        }
+        return cnt;
+}
+
+/**
+ * Returns the number of keys less than @a key (order given by @a keycmp
+ * function), in O(log n).
+ * @param[in] key
+ * @param[in] tree
+ * @return Rank of @a key (from 0 to tree_size).
+ */
+size_t
+piojo_btree_rank(const void *key, const piojo_btree_t *tree)
+{
+        bool found_p;
+        PIOJO_ASSERT(tree);
+        PIOJO_ASSERT(key);
+
+        return rank_key(key, tree, &found_p);
+}
+
+/**
+ * Reads the key of rank @a idx (order given by @a keycmp function),
+ * in O(log n).
+ * @param[in] idx Index of entry being read (from 0 to tree_size - 1).
+ * @param[in] tree
+ * @param[out] data Entry value, can be @b NULL.
+ * @return Key at index @a idx.
+ */
+const void*
+piojo_btree_select(size_t idx, const piojo_btree_t *tree, void **data)
+{
+        iter_t iter;
+        PIOJO_ASSERT(tree);
+        PIOJO_ASSERT(idx < tree->ecount);
+
+        iter = select_node(idx, tree);
+        if (data != NULL){
+                *data = entry_val(iter.eidx, iter.bnode, tree);
+        }
+        return entry_key(iter.eidx, iter.bnode, tree);
+}
+
+/**
+ * Returns the number of keys in [@a lo, @a hi], in O(log n).
+ * @param[in] lo Lowest key.
+ * @param[in] hi Highest key.
+ * @param[in] tree
+ * @return Number of entries with key in range.
+ */
+size_t
+piojo_btree_count_range(const void *lo, const void *hi,
+                        const piojo_btree_t *tree)
+{
+        bool found_p;
+        size_t below;
+        PIOJO_ASSERT(tree);
+        PIOJO_ASSERT(lo && hi);
+
+        if (key_cmp(lo, hi, tree) > 0){
+                return 0;
+        }
+        below = rank_key(lo, tree, &found_p);
+        return rank_key(hi, tree, &found_p) + (found_p ? 1 : 0) - below;
+}
+
+/** @}
+ * Private functions.
+ */
+
+static bnode_t*
+alloc_bnode(const piojo_btree_t *tree)
+{
+        piojo_alloc_if ator = tree->allocator;
+        bnode_t *bnode;
+        size_t keysiz = tree->eksize * (tree->cmax - 1);
+        size_t kvsize = sizeof(kv_t) * (tree->cmax - 1);
+        size_t childrensiz = sizeof(bnode_t*) * tree->cmax;
+        size_t countsiz = sizeof(size_t) * tree->cmax;
+        size_t bnodesiz = sizeof(bnode_t);
+
+        bnode = ((bnode_t*)
+                 ator.alloc_cb(bnodesiz + keysiz + kvsize + childrensiz +
+                               countsiz));
+        PIOJO_ASSERT(bnode);
+
+        bnode->keys = (uint8_t*) bnode + bnodesiz;
+        bnode->kvs = (kv_t*)((uint8_t*) bnode->keys + keysiz);
+        bnode->children = ((bnode_t**)
+                           ((uint8_t*) bnode->kvs + kvsize));
+        bnode->counts = (size_t*)((uint8_t*) bnode->children + childrensiz);
+        bnode->ecnt = bnode->pidx = 0;
+        bnode->leaf_p = FALSE;
+        bnode->parent = NULL;
+        bnode->next = bnode->prev = NULL;
+        bnode->refs = 1;
+
+        return bnode;
+}
+
+static void
+free_bnode(const bnode_t *bnode, const piojo_btree_t *tree)
+{
+        tree->allocator.free_cb(bnode);
+}
+
+/* Drops a reference, the last one frees bnode with its entries. */
+static void
+release_bnode(bnode_t *bnode, piojo_btree_t *tree)
+{
+        if (PIOJO_ATOMIC_ADD(&bnode->refs, (size_t) -1) == 1){
+                clear_bnode(bnode, tree);
+                free_bnode(bnode, tree);
+        }
+}
+
+static bool
+shared_p(const bnode_t *bnode)
+{
+        return PIOJO_ATOMIC_LOAD(&bnode->refs) > 1;
+}
+
+/*
+ * Replaces a shared bnode with a copy only referenced by tree, bnode's
+ * parent must be owned already (nodes are owned from the root down).
+ * The copy takes over children and leaf links, entries are duplicated.
+ */
+static bnode_t*
+own_bnode(bnode_t *bnode, piojo_btree_t *tree)
+{
+        size_t i;
+        bnode_t *copy;
+        piojo_alloc_if ator = tree->allocator;
+
+        if (! shared_p(bnode)){
+                return bnode;
+        }
+        copy = alloc_bnode(tree);
+        copy->leaf_p = bnode->leaf_p;
+        copy->ecnt = bnode->ecnt;
+        memcpy(copy->keys, bnode->keys, tree->eksize * bnode->ecnt);
+        for (i = 0; i < bnode->ecnt; ++i){
+                /* B+ separators only borrow leaf values. */
+                copy->kvs[i].value = bnode->kvs[i].value;
+                if (counted_p(bnode, tree)){
+                        copy->kvs[i].value = ator.alloc_cb(tree->evsize);
+                        PIOJO_ASSERT(copy->kvs[i].value);
+                        memcpy(copy->kvs[i].value, bnode->kvs[i].value,
+                               tree->evsize);
+                }
+        }
+        if (! bnode->leaf_p){
+                memcpy(copy->counts, bnode->counts,
+                       sizeof(size_t) * (bnode->ecnt + 1));
+                for (i = 0; i <= bnode->ecnt; ++i){
+                        copy->children[i] = bnode->children[i];
+                        copy->children[i]->parent = copy;
+                        PIOJO_ATOMIC_ADD(&copy->children[i]->refs, 1);
+                }
+        }
+        if (plus_leaf_p(bnode, tree)){
+                copy->next = bnode->next;
+                copy->prev = bnode->prev;
+                if (copy->next != NULL){
+                        copy->next->prev = copy;
+                }
+                if (copy->prev != NULL){
+                        copy->prev->next = copy;
+                }
+        }
+
+        copy->pidx = bnode->pidx;
+        copy->parent = bnode->parent;
+        if (bnode == tree->root){
+                tree->root = copy;
+        }else{
+                copy->parent->children[copy->pidx] = copy;
+        }
+        release_bnode(bnode, tree);
+        return copy;
+}
+
+/* Owns bnode and its leftmost (or rightmost) descendants. */
+static bnode_t*
+own_spine(bnode_t *bnode, bool right_p, piojo_btree_t *tree)
+{
+        bnode_t *top = own_bnode(bnode, tree);
+
+        bnode = top;
+        while (! bnode->leaf_p){
+                bnode = own_bnode(bnode->children[right_p ? bnode->ecnt : 0],
+                                  tree);
+        }
+        return top;
+}
+
+/* B+ mode leaves hold entries, internal nodes only hold keys. */
+static bool
+plus_leaf_p(const bnode_t *bnode, const piojo_btree_t *tree)
+{
+        return tree->mode == PIOJO_BTREE_MODE_PLUS && bnode->leaf_p;
+}
+
+/* Frees entries and unshared descendants of bnode, leaving it empty. */
+static void
+clear_bnode(bnode_t *bnode, piojo_btree_t *tree)
+{
+        size_t i;
+        bool deleted_p;
+
+        if (! bnode->leaf_p){
+                for (i = 0; i <= bnode->ecnt; ++i){
+                        release_bnode(bnode->children[i], tree);
+                }
+        }
+        if (tree->mode == PIOJO_BTREE_MODE_CLASSIC || bnode->leaf_p){
+                for (i = 0; i < bnode->ecnt; ++i){
+                        deleted_p = FALSE;
+                        free_entry(&bnode->kvs[i], tree, &deleted_p);
+                }
+        }
+        bnode->ecnt = 0;
+        bnode->next = bnode->prev = NULL;
+}
+
+static void
+build_begin(float fill, piojo_btree_t *tree, build_t *build)
+{
+        size_t target;
+        PIOJO_ASSERT(fill > 0 && fill <= 1);
+        PIOJO_ASSERT(! tree->snapshot_p);
+        PIOJO_ASSERT(tree->ecount == 0 && tree->root->leaf_p);
+
+        target = (size_t) (fill * (tree->cmax - 1) + 0.5f);
+        if (target < tree->cmin - 1){
+                target = tree->cmin - 1;
+        }else if (target > tree->cmax - 1){
+                target = tree->cmax - 1;
+        }
+
+        build->tree = tree;
+        build->target = target;
+        build->height = 1;
+        build->spine[0] = own_bnode(tree->root, tree);
+        build->lastkey = NULL;
+}
+
+/*
+ * Appends an entry to the rightmost node of 'level'. A full node is
+ * closed, the entry moves up as separator and a new empty node is linked
+ * as its right child. Returns the node that takes the next child.
+ */
+static bnode_t*
+build_push(size_t level, const void *key, const void *data,
+           build_t *build)
+{
+        piojo_btree_t *tree = build->tree;
+        bnode_t *bnode, *parent;
+
+        bnode = build->spine[level];
+        if (bnode->ecnt == build->target){
+                if (level + 1 == build->height){
+                        PIOJO_ASSERT(build->height < TREE_HEIGHT_MAX);
+                        parent = alloc_bnode(tree);
+                        move_child(bnode, 0, parent);
+                        build->spine[build->height++] = parent;
+                }
+                parent = build_push(level + 1, key, data, build);
+                bnode = alloc_bnode(tree);
+                bnode->leaf_p = (level == 0);
+                move_child(bnode, parent->ecnt, parent);
+                if (! plus_leaf_p(bnode, tree)){
+                        build->spine[level] = bnode;
+                        return bnode;
+                }
+                /* B+ leaves are chained, the entry starts the new leaf. */
+                bnode->prev = build->spine[level];
+                build->spine[level]->next = bnode;
+                build->spine[level] = bnode;
+        }
+
+        if (tree->mode == PIOJO_BTREE_MODE_PLUS && level > 0){
+                piojo_key_copy(entry_key(bnode->ecnt, bnode, tree), key,
+                               tree->eksize);
+        }else{
+                init_entry(key, data, bnode->ecnt, bnode, tree);
+        }
+        build->lastkey = entry_key(bnode->ecnt, bnode, tree);
+        ++bnode->ecnt;
+        return bnode;
+}
+
+static void
+build_entry(const void *key, const void *data, build_t *build)
+{
+        PIOJO_ASSERT(build->lastkey == NULL ||
+                     key_cmp(build->lastkey, key, build->tree) < 0);
+        build_push(0, key, data, build);
+        ++build->tree->ecount;
+}
+
+/*
+ * Tops up the rightmost node of each level from its left sibling (a full
+ * node), rotating entries or merging both nodes. A merge takes an entry
+ * from the level above, so merges are planned bottom-up and applied
+ * top-down, parents first get one more entry to give away.
+ */
+static void
+build_end(build_t *build)
+{
+        piojo_btree_t *tree = build->tree;
+        bnode_t *bnode, *lsibling, *parent;
+        bool merge_p[TREE_HEIGHT_MAX];
+        size_t level, want[TREE_HEIGHT_MAX];
+
+        tree->root = build->spine[build->height - 1];
+        for (level = 0; level + 1 < build->height; ++level){
+                want[level] = tree->cmin - 1;
+                if (level > 0 && merge_p[level - 1]){
+                        ++want[level];
+                }
+                bnode = build->spine[level];
+                merge_p[level] = (bnode->ecnt < want[level] &&
+                                  build->target + bnode->ecnt <
+                                  tree->cmin - 1 + want[level]);
+        }
+
+        for (level = build->height - 1; level-- > 0;){
+                bnode = build->spine[level];
+                if (bnode->ecnt >= want[level]){
+                        continue;
+                }
+                parent = bnode->parent;
+                PIOJO_ASSERT(bnode->pidx > 0);
+                lsibling = parent->children[bnode->pidx - 1];
+                if (merge_p[level]){
+                        merge_bnodes(tree, bnode->pidx - 1, lsibling,
+                                     bnode, parent);
+                        continue;
+                }
+                while (bnode->ecnt < want[level]){
+                        rotate_right(bnode->pidx - 1, lsibling, bnode,
+                                     parent, tree);
+                }
+        }
+        /* Counts are summed once the shape is final. */
+        count_bnode(tree->root, tree);
+}
+
+/*
+ * Children keep their entry count when moved, a child without parent
+ * starts with none (callers set it).
+ */
+static void
+move_child(bnode_t *child, size_t toidx, bnode_t *to)
+{
+        size_t cnt = 0;
+
+        if (child->parent != NULL){
+                cnt = child->parent->counts[child->pidx];
+        }
+        to->counts[toidx] = cnt;
+        to->children[toidx] = child;
+        child->parent = to;
+        child->pidx = toidx;
+}
+
+/* B+ internal nodes only hold separators, other node entries count. */
+static bool
+counted_p(const bnode_t *bnode, const piojo_btree_t *tree)
+{
+        return tree->mode == PIOJO_BTREE_MODE_CLASSIC || bnode->leaf_p;
+}
+
+/* Returns the entries below the first cnt children of bnode. */
+static size_t
+sum_counts(const bnode_t *bnode, size_t cnt)
+{
+        size_t i, sum = 0;
+
+        for (i = 0; i < cnt; ++i){
+                sum += bnode->counts[i];
+        }
+        return sum;
+}
+
+static size_t
+subtree_count(const bnode_t *bnode, const piojo_btree_t *tree)
+{
+        size_t cnt = (counted_p(bnode, tree) ? bnode->ecnt : 0);
+
+        if (! bnode->leaf_p){
+                cnt += sum_counts(bnode, bnode->ecnt + 1);
+        }
+        return cnt;
+}
+
+/* Sets the counts of bnode and its descendants, returns their total. */
+static size_t
+count_bnode(bnode_t *bnode, const piojo_btree_t *tree)
+{
+        size_t i;
+
+        if (! bnode->leaf_p){
+                for (i = 0; i <= bnode->ecnt; ++i){
+                        bnode->counts[i] = count_bnode(bnode->children[i],
+                                                       tree);
+                }
+        }
+        return subtree_count(bnode, tree);
+}
+
+/* Counts an entry added to (or removed from) bnode in its ancestors. */
+static void
+adjust_counts(const bnode_t *bnode, bool inc_p)
+{
+        for (; bnode->parent != NULL; bnode = bnode->parent){
+                if (inc_p){
+                        ++bnode->parent->counts[bnode->pidx];
+                }else{
+                        --bnode->parent->counts[bnode->pidx];
+                }
+        }
+}
+
+static void
+split_root(piojo_btree_t *tree)
+{
+        bnode_t *newroot;
+        PIOJO_ASSERT(tree->root->ecnt == tree->cmax - 1);
+
+        newroot = alloc_bnode(tree);
+        newroot->leaf_p = FALSE;
+        move_child(tree->root, 0, newroot);
+        newroot->counts[0] = subtree_count(tree->root, tree);
+
+        split_bnode(tree, 0, tree->root, newroot);
 
         tree->root = newroot;
 }
@@ -654,13 +1573,26 @@ split_bnode(piojo_btree_t *tree, size_t pidx, bnode_t *bnode,
 {
         size_t i, j, mid = bnode->ecnt / 2;
         bnode_t *rbnode;
+        bool plus_p = plus_leaf_p(bnode, tree);
         PIOJO_ASSERT(parent->ecnt < tree->cmax - 1);
 
-        /* Copy children/entries greater than median to right bnode. */
+        /*
+         * Copy children/entries greater than median to right bnode,
+         * B+ leaves keep the median and only a copy of its key moves up.
+         */
         rbnode = alloc_bnode(tree);
-        for (i = mid + 1; i < bnode->ecnt; ++i, ++rbnode->ecnt){
+        for (i = (plus_p ? mid : mid + 1); i < bnode->ecnt;
+             ++i, ++rbnode->ecnt){
                 copy_bentry(i, bnode, rbnode->ecnt, rbnode, tree);
         }
+        if (plus_p){
+                rbnode->next = bnode->next;
+                rbnode->prev = bnode;
+                if (bnode->next != NULL){
+                        bnode->next->prev = rbnode;
+                }
+                bnode->next = rbnode;
+        }
         if (! bnode->leaf_p){
                 for (j = 0, i = mid + 1; i <= bnode->ecnt; ++i, ++j){
                         move_child(bnode->children[i], j, rbnode);
@@ -683,6 +1615,11 @@ split_bnode(piojo_btree_t *tree, size_t pidx, bnode_t *bnode,
         ++parent->ecnt;
 
         bnode->ecnt = mid;
+        parent->counts[pidx + 1] = subtree_count(rbnode, tree);
+        parent->counts[pidx] -= parent->counts[pidx + 1];
+        if (counted_p(parent, tree)){
+                --parent->counts[pidx];
+        }
 }
 
 static void
@@ -691,9 +1628,21 @@ merge_bnodes(piojo_btree_t *tree, size_t pidx, bnode_t *lbnode,
 {
         size_t i, ccnt = lbnode->ecnt + 1;
 
-        /* Append parent entry to left bnode. */
-        copy_bentry(pidx, parent, lbnode->ecnt, lbnode, tree);
-        ++lbnode->ecnt;
+        parent->counts[pidx] += parent->counts[pidx + 1];
+        if (counted_p(parent, tree)){
+                ++parent->counts[pidx];
+        }
+
+        /* Append parent entry to left bnode (just drop it in B+ leaves). */
+        if (plus_leaf_p(lbnode, tree)){
+                lbnode->next = rbnode->next;
+                if (rbnode->next != NULL){
+                        rbnode->next->prev = lbnode;
+                }
+        }else{
+                copy_bentry(pidx, parent, lbnode->ecnt, lbnode, tree);
+                ++lbnode->ecnt;
+        }
 
         /* Append right bnode to left bnode. */
         for (i = 0; i < rbnode->ecnt; ++i, ++lbnode->ecnt){
@@ -719,6 +1668,7 @@ merge_bnodes(piojo_btree_t *tree, size_t pidx, bnode_t *lbnode,
         if (tree->root == parent && parent->ecnt == 0){
                 free_bnode(tree->root, tree);
                 tree->root = lbnode;
+                lbnode->parent = NULL;
         }
 
         /* Free right bnode. */
@@ -730,7 +1680,26 @@ rotate_left(size_t pidx, bnode_t *lbnode,
             bnode_t *rbnode, bnode_t *parent,
             const piojo_btree_t *tree)
 {
-        size_t i;
+        size_t i, moved = (counted_p(lbnode, tree) ? 1 : 0);
+
+        if (! lbnode->leaf_p){
+                moved += rbnode->counts[0];
+        }
+        parent->counts[pidx] += moved;
+        parent->counts[pidx + 1] -= moved;
+
+        /* B+ leaves move the entry and its key becomes the separator. */
+        if (plus_leaf_p(lbnode, tree)){
+                copy_bentry(0, rbnode, lbnode->ecnt, lbnode, tree);
+                ++lbnode->ecnt;
+                --rbnode->ecnt;
+                for (i = 0; i < rbnode->ecnt; ++i){
+                        copy_bentry(i + 1, rbnode, i, rbnode, tree);
+                }
+                piojo_key_copy(entry_key(pidx, parent, tree),
+                               entry_key(0, rbnode, tree), tree->eksize);
+                return;
+        }
 
         /* Append parent entry to left bnode. */
         copy_bentry(pidx, parent, lbnode->ecnt, lbnode, tree);
@@ -758,7 +1727,26 @@ rotate_right(size_t pidx, bnode_t *lbnode,
              bnode_t *rbnode, bnode_t *parent,
              const piojo_btree_t *tree)
 {
-        size_t i;
+        size_t i, moved = (counted_p(rbnode, tree) ? 1 : 0);
+
+        if (! rbnode->leaf_p){
+                moved += lbnode->counts[lbnode->ecnt];
+        }
+        parent->counts[pidx] -= moved;
+        parent->counts[pidx + 1] += moved;
+
+        /* B+ leaves move the entry and its key becomes the separator. */
+        if (plus_leaf_p(rbnode, tree)){
+                for (i = rbnode->ecnt; i > 0; --i){
+                        copy_bentry(i - 1, rbnode, i, rbnode, tree);
+                }
+                copy_bentry(lbnode->ecnt - 1, lbnode, 0, rbnode, tree);
+                ++rbnode->ecnt;
+                --lbnode->ecnt;
+                piojo_key_copy(entry_key(pidx, parent, tree),
+                               entry_key(0, rbnode, tree), tree->eksize);
+                return;
+        }
 
         /* Prepend parent entry to right bnode. */
         for (i = rbnode->ecnt; i > 0; --i){
@@ -782,24 +1770,24 @@ rotate_right(size_t pidx, bnode_t *lbnode,
 }
 
 static void
-copy_bentry(uint8_t eidx, const bnode_t *bnode, uint8_t toidx,
+copy_bentry(size_t eidx, const bnode_t *bnode, size_t toidx,
             const bnode_t *to, const piojo_btree_t *tree)
 {
-        memcpy(&to->keys[toidx * tree->eksize],
-               &bnode->keys[eidx * tree->eksize], tree->eksize);
+        piojo_key_copy(&to->keys[toidx * tree->eksize],
+                       &bnode->keys[eidx * tree->eksize], tree->eksize);
 
         to->kvs[toidx].value = bnode->kvs[eidx].value;
 }
 
 static void*
-entry_key(uint8_t eidx, const bnode_t *bnode,
+entry_key(size_t eidx, const bnode_t *bnode,
           const piojo_btree_t *tree)
 {
         return &bnode->keys[eidx * tree->eksize];
 }
 
 static void*
-entry_val(uint8_t eidx, const bnode_t *bnode,
+entry_val(size_t eidx, const bnode_t *bnode,
           const piojo_btree_t *tree)
 {
         PIOJO_UNUSED(tree);
@@ -807,7 +1795,7 @@ entry_val(uint8_t eidx, const bnode_t *bnode,
 }
 
 static void
-init_entry(const void *key, const void *data, uint8_t eidx,
+init_entry(const void *key, const void *data, size_t eidx,
            const bnode_t *bnode, const piojo_btree_t *tree)
 {
         bool null_p = TRUE;
@@ -817,7 +1805,7 @@ init_entry(const void *key, const void *data, uint8_t eidx,
                 data = &null_p;
         }
 
-        memcpy(entry_key(eidx, bnode, tree), key, tree->eksize);
+        piojo_key_copy(entry_key(eidx, bnode, tree), key, tree->eksize);
 
         bnode->kvs[eidx].value = ator.alloc_cb(tree->evsize);
         PIOJO_ASSERT(bnode->kvs[eidx].value);
@@ -842,7 +1830,17 @@ search_node(const void *key, const piojo_btree_t *tree)
         iter_t iter;
         bnode_t *bnode = tree->root;
 
+        iter.tree = tree;
         iter.bnode = NULL;
+        if (tree->mode == PIOJO_BTREE_MODE_PLUS){
+                bnode = search_leaf(key, tree);
+                idx = bin_search(key, tree, bnode, &found_p);
+                if (found_p){
+                        iter.bnode = bnode;
+                        iter.eidx = idx;
+                }
+                return iter;
+        }
         while (bnode->ecnt > 0){
                 idx = bin_search(key, tree, bnode, &found_p);
                 if (found_p){
@@ -857,7 +1855,298 @@ search_node(const void *key, const piojo_btree_t *tree)
         return iter;
 }
 
-/* Similar to search_node() but split bnodes before traversing them. */
+static iter_t
+search_lower(const void *key, const piojo_btree_t *tree)
+{
+        bool found_p;
+        size_t idx;
+        iter_t iter;
+        bnode_t *bnode = tree->root;
+
+        iter.tree = tree;
+        iter.bnode = NULL;
+        iter.eidx = 0;
+        if (tree->mode == PIOJO_BTREE_MODE_PLUS){
+                bnode = search_leaf(key, tree);
+                idx = bin_search(key, tree, bnode, &found_p);
+                if (idx < bnode->ecnt){
+                        iter.bnode = bnode;
+                        iter.eidx = idx;
+                }else if (tree->snapshot_p){
+                        iter = search_adjacent(key, TRUE, tree);
+                }else if (bnode->next != NULL){
+                        iter.bnode = bnode->next;
+                        iter.eidx = 0;
+                }
+                return iter;
+        }
+        while (bnode->ecnt > 0){
+                idx = bin_search(key, tree, bnode, &found_p);
+                if (idx < bnode->ecnt){
+                        iter.bnode = bnode;
+                        iter.eidx = idx;
+                }
+                if (found_p || bnode->leaf_p){
+                        break;
+                }
+                bnode = bnode->children[idx];
+        }
+        return iter;
+}
+
+/*
+ * Returns the first key greater than key (last key less than key if not
+ * next_p), searched from the root. Snapshots can't follow parent or leaf
+ * links, they only describe the writable tree.
+ */
+static iter_t
+search_adjacent(const void *key, bool next_p, const piojo_btree_t *tree)
+{
+        bool found_p;
+        size_t idx;
+        iter_t iter, sub;
+        bnode_t *bnode = tree->root;
+        bool plus_p = (tree->mode == PIOJO_BTREE_MODE_PLUS);
+
+        iter.tree = sub.tree = tree;
+        iter.bnode = sub.bnode = NULL;
+        while (bnode->ecnt > 0){
+                idx = bin_search(key, tree, bnode, &found_p);
+                if (next_p && found_p){
+                        ++idx;
+                }
+                if (plus_p && ! bnode->leaf_p){
+                        /* Only leaves hold entries, keep the next subtree. */
+                        if (! next_p && found_p){
+                                ++idx;
+                        }
+                        if (next_p ? idx < bnode->ecnt : idx > 0){
+                                sub.bnode = bnode;
+                                sub.eidx = (next_p ? idx + 1 : idx - 1);
+                        }
+                }else if (next_p ? idx < bnode->ecnt : idx > 0){
+                        iter.bnode = bnode;
+                        iter.eidx = (next_p ? idx : idx - 1);
+                }
+                if (bnode->leaf_p){
+                        break;
+                }
+                bnode = bnode->children[idx];
+        }
+        if (plus_p && iter.bnode == NULL && sub.bnode != NULL){
+                if (next_p){
+                        search_min(&sub);
+                }else{
+                        search_max(&sub);
+                }
+                return sub;
+        }
+        return iter;
+}
+
+/* Moves a snapshot iterator to the next (or previous) key. */
+static bool
+step_snapshot(iter_t *iter, bool next_p)
+{
+        iter_t adj;
+
+        adj = search_adjacent(entry_key(iter->eidx, iter->bnode, iter->tree),
+                              next_p, iter->tree);
+        if (adj.bnode == NULL){
+                return FALSE;
+        }
+        *iter = adj;
+        return TRUE;
+}
+
+/* Returns the B+ leaf where key is or would be. */
+static bnode_t*
+search_leaf(const void *key, const piojo_btree_t *tree)
+{
+        bool found_p;
+        size_t idx;
+        bnode_t *bnode = tree->root;
+
+        while (! bnode->leaf_p){
+                /* Keys equal to a separator are in its right subtree. */
+                idx = bin_search(key, tree, bnode, &found_p);
+                bnode = bnode->children[found_p ? idx + 1 : idx];
+        }
+        return bnode;
+}
+
+/* Returns the number of keys less than key, found_p if key exists. */
+static size_t
+rank_key(const void *key, const piojo_btree_t *tree, bool *found_p)
+{
+        size_t idx, rank = 0;
+        bnode_t *bnode = tree->root;
+        bool plus_p = (tree->mode == PIOJO_BTREE_MODE_PLUS);
+
+        while (! bnode->leaf_p){
+                idx = bin_search(key, tree, bnode, found_p);
+                if (*found_p && plus_p){
+                        /* Separator key, the entry is in the right leaf. */
+                        ++idx;
+                }else if (*found_p){
+                        return rank + idx + sum_counts(bnode, idx + 1);
+                }
+                rank += sum_counts(bnode, idx) + (plus_p ? 0 : idx);
+                bnode = bnode->children[idx];
+        }
+        return rank + bin_search(key, tree, bnode, found_p);
+}
+
+/* Returns the entry of rank idx, children are skipped by their counts. */
+static iter_t
+select_node(size_t idx, const piojo_btree_t *tree)
+{
+        size_t i;
+        iter_t iter;
+        bnode_t *bnode;
+        bool plus_p = (tree->mode == PIOJO_BTREE_MODE_PLUS);
+
+        iter.tree = tree;
+        iter.bnode = tree->root;
+        while (! iter.bnode->leaf_p){
+                bnode = iter.bnode;
+                for (i = 0; idx >= bnode->counts[i]; ++i){
+                        idx -= bnode->counts[i];
+                        if (! plus_p && idx-- == 0){
+                                iter.eidx = i;
+                                return iter;
+                        }
+                }
+                iter.bnode = bnode->children[i];
+        }
+        iter.eidx = idx;
+        return iter;
+}
+
+static bool
+next_entry(iter_t *iter)
+{
+        if (iter->tree->snapshot_p){
+                return step_snapshot(iter, TRUE);
+        }
+        if (iter->tree->mode == PIOJO_BTREE_MODE_PLUS){
+                if (iter->eidx + 1 < iter->bnode->ecnt){
+                        ++iter->eidx;
+                        return TRUE;
+                }else if (iter->bnode->next != NULL){
+                        iter->bnode = iter->bnode->next;
+                        iter->eidx = 0;
+                        return TRUE;
+                }
+                return FALSE;
+        }
+        if (! iter->bnode->leaf_p && iter->eidx < iter->bnode->ecnt){
+                iter->bnode = iter->bnode->children[iter->eidx + 1];
+                iter->eidx = 0;
+                search_min(iter);
+                return TRUE;
+        }else if (iter->eidx + 1 < iter->bnode->ecnt){
+                ++iter->eidx;
+                return TRUE;
+        }
+        while (iter->bnode->parent != NULL){
+                iter->eidx = iter->bnode->pidx;
+                iter->bnode = iter->bnode->parent;
+                if (iter->eidx < iter->bnode->ecnt){
+                        return TRUE;
+                }
+        }
+        return FALSE;
+}
+
+/*
+ * Visits B+ leaves from iter up to hi, only the last leaf is searched for
+ * hi, the next leaf is prefetched while visiting the current one.
+ */
+static size_t
+range_leaves(iter_t *iter, const void *hi, piojo_btree_visit_cb cb,
+             void *state)
+{
+        bool found_p;
+        size_t end, cnt = 0, i = iter->eidx;
+        const piojo_btree_t *tree = iter->tree;
+        bnode_t *bnode = iter->bnode;
+
+        while (bnode != NULL){
+                PIOJO_PREFETCH(bnode->next);
+                end = bnode->ecnt;
+                if (key_cmp(entry_key(end - 1, bnode, tree), hi, tree) > 0){
+                        end = bin_search(hi, tree, bnode, &found_p);
+                        end += (found_p ? 1 : 0);
+                }
+                for (; i < end; ++i){
+                        ++cnt;
+                        if (! cb(entry_key(i, bnode, tree),
+                                 entry_val(i, bnode, tree), state)){
+                                return cnt;
+                        }
+                }
+                if (end < bnode->ecnt){
+                        break;
+                }
+                bnode = bnode->next;
+                i = 0;
+        }
+        return cnt;
+}
+
+static bool
+prev_entry(iter_t *iter)
+{
+        if (iter->tree->snapshot_p){
+                return step_snapshot(iter, FALSE);
+        }
+        if (iter->tree->mode == PIOJO_BTREE_MODE_PLUS){
+                if (iter->eidx > 0){
+                        --iter->eidx;
+                        return TRUE;
+                }else if (iter->bnode->prev != NULL){
+                        iter->bnode = iter->bnode->prev;
+                        iter->eidx = iter->bnode->ecnt - 1;
+                        return TRUE;
+                }
+                return FALSE;
+        }
+        if (! iter->bnode->leaf_p && iter->eidx < iter->bnode->ecnt + 1){
+                iter->bnode = iter->bnode->children[iter->eidx];
+                iter->eidx = iter->bnode->ecnt;
+                search_max(iter);
+                return TRUE;
+        }else if (iter->eidx > 0){
+                --iter->eidx;
+                return TRUE;
+        }
+        while (iter->bnode->parent != NULL){
+                iter->eidx = iter->bnode->pidx;
+                iter->bnode = iter->bnode->parent;
+                if (iter->eidx > 0){
+                        --iter->eidx;
+                        return TRUE;
+                }
+        }
+        return FALSE;
+}
+
+static const void*
+cursor_key(const iter_t *iter, piojo_btree_cursor_t *cursor)
+{
+        cursor->bnode = iter->bnode;
+        if (iter->bnode == NULL){
+                return NULL;
+        }
+        cursor->eidx = iter->eidx;
+        return entry_key(iter->eidx, iter->bnode, iter->tree);
+}
+
+/*
+ * Similar to search_node() but split bnodes before traversing them,
+ * bnodes on the path are owned first.
+ */
 static iter_t
 insert_node(const void *key, const void *data, piojo_btree_t *tree)
 {
@@ -866,25 +2155,33 @@ insert_node(const void *key, const void *data, piojo_btree_t *tree)
         size_t idx=0, j;
         iter_t iter;
         bnode_t *bnode;
+        bool plus_p = (tree->mode == PIOJO_BTREE_MODE_PLUS);
 
-        if (tree->root->ecnt == tree->cmax - 1){
+        if (own_bnode(tree->root, tree)->ecnt == tree->cmax - 1){
                 split_root(tree);
         }
         bnode = tree->root;
         iter.bnode = NULL;
         while (bnode->ecnt > 0){
                 idx = bin_search(key, tree, bnode, &found_p);
-                if (found_p){
+                if (found_p && plus_p && ! bnode->leaf_p){
+                        /* Separator key, the entry is in the right leaf. */
+                        ++idx;
+                }else if (found_p){
                         iter.bnode = bnode;
                         iter.eidx = idx;
                         return iter;
                 }else if (bnode->leaf_p){
                         break;
                 }
-                if (bnode->children[idx]->ecnt == tree->cmax - 1){
+                if (own_bnode(bnode->children[idx], tree)->ecnt ==
+                    tree->cmax - 1){
                         split_bnode(tree, idx, bnode->children[idx], bnode);
-                        cmpval = tree->cmp_cb(key, entry_key(idx, bnode, tree));
-                        if (cmpval == 0){
+                        cmpval = key_cmp(key, entry_key(idx, bnode, tree),
+                                         tree);
+                        if (cmpval == 0 && plus_p){
+                                ++idx;
+                        }else if (cmpval == 0){
                                 iter.bnode = bnode;
                                 iter.eidx = idx;
                                 return iter;
@@ -902,6 +2199,7 @@ insert_node(const void *key, const void *data, piojo_btree_t *tree)
 
         init_entry(key, data, idx, bnode, tree);
         ++bnode->ecnt;
+        adjust_counts(bnode, TRUE);
 
         return iter;
 }
@@ -914,6 +2212,10 @@ delete_node(const void *key, bnode_t *bnode, piojo_btree_t *tree)
         bnode_t *next;
         iter_t iter;
 
+        if (tree->mode == PIOJO_BTREE_MODE_PLUS){
+                return delete_leaf_node(key, tree);
+        }
+        bnode = own_bnode(bnode, tree);
         while (bnode != NULL){
                 i = bin_search(key, tree, bnode, &found_p);
                 if (found_p){
@@ -924,12 +2226,14 @@ delete_node(const void *key, bnode_t *bnode, piojo_btree_t *tree)
                                 for (; i < bnode->ecnt; ++i){
                                         copy_bentry(i + 1, bnode, i, bnode, tree);
                                 }
+                                adjust_counts(bnode, FALSE);
                                 return TRUE;
                         }
 
                         /* Key in internal node, move prev/next key up and delete it. */
                         iter.bnode = bnode;
                         if (bnode->children[i]->ecnt >= tree->cmin){
+                                own_spine(bnode->children[i], TRUE, tree);
                                 free_entry(&bnode->kvs[i], tree, &deleted_p);
                                 iter.eidx = i;
                                 search_max(&iter);
@@ -937,6 +2241,7 @@ delete_node(const void *key, bnode_t *bnode, piojo_btree_t *tree)
                                 key = entry_key(i, bnode, tree);
                                 bnode = bnode->children[i];
                         }else if (bnode->children[i + 1]->ecnt >= tree->cmin){
+                                own_spine(bnode->children[i + 1], FALSE, tree);
                                 free_entry(&bnode->kvs[i], tree, &deleted_p);
                                 iter.eidx = i + 1;
                                 search_min(&iter);
@@ -947,13 +2252,14 @@ delete_node(const void *key, bnode_t *bnode, piojo_btree_t *tree)
                                 /* Both node children are key deficient, merge and try again. */
                                 PIOJO_ASSERT(bnode->children[i]->ecnt == tree->cmin - 1);
                                 PIOJO_ASSERT(bnode->children[i + 1]->ecnt == tree->cmin - 1);
-                                next = bnode->children[i];
+                                next = own_bnode(bnode->children[i], tree);
+                                own_bnode(bnode->children[i + 1], tree);
                                 merge_bnodes(tree, i, next, bnode->children[i + 1], bnode);
                                 bnode = next;
                         }
                 }else if (! bnode->leaf_p){
                         /* Key not in internal node, rebalance and try again. */
-                        next = bnode->children[i];
+                        next = own_bnode(bnode->children[i], tree);
                         if (next->ecnt < tree->cmin){
                                 PIOJO_ASSERT(next->ecnt == tree->cmin - 1);
                                 next = rebalance_bnode(tree, i, next, bnode);
@@ -967,7 +2273,48 @@ delete_node(const void *key, bnode_t *bnode, piojo_btree_t *tree)
         return FALSE;
 }
 
-/* Returns bnode if it wasn't freed by merge, left sibling otherwise. */
+/*
+ * Deletes from a B+ leaf, nodes on the path are refilled before being
+ * visited, like delete_node(). Separators of deleted keys are kept, they
+ * still split both subtrees correctly.
+ */
+static bool
+delete_leaf_node(const void *key, piojo_btree_t *tree)
+{
+        bool found_p, deleted_p = FALSE;
+        size_t i;
+        bnode_t *next, *bnode = own_bnode(tree->root, tree);
+
+        while (! bnode->leaf_p){
+                i = bin_search(key, tree, bnode, &found_p);
+                if (found_p){
+                        ++i;
+                }
+                next = own_bnode(bnode->children[i], tree);
+                if (next->ecnt < tree->cmin){
+                        PIOJO_ASSERT(next->ecnt == tree->cmin - 1);
+                        next = rebalance_bnode(tree, i, next, bnode);
+                }
+                bnode = next;
+        }
+
+        i = bin_search(key, tree, bnode, &found_p);
+        if (! found_p){
+                return FALSE;
+        }
+        free_entry(&bnode->kvs[i], tree, &deleted_p);
+        --bnode->ecnt;
+        for (; i < bnode->ecnt; ++i){
+                copy_bentry(i + 1, bnode, i, bnode, tree);
+        }
+        adjust_counts(bnode, FALSE);
+        return TRUE;
+}
+
+/*
+ * Returns bnode if it wasn't freed by merge, left sibling otherwise.
+ * Parent and bnode are owned, the sibling used is owned here.
+ */
 static bnode_t*
 rebalance_bnode(piojo_btree_t *tree, size_t pidx, bnode_t *bnode,
                 bnode_t *parent)
@@ -982,16 +2329,20 @@ rebalance_bnode(piojo_btree_t *tree, size_t pidx, bnode_t *bnode,
         if (lsibling != NULL && lsibling->ecnt >= tree->cmin){
                 PIOJO_ASSERT(bnode->ecnt > 0 && bnode->ecnt < tree->cmax - 1);
                 PIOJO_ASSERT(lsibling->ecnt > 1);
+                lsibling = own_bnode(lsibling, tree);
                 rotate_right(pidx - 1, lsibling, bnode, parent, tree);
         }else if (rsibling != NULL && rsibling->ecnt >= tree->cmin){
                 PIOJO_ASSERT(bnode->ecnt > 0 && bnode->ecnt < tree->cmax - 1);
                 PIOJO_ASSERT(rsibling->ecnt > 1);
+                rsibling = own_bnode(rsibling, tree);
                 rotate_left(pidx, bnode, rsibling, parent, tree);
         }else if (lsibling != NULL){
+                lsibling = own_bnode(lsibling, tree);
                 merge_bnodes(tree, pidx - 1, lsibling, bnode, parent);
                 return lsibling;
         }else{
                 PIOJO_ASSERT(rsibling);
+                rsibling = own_bnode(rsibling, tree);
                 merge_bnodes(tree, pidx, bnode, rsibling, parent);
         }
         return bnode;
@@ -1029,33 +2380,250 @@ search_max(iter_t *from)
         }
 }
 
+/*
+ * Defines bin_search_<suffix>(), a binary search comparing keys with
+ * 'cmp', keys are 'ksize' bytes apart.
+ */
+#define DEFINE_BIN_SEARCH(suffix, cmp, ksize)                           \
+        static size_t                                                   \
+        bin_search_##suffix(const void *key, const piojo_btree_t *tree, \
+                            bnode_t *bnode, bool *found_p)              \
+        {                                                               \
+                int cmpval;                                             \
+                size_t mid, imin = 0, imax = bnode->ecnt - 1;           \
+                PIOJO_UNUSED(tree);                                     \
+                                                                        \
+                *found_p = FALSE;                                       \
+                if (bnode->ecnt > 0){                                   \
+                        while (imin <= imax){                           \
+                                mid = imin + ((imax - imin) / 2);       \
+                                cmpval = cmp(key,                       \
+                                             &bnode->keys[mid * ksize]); \
+                                if (cmpval == 0){                       \
+                                        *found_p = TRUE;                \
+                                        imin = mid;                     \
+                                        break;                          \
+                                }else if (cmpval > 0){                  \
+                                        imin = mid + 1;                 \
+                                }else if (imin != mid){                 \
+                                        imax = mid - 1;                 \
+                                }else{                                  \
+                                        break;                          \
+                                }                                       \
+                        }                                               \
+                }                                                       \
+                return imin;                                            \
+        }
+
+#define DEFINE_BIN_SEARCH_KEY(suffix, type)                             \
+        DEFINE_BIN_SEARCH(suffix, piojo_key_cmp_##suffix, sizeof(type))
+
+DEFINE_BIN_SEARCH(cb, tree->cmp_cb, tree->eksize)
+DEFINE_BIN_SEARCH_KEY(siz, size_t)
+
+/*
+ * Defines scan_search_<suffix>(), a branchless binary search that stops
+ * once the range fits in TREE_SCAN_BYTES and counts the remaining keys
+ * with tree->count_less (vectorized when the CPU supports it).
+ */
+#define DEFINE_SCAN_SEARCH(suffix, type)                                \
+        static size_t                                                   \
+        scan_search_##suffix(const void *key, const piojo_btree_t *tree, \
+                             bnode_t *bnode, bool *found_p)             \
+        {                                                               \
+                const size_t span = TREE_SCAN_BYTES / sizeof(type);     \
+                size_t half, base = 0, cnt = bnode->ecnt;               \
+                const uint8_t *keys = bnode->keys;                      \
+                                                                        \
+                while (cnt > span){                                     \
+                        half = cnt / 2;                                 \
+                        base += (piojo_key_cmp_##suffix(                \
+                                         &keys[(base + half) *          \
+                                               sizeof(type)],           \
+                                         key) < 0) ? half : 0;          \
+                        cnt -= half;                                    \
+                }                                                       \
+                base += tree->count_less(key, &keys[base * sizeof(type)], \
+                                         cnt);                          \
+                *found_p = (base < bnode->ecnt &&                       \
+                            piojo_key_eq_##suffix(                      \
+                                    &keys[base * sizeof(type)], key));  \
+                return base;                                            \
+        }
+
+DEFINE_SCAN_SEARCH(i32, int32_t)
+DEFINE_SCAN_SEARCH(i64, int64_t)
+
 static size_t
 bin_search(const void *key, const piojo_btree_t *tree,
            bnode_t *bnode, bool *found_p)
 {
-        int cmpval;
-        size_t mid, imin = 0, imax = bnode->ecnt - 1;
+        switch (tree->keytype){
+        case PIOJO_KEY_I32:
+                return scan_search_i32(key, tree, bnode, found_p);
+        case PIOJO_KEY_I64:
+                return scan_search_i64(key, tree, bnode, found_p);
+        case PIOJO_KEY_SIZ:
+                return bin_search_siz(key, tree, bnode, found_p);
+        default:
+                return bin_search_cb(key, tree, bnode, found_p);
+        }
+}
 
-        *found_p = FALSE;
-        if (bnode->ecnt > 0){
-                while (imin <= imax){
-                        mid = imin + ((imax - imin) / 2);
-                        cmpval = tree->cmp_cb(key, entry_key(mid, bnode, tree));
-                        if (cmpval == 0){
-                                *found_p = TRUE;
-                                imin = mid;
-                                break;
-                        }else if (cmpval > 0){
-                                imin = mid + 1;
-                        }else if (imin != mid){
-                                imax = mid - 1;
-                        }else{
-                                break;
-                        }
-                }
+static int
+key_cmp(const void *k1, const void *k2, const piojo_btree_t *tree)
+{
+        switch (tree->keytype){
+        case PIOJO_KEY_I32:
+                return piojo_key_cmp_i32(k1, k2);
+        case PIOJO_KEY_I64:
+                return piojo_key_cmp_i64(k1, k2);
+        case PIOJO_KEY_SIZ:
+                return piojo_key_cmp_siz(k1, k2);
+        default:
+                return tree->cmp_cb(k1, k2);
+        }
+}
+
+/* Keys of the *_i32k/i64k/sizk allocators are compared inline. */
+static piojo_keytype_t
+key_type(piojo_cmp_cb keycmp)
+{
+        if (keycmp == i32_cmp){
+                return PIOJO_KEY_I32;
+        }else if (keycmp == i64_cmp){
+                return PIOJO_KEY_I64;
+        }else if (keycmp == siz_cmp){
+                return PIOJO_KEY_SIZ;
+        }
+        return PIOJO_KEY_CB;
+}
+
+static size_t
+default_children(size_t eksize)
+{
+        size_t cnt = TREE_KEYS_BYTES / eksize;
+
+        /* Key array holds maxchildren - 1 entries. */
+        cnt -= cnt % 2;
+        if (cnt < 8){
+                cnt = 8;
+        }else if (cnt > TREE_CHILDREN_MAX){
+                cnt = TREE_CHILDREN_MAX;
+        }
+        return cnt;
+}
+
+/* Picks the widest count_less_<type> the running CPU supports. */
+static count_less_cb
+count_less_fn(piojo_keytype_t keytype)
+{
+        bool i32_p = (keytype == PIOJO_KEY_I32);
+
+        if (keytype != PIOJO_KEY_I32 && keytype != PIOJO_KEY_I64){
+                return NULL;
+        }
+#if PIOJO_BTREE_SIMD
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2")){
+                return i32_p ? count_less_i32_avx2 : count_less_i64_avx2;
+        }else if (__builtin_cpu_supports("sse4.2")){
+                return i32_p ? count_less_i32_sse : count_less_i64_sse;
+        }
+#endif
+        return i32_p ? count_less_i32 : count_less_i64;
+}
+
+/*
+ * Defines count_less_<suffix>(), the portable fallback, the sum of
+ * comparisons has no branches to mispredict.
+ */
+#define DEFINE_COUNT_LESS(suffix, type)                                 \
+        static size_t                                                   \
+        count_less_##suffix(const void *key, const uint8_t *keys,       \
+                            size_t cnt)                                 \
+        {                                                               \
+                size_t i, less = 0;                                     \
+                for (i = 0; i < cnt; ++i){                              \
+                        less += (piojo_key_cmp_##suffix(                \
+                                         &keys[i * sizeof(type)],       \
+                                         key) < 0);                     \
+                }                                                       \
+                return less;                                            \
+        }
+
+DEFINE_COUNT_LESS(i32, int32_t)
+DEFINE_COUNT_LESS(i64, int64_t)
+
+#if PIOJO_BTREE_SIMD
+/*
+ * Vector versions compare a broadcast key against packed keys and count
+ * the mask bits of keys less than it, the tail uses the fallback.
+ */
+__attribute__((target("sse4.2,popcnt")))
+static size_t
+count_less_i32_sse(const void *key, const uint8_t *keys, size_t cnt)
+{
+        size_t i, less = 0;
+        __m128i k = _mm_set1_epi32(piojo_key_load_i32(key)), v;
+
+        for (i = 0; i + 4 <= cnt; i += 4){
+                v = _mm_loadu_si128((const __m128i*) &keys[i * 4]);
+                v = _mm_cmpgt_epi32(k, v);
+                less += __builtin_popcount(
+                        _mm_movemask_ps(_mm_castsi128_ps(v)));
+        }
+        return less + count_less_i32(key, &keys[i * 4], cnt - i);
+}
+
+__attribute__((target("sse4.2,popcnt")))
+static size_t
+count_less_i64_sse(const void *key, const uint8_t *keys, size_t cnt)
+{
+        size_t i, less = 0;
+        __m128i k = _mm_set1_epi64x(piojo_key_load_i64(key)), v;
+
+        for (i = 0; i + 2 <= cnt; i += 2){
+                v = _mm_loadu_si128((const __m128i*) &keys[i * 8]);
+                v = _mm_cmpgt_epi64(k, v);
+                less += __builtin_popcount(
+                        _mm_movemask_pd(_mm_castsi128_pd(v)));
+        }
+        return less + count_less_i64(key, &keys[i * 8], cnt - i);
+}
+
+__attribute__((target("avx2,popcnt")))
+static size_t
+count_less_i32_avx2(const void *key, const uint8_t *keys, size_t cnt)
+{
+        size_t i, less = 0;
+        __m256i k = _mm256_set1_epi32(piojo_key_load_i32(key)), v;
+
+        for (i = 0; i + 8 <= cnt; i += 8){
+                v = _mm256_loadu_si256((const __m256i*) &keys[i * 4]);
+                v = _mm256_cmpgt_epi32(k, v);
+                less += __builtin_popcount(
+                        _mm256_movemask_ps(_mm256_castsi256_ps(v)));
+        }
+        return less + count_less_i32(key, &keys[i * 4], cnt - i);
+}
+
+__attribute__((target("avx2,popcnt")))
+static size_t
+count_less_i64_avx2(const void *key, const uint8_t *keys, size_t cnt)
+{
+        size_t i, less = 0;
+        __m256i k = _mm256_set1_epi64x(piojo_key_load_i64(key)), v;
+
+        for (i = 0; i + 4 <= cnt; i += 4){
+                v = _mm256_loadu_si256((const __m256i*) &keys[i * 8]);
+                v = _mm256_cmpgt_epi64(k, v);
+                less += __builtin_popcount(
+                        _mm256_movemask_pd(_mm256_castsi256_pd(v)));
         }
-        return imin;
+        return less + count_less_i64(key, &keys[i * 8], cnt - i);
 }
+#endif
 
 /*
  * Private compare functions.
@@ -0,0 +1,1027 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2013 G. Elian Gidoni
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+
+/**
+ * @file
+ * @addtogroup piojocbtree Piojo Concurrent B-tree
+ * @{
+ * Piojo Concurrent B-tree implementation.
+ * Nodes are guarded by version counters (optimistic lock coupling):
+ * searches take no lock and don't write shared memory, they validate
+ * each node version after reading it and restart when it changed.
+ * Writers lock the leaf they modify, and a full node together with its
+ * parent while splitting it.
+ * Entries are kept in leaves and nodes are never merged, so a node read
+ * by a search stays allocated until the tree is cleared or freed.
+ * Leaves aren't linked, ordered reads walk down again from the closest
+ * separator on the right of an exhausted leaf.
+ * All functions are thread-safe except alloc/free/clear.
+ */
+
+#define _POSIX_C_SOURCE 200112L
+
+#include <sched.h>
+#include <piojo/piojo_cbtree.h>
+#include <piojo_defs.h>
+
+typedef struct bnode_t bnode_t;
+struct bnode_t {
+        /* Odd while write locked, incremented again on unlock. */
+        uint64_t version;
+        size_t ecnt;
+        bool leaf_p;
+        uint8_t *keys, *values;
+        bnode_t **children;
+};
+
+/*
+ * Node reached by a search, with the versions read on the way down.
+ * Right is the lowest node with a subtree right of the path, ridx the
+ * separator before that subtree.
+ */
+typedef struct {
+        bnode_t *bnode, *parent, *right;
+        uint64_t version, pversion, rversion;
+        size_t ridx;
+} path_t;
+
+#define CACHE_LINE_SIZE 64
+/* Keys up to this size are copied on the stack by next(). */
+#define KEY_STACK_SIZE 64
+
+struct piojo_cbtree_t {
+        bnode_t *root;
+        size_t eksize, evsize, kmax;
+        piojo_cmp_cb cmp_cb;
+        piojo_keytype_t keytype;
+        piojo_alloc_if allocator;
+        /* Keeps the root pointer away from the written counter. */
+        uint8_t pad[CACHE_LINE_SIZE];
+        size_t ecount;
+};
+/** @hideinitializer Size of concurrent tree in bytes */
+const size_t piojo_cbtree_sizeof = sizeof(piojo_cbtree_t);
+
+/* Smallest node fanout. */
+static const size_t TREE_CHILDREN_MIN = 4;
+/* Default fanout fills this many bytes of key array per node. */
+static const size_t TREE_KEYS_BYTES = 16 * 64;
+/* Lock waits give up the CPU after this many spins. */
+static const size_t SPINS_PER_YIELD = 64;
+
+static bnode_t*
+alloc_bnode(bool leaf_p, const piojo_cbtree_t *tree);
+
+static void
+clear_bnode(bnode_t *bnode, const piojo_cbtree_t *tree);
+
+static bool
+full_p(const bnode_t *bnode, const piojo_cbtree_t *tree);
+
+static void
+prefetch_keys(const bnode_t *bnode, const piojo_cbtree_t *tree);
+
+static void
+backoff(size_t *spins);
+
+static uint64_t
+read_lock(const bnode_t *bnode);
+
+static bool
+valid_p(const bnode_t *bnode, uint64_t version);
+
+static bool
+upgrade_p(bnode_t *bnode, uint64_t version);
+
+static void
+write_unlock(bnode_t *bnode);
+
+static bool
+find_leaf(const void *key, bool split_p, piojo_cbtree_t *tree,
+          path_t *path);
+
+static bool
+seek_entry(const void *key, bool from_p, void *nextkey, void *data,
+           bool *found_p, const piojo_cbtree_t *tree);
+
+static void
+split_path(const path_t *path, piojo_cbtree_t *tree);
+
+static void
+split_bnode(bnode_t *bnode, bnode_t *parent, piojo_cbtree_t *tree);
+
+static void
+insert_child(const void *key, bnode_t *child, bnode_t *parent,
+             const piojo_cbtree_t *tree);
+
+static bool
+write_entry(const void *key, const void *data, bool replace_p,
+            piojo_cbtree_t *tree);
+
+static void
+insert_entry(const void *key, const void *data, size_t idx,
+             bnode_t *leaf, const piojo_cbtree_t *tree);
+
+static void
+delete_entry(size_t idx, bnode_t *leaf, const piojo_cbtree_t *tree);
+
+static uint8_t*
+entry_key(size_t eidx, const bnode_t *bnode, const piojo_cbtree_t *tree);
+
+static uint8_t*
+entry_val(size_t eidx, const bnode_t *bnode, const piojo_cbtree_t *tree);
+
+static size_t
+lower_bound(const void *key, const bnode_t *bnode, size_t cnt,
+            const piojo_cbtree_t *tree);
+
+static bool
+key_eq_p(const void *key, size_t eidx, const bnode_t *bnode,
+         const piojo_cbtree_t *tree);
+
+static size_t
+child_index(const void *key, const bnode_t *bnode,
+            const piojo_cbtree_t *tree);
+
+static piojo_keytype_t
+key_type(piojo_cmp_cb keycmp);
+
+static int
+i32_cmp(const void *e1, const void *e2);
+
+static int
+i64_cmp(const void *e1, const void *e2);
+
+static int
+siz_cmp(const void *e1, const void *e2);
+
+/**
+ * Allocates a new concurrent tree.
+ * Uses default allocator, default fanout and key size of @b int32_t.
+ * @param[in] evsize Entry value size in bytes.
+ * @return New concurrent tree.
+ */
+piojo_cbtree_t*
+piojo_cbtree_alloc_i32k(size_t evsize)
+{
+        return piojo_cbtree_alloc_cb_i32k(0, evsize, piojo_alloc_default);
+}
+
+/**
+ * Allocates a new concurrent tree.
+ * Uses default allocator, default fanout and key size of @b int64_t.
+ * @param[in] evsize Entry value size in bytes.
+ * @return New concurrent tree.
+ */
+piojo_cbtree_t*
+piojo_cbtree_alloc_i64k(size_t evsize)
+{
+        return piojo_cbtree_alloc_cb_i64k(0, evsize, piojo_alloc_default);
+}
+
+/**
+ * Allocates a new concurrent tree.
+ * Uses default allocator, default fanout and key size of @b size_t.
+ * @param[in] evsize Entry value size in bytes.
+ * @return New concurrent tree.
+ */
+piojo_cbtree_t*
+piojo_cbtree_alloc_sizk(size_t evsize)
+{
+        return piojo_cbtree_alloc_cb_sizk(0, evsize, piojo_alloc_default);
+}
+
+/**
+ * Allocates a new concurrent tree.
+ * Uses key size of @b int32_t.
+ * @param[in] maxchildren Maximum children in each node (at least 4), or
+ *            @b 0 to size node keys to whole cache lines.
+ * @param[in] evsize Entry value size in bytes.
+ * @param[in] allocator Allocator to be used.
+ * @return New concurrent tree.
+ */
+piojo_cbtree_t*
+piojo_cbtree_alloc_cb_i32k(size_t maxchildren, size_t evsize,
+                           piojo_alloc_if allocator)
+{
+        return piojo_cbtree_alloc_cb_cmp(maxchildren, evsize, i32_cmp,
+                                         sizeof(int32_t), allocator);
+}
+
+/**
+ * Allocates a new concurrent tree.
+ * Uses key size of @b int64_t.
+ * @param[in] maxchildren Maximum children in each node (at least 4), or
+ *            @b 0 to size node keys to whole cache lines.
+ * @param[in] evsize Entry value size in bytes.
+ * @param[in] allocator Allocator to be used.
+ * @return New concurrent tree.
+ */
+piojo_cbtree_t*
+piojo_cbtree_alloc_cb_i64k(size_t maxchildren, size_t evsize,
+                           piojo_alloc_if allocator)
+{
+        return piojo_cbtree_alloc_cb_cmp(maxchildren, evsize, i64_cmp,
+                                         sizeof(int64_t), allocator);
+}
+
+/**
+ * Allocates a new concurrent tree.
+ * Uses key size of @b size_t.
+ * @param[in] maxchildren Maximum children in each node (at least 4), or
+ *            @b 0 to size node keys to whole cache lines.
+ * @param[in] evsize Entry value size in bytes.
+ * @param[in] allocator Allocator to be used.
+ * @return New concurrent tree.
+ */
+piojo_cbtree_t*
+piojo_cbtree_alloc_cb_sizk(size_t maxchildren, size_t evsize,
+                           piojo_alloc_if allocator)
+{
+        return piojo_cbtree_alloc_cb_cmp(maxchildren, evsize, siz_cmp,
+                                         sizeof(size_t), allocator);
+}
+
+/**
+ * Allocates a new concurrent tree.
+ * Searches may compare keys that are being written concurrently (the
+ * result is discarded), so keys must be plain values without pointers.
+ * @param[in] maxchildren Maximum children in each node (at least 4), or
+ *            @b 0 to size node keys to whole cache lines.
+ * @param[in] evsize Entry value size in bytes.
+ * @param[in] keycmp Entry key comparison function.
+ * @param[in] eksize Entry key size in bytes.
+ * @param[in] allocator Allocator to be used.
+ * @return New concurrent tree.
+ */
+piojo_cbtree_t*
+piojo_cbtree_alloc_cb_cmp(size_t maxchildren, size_t evsize,
+                          piojo_cmp_cb keycmp, size_t eksize,
+                          piojo_alloc_if allocator)
+{
+        piojo_cbtree_t *tree;
+        PIOJO_ASSERT(eksize > 0 && evsize > 0);
+        PIOJO_ASSERT(keycmp);
+
+        if (maxchildren == 0){
+                maxchildren = TREE_KEYS_BYTES / eksize;
+                if (maxchildren < 2 * TREE_CHILDREN_MIN){
+                        maxchildren = 2 * TREE_CHILDREN_MIN;
+                }
+        }
+        PIOJO_ASSERT(maxchildren >= TREE_CHILDREN_MIN);
+        PIOJO_ASSERT(piojo_safe_mulsiz_p(maxchildren, eksize + evsize));
+
+        tree = (piojo_cbtree_t*) allocator.alloc_cb(sizeof(piojo_cbtree_t));
+        PIOJO_ASSERT(tree);
+
+        tree->eksize = eksize;
+        tree->evsize = evsize;
+        tree->kmax = maxchildren - 1;
+        tree->cmp_cb = keycmp;
+        tree->keytype = key_type(keycmp);
+        tree->allocator = allocator;
+        tree->ecount = 0;
+        tree->root = alloc_bnode(TRUE, tree);
+        return tree;
+}
+
+/**
+ * Frees @a tree and all its entries.
+ * Must not be called concurrently with other functions.
+ * @param[in] tree Concurrent tree being freed.
+ */
+void
+piojo_cbtree_free(const piojo_cbtree_t *tree)
+{
+        PIOJO_ASSERT(tree);
+
+        clear_bnode(tree->root, tree);
+        tree->allocator.free_cb(tree);
+}
+
+/**
+ * Deletes all entries in @a tree.
+ * Must not be called concurrently with other functions.
+ * @param[out] tree Concurrent tree being cleared.
+ */
+void
+piojo_cbtree_clear(piojo_cbtree_t *tree)
+{
+        PIOJO_ASSERT(tree);
+
+        clear_bnode(tree->root, tree);
+        tree->root = alloc_bnode(TRUE, tree);
+        tree->ecount = 0;
+}
+
+/**
+ * Returns number of entries.
+ * @param[in] tree Concurrent tree.
+ * @return Number of entries in @a tree.
+ */
+size_t
+piojo_cbtree_size(const piojo_cbtree_t *tree)
+{
+        PIOJO_ASSERT(tree);
+        return PIOJO_ATOMIC_LOAD(&tree->ecount);
+}
+
+/**
+ * Inserts a new entry.
+ * If @a data is @b NULL, the value is replaced with @b TRUE (useful for sets).
+ * @param[in] key Entry key.
+ * @param[in] data Entry value.
+ * @param[out] tree Concurrent tree being modified.
+ * @return @b TRUE if inserted, @b FALSE if @a key is duplicate.
+ */
+bool
+piojo_cbtree_insert(const void *key, const void *data, piojo_cbtree_t *tree)
+{
+        PIOJO_ASSERT(tree);
+        PIOJO_ASSERT(key);
+        PIOJO_ASSERT(data || tree->evsize == sizeof(bool));
+
+        return write_entry(key, data, FALSE, tree);
+}
+
+/**
+ * Replaces or inserts an entry.
+ * If @a data is @b NULL, the value is replaced with @b TRUE (useful for sets).
+ * @param[in] key Entry key.
+ * @param[in] data Entry value.
+ * @param[out] tree Concurrent tree being modified.
+ * @return @b TRUE if @a key is new, @b FALSE otherwise.
+ */
+bool
+piojo_cbtree_set(const void *key, const void *data, piojo_cbtree_t *tree)
+{
+        PIOJO_ASSERT(tree);
+        PIOJO_ASSERT(key);
+        PIOJO_ASSERT(data || tree->evsize == sizeof(bool));
+
+        return write_entry(key, data, TRUE, tree);
+}
+
+/**
+ * Searches an entry by key.
+ * The value is copied because entries may move once the search returns.
+ * @param[in] key Entry key.
+ * @param[out] data Entry value copy, can be @b NULL.
+ * @param[in] tree Concurrent tree.
+ * @return @b TRUE if found, @b FALSE if @a key doesn't exist.
+ */
+bool
+piojo_cbtree_search(const void *key, void *data, const piojo_cbtree_t *tree)
+{
+        path_t path;
+        size_t idx, cnt;
+        bool found_p;
+        PIOJO_ASSERT(tree);
+        PIOJO_ASSERT(key);
+
+        while (TRUE){
+                /* Searches never split, so the tree isn't modified. */
+                if (! find_leaf(key, FALSE, (piojo_cbtree_t*) tree, &path)){
+                        continue;
+                }
+                cnt = PIOJO_ATOMIC_LOAD(&path.bnode->ecnt);
+                idx = lower_bound(key, path.bnode, cnt, tree);
+                found_p = (idx < cnt && key_eq_p(key, idx, path.bnode, tree));
+                if (found_p && data != NULL){
+                        memcpy(data, entry_val(idx, path.bnode, tree),
+                               tree->evsize);
+                }
+                if (valid_p(path.bnode, path.version)){
+                        return found_p;
+                }
+        }
+}
+
+/**
+ * Deletes an entry by key.
+ * Leaves aren't merged, emptied leaves are reused by later insertions.
+ * @param[in] key Entry key.
+ * @param[out] tree Concurrent tree being modified.
+ * @return @b TRUE if deleted, @b FALSE if @a key doesn't exist.
+ */
+bool
+piojo_cbtree_delete(const void *key, piojo_cbtree_t *tree)
+{
+        path_t path;
+        size_t idx;
+        bool found_p;
+        PIOJO_ASSERT(tree);
+        PIOJO_ASSERT(key);
+
+        while (TRUE){
+                if (! find_leaf(key, FALSE, tree, &path) ||
+                    ! upgrade_p(path.bnode, path.version)){
+                        continue;
+                }
+                idx = lower_bound(key, path.bnode, path.bnode->ecnt, tree);
+                found_p = (idx < path.bnode->ecnt &&
+                           key_eq_p(key, idx, path.bnode, tree));
+                if (found_p){
+                        delete_entry(idx, path.bnode, tree);
+                }
+                write_unlock(path.bnode);
+                if (found_p){
+                        PIOJO_ATOMIC_ADD(&tree->ecount, (size_t) -1);
+                }
+                return found_p;
+        }
+}
+
+/**
+ * Reads the first entry in @a tree (order given by @a keycmp function).
+ * @param[out] key First key copy.
+ * @param[out] data Entry value copy, can be @b NULL.
+ * @param[in] tree Concurrent tree.
+ * @return @b TRUE if found, @b FALSE if @a tree is empty.
+ */
+bool
+piojo_cbtree_first(void *key, void *data, const piojo_cbtree_t *tree)
+{
+        bool found_p;
+        PIOJO_ASSERT(tree);
+        PIOJO_ASSERT(key);
+
+        while (! seek_entry(NULL, TRUE, key, data, &found_p, tree)){
+                continue;
+        }
+        return found_p;
+}
+
+/**
+ * Reads the entry following @a key (order given by @a keycmp function).
+ * @a key doesn't need to be in @a tree, so iterations continue past
+ * entries deleted concurrently.
+ * @param[in] key Entry key.
+ * @param[out] nextkey Next key copy, can be @a key.
+ * @param[out] data Entry value copy, can be @b NULL.
+ * @param[in] tree Concurrent tree.
+ * @return @b TRUE if found, @b FALSE if no key follows @a key.
+ */
+bool
+piojo_cbtree_next(const void *key, void *nextkey, void *data,
+                  const piojo_cbtree_t *tree)
+{
+        uint64_t stackkey[KEY_STACK_SIZE / sizeof(uint64_t)];
+        void *keycopy = NULL;
+        bool found_p;
+        PIOJO_ASSERT(tree);
+        PIOJO_ASSERT(key && nextkey);
+
+        /* Walks restart from @a key, which nextkey may overwrite. */
+        if (nextkey == key){
+                keycopy = stackkey;
+                if (tree->eksize > sizeof(stackkey)){
+                        keycopy = tree->allocator.alloc_cb(tree->eksize);
+                        PIOJO_ASSERT(keycopy);
+                }
+                piojo_key_copy(keycopy, key, tree->eksize);
+                key = keycopy;
+        }
+        while (! seek_entry(key, FALSE, nextkey, data, &found_p, tree)){
+                continue;
+        }
+        if (keycopy != NULL && keycopy != (void*) stackkey){
+                tree->allocator.free_cb(keycopy);
+        }
+        return found_p;
+}
+
+/** @}
+ * Private functions.
+ */
+
+/* Internal nodes hold children, leaves hold values, both in one block. */
+static bnode_t*
+alloc_bnode(bool leaf_p, const piojo_cbtree_t *tree)
+{
+        bnode_t *bnode;
+        size_t kmax = tree->kmax, size = sizeof(bnode_t);
+        uint8_t *block;
+
+        if (leaf_p){
+                size += kmax * (tree->eksize + tree->evsize);
+        }else{
+                size += (kmax + 1) * sizeof(bnode_t*) + kmax * tree->eksize;
+        }
+        block = (uint8_t*) tree->allocator.alloc_cb(size);
+        PIOJO_ASSERT(block);
+
+        bnode = (bnode_t*) block;
+        block += sizeof(bnode_t);
+        bnode->version = 0;
+        bnode->ecnt = 0;
+        bnode->leaf_p = leaf_p;
+        bnode->children = NULL;
+        bnode->values = NULL;
+        if (leaf_p){
+                bnode->keys = block;
+                bnode->values = block + kmax * tree->eksize;
+        }else{
+                bnode->children = (bnode_t**) block;
+                bnode->keys = block + (kmax + 1) * sizeof(bnode_t*);
+        }
+        return bnode;
+}
+
+static void
+clear_bnode(bnode_t *bnode, const piojo_cbtree_t *tree)
+{
+        size_t i;
+
+        if (! bnode->leaf_p){
+                for (i = 0; i <= bnode->ecnt; ++i){
+                        clear_bnode(bnode->children[i], tree);
+                }
+        }
+        tree->allocator.free_cb(bnode);
+}
+
+static bool
+full_p(const bnode_t *bnode, const piojo_cbtree_t *tree)
+{
+        return (PIOJO_ATOMIC_LOAD(&bnode->ecnt) == tree->kmax);
+}
+
+/*
+ * Requests every cache line of the key array at once, the binary search
+ * then doesn't wait for one dependent miss per step.
+ */
+static void
+prefetch_keys(const bnode_t *bnode, const piojo_cbtree_t *tree)
+{
+        size_t off, size = PIOJO_ATOMIC_LOAD(&bnode->ecnt) * tree->eksize;
+
+        for (off = 0; off < size; off += CACHE_LINE_SIZE){
+                PIOJO_PREFETCH(&bnode->keys[off]);
+        }
+}
+
+/* Lock holders may be descheduled, so waiters eventually yield. */
+static void
+backoff(size_t *spins)
+{
+        if (++*spins % SPINS_PER_YIELD == 0){
+                sched_yield();
+        }else{
+#if (defined(__GNUC__) || defined(__clang__)) && \
+        (defined(__x86_64__) || defined(__i386__))
+                __builtin_ia32_pause();
+#endif
+        }
+}
+
+/* Waits until @a bnode is unlocked and returns its version. */
+static uint64_t
+read_lock(const bnode_t *bnode)
+{
+        uint64_t version;
+        size_t spins = 0;
+
+        while ((version = PIOJO_ATOMIC_LOAD(&bnode->version)) & 1){
+                backoff(&spins);
+        }
+        return version;
+}
+
+/* Returns @b TRUE if @a bnode didn't change since @a version was read. */
+static bool
+valid_p(const bnode_t *bnode, uint64_t version)
+{
+        PIOJO_ATOMIC_LOAD_FENCE();
+        return (PIOJO_ATOMIC_LOAD(&bnode->version) == version);
+}
+
+/* Write locks @a bnode if it didn't change since @a version was read. */
+static bool
+upgrade_p(bnode_t *bnode, uint64_t version)
+{
+        return PIOJO_ATOMIC_CAS(&bnode->version, &version, version + 1);
+}
+
+static void
+write_unlock(bnode_t *bnode)
+{
+        PIOJO_ATOMIC_STORE(&bnode->version, bnode->version + 1);
+}
+
+/*
+ * Walks down to the leaf covering @a key (the first leaf if @b NULL),
+ * writers (@a split_p) split full internal nodes on the way so a leaf
+ * split always finds room in its parent. Returns @b FALSE if the walk
+ * must be restarted.
+ */
+static bool
+find_leaf(const void *key, bool split_p, piojo_cbtree_t *tree,
+          path_t *path)
+{
+        bnode_t *child;
+        uint64_t cversion;
+        size_t idx;
+
+        path->parent = path->right = NULL;
+        path->bnode = PIOJO_ATOMIC_LOAD(&tree->root);
+        path->version = read_lock(path->bnode);
+        if (path->bnode != PIOJO_ATOMIC_LOAD(&tree->root)){
+                return FALSE;
+        }
+        prefetch_keys(path->bnode, tree);
+        while (! path->bnode->leaf_p){
+                if (split_p && full_p(path->bnode, tree)){
+                        split_path(path, tree);
+                        return FALSE;
+                }
+                idx = (key != NULL) ? child_index(key, path->bnode, tree) : 0;
+                child = PIOJO_ATOMIC_LOAD(&path->bnode->children[idx]);
+                if (! valid_p(path->bnode, path->version)){
+                        return FALSE;
+                }
+                if (idx < PIOJO_ATOMIC_LOAD(&path->bnode->ecnt)){
+                        path->right = path->bnode;
+                        path->rversion = path->version;
+                        path->ridx = idx;
+                }
+                /* A split of child changes its parent version too. */
+                cversion = read_lock(child);
+                if (! valid_p(path->bnode, path->version)){
+                        return FALSE;
+                }
+                prefetch_keys(child, tree);
+                path->parent = path->bnode;
+                path->pversion = path->version;
+                path->bnode = child;
+                path->version = cversion;
+        }
+        return TRUE;
+}
+
+/*
+ * Copies the first entry after @a key to @a nextkey and @a data, or the
+ * first one not before it if @a from_p (the first entry if @a key is
+ * @b NULL). Keys past an exhausted leaf are all in the subtree right of
+ * its path, so the walk goes on from that separator, copied to
+ * @a nextkey. Sets @a found_p, returns @b FALSE if the walk must be
+ * restarted.
+ */
+static bool
+seek_entry(const void *key, bool from_p, void *nextkey, void *data,
+           bool *found_p, const piojo_cbtree_t *tree)
+{
+        path_t path;
+        size_t idx, cnt;
+
+        while (TRUE){
+                /* Reads never split, so the tree isn't modified. */
+                if (! find_leaf(key, FALSE, (piojo_cbtree_t*) tree, &path)){
+                        return FALSE;
+                }
+                cnt = PIOJO_ATOMIC_LOAD(&path.bnode->ecnt);
+                idx = 0;
+                if (key != NULL){
+                        idx = lower_bound(key, path.bnode, cnt, tree);
+                        if (! from_p && idx < cnt &&
+                            key_eq_p(key, idx, path.bnode, tree)){
+                                ++idx;
+                        }
+                }
+                if (idx < cnt){
+                        piojo_key_copy(nextkey, entry_key(idx, path.bnode,
+                                                          tree),
+                                       tree->eksize);
+                        if (data != NULL){
+                                memcpy(data, entry_val(idx, path.bnode, tree),
+                                       tree->evsize);
+                        }
+                        *found_p = TRUE;
+                        return valid_p(path.bnode, path.version);
+                }
+                if (! valid_p(path.bnode, path.version)){
+                        return FALSE;
+                }
+                if (path.right == NULL){
+                        *found_p = FALSE;
+                        return TRUE;
+                }
+                piojo_key_copy(nextkey, entry_key(path.ridx, path.right, tree),
+                               tree->eksize);
+                if (! valid_p(path.right, path.rversion)){
+                        return FALSE;
+                }
+                key = nextkey;
+                from_p = TRUE;
+        }
+}
+
+/* Splits path->bnode unless it or its parent changed since read. */
+static void
+split_path(const path_t *path, piojo_cbtree_t *tree)
+{
+        if (path->parent != NULL && ! upgrade_p(path->parent,
+                                                path->pversion)){
+                return;
+        }
+        if (upgrade_p(path->bnode, path->version)){
+                split_bnode(path->bnode, path->parent, tree);
+                write_unlock(path->bnode);
+        }
+        if (path->parent != NULL){
+                write_unlock(path->parent);
+        }
+}
+
+/*
+ * Moves the upper half of the locked @a bnode to a new sibling and adds
+ * it to the locked @a parent, or to a new root if @a parent is @b NULL.
+ */
+static void
+split_bnode(bnode_t *bnode, bnode_t *parent, piojo_cbtree_t *tree)
+{
+        bnode_t *sibling, *root;
+        size_t mid = bnode->ecnt / 2, from, cnt, ksize = tree->eksize;
+
+        sibling = alloc_bnode(bnode->leaf_p, tree);
+        from = (bnode->leaf_p) ? mid : mid + 1;
+        cnt = bnode->ecnt - from;
+        memcpy(sibling->keys, entry_key(from, bnode, tree), cnt * ksize);
+        if (bnode->leaf_p){
+                memcpy(sibling->values, entry_val(from, bnode, tree),
+                       cnt * tree->evsize);
+        }else{
+                memcpy(sibling->children, &bnode->children[from],
+                       (cnt + 1) * sizeof(bnode_t*));
+        }
+        sibling->ecnt = cnt;
+        /* Separator stays readable, the slot isn't reused until unlock. */
+        PIOJO_ATOMIC_STORE(&bnode->ecnt, mid);
+
+        if (parent != NULL){
+                insert_child(entry_key(mid, bnode, tree), sibling, parent,
+                             tree);
+                return;
+        }
+        root = alloc_bnode(FALSE, tree);
+        piojo_key_copy(root->keys, entry_key(mid, bnode, tree), ksize);
+        root->children[0] = bnode;
+        root->children[1] = sibling;
+        root->ecnt = 1;
+        PIOJO_ATOMIC_STORE(&tree->root, root);
+}
+
+/* Inserts separator @a key and its right @a child in locked @a parent. */
+static void
+insert_child(const void *key, bnode_t *child, bnode_t *parent,
+             const piojo_cbtree_t *tree)
+{
+        size_t idx = child_index(key, parent, tree), ksize = tree->eksize;
+
+        memmove(entry_key(idx + 1, parent, tree), entry_key(idx, parent, tree),
+                (parent->ecnt - idx) * ksize);
+        memmove(&parent->children[idx + 2], &parent->children[idx + 1],
+                (parent->ecnt - idx) * sizeof(bnode_t*));
+        piojo_key_copy(entry_key(idx, parent, tree), key, ksize);
+        PIOJO_ATOMIC_STORE(&parent->children[idx + 1], child);
+        PIOJO_ATOMIC_STORE(&parent->ecnt, parent->ecnt + 1);
+}
+
+static bool
+write_entry(const void *key, const void *data, bool replace_p,
+            piojo_cbtree_t *tree)
+{
+        path_t path;
+        size_t idx;
+        bool found_p;
+
+        while (TRUE){
+                if (! find_leaf(key, TRUE, tree, &path) ||
+                    ! upgrade_p(path.bnode, path.version)){
+                        continue;
+                }
+                idx = lower_bound(key, path.bnode, path.bnode->ecnt, tree);
+                found_p = (idx < path.bnode->ecnt &&
+                           key_eq_p(key, idx, path.bnode, tree));
+                if (found_p || ! full_p(path.bnode, tree)){
+                        break;
+                }
+                /* Leaf already locked, split it and walk down again. */
+                if (path.parent == NULL){
+                        split_bnode(path.bnode, NULL, tree);
+                }else if (upgrade_p(path.parent, path.pversion)){
+                        split_bnode(path.bnode, path.parent, tree);
+                        write_unlock(path.parent);
+                }
+                write_unlock(path.bnode);
+        }
+
+        if (! found_p){
+                insert_entry(key, data, idx, path.bnode, tree);
+        }else if (replace_p && data != NULL){
+                memcpy(entry_val(idx, path.bnode, tree), data, tree->evsize);
+        }
+        write_unlock(path.bnode);
+        if (! found_p){
+                PIOJO_ATOMIC_ADD(&tree->ecount, 1);
+        }
+        return ! found_p;
+}
+
+static void
+insert_entry(const void *key, const void *data, size_t idx,
+             bnode_t *leaf, const piojo_cbtree_t *tree)
+{
+        bool null_p = TRUE;
+        size_t cnt = leaf->ecnt - idx;
+
+        if (data == NULL){
+                data = &null_p;
+        }
+        memmove(entry_key(idx + 1, leaf, tree), entry_key(idx, leaf, tree),
+                cnt * tree->eksize);
+        memmove(entry_val(idx + 1, leaf, tree), entry_val(idx, leaf, tree),
+                cnt * tree->evsize);
+        piojo_key_copy(entry_key(idx, leaf, tree), key, tree->eksize);
+        memcpy(entry_val(idx, leaf, tree), data, tree->evsize);
+        PIOJO_ATOMIC_STORE(&leaf->ecnt, leaf->ecnt + 1);
+}
+
+static void
+delete_entry(size_t idx, bnode_t *leaf, const piojo_cbtree_t *tree)
+{
+        size_t cnt = leaf->ecnt - idx - 1;
+
+        memmove(entry_key(idx, leaf, tree), entry_key(idx + 1, leaf, tree),
+                cnt * tree->eksize);
+        memmove(entry_val(idx, leaf, tree), entry_val(idx + 1, leaf, tree),
+                cnt * tree->evsize);
+        PIOJO_ATOMIC_STORE(&leaf->ecnt, leaf->ecnt - 1);
+}
+
+static uint8_t*
+entry_key(size_t eidx, const bnode_t *bnode, const piojo_cbtree_t *tree)
+{
+        return &bnode->keys[eidx * tree->eksize];
+}
+
+static uint8_t*
+entry_val(size_t eidx, const bnode_t *bnode, const piojo_cbtree_t *tree)
+{
+        return &bnode->values[eidx * tree->evsize];
+}
+
+/*
+ * Defines lower_bound_<suffix>(), a branchless binary search returning
+ * the index of the first key not less than @a key in keys [0, cnt).
+ */
+#define DEFINE_LOWER_BOUND(suffix, cmp, ksize)                          \
+        static size_t                                                   \
+        lower_bound_##suffix(const void *key, const bnode_t *bnode,     \
+                             size_t cnt, const piojo_cbtree_t *tree)    \
+        {                                                               \
+                size_t half, base = 0;                                  \
+                const uint8_t *keys = bnode->keys;                      \
+                PIOJO_UNUSED(tree);                                     \
+                                                                        \
+                if (cnt == 0){                                          \
+                        return 0;                                       \
+                }                                                       \
+                while (cnt > 1){                                        \
+                        half = cnt / 2;                                 \
+                        base += (cmp(&keys[(base + half) * ksize],      \
+                                     key) < 0) ? half : 0;              \
+                        cnt -= half;                                    \
+                }                                                       \
+                return base + (cmp(&keys[base * ksize], key) < 0);      \
+        }
+
+#define DEFINE_LOWER_BOUND_KEY(suffix, type)                            \
+        DEFINE_LOWER_BOUND(suffix, piojo_key_cmp_##suffix, sizeof(type))
+
+DEFINE_LOWER_BOUND(cb, tree->cmp_cb, tree->eksize)
+PIOJO_KEYTYPE_EXPAND(DEFINE_LOWER_BOUND_KEY)
+
+static size_t
+lower_bound(const void *key, const bnode_t *bnode, size_t cnt,
+            const piojo_cbtree_t *tree)
+{
+        switch (tree->keytype){
+        case PIOJO_KEY_I32:
+                return lower_bound_i32(key, bnode, cnt, tree);
+        case PIOJO_KEY_I64:
+                return lower_bound_i64(key, bnode, cnt, tree);
+        case PIOJO_KEY_SIZ:
+                return lower_bound_siz(key, bnode, cnt, tree);
+        default:
+                return lower_bound_cb(key, bnode, cnt, tree);
+        }
+}
+
+static bool
+key_eq_p(const void *key, size_t eidx, const bnode_t *bnode,
+         const piojo_cbtree_t *tree)
+{
+        const void *ekey = entry_key(eidx, bnode, tree);
+
+        switch (tree->keytype){
+        case PIOJO_KEY_I32:
+                return piojo_key_eq_i32(key, ekey);
+        case PIOJO_KEY_I64:
+                return piojo_key_eq_i64(key, ekey);
+        case PIOJO_KEY_SIZ:
+                return piojo_key_eq_siz(key, ekey);
+        default:
+                return (tree->cmp_cb(key, ekey) == 0);
+        }
+}
+
+/* Separators equal to @a key lead to the right child. */
+static size_t
+child_index(const void *key, const bnode_t *bnode,
+            const piojo_cbtree_t *tree)
+{
+        size_t cnt = PIOJO_ATOMIC_LOAD(&bnode->ecnt);
+        size_t idx = lower_bound(key, bnode, cnt, tree);
+
+        if (idx < cnt && key_eq_p(key, idx, bnode, tree)){
+                ++idx;
+        }
+        return idx;
+}
+
+/* Keys of the *_i32k/i64k/sizk allocators are compared inline. */
+static piojo_keytype_t
+key_type(piojo_cmp_cb keycmp)
+{
+        if (keycmp == i32_cmp){
+                return PIOJO_KEY_I32;
+        }else if (keycmp == i64_cmp){
+                return PIOJO_KEY_I64;
+        }else if (keycmp == siz_cmp){
+                return PIOJO_KEY_SIZ;
+        }
+        return PIOJO_KEY_CB;
+}
+
+static int
+i32_cmp(const void *e1, const void *e2)
+{
+        int32_t v1 = *(int32_t*) e1;
+        int32_t v2 = *(int32_t*) e2;
+        if (v1 > v2){
+                return 1;
+        }else if (v1 < v2){
+                return -1;
+        }
+        return 0;
+}
+
+static int
+i64_cmp(const void *e1, const void *e2)
+{
+        int64_t v1 = *(int64_t*) e1;
+        int64_t v2 = *(int64_t*) e2;
+        if (v1 > v2){
+                return 1;
+        }else if (v1 < v2){
+                return -1;
+        }
+        return 0;
+}
+
+static int
+siz_cmp(const void *e1, const void *e2)
+{
+        size_t v1 = *(size_t*) e1;
+        size_t v2 = *(size_t*) e2;
+        if (v1 > v2){
+                return 1;
+        }else if (v1 < v2){
+                return -1;
+        }
+        return 0;
+}
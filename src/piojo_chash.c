@@ -0,0 +1,469 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2013 G. Elian Gidoni
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+
+/**
+ * @file
+ * @addtogroup piojochash Piojo Concurrent Hash Table
+ * @{
+ * Piojo Concurrent Hash Table implementation.
+ * Keys are sharded across hash tables, each one guarded by its own
+ * reader/writer lock. All functions are thread-safe except alloc/free.
+ */
+
+#define _POSIX_C_SOURCE 200112L
+
+#include <pthread.h>
+#include <piojo/piojo_chash.h>
+#include <piojo_defs.h>
+
+typedef struct {
+        pthread_rwlock_t lock;
+        piojo_hash_t *table;
+} shard_t;
+
+struct piojo_chash_t {
+        /* Shards start at the first cache line boundary of the block. */
+        uint8_t *shards, *block;
+        size_t shardcnt, shardsize, evsize;
+        uint64_t seed;
+        piojo_hash_cb hash_cb;
+        size_t eksize;
+        piojo_alloc_if allocator;
+};
+/** @hideinitializer Size of concurrent hash table in bytes */
+const size_t piojo_chash_sizeof = sizeof(piojo_chash_t);
+
+static const size_t DEFAULT_SHARD_COUNT = 64;
+
+/* Shards are padded to separate cache lines to avoid false sharing. */
+static const size_t CACHE_LINE_SIZE = 64;
+
+static shard_t*
+shard_at(size_t idx, const piojo_chash_t *chash);
+
+static shard_t*
+key_shard(const void *key, const piojo_chash_t *chash);
+
+static void
+lock_read(shard_t *shard);
+
+static void
+lock_write(shard_t *shard);
+
+static void
+unlock(shard_t *shard);
+
+static bool
+i32_eq(const void *e1, const void *e2);
+
+static bool
+i64_eq(const void *e1, const void *e2);
+
+static bool
+siz_eq(const void *e1, const void *e2);
+
+static const piojo_hasher_if I32_HASHER = { piojo_i32_hash, i32_eq };
+static const piojo_hasher_if I64_HASHER = { piojo_i64_hash, i64_eq };
+static const piojo_hasher_if SIZ_HASHER = { piojo_siz_hash, siz_eq };
+
+/**
+ * Allocates a new concurrent hash table.
+ * Uses default allocator, default shard count and key size of @b int32_t.
+ * @param[in] evsize Entry value size in bytes.
+ * @return New concurrent hash table.
+ */
+piojo_chash_t*
+piojo_chash_alloc_i32k(size_t evsize)
+{
+        return piojo_chash_alloc_cb_i32k(DEFAULT_SHARD_COUNT, evsize,
+                                         piojo_alloc_default);
+}
+
+/**
+ * Allocates a new concurrent hash table.
+ * Uses default allocator, default shard count and key size of @b int64_t.
+ * @param[in] evsize Entry value size in bytes.
+ * @return New concurrent hash table.
+ */
+piojo_chash_t*
+piojo_chash_alloc_i64k(size_t evsize)
+{
+        return piojo_chash_alloc_cb_i64k(DEFAULT_SHARD_COUNT, evsize,
+                                         piojo_alloc_default);
+}
+
+/**
+ * Allocates a new concurrent hash table.
+ * Uses default allocator, default shard count and key size of @b size_t.
+ * @param[in] evsize Entry value size in bytes.
+ * @return New concurrent hash table.
+ */
+piojo_chash_t*
+piojo_chash_alloc_sizk(size_t evsize)
+{
+        return piojo_chash_alloc_cb_sizk(DEFAULT_SHARD_COUNT, evsize,
+                                         piojo_alloc_default);
+}
+
+/**
+ * Allocates a new concurrent hash table.
+ * Uses key size of @b int32_t.
+ * @param[in] shardcnt Number of shards (rounded up to a power of 2).
+ * @param[in] evsize Entry value size in bytes.
+ * @param[in] allocator Allocator to be used.
+ * @return New concurrent hash table.
+ */
+piojo_chash_t*
+piojo_chash_alloc_cb_i32k(size_t shardcnt, size_t evsize,
+                          piojo_alloc_if allocator)
+{
+        return piojo_chash_alloc_cb_hash(shardcnt, evsize, I32_HASHER,
+                                         sizeof(int32_t), allocator);
+}
+
+/**
+ * Allocates a new concurrent hash table.
+ * Uses key size of @b int64_t.
+ * @param[in] shardcnt Number of shards (rounded up to a power of 2).
+ * @param[in] evsize Entry value size in bytes.
+ * @param[in] allocator Allocator to be used.
+ * @return New concurrent hash table.
+ */
+piojo_chash_t*
+piojo_chash_alloc_cb_i64k(size_t shardcnt, size_t evsize,
+                          piojo_alloc_if allocator)
+{
+        return piojo_chash_alloc_cb_hash(shardcnt, evsize, I64_HASHER,
+                                         sizeof(int64_t), allocator);
+}
+
+/**
+ * Allocates a new concurrent hash table.
+ * Uses key size of @b size_t.
+ * @param[in] shardcnt Number of shards (rounded up to a power of 2).
+ * @param[in] evsize Entry value size in bytes.
+ * @param[in] allocator Allocator to be used.
+ * @return New concurrent hash table.
+ */
+piojo_chash_t*
+piojo_chash_alloc_cb_sizk(size_t shardcnt, size_t evsize,
+                          piojo_alloc_if allocator)
+{
+        return piojo_chash_alloc_cb_hash(shardcnt, evsize, SIZ_HASHER,
+                                         sizeof(size_t), allocator);
+}
+
+/**
+ * Allocates a new concurrent hash table.
+ * Each shard is a ::PIOJO_HASH_MODE_FLAT hash table, the shard of a key
+ * is chosen with @a hasher and a seed independent from the shard tables.
+ * @param[in] shardcnt Number of shards (rounded up to a power of 2).
+ * @param[in] evsize Entry value size in bytes.
+ * @param[in] hasher Entry key hash and equality functions.
+ * @param[in] eksize Entry key size in bytes.
+ * @param[in] allocator Allocator to be used.
+ * @return New concurrent hash table.
+ */
+piojo_chash_t*
+piojo_chash_alloc_cb_hash(size_t shardcnt, size_t evsize,
+                          piojo_hasher_if hasher, size_t eksize,
+                          piojo_alloc_if allocator)
+{
+        piojo_chash_t *chash;
+        shard_t *shard;
+        size_t i, cnt = 1;
+        int ret;
+        PIOJO_ASSERT(shardcnt > 0 && shardcnt <= SIZE_MAX / 2);
+        PIOJO_ASSERT(eksize > 0 && evsize > 0);
+        PIOJO_ASSERT(hasher.hash_cb && hasher.eq_cb);
+
+        while (cnt < shardcnt){
+                cnt *= 2;
+        }
+
+        chash = (piojo_chash_t*) allocator.alloc_cb(sizeof(piojo_chash_t));
+        PIOJO_ASSERT(chash);
+
+        chash->shardcnt = cnt;
+        chash->shardsize = (sizeof(shard_t) + CACHE_LINE_SIZE - 1) /
+                CACHE_LINE_SIZE * CACHE_LINE_SIZE;
+        chash->evsize = evsize;
+        chash->eksize = eksize;
+        chash->hash_cb = hasher.hash_cb;
+        chash->seed = piojo_rand_seed();
+        chash->allocator = allocator;
+
+        PIOJO_ASSERT(piojo_safe_mulsiz_p(cnt, chash->shardsize));
+        PIOJO_ASSERT(cnt * chash->shardsize <= SIZE_MAX - CACHE_LINE_SIZE);
+        chash->block = (uint8_t*) allocator.alloc_cb(cnt * chash->shardsize +
+                                                     CACHE_LINE_SIZE - 1);
+        PIOJO_ASSERT(chash->block);
+        chash->shards = (uint8_t*) (((uintptr_t) chash->block +
+                                     CACHE_LINE_SIZE - 1) /
+                                    CACHE_LINE_SIZE * CACHE_LINE_SIZE);
+
+        for (i = 0; i < cnt; ++i){
+                shard = shard_at(i, chash);
+                ret = pthread_rwlock_init(&shard->lock, NULL);
+                PIOJO_ASSERT(ret == 0);
+                shard->table = piojo_hash_alloc_mode_hash(PIOJO_HASH_MODE_FLAT,
+                                                          evsize, hasher,
+                                                          eksize, allocator);
+        }
+        return chash;
+}
+
+/**
+ * Frees @a chash and all its entries.
+ * Must not be called concurrently with other functions.
+ * @param[in] chash Concurrent hash table being freed.
+ */
+void
+piojo_chash_free(const piojo_chash_t *chash)
+{
+        shard_t *shard;
+        size_t i;
+        PIOJO_ASSERT(chash);
+
+        for (i = 0; i < chash->shardcnt; ++i){
+                shard = shard_at(i, chash);
+                piojo_hash_free(shard->table);
+                pthread_rwlock_destroy(&shard->lock);
+        }
+        chash->allocator.free_cb(chash->block);
+        chash->allocator.free_cb(chash);
+}
+
+/**
+ * Deletes all entries in @a chash.
+ * Shards are cleared one at a time, entries inserted concurrently
+ * in already cleared shards are kept.
+ * @param[out] chash Concurrent hash table being cleared.
+ */
+void
+piojo_chash_clear(piojo_chash_t *chash)
+{
+        shard_t *shard;
+        size_t i;
+        PIOJO_ASSERT(chash);
+
+        for (i = 0; i < chash->shardcnt; ++i){
+                shard = shard_at(i, chash);
+                lock_write(shard);
+                piojo_hash_clear(shard->table);
+                unlock(shard);
+        }
+}
+
+/**
+ * Returns number of entries.
+ * All shards are read locked before counting, so the result is a
+ * consistent snapshot.
+ * @param[in] chash Concurrent hash table.
+ * @return Number of entries in @a chash.
+ */
+size_t
+piojo_chash_size(const piojo_chash_t *chash)
+{
+        size_t i, cnt = 0;
+        PIOJO_ASSERT(chash);
+
+        /* Writers lock a single shard, so locking in order can't deadlock. */
+        for (i = 0; i < chash->shardcnt; ++i){
+                lock_read(shard_at(i, chash));
+        }
+        for (i = 0; i < chash->shardcnt; ++i){
+                cnt += piojo_hash_size(shard_at(i, chash)->table);
+        }
+        for (i = 0; i < chash->shardcnt; ++i){
+                unlock(shard_at(i, chash));
+        }
+        return cnt;
+}
+
+/**
+ * Inserts a new entry.
+ * If @a data is @b NULL, the value is replaced with @b TRUE (useful for sets).
+ * @param[in] key Entry key.
+ * @param[in] data Entry value.
+ * @param[out] chash Concurrent hash table being modified.
+ * @return @b TRUE if inserted, @b FALSE if @a key is duplicate.
+ */
+bool
+piojo_chash_insert(const void *key, const void *data, piojo_chash_t *chash)
+{
+        shard_t *shard;
+        bool inserted_p;
+        PIOJO_ASSERT(chash);
+        PIOJO_ASSERT(key);
+
+        shard = key_shard(key, chash);
+        lock_write(shard);
+        inserted_p = piojo_hash_insert(key, data, shard->table);
+        unlock(shard);
+        return inserted_p;
+}
+
+/**
+ * Replaces or inserts an entry.
+ * If @a data is @b NULL, the value is replaced with @b TRUE (useful for sets).
+ * @param[in] key Entry key.
+ * @param[in] data Entry value.
+ * @param[out] chash Concurrent hash table being modified.
+ * @return @b TRUE if @a key is new, @b FALSE otherwise.
+ */
+bool
+piojo_chash_set(const void *key, const void *data, piojo_chash_t *chash)
+{
+        shard_t *shard;
+        bool new_p;
+        PIOJO_ASSERT(chash);
+        PIOJO_ASSERT(key);
+
+        shard = key_shard(key, chash);
+        lock_write(shard);
+        new_p = piojo_hash_set(key, data, shard->table);
+        unlock(shard);
+        return new_p;
+}
+
+/**
+ * Searches an entry by key.
+ * The value is copied because entries may move once the lock is released.
+ * @param[in] key Entry key.
+ * @param[out] data Entry value copy, can be @b NULL.
+ * @param[in] chash Concurrent hash table.
+ * @return @b TRUE if found, @b FALSE if @a key doesn't exist.
+ */
+bool
+piojo_chash_search(const void *key, void *data, const piojo_chash_t *chash)
+{
+        shard_t *shard;
+        void *value;
+        PIOJO_ASSERT(chash);
+        PIOJO_ASSERT(key);
+
+        shard = key_shard(key, chash);
+        lock_read(shard);
+        value = piojo_hash_search(key, shard->table);
+        if (value != NULL && data != NULL){
+                memcpy(data, value, chash->evsize);
+        }
+        unlock(shard);
+        return (value != NULL);
+}
+
+/**
+ * Deletes an entry by key.
+ * @param[in] key Entry key.
+ * @param[out] chash Concurrent hash table.
+ * @return @b TRUE if deleted, @b FALSE if @a key doesn't exist.
+ */
+bool
+piojo_chash_delete(const void *key, piojo_chash_t *chash)
+{
+        shard_t *shard;
+        bool deleted_p;
+        PIOJO_ASSERT(chash);
+        PIOJO_ASSERT(key);
+
+        shard = key_shard(key, chash);
+        lock_write(shard);
+        deleted_p = piojo_hash_delete(key, shard->table);
+        unlock(shard);
+        return deleted_p;
+}
+
+/** @}
+ * Private functions.
+ */
+
+static shard_t*
+shard_at(size_t idx, const piojo_chash_t *chash)
+{
+        return (shard_t*) (chash->shards + idx * chash->shardsize);
+}
+
+/* High hash bits pick the shard, tables use their own seeds. */
+static shard_t*
+key_shard(const void *key, const piojo_chash_t *chash)
+{
+        uint64_t hval = chash->hash_cb(key, chash->eksize, chash->seed);
+        return shard_at((hval >> 32) & (chash->shardcnt - 1), chash);
+}
+
+static void
+lock_read(shard_t *shard)
+{
+        int ret = pthread_rwlock_rdlock(&shard->lock);
+        PIOJO_ASSERT(ret == 0);
+}
+
+static void
+lock_write(shard_t *shard)
+{
+        int ret = pthread_rwlock_wrlock(&shard->lock);
+        PIOJO_ASSERT(ret == 0);
+}
+
+static void
+unlock(shard_t *shard)
+{
+        int ret = pthread_rwlock_unlock(&shard->lock);
+        PIOJO_ASSERT(ret == 0);
+}
+
+static bool
+i32_eq(const void *e1, const void *e2)
+{
+        int32_t v1 = *(int32_t*) e1;
+        int32_t v2 = *(int32_t*) e2;
+        if (v1 == v2){
+                return TRUE;
+        }
+        return FALSE;
+}
+
+static bool
+i64_eq(const void *e1, const void *e2)
+{
+        int64_t v1 = *(int64_t*) e1;
+        int64_t v2 = *(int64_t*) e2;
+        if (v1 == v2){
+                return TRUE;
+        }
+        return FALSE;
+}
+
+static bool
+siz_eq(const void *e1, const void *e2)
+{
+        size_t v1 = *(size_t*) e1;
+        size_t v2 = *(size_t*) e2;
+        if (v1 == v2){
+                return TRUE;
+        }
+        return FALSE;
+}
@@ -0,0 +1,1154 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2013 G. Elian Gidoni
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+
+/**
+ * @file
+ * @addtogroup piojocskiplist Piojo Concurrent Skip List
+ * @{
+ * Piojo Concurrent Skip List implementation.
+ * Lock-free skip list (Fraser, Herlihy): nodes are linked level by level
+ * with compare-and-swap and deleted by marking their links, the marked
+ * nodes are unlinked by any later search for their key.
+ * Unlinked nodes are freed once every thread that could still see them
+ * has left (epoch based reclamation), so each thread registers a state
+ * which also holds its random generator for node levels.
+ * Values are replaced in place under a per-node version counter, readers
+ * copy them and retry if a replacement overlapped.
+ * All functions are thread-safe except alloc/free/clear.
+ */
+
+#define _POSIX_C_SOURCE 200112L
+
+#include <pthread.h>
+#include <sched.h>
+#include <piojo/piojo_cskiplist.h>
+#include <piojo_defs.h>
+
+#define MAX_LEVELS 24
+#define CACHE_LINE_SIZE 64
+
+typedef struct node_t node_t;
+struct node_t {
+        /* Odd while the value is being replaced. */
+        uint64_t version;
+        /* Held by the list and by the inserter until it's done linking. */
+        size_t refs;
+        int level;
+        uint64_t epoch;
+        node_t *retired;
+        uint8_t *key, *data;
+        /* Low bit set once the node is deleted at that level. */
+        uintptr_t nexts[];
+};
+
+struct piojo_cskiplist_thread_t {
+        uint64_t epoch;
+        uint64_t rand;
+        bool used_p;
+        /* Unlinked nodes waiting for readers to leave. */
+        node_t *retired;
+        size_t rcount;
+        piojo_cskiplist_thread_t *next;
+};
+
+struct piojo_cskiplist_t {
+        node_t *head;
+        int level;
+        uint64_t epoch;
+        size_t eksize, evsize;
+        piojo_cmp_cb cmp_cb;
+        piojo_keytype_t keytype;
+        piojo_alloc_if allocator;
+        pthread_mutex_t lock;
+        piojo_cskiplist_thread_t *threads;
+        /* Keeps the read-mostly fields away from the written counter. */
+        uint8_t pad[CACHE_LINE_SIZE];
+        size_t ecount;
+};
+/** @hideinitializer Size of concurrent list in bytes */
+const size_t piojo_cskiplist_sizeof = sizeof(piojo_cskiplist_t);
+
+static const uintptr_t DELETED_MARK = 1;
+
+/* Epoch of threads outside a list operation. */
+static const uint64_t QUIESCENT_EPOCH = 0;
+
+/* Retired nodes of a thread are reclaimed in batches of this size. */
+static const size_t RECLAIM_BATCH = 64;
+
+/* Value writers give up the CPU after this many spins. */
+static const size_t SPINS_PER_YIELD = 64;
+
+static node_t*
+alloc_node(const void *key, const void *data, int level,
+           const piojo_cskiplist_t *list);
+
+static void
+free_nodes(const piojo_cskiplist_t *list);
+
+static void
+free_retired(piojo_cskiplist_thread_t *thread,
+             const piojo_cskiplist_t *list);
+
+static node_t*
+node_ptr(uintptr_t link);
+
+static bool
+marked_p(uintptr_t link);
+
+static int
+node_level(piojo_cskiplist_thread_t *thread);
+
+static void
+raise_level(int level, piojo_cskiplist_t *list);
+
+static bool
+find(const void *key, node_t **preds, node_t **succs,
+     piojo_cskiplist_t *list);
+
+static bool
+find_level(const void *key, int level, node_t *pred, bool strict_p,
+           node_t **preds, node_t **succs, piojo_cskiplist_t *list);
+
+static void
+unlink_node(node_t *node, piojo_cskiplist_t *list);
+
+static node_t*
+seek(const void *key, bool strict_p, const piojo_cskiplist_t *list);
+
+static bool
+insert_node(const void *key, const void *data, bool replace_p,
+            piojo_cskiplist_thread_t *thread, piojo_cskiplist_t *list);
+
+static void
+link_levels(node_t *node, node_t **preds, node_t **succs,
+            piojo_cskiplist_t *list);
+
+static void
+mark_levels(node_t *node);
+
+static void
+release(node_t *node, piojo_cskiplist_thread_t *thread,
+        piojo_cskiplist_t *list);
+
+static void
+reclaim_retired(piojo_cskiplist_thread_t *thread, piojo_cskiplist_t *list);
+
+static void
+enter(piojo_cskiplist_thread_t *thread, const piojo_cskiplist_t *list);
+
+static void
+leave(piojo_cskiplist_thread_t *thread);
+
+static void
+backoff(size_t *spins);
+
+static void
+read_value(void *data, const node_t *node, const piojo_cskiplist_t *list);
+
+static void
+write_value(const void *data, node_t *node, const piojo_cskiplist_t *list);
+
+static int
+key_cmp(const void *k1, const void *k2, const piojo_cskiplist_t *list);
+
+static piojo_keytype_t
+key_type(piojo_cmp_cb keycmp);
+
+static int
+i32_cmp(const void *e1, const void *e2);
+
+static int
+i64_cmp(const void *e1, const void *e2);
+
+static int
+siz_cmp(const void *e1, const void *e2);
+
+/**
+ * Allocates a new concurrent list.
+ * Uses default allocator and key size of @b int32_t.
+ * @param[in] evsize Entry value size in bytes.
+ * @return New concurrent list.
+ */
+piojo_cskiplist_t*
+piojo_cskiplist_alloc_i32k(size_t evsize)
+{
+        return piojo_cskiplist_alloc_cb_i32k(evsize, piojo_alloc_default);
+}
+
+/**
+ * Allocates a new concurrent list.
+ * Uses default allocator and key size of @b int64_t.
+ * @param[in] evsize Entry value size in bytes.
+ * @return New concurrent list.
+ */
+piojo_cskiplist_t*
+piojo_cskiplist_alloc_i64k(size_t evsize)
+{
+        return piojo_cskiplist_alloc_cb_i64k(evsize, piojo_alloc_default);
+}
+
+/**
+ * Allocates a new concurrent list.
+ * Uses default allocator and key size of @b size_t.
+ * @param[in] evsize Entry value size in bytes.
+ * @return New concurrent list.
+ */
+piojo_cskiplist_t*
+piojo_cskiplist_alloc_sizk(size_t evsize)
+{
+        return piojo_cskiplist_alloc_cb_sizk(evsize, piojo_alloc_default);
+}
+
+/**
+ * Allocates a new concurrent list.
+ * Uses key size of @b int32_t.
+ * @param[in] evsize Entry value size in bytes.
+ * @param[in] allocator Allocator to be used, must be thread-safe.
+ * @return New concurrent list.
+ */
+piojo_cskiplist_t*
+piojo_cskiplist_alloc_cb_i32k(size_t evsize, piojo_alloc_if allocator)
+{
+        return piojo_cskiplist_alloc_cb_cmp(evsize, i32_cmp, sizeof(int32_t),
+                                            allocator);
+}
+
+/**
+ * Allocates a new concurrent list.
+ * Uses key size of @b int64_t.
+ * @param[in] evsize Entry value size in bytes.
+ * @param[in] allocator Allocator to be used, must be thread-safe.
+ * @return New concurrent list.
+ */
+piojo_cskiplist_t*
+piojo_cskiplist_alloc_cb_i64k(size_t evsize, piojo_alloc_if allocator)
+{
+        return piojo_cskiplist_alloc_cb_cmp(evsize, i64_cmp, sizeof(int64_t),
+                                            allocator);
+}
+
+/**
+ * Allocates a new concurrent list.
+ * Uses key size of @b size_t.
+ * @param[in] evsize Entry value size in bytes.
+ * @param[in] allocator Allocator to be used, must be thread-safe.
+ * @return New concurrent list.
+ */
+piojo_cskiplist_t*
+piojo_cskiplist_alloc_cb_sizk(size_t evsize, piojo_alloc_if allocator)
+{
+        return piojo_cskiplist_alloc_cb_cmp(evsize, siz_cmp, sizeof(size_t),
+                                            allocator);
+}
+
+/**
+ * Allocates a new concurrent list.
+ * @param[in] evsize Entry value size in bytes.
+ * @param[in] keycmp Entry key comparison function.
+ * @param[in] eksize Entry key size in bytes.
+ * @param[in] allocator Allocator to be used, must be thread-safe.
+ * @return New concurrent list.
+ */
+piojo_cskiplist_t*
+piojo_cskiplist_alloc_cb_cmp(size_t evsize, piojo_cmp_cb keycmp,
+                             size_t eksize, piojo_alloc_if allocator)
+{
+        piojo_cskiplist_t *list;
+        size_t size;
+        int ret;
+        PIOJO_ASSERT(eksize > 0 && evsize > 0);
+        PIOJO_ASSERT(keycmp);
+        PIOJO_ASSERT(eksize <= SIZE_MAX - sizeof(void*));
+        PIOJO_ASSERT(piojo_safe_addsiz_p(eksize + sizeof(void*), evsize));
+
+        list = (piojo_cskiplist_t*)
+                allocator.alloc_cb(sizeof(piojo_cskiplist_t));
+        PIOJO_ASSERT(list);
+
+        list->eksize = eksize;
+        list->evsize = evsize;
+        list->cmp_cb = keycmp;
+        list->keytype = key_type(keycmp);
+        list->allocator = allocator;
+        list->level = 0;
+        list->epoch = 1;
+        list->ecount = 0;
+        list->threads = NULL;
+
+        size = sizeof(node_t) + MAX_LEVELS * sizeof(uintptr_t);
+        list->head = (node_t*) allocator.alloc_cb(size);
+        PIOJO_ASSERT(list->head);
+        memset(list->head, 0, size);
+        list->head->level = MAX_LEVELS - 1;
+
+        ret = pthread_mutex_init(&list->lock, NULL);
+        PIOJO_ASSERT(ret == 0);
+        return list;
+}
+
+/**
+ * Frees @a list, all its entries and thread states.
+ * Must not be called concurrently with other functions.
+ * @param[in] list Concurrent list being freed.
+ */
+void
+piojo_cskiplist_free(const piojo_cskiplist_t *list)
+{
+        piojo_cskiplist_thread_t *thread, *nextthread;
+        PIOJO_ASSERT(list);
+
+        free_nodes(list);
+        thread = list->threads;
+        while (thread != NULL){
+                nextthread = thread->next;
+                free_retired(thread, list);
+                list->allocator.free_cb(thread);
+                thread = nextthread;
+        }
+        list->allocator.free_cb(list->head);
+        pthread_mutex_destroy((pthread_mutex_t*) &list->lock);
+        list->allocator.free_cb(list);
+}
+
+/**
+ * Deletes all entries in @a list.
+ * Must not be called concurrently with other functions.
+ * @param[out] list Concurrent list being cleared.
+ */
+void
+piojo_cskiplist_clear(piojo_cskiplist_t *list)
+{
+        piojo_cskiplist_thread_t *thread;
+        PIOJO_ASSERT(list);
+
+        free_nodes(list);
+        for (thread = list->threads; thread != NULL; thread = thread->next){
+                free_retired(thread, list);
+        }
+        memset(list->head->nexts, 0, MAX_LEVELS * sizeof(uintptr_t));
+        list->level = 0;
+        list->ecount = 0;
+}
+
+/**
+ * Returns number of entries.
+ * @param[in] list Concurrent list.
+ * @return Number of entries in @a list.
+ */
+size_t
+piojo_cskiplist_size(const piojo_cskiplist_t *list)
+{
+        PIOJO_ASSERT(list);
+        return PIOJO_ATOMIC_LOAD(&list->ecount);
+}
+
+/**
+ * Registers a thread.
+ * Each thread using @a list needs its own state, which can't be shared
+ * with other threads.
+ * @param[out] list Concurrent list.
+ * @return New thread state.
+ */
+piojo_cskiplist_thread_t*
+piojo_cskiplist_register(piojo_cskiplist_t *list)
+{
+        piojo_cskiplist_thread_t *thread;
+        size_t size;
+        int ret;
+        PIOJO_ASSERT(list);
+
+        ret = pthread_mutex_lock(&list->lock);
+        PIOJO_ASSERT(ret == 0);
+        thread = list->threads;
+        while (thread != NULL && thread->used_p){
+                thread = thread->next;
+        }
+        if (thread == NULL){
+                size = sizeof(piojo_cskiplist_thread_t);
+                size = (size + CACHE_LINE_SIZE - 1) / CACHE_LINE_SIZE *
+                        CACHE_LINE_SIZE;
+                thread = (piojo_cskiplist_thread_t*)
+                        list->allocator.alloc_cb(size);
+                PIOJO_ASSERT(thread);
+                thread->epoch = QUIESCENT_EPOCH;
+                thread->retired = NULL;
+                thread->rcount = 0;
+                thread->next = list->threads;
+                PIOJO_ATOMIC_STORE(&list->threads, thread);
+        }
+        /* Xorshift state can't be zero. */
+        thread->rand = piojo_rand_seed() | 1;
+        thread->used_p = TRUE;
+        ret = pthread_mutex_unlock(&list->lock);
+        PIOJO_ASSERT(ret == 0);
+        return thread;
+}
+
+/**
+ * Unregisters a thread.
+ * The state and its pending nodes are kept for reuse by
+ * piojo_cskiplist_register().
+ * @param[in] thread Thread state.
+ * @param[out] list Concurrent list.
+ */
+void
+piojo_cskiplist_unregister(piojo_cskiplist_thread_t *thread,
+                           piojo_cskiplist_t *list)
+{
+        int ret;
+        PIOJO_ASSERT(list);
+        PIOJO_ASSERT(thread && thread->used_p);
+
+        reclaim_retired(thread, list);
+        ret = pthread_mutex_lock(&list->lock);
+        PIOJO_ASSERT(ret == 0);
+        thread->used_p = FALSE;
+        ret = pthread_mutex_unlock(&list->lock);
+        PIOJO_ASSERT(ret == 0);
+}
+
+/**
+ * Inserts a new entry.
+ * If @a data is @b NULL, the value is replaced with @b TRUE (useful for sets).
+ * @param[in] key Entry key.
+ * @param[in] data Entry value.
+ * @param[in] thread State of the calling thread.
+ * @param[out] list Concurrent list being modified.
+ * @return @b TRUE if inserted, @b FALSE if @a key is duplicate.
+ */
+bool
+piojo_cskiplist_insert(const void *key, const void *data,
+                       piojo_cskiplist_thread_t *thread,
+                       piojo_cskiplist_t *list)
+{
+        bool inserted_p;
+        PIOJO_ASSERT(list);
+        PIOJO_ASSERT(key);
+        PIOJO_ASSERT(data || list->evsize == sizeof(bool));
+        PIOJO_ASSERT(thread && thread->used_p);
+
+        enter(thread, list);
+        inserted_p = insert_node(key, data, FALSE, thread, list);
+        leave(thread);
+        return inserted_p;
+}
+
+/**
+ * Replaces or inserts an entry.
+ * If @a data is @b NULL, the value is replaced with @b TRUE (useful for sets).
+ * @param[in] key Entry key.
+ * @param[in] data Entry value.
+ * @param[in] thread State of the calling thread.
+ * @param[out] list Concurrent list being modified.
+ * @return @b TRUE if @a key is new, @b FALSE otherwise.
+ */
+bool
+piojo_cskiplist_set(const void *key, const void *data,
+                    piojo_cskiplist_thread_t *thread,
+                    piojo_cskiplist_t *list)
+{
+        bool inserted_p;
+        PIOJO_ASSERT(list);
+        PIOJO_ASSERT(key);
+        PIOJO_ASSERT(data || list->evsize == sizeof(bool));
+        PIOJO_ASSERT(thread && thread->used_p);
+
+        enter(thread, list);
+        inserted_p = insert_node(key, data, TRUE, thread, list);
+        leave(thread);
+        return inserted_p;
+}
+
+/**
+ * Searches an entry by key.
+ * Takes no lock and writes no shared memory, the value is copied because
+ * its entry may be reclaimed once the search returns.
+ * @param[in] key Entry key.
+ * @param[out] data Entry value copy, can be @b NULL.
+ * @param[in] thread State of the calling thread.
+ * @param[in] list Concurrent list.
+ * @return @b TRUE if found, @b FALSE if @a key doesn't exist.
+ */
+bool
+piojo_cskiplist_search(const void *key, void *data,
+                       piojo_cskiplist_thread_t *thread,
+                       const piojo_cskiplist_t *list)
+{
+        node_t *node;
+        bool found_p;
+        PIOJO_ASSERT(list);
+        PIOJO_ASSERT(key);
+        PIOJO_ASSERT(thread && thread->used_p);
+
+        enter(thread, list);
+        node = seek(key, FALSE, list);
+        found_p = (node != NULL && key_cmp(node->key, key, list) == 0);
+        if (found_p && data != NULL){
+                read_value(data, node, list);
+        }
+        leave(thread);
+        return found_p;
+}
+
+/**
+ * Deletes an entry by key.
+ * @param[in] key Entry key.
+ * @param[in] thread State of the calling thread.
+ * @param[out] list Concurrent list being modified.
+ * @return @b TRUE if deleted, @b FALSE if @a key doesn't exist.
+ */
+bool
+piojo_cskiplist_delete(const void *key, piojo_cskiplist_thread_t *thread,
+                       piojo_cskiplist_t *list)
+{
+        node_t *preds[MAX_LEVELS], *succs[MAX_LEVELS], *node;
+        uintptr_t link;
+        bool deleted_p = FALSE;
+        PIOJO_ASSERT(list);
+        PIOJO_ASSERT(key);
+        PIOJO_ASSERT(thread && thread->used_p);
+
+        enter(thread, list);
+        if (find(key, preds, succs, list)){
+                node = succs[0];
+                mark_levels(node);
+                /* Whoever marks the bottom level deletes the entry. */
+                link = PIOJO_ATOMIC_LOAD(&node->nexts[0]);
+                while (! marked_p(link)){
+                        if (PIOJO_ATOMIC_CAS(&node->nexts[0], &link,
+                                             link | DELETED_MARK)){
+                                deleted_p = TRUE;
+                                break;
+                        }
+                }
+                if (deleted_p){
+                        unlink_node(node, list);
+                        PIOJO_ATOMIC_ADD(&list->ecount, (size_t) -1);
+                        release(node, thread, list);
+                }
+        }
+        leave(thread);
+        return deleted_p;
+}
+
+/**
+ * Reads the first entry in @a list (order given by @a keycmp function).
+ * @param[out] key First key copy.
+ * @param[out] data Entry value copy, can be @b NULL.
+ * @param[in] thread State of the calling thread.
+ * @param[in] list Concurrent list.
+ * @return @b TRUE if found, @b FALSE if @a list is empty.
+ */
+bool
+piojo_cskiplist_first(void *key, void *data,
+                      piojo_cskiplist_thread_t *thread,
+                      const piojo_cskiplist_t *list)
+{
+        node_t *node;
+        PIOJO_ASSERT(list);
+        PIOJO_ASSERT(key);
+        PIOJO_ASSERT(thread && thread->used_p);
+
+        enter(thread, list);
+        node = seek(NULL, FALSE, list);
+        if (node != NULL){
+                piojo_key_copy(key, node->key, list->eksize);
+                if (data != NULL){
+                        read_value(data, node, list);
+                }
+        }
+        leave(thread);
+        return (node != NULL);
+}
+
+/**
+ * Reads the entry following @a key (order given by @a keycmp function).
+ * @a key doesn't need to be in @a list, so iterations continue past
+ * entries deleted concurrently.
+ * @param[in] key Entry key.
+ * @param[out] nextkey Next key copy, can be @a key.
+ * @param[out] data Entry value copy, can be @b NULL.
+ * @param[in] thread State of the calling thread.
+ * @param[in] list Concurrent list.
+ * @return @b TRUE if found, @b FALSE if no key follows @a key.
+ */
+bool
+piojo_cskiplist_next(const void *key, void *nextkey, void *data,
+                     piojo_cskiplist_thread_t *thread,
+                     const piojo_cskiplist_t *list)
+{
+        node_t *node;
+        PIOJO_ASSERT(list);
+        PIOJO_ASSERT(key && nextkey);
+        PIOJO_ASSERT(thread && thread->used_p);
+
+        enter(thread, list);
+        node = seek(key, TRUE, list);
+        if (node != NULL){
+                piojo_key_copy(nextkey, node->key, list->eksize);
+                if (data != NULL){
+                        read_value(data, node, list);
+                }
+        }
+        leave(thread);
+        return (node != NULL);
+}
+
+/**
+ * Frees the nodes deleted by @a thread that no thread can see anymore.
+ * Deletions already do this periodically, this is useful when no more
+ * changes are expected.
+ * @param[in] thread State of the calling thread.
+ * @param[out] list Concurrent list.
+ */
+void
+piojo_cskiplist_reclaim(piojo_cskiplist_thread_t *thread,
+                        piojo_cskiplist_t *list)
+{
+        PIOJO_ASSERT(list);
+        PIOJO_ASSERT(thread && thread->used_p);
+
+        reclaim_retired(thread, list);
+}
+
+/** @}
+ * Private functions.
+ */
+
+/* Links, key and value in one block, the key slot keeps values aligned. */
+static node_t*
+alloc_node(const void *key, const void *data, int level,
+           const piojo_cskiplist_t *list)
+{
+        bool null_p = TRUE;
+        size_t linksize, keysize;
+        node_t *node;
+
+        if (data == NULL){
+                data = &null_p;
+        }
+        linksize = (level + 1) * sizeof(uintptr_t);
+        keysize = (list->eksize + sizeof(void*) - 1) / sizeof(void*) *
+                sizeof(void*);
+        node = (node_t*) list->allocator.alloc_cb(sizeof(node_t) + linksize +
+                                                  keysize + list->evsize);
+        PIOJO_ASSERT(node);
+        node->version = 0;
+        node->refs = 2;
+        node->level = level;
+        node->retired = NULL;
+        node->key = (uint8_t*) node->nexts + linksize;
+        node->data = node->key + keysize;
+        piojo_key_copy(node->key, key, list->eksize);
+        memcpy(node->data, data, list->evsize);
+        return node;
+}
+
+/* Frees linked nodes, no thread may be using the list. */
+static void
+free_nodes(const piojo_cskiplist_t *list)
+{
+        node_t *node, *next;
+
+        node = node_ptr(list->head->nexts[0]);
+        while (node != NULL){
+                next = node_ptr(node->nexts[0]);
+                list->allocator.free_cb(node);
+                node = next;
+        }
+}
+
+static void
+free_retired(piojo_cskiplist_thread_t *thread,
+             const piojo_cskiplist_t *list)
+{
+        node_t *node, *next;
+
+        node = thread->retired;
+        while (node != NULL){
+                next = node->retired;
+                list->allocator.free_cb(node);
+                node = next;
+        }
+        thread->retired = NULL;
+        thread->rcount = 0;
+}
+
+static node_t*
+node_ptr(uintptr_t link)
+{
+        return (node_t*) (link & ~DELETED_MARK);
+}
+
+static bool
+marked_p(uintptr_t link)
+{
+        return (link & DELETED_MARK) != 0;
+}
+
+/* Geometric level from the thread generator, no shared state is written. */
+static int
+node_level(piojo_cskiplist_thread_t *thread)
+{
+        uint64_t bits;
+        int level = 0;
+
+        thread->rand ^= thread->rand << 13;
+        thread->rand ^= thread->rand >> 7;
+        thread->rand ^= thread->rand << 17;
+        bits = thread->rand;
+        while ((bits & 1) && level < MAX_LEVELS - 1){
+                ++level;
+                bits >>= 1;
+        }
+        return level;
+}
+
+/* Searches start at the highest level in use, it never decreases. */
+static void
+raise_level(int level, piojo_cskiplist_t *list)
+{
+        int cur = PIOJO_ATOMIC_LOAD(&list->level);
+        while (cur < level &&
+               ! PIOJO_ATOMIC_CAS(&list->level, &cur, level)){
+        }
+}
+
+/*
+ * Fills the predecessors and successors of key at each level, unlinking
+ * the deleted nodes on the way. Predecessors have smaller keys and
+ * successors have equal or greater keys.
+ * Returns TRUE if key is found.
+ */
+static bool
+find(const void *key, node_t **preds, node_t **succs,
+     piojo_cskiplist_t *list)
+{
+        node_t *pred;
+        int i, top;
+
+        i = top = PIOJO_ATOMIC_LOAD(&list->level);
+        while (i >= 0){
+                pred = (i == top) ? list->head : preds[i + 1];
+                if (find_level(key, i, pred, FALSE, preds, succs, list)){
+                        --i;
+                }else{
+                        /* A predecessor got deleted, start over. */
+                        i = top = PIOJO_ATOMIC_LOAD(&list->level);
+                }
+        }
+        return (succs[0] != NULL && key_cmp(succs[0]->key, key, list) == 0);
+}
+
+/*
+ * Each predecessor link is read unmarked, so a node that isn't reached
+ * isn't linked at @a level when its predecessor was read. Stops at the
+ * first key greater than (or equal to, unless @a strict_p) @a key.
+ */
+static bool
+find_level(const void *key, int level, node_t *pred, bool strict_p,
+           node_t **preds, node_t **succs, piojo_cskiplist_t *list)
+{
+        node_t *curr;
+        uintptr_t link, expected;
+        int cmp;
+
+        link = PIOJO_ATOMIC_LOAD(&pred->nexts[level]);
+        if (marked_p(link)){
+                return FALSE;
+        }
+        curr = node_ptr(link);
+        while (curr != NULL){
+                link = PIOJO_ATOMIC_LOAD(&curr->nexts[level]);
+                if (marked_p(link)){
+                        expected = (uintptr_t) curr;
+                        if (! PIOJO_ATOMIC_CAS(&pred->nexts[level],
+                                               &expected,
+                                               link & ~DELETED_MARK)){
+                                return FALSE;
+                        }
+                        curr = node_ptr(link);
+                        continue;
+                }
+                cmp = key_cmp(curr->key, key, list);
+                if (cmp > 0 || (cmp == 0 && ! strict_p)){
+                        break;
+                }
+                pred = curr;
+                curr = node_ptr(link);
+        }
+        preds[level] = pred;
+        succs[level] = curr;
+        return TRUE;
+}
+
+/*
+ * Unlinks a marked node at every level before it's released. An insert
+ * of the same key may have read the node unmarked and linked its own in
+ * front of it, so the walk goes past nodes with an equal key. Once gone
+ * from a level it isn't linked there again, inserts expect their old
+ * successor in place (the node's own inserter calls this as well).
+ */
+static void
+unlink_node(node_t *node, piojo_cskiplist_t *list)
+{
+        node_t *preds[MAX_LEVELS], *succs[MAX_LEVELS];
+        int i;
+
+        find(node->key, preds, succs, list);
+        i = node->level;
+        while (i >= 0){
+                if (find_level(node->key, i, preds[i], TRUE, preds, succs,
+                               list)){
+                        --i;
+                }else{
+                        /* A predecessor got deleted, look it up again. */
+                        find(node->key, preds, succs, list);
+                }
+        }
+}
+
+/*
+ * Returns the first node not deleted with a key greater than (or equal
+ * to, unless @a strict_p) @a key, or the first node if @a key is @b NULL.
+ * Deleted nodes are skipped but not unlinked, so nothing is written.
+ */
+static node_t*
+seek(const void *key, bool strict_p, const piojo_cskiplist_t *list)
+{
+        node_t *pred = list->head, *curr = NULL;
+        uintptr_t link;
+        int i, cmp;
+
+        i = (key != NULL) ? PIOJO_ATOMIC_LOAD(&list->level) : 0;
+        for (; i >= 0; --i){
+                curr = node_ptr(PIOJO_ATOMIC_LOAD(&pred->nexts[i]));
+                while (curr != NULL){
+                        link = PIOJO_ATOMIC_LOAD(&curr->nexts[i]);
+                        if (marked_p(link)){
+                                curr = node_ptr(link);
+                                continue;
+                        }
+                        if (key == NULL){
+                                break;
+                        }
+                        cmp = key_cmp(curr->key, key, list);
+                        if (cmp > 0 || (cmp == 0 && ! strict_p)){
+                                break;
+                        }
+                        pred = curr;
+                        curr = node_ptr(link);
+                }
+        }
+        return curr;
+}
+
+/* Returns TRUE if key was inserted, replaces the value if replace_p. */
+static bool
+insert_node(const void *key, const void *data, bool replace_p,
+            piojo_cskiplist_thread_t *thread, piojo_cskiplist_t *list)
+{
+        node_t *preds[MAX_LEVELS], *succs[MAX_LEVELS], *node = NULL;
+        bool null_p = TRUE;
+        uintptr_t expected;
+        int i, level;
+
+        level = node_level(thread);
+        raise_level(level, list);
+        while (TRUE){
+                if (find(key, preds, succs, list)){
+                        if (node != NULL){
+                                /* Never published. */
+                                list->allocator.free_cb(node);
+                        }
+                        if (replace_p){
+                                write_value(data != NULL ? data : &null_p,
+                                            succs[0], list);
+                        }
+                        return FALSE;
+                }
+                if (node == NULL){
+                        node = alloc_node(key, data, level, list);
+                }
+                for (i = 0; i <= level; ++i){
+                        node->nexts[i] = (uintptr_t) succs[i];
+                }
+                /* Counted first, a deleter may come before the add. */
+                PIOJO_ATOMIC_ADD(&list->ecount, 1);
+                expected = (uintptr_t) succs[0];
+                if (PIOJO_ATOMIC_CAS(&preds[0]->nexts[0], &expected,
+                                     (uintptr_t) node)){
+                        break;
+                }
+                PIOJO_ATOMIC_ADD(&list->ecount, (size_t) -1);
+        }
+        link_levels(node, preds, succs, list);
+        release(node, thread, list);
+        return TRUE;
+}
+
+/*
+ * Links the upper levels of a node already linked at the bottom one.
+ * Stops once the node gets deleted, the deleter may have unlinked it
+ * before the last level was linked, so it's unlinked again.
+ */
+static void
+link_levels(node_t *node, node_t **preds, node_t **succs,
+            piojo_cskiplist_t *list)
+{
+        uintptr_t link, expected;
+        bool deleted_p = FALSE;
+        int i;
+
+        for (i = 1; i <= node->level && ! deleted_p; ++i){
+                while (TRUE){
+                        link = PIOJO_ATOMIC_LOAD(&node->nexts[i]);
+                        if (marked_p(link) ||
+                            (link != (uintptr_t) succs[i] &&
+                             ! PIOJO_ATOMIC_CAS(&node->nexts[i], &link,
+                                                (uintptr_t) succs[i]))){
+                                deleted_p = TRUE;
+                                break;
+                        }
+                        expected = (uintptr_t) succs[i];
+                        if (PIOJO_ATOMIC_CAS(&preds[i]->nexts[i], &expected,
+                                             (uintptr_t) node)){
+                                break;
+                        }
+                        find(node->key, preds, succs, list);
+                        if (succs[0] != node){
+                                deleted_p = TRUE;
+                                break;
+                        }
+                }
+        }
+        if (marked_p(PIOJO_ATOMIC_LOAD(&node->nexts[0]))){
+                unlink_node(node, list);
+        }
+}
+
+/* Marks the upper levels top-down, the bottom one decides the deleter. */
+static void
+mark_levels(node_t *node)
+{
+        uintptr_t link;
+        int i;
+
+        for (i = node->level; i > 0; --i){
+                link = PIOJO_ATOMIC_LOAD(&node->nexts[i]);
+                while (! marked_p(link) &&
+                       ! PIOJO_ATOMIC_CAS(&node->nexts[i], &link,
+                                          link | DELETED_MARK)){
+                }
+        }
+}
+
+/*
+ * Both the deleter and the inserter unlink the node before releasing it,
+ * the last one retires it.
+ */
+static void
+release(node_t *node, piojo_cskiplist_thread_t *thread,
+        piojo_cskiplist_t *list)
+{
+        if (PIOJO_ATOMIC_ADD(&node->refs, (size_t) -1) != 1){
+                return;
+        }
+        node->epoch = PIOJO_ATOMIC_LOAD(&list->epoch);
+        node->retired = thread->retired;
+        thread->retired = node;
+        if (++thread->rcount >= RECLAIM_BATCH){
+                reclaim_retired(thread, list);
+        }
+}
+
+static void
+reclaim_retired(piojo_cskiplist_thread_t *thread, piojo_cskiplist_t *list)
+{
+        piojo_cskiplist_thread_t *other;
+        node_t *node, **link;
+        uint64_t minepoch, epoch;
+
+        if (thread->retired == NULL){
+                return;
+        }
+
+        /* New operations won't see nodes retired up to now. */
+        minepoch = PIOJO_ATOMIC_ADD(&list->epoch, 1) + 1;
+        PIOJO_ATOMIC_FENCE();
+        for (other = PIOJO_ATOMIC_LOAD(&list->threads); other != NULL;
+             other = other->next){
+                epoch = PIOJO_ATOMIC_LOAD(&other->epoch);
+                if (epoch != QUIESCENT_EPOCH && epoch < minepoch){
+                        minepoch = epoch;
+                }
+        }
+
+        link = &thread->retired;
+        while (*link != NULL){
+                node = *link;
+                if (node->epoch < minepoch){
+                        *link = node->retired;
+                        list->allocator.free_cb(node);
+                        --thread->rcount;
+                }else{
+                        link = &node->retired;
+                }
+        }
+}
+
+/* Announces the epoch before reading any shared pointer. */
+static void
+enter(piojo_cskiplist_thread_t *thread, const piojo_cskiplist_t *list)
+{
+        PIOJO_ATOMIC_STORE(&thread->epoch, PIOJO_ATOMIC_LOAD(&list->epoch));
+        PIOJO_ATOMIC_FENCE();
+}
+
+static void
+leave(piojo_cskiplist_thread_t *thread)
+{
+        PIOJO_ATOMIC_STORE(&thread->epoch, QUIESCENT_EPOCH);
+}
+
+/* Value writers may be descheduled, so waiters eventually yield. */
+static void
+backoff(size_t *spins)
+{
+        if (++*spins % SPINS_PER_YIELD == 0){
+                sched_yield();
+        }else{
+#if (defined(__GNUC__) || defined(__clang__)) && \
+        (defined(__x86_64__) || defined(__i386__))
+                __builtin_ia32_pause();
+#endif
+        }
+}
+
+static void
+read_value(void *data, const node_t *node, const piojo_cskiplist_t *list)
+{
+        uint64_t version;
+        size_t spins = 0;
+
+        while (TRUE){
+                version = PIOJO_ATOMIC_LOAD(&node->version);
+                if ((version & 1) == 0){
+                        memcpy(data, node->data, list->evsize);
+                        PIOJO_ATOMIC_LOAD_FENCE();
+                        if (PIOJO_ATOMIC_LOAD(&node->version) == version){
+                                return;
+                        }
+                }
+                backoff(&spins);
+        }
+}
+
+static void
+write_value(const void *data, node_t *node, const piojo_cskiplist_t *list)
+{
+        uint64_t version;
+        size_t spins = 0;
+
+        while (TRUE){
+                version = PIOJO_ATOMIC_LOAD(&node->version);
+                if ((version & 1) == 0 &&
+                    PIOJO_ATOMIC_CAS(&node->version, &version, version + 1)){
+                        break;
+                }
+                backoff(&spins);
+        }
+        memcpy(node->data, data, list->evsize);
+        PIOJO_ATOMIC_STORE(&node->version, version + 2);
+}
+
+static int
+key_cmp(const void *k1, const void *k2, const piojo_cskiplist_t *list)
+{
+        switch (list->keytype){
+        case PIOJO_KEY_I32:
+                return piojo_key_cmp_i32(k1, k2);
+        case PIOJO_KEY_I64:
+                return piojo_key_cmp_i64(k1, k2);
+        case PIOJO_KEY_SIZ:
+                return piojo_key_cmp_siz(k1, k2);
+        default:
+                return list->cmp_cb(k1, k2);
+        }
+}
+
+/* Keys of the *_i32k/i64k/sizk allocators are compared inline. */
+static piojo_keytype_t
+key_type(piojo_cmp_cb keycmp)
+{
+        if (keycmp == i32_cmp){
+                return PIOJO_KEY_I32;
+        }else if (keycmp == i64_cmp){
+                return PIOJO_KEY_I64;
+        }else if (keycmp == siz_cmp){
+                return PIOJO_KEY_SIZ;
+        }
+        return PIOJO_KEY_CB;
+}
+
+static int
+i32_cmp(const void *e1, const void *e2)
+{
+        int32_t v1 = *(int32_t*) e1;
+        int32_t v2 = *(int32_t*) e2;
+        if (v1 > v2){
+                return 1;
+        }else if (v1 < v2){
+                return -1;
+        }
+        return 0;
+}
+
+static int
+i64_cmp(const void *e1, const void *e2)
+{
+        int64_t v1 = *(int64_t*) e1;
+        int64_t v2 = *(int64_t*) e2;
+        if (v1 > v2){
+                return 1;
+        }else if (v1 < v2){
+                return -1;
+        }
+        return 0;
+}
+
+static int
+siz_cmp(const void *e1, const void *e2)
+{
+        size_t v1 = *(size_t*) e1;
+        size_t v2 = *(size_t*) e2;
+        if (v1 > v2){
+                return 1;
+        }else if (v1 < v2){
+                return -1;
+        }
+        return 0;
+}
@@ -48,6 +48,7 @@ typedef struct {
         piojo_graph_weight_t score;     /* Used by A* algorithm. */
         mark_t mark;                    /* Useb by several algorithms. */
         size_t counter;                 /* Used by DFS/BFS/sort algorithms. */
+        piojo_heap_handle_t handle;     /* Used by path algorithms. */
 } alist_t;
 
 typedef struct {
@@ -67,6 +68,7 @@ const size_t piojo_graph_sizeof = sizeof(piojo_graph_t);
 static const size_t DEFAULT_EDGE_COUNT = 8;
 static const piojo_graph_weight_t WEIGHT_INF = (1 << FLT_MANT_DIG) - 1;
 static const piojo_graph_weight_t WEIGHT_MAX = (1 << FLT_MANT_DIG) - 2;
+static const piojo_heap_handle_t NO_HANDLE = SIZE_MAX;
 /** @hideinitializer Maximum weight, greater values will be capped to it. */
 const piojo_graph_weight_t PIOJO_GRAPH_WEIGHT_MAX = (1 << FLT_MANT_DIG) - 2;
 
@@ -107,14 +109,14 @@ alloc_prioq(piojo_heap_leq_cb leq, const piojo_graph_t *graph);
 static void
 free_prioq(piojo_heap_t *prioq);
 
-static void
+static piojo_heap_handle_t
 insert_prioq(piojo_opaque_t data, piojo_heap_t *prioq);
 
 static void
-update_prioq(piojo_opaque_t data, piojo_heap_t *prioq);
+update_prioq(piojo_heap_handle_t handle, piojo_heap_t *prioq);
 
 static bool
-in_prioq(piojo_opaque_t data, piojo_heap_t *prioq);
+in_prioq(piojo_heap_handle_t handle, piojo_heap_t *prioq);
 
 static piojo_opaque_t
 del_min_prioq(piojo_heap_t *prioq);
@@ -824,9 +826,11 @@ piojo_graph_a_star(piojo_graph_vid_t root, piojo_graph_vid_t dst,
         PIOJO_ASSERT(v->score >= 0);
 
         /* Relax the nearest vertex on each iteration. */
-        insert_prioq((piojo_opaque_t)v, openset);
+        v->handle = insert_prioq((piojo_opaque_t)v, openset);
         while (! empty_prioq_p(openset)){
                 v = (alist_t*)del_min_prioq(openset);
+                /* Popped handles are reused by later inserts. */
+                v->handle = NO_HANDLE;
                 if (v->vid == dst){
                         break;
                 }
@@ -1019,6 +1023,7 @@ reset_attributes(const piojo_graph_t *graph)
                 alist->weight = WEIGHT_INF;
                 alist->score = WEIGHT_INF;
                 alist->mark = MARK_UNKNOWN;
+                alist->handle = NO_HANDLE;
                 vid = ((const piojo_graph_vid_t*)
                        piojo_hash_next(vid, graph->alists_by_vid, (void**)&alist));
         }
@@ -1071,7 +1076,7 @@ alloc_prioq(piojo_heap_leq_cb leq, const piojo_graph_t *graph)
         ator.alloc_cb = graph->allocator.alloc_cb;
         ator.realloc_cb = graph->allocator.realloc_cb;
         ator.free_cb = graph->allocator.free_cb;
-        return piojo_heap_alloc_cb(leq, ator);
+        return piojo_heap_alloc_mode(PIOJO_HEAP_MODE_HANDLE, leq, ator);
 }
 
 static void
@@ -1080,22 +1085,22 @@ free_prioq(piojo_heap_t *prioq)
         piojo_heap_free(prioq);
 }
 
-static void
+static piojo_heap_handle_t
 insert_prioq(piojo_opaque_t data, piojo_heap_t *prioq)
 {
-        piojo_heap_push(data, prioq);
+        return piojo_heap_push_handle(data, prioq);
 }
 
 static void
-update_prioq(piojo_opaque_t data, piojo_heap_t *prioq)
+update_prioq(piojo_heap_handle_t handle, piojo_heap_t *prioq)
 {
-        piojo_heap_decrease(data, prioq);
+        piojo_heap_decrease_handle(handle, prioq);
 }
 
 static bool
-in_prioq(piojo_opaque_t data, piojo_heap_t *prioq)
+in_prioq(piojo_heap_handle_t handle, piojo_heap_t *prioq)
 {
-        return piojo_heap_contain_p(data, prioq);
+        return piojo_heap_contain_handle_p(handle, prioq);
 }
 
 static piojo_opaque_t
@@ -1123,9 +1128,11 @@ dijkstra_search(piojo_graph_vid_t root, const piojo_graph_vid_t *dst,
 
         /* Relax the nearest (unvisited) vertex on each iteration. */
         v->weight = 0;
-        insert_prioq((piojo_opaque_t)v, prioq);
+        v->handle = insert_prioq((piojo_opaque_t)v, prioq);
         while (! empty_prioq_p(prioq)){
                 v = (alist_t *)del_min_prioq(prioq);
+                /* Popped handles are reused by later inserts. */
+                v->handle = NO_HANDLE;
                 if (dst != NULL && v->vid == *dst){
                         break;
                 }
@@ -1163,10 +1170,11 @@ dijkstra_relax(alist_t *v, const piojo_graph_t *graph,
                 if (dist < nv->weight){
                         if (nv->weight == WEIGHT_INF){
                                 nv->weight = dist;
-                                insert_prioq((piojo_opaque_t)nv, prioq);
+                                nv->handle = insert_prioq((piojo_opaque_t)nv,
+                                                          prioq);
                         }else{
                                 nv->weight = dist;
-                                update_prioq((piojo_opaque_t)nv, prioq);
+                                update_prioq(nv->handle, prioq);
                         }
                         if (prevs != NULL){
                                 piojo_hash_set(&nv->vid, &v->vid, prevs);
@@ -1232,7 +1240,7 @@ a_star_relax(alist_t *v, piojo_graph_vid_t dst,
                         dist = WEIGHT_MAX;
                 }
 
-                open_p = in_prioq((piojo_opaque_t)nv, openset);
+                open_p = in_prioq(nv->handle, openset);
                 if (! open_p || dist < nv->weight){
                         nv->weight = dist;
                         hw = h(nv->vid, dst, graph);
@@ -1243,9 +1251,10 @@ a_star_relax(alist_t *v, piojo_graph_vid_t dst,
                         }
                         nv->score = fscore;
                         if (! open_p){
-                                insert_prioq((piojo_opaque_t)nv, openset);
+                                nv->handle = insert_prioq((piojo_opaque_t)nv,
+                                                          openset);
                         }else{
-                                update_prioq((piojo_opaque_t)nv, openset);
+                                update_prioq(nv->handle, openset);
                         }
                         if (prevs != NULL){
                                 piojo_hash_set(&nv->vid, &v->vid, prevs);
@@ -29,6 +29,13 @@
  * Piojo Hash Table implementation.
  */
 
+/* Must be defined before any system header for mmap(). */
+#define _POSIX_C_SOURCE 200112L
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
 #include <piojo/piojo_hash.h>
 #include <piojo_defs.h>
 
@@ -36,6 +43,13 @@ typedef struct entry_t entry_t;
 struct entry_t {
         void *key, *value;
         entry_t *next;
+        uint32_t hval;
+};
+
+/* Chained entries are carved from slabs, freed entries are reused. */
+typedef struct slab_t slab_t;
+struct slab_t {
+        slab_t *next;
 };
 
 typedef struct {
@@ -50,10 +64,22 @@ typedef enum {
 } insert_t;
 
 struct piojo_hash_t {
-        entry_t **buckets;
-        size_t eksize, evsize, ecount, bucketcnt;
-        piojo_eq_cb eq_cb;
+        piojo_hash_mode_t mode;
+        entry_t **buckets, **oldbuckets;
+        uint8_t *ctrl, *slots;
+        size_t eksize, evsize, ecount, bucketcnt, slotsize, delcnt;
+        size_t oldcnt, rehashidx;
+        slab_t *slabs;
+        entry_t *freelist;
+        uint8_t *slabnext;
+        size_t entrysize, slabcnt, slabfree;
+        uint64_t seed;
+        piojo_hasher_if hasher;
+        piojo_keytype_t keytype;
         piojo_alloc_if allocator;
+        uint8_t *mapping;
+        size_t mapsize;
+        bool readonly_p;
 };
 /** @hideinitializer Size of hash table in bytes */
 const size_t piojo_hash_sizeof = sizeof(piojo_hash_t);
@@ -62,27 +88,99 @@ static const double GROWTH_FACTOR = 1.5f;
 static const size_t INITIAL_BUCKET_COUNT = 32;
 static const double LOAD_RATIO_MAX = 0.8f;
 
+/*
+ * Incremental mode: after growing, old buckets are kept and migrated
+ * REHASH_STEP buckets per insertion/deletion. Buckets are indexed as
+ * [new buckets][old buckets] while both arrays are in use.
+ */
+static const size_t REHASH_STEP = 4;
+static const size_t REHASH_EMPTY_VISITS = 10;
+
+static const size_t SLAB_ENTRIES_MIN = 16;
+static const size_t SLAB_ENTRIES_MAX = 4096;
+
+/* Keys hashed and prefetched at once by batch operations. */
+#define BATCH_WIDTH 16
+
+/*
+ * Open addressing (flat) mode: one control byte per slot, slots are
+ * probed in groups of GROUP_WIDTH. A full slot stores the low 7 bits
+ * of the key hash, empty and deleted slots have the high bit set.
+ */
+#define GROUP_WIDTH 16
+#define CTRL_EMPTY ((uint8_t)0x80)
+#define CTRL_DELETED ((uint8_t)0xfe)
+#define CTRL_FULL_P(c) ((c) < 0x80)
+#define FLAT_H1(h) ((h) >> 7)
+#define FLAT_H2(h) ((uint8_t)((h) & 0x7f))
+static const size_t FLAT_NOT_FOUND = SIZE_MAX;
+
+/*
+ * Snapshot file: a header followed by the flat mode slots as they are
+ * in memory (control bytes, then key/value slots), so a mapped file is
+ * searched in place. Only readable on the same byte order and word size.
+ */
+typedef struct {
+        char magic[8];
+        uint32_t version, byteorder;
+        uint32_t keykind, groupwidth;
+        uint64_t wordsize, eksize, evsize, bucketcnt, ecount, delcnt, seed;
+} snapshot_t;
+
+static const char SNAPSHOT_MAGIC[8] = "PIOJOHT";
+static const uint32_t SNAPSHOT_VERSION = 2;
+static const uint32_t SNAPSHOT_BYTEORDER = 0x01020304;
+static const size_t SNAPSHOT_ALIGN = 64;
+/* Snapshots are written next to the file they replace. */
+static const char SNAPSHOT_TMP_FORMAT[] = "%s.%ld.tmp";
+
+static uint64_t
+calc_hash(const void *key, const piojo_hash_t *hash);
+
 static uint32_t
-calc_hash(const unsigned char *buf, size_t len);
+entry_hash(const void *key, const piojo_hash_t *hash);
+
+static bool
+entry_eq_p(const void *key, uint32_t hval, const entry_t *kv,
+           const piojo_hash_t *hash);
 
 static piojo_hash_t*
-alloc_hash(size_t evsize, piojo_eq_cb keyeq, size_t eksize,
-           piojo_alloc_if allocator, size_t bucketcnt);
+alloc_hash(piojo_hash_mode_t mode, size_t evsize, piojo_hasher_if hasher,
+           size_t eksize, piojo_alloc_if allocator, size_t bucketcnt);
 
 static entry_t*
 insert_entry(entry_t *newkv, insert_t op, piojo_hash_t *hash);
 
 static iter_t
-search_entry(const void *key, const piojo_hash_t *hash);
+search_entry(const void *key, uint32_t hval, const piojo_hash_t *hash);
+
+static bool
+insert_hashed(const void *key, const void *data, uint64_t hval,
+              piojo_hash_t *hash);
+
+static void*
+search_hashed(const void *key, uint64_t hval, const piojo_hash_t *hash);
+
+static void
+prefetch_batch(const uint8_t *keys, size_t n, uint64_t *hvals,
+               const piojo_hash_t *hash);
+
+static iter_t
+search_bucket(const void *key, uint32_t hval, size_t bidx,
+              const piojo_hash_t *hash);
 
 static void
 delete_entry(iter_t iter, piojo_hash_t *hash);
 
 static entry_t*
-init_entry(const void *key, const void *data, const piojo_hash_t *hash);
+init_entry(const void *key, const void *data, uint32_t hval,
+           piojo_hash_t *hash);
 
 static void
-finish_entry(const piojo_hash_t *hash, entry_t *kv);
+finish_entry(piojo_hash_t *hash, entry_t *kv);
+
+static void
+alloc_slab(piojo_hash_t *hash);
 
 static void
 finish_all(const piojo_hash_t *hash);
@@ -93,6 +191,64 @@ next_valid_entry(iter_t *iter);
 static void
 expand_table(piojo_hash_t *hash);
 
+static void
+rehash_buckets(size_t n, piojo_hash_t *hash);
+
+static size_t
+chain_bucketcnt(const piojo_hash_t *hash);
+
+static entry_t**
+chain_bucket(size_t bidx, const piojo_hash_t *hash);
+
+static const void*
+cursor_forward(size_t bidx, const piojo_hash_t *hash,
+               piojo_hash_cursor_t *cursor);
+
+static const void*
+cursor_backward(size_t bidx, const piojo_hash_t *hash,
+                piojo_hash_cursor_t *cursor);
+
+static const void*
+cursor_key(const piojo_hash_cursor_t *cursor, const piojo_hash_t *hash);
+
+static void
+flat_alloc_slots(size_t slotcnt, piojo_hash_t *hash);
+
+static size_t
+flat_search(const void *key, uint64_t hval, const piojo_hash_t *hash);
+
+static size_t
+flat_insert(const void *key, const void *data, uint64_t hval,
+            piojo_hash_t *hash, bool *new_p);
+
+static void
+flat_delete(size_t idx, piojo_hash_t *hash);
+
+static size_t
+flat_next_full(size_t idx, const piojo_hash_t *hash);
+
+static void
+flat_resize(size_t slotcnt, piojo_hash_t *hash);
+
+static void
+flat_free_slots(uint8_t *ctrl, piojo_hash_t *hash);
+
+static piojo_hash_t*
+flat_compact_copy(const piojo_hash_t *hash);
+
+static bool
+key_eq(const void *k1, const void *k2, const piojo_hash_t *hash);
+
+static piojo_keytype_t
+key_type(piojo_hasher_if hasher);
+
+static size_t
+snapshot_offset(void);
+
+static piojo_hash_t*
+open_mapped(const char *path, const piojo_hasher_if *hasher,
+            piojo_alloc_if allocator);
+
 static bool
 i32_eq(const void *e1, const void *e2);
 
@@ -102,6 +258,10 @@ i64_eq(const void *e1, const void *e2);
 static bool
 siz_eq(const void *e1, const void *e2);
 
+static const piojo_hasher_if I32_HASHER = { piojo_i32_hash, i32_eq };
+static const piojo_hasher_if I64_HASHER = { piojo_i64_hash, i64_eq };
+static const piojo_hasher_if SIZ_HASHER = { piojo_siz_hash, siz_eq };
+
 /**
  * Allocates a new hash table.
  * Uses default allocator and key size of @b int32_t.
@@ -148,8 +308,8 @@ piojo_hash_alloc_sizk(size_t evsize)
 piojo_hash_t*
 piojo_hash_alloc_cb_i32k(size_t evsize, piojo_alloc_if allocator)
 {
-        return piojo_hash_alloc_cb_eq(evsize, i32_eq, sizeof(int32_t),
-                                      allocator);
+        return piojo_hash_alloc_mode_i32k(PIOJO_HASH_MODE_CHAIN, evsize,
+                                          allocator);
 }
 
 /**
@@ -162,8 +322,8 @@ piojo_hash_alloc_cb_i32k(size_t evsize, piojo_alloc_if allocator)
 piojo_hash_t*
 piojo_hash_alloc_cb_i64k(size_t evsize, piojo_alloc_if allocator)
 {
-        return piojo_hash_alloc_cb_eq(evsize, i64_eq, sizeof(int64_t),
-                                      allocator);
+        return piojo_hash_alloc_mode_i64k(PIOJO_HASH_MODE_CHAIN, evsize,
+                                          allocator);
 }
 
 /**
@@ -176,8 +336,8 @@ piojo_hash_alloc_cb_i64k(size_t evsize, piojo_alloc_if allocator)
 piojo_hash_t*
 piojo_hash_alloc_cb_sizk(size_t evsize, piojo_alloc_if allocator)
 {
-        return piojo_hash_alloc_cb_eq(evsize, siz_eq, sizeof(size_t),
-                                      allocator);
+        return piojo_hash_alloc_mode_sizk(PIOJO_HASH_MODE_CHAIN, evsize,
+                                          allocator);
 }
 
 /**
@@ -207,7 +367,101 @@ piojo_hash_t*
 piojo_hash_alloc_cb_eq(size_t evsize, piojo_eq_cb keyeq, size_t eksize,
                        piojo_alloc_if allocator)
 {
-        return alloc_hash(evsize, keyeq, eksize, allocator,
+        return piojo_hash_alloc_mode_eq(PIOJO_HASH_MODE_CHAIN, evsize, keyeq,
+                                        eksize, allocator);
+}
+
+/**
+ * Allocates a new hash table.
+ * Uses key size of @b int32_t.
+ * @param[in] mode Table layout.
+ * @param[in] evsize Entry value size in bytes.
+ * @param[in] allocator Allocator to be used.
+ * @return New hash table.
+ */
+piojo_hash_t*
+piojo_hash_alloc_mode_i32k(piojo_hash_mode_t mode, size_t evsize,
+                           piojo_alloc_if allocator)
+{
+        return piojo_hash_alloc_mode_hash(mode, evsize, I32_HASHER,
+                                          sizeof(int32_t), allocator);
+}
+
+/**
+ * Allocates a new hash table.
+ * Uses key size of @b int64_t.
+ * @param[in] mode Table layout.
+ * @param[in] evsize Entry value size in bytes.
+ * @param[in] allocator Allocator to be used.
+ * @return New hash table.
+ */
+piojo_hash_t*
+piojo_hash_alloc_mode_i64k(piojo_hash_mode_t mode, size_t evsize,
+                           piojo_alloc_if allocator)
+{
+        return piojo_hash_alloc_mode_hash(mode, evsize, I64_HASHER,
+                                          sizeof(int64_t), allocator);
+}
+
+/**
+ * Allocates a new hash table.
+ * Uses key size of @b size_t.
+ * @param[in] mode Table layout.
+ * @param[in] evsize Entry value size in bytes.
+ * @param[in] allocator Allocator to be used.
+ * @return New hash table.
+ */
+piojo_hash_t*
+piojo_hash_alloc_mode_sizk(piojo_hash_mode_t mode, size_t evsize,
+                           piojo_alloc_if allocator)
+{
+        return piojo_hash_alloc_mode_hash(mode, evsize, SIZ_HASHER,
+                                          sizeof(size_t), allocator);
+}
+
+/**
+ * Allocates a new hash table.
+ * Keys are hashed with piojo_bytes_hash().
+ * @param[in] mode Table layout.
+ * @param[in] evsize Entry value size in bytes.
+ * @param[in] keyeq Entry key equality function.
+ * @param[in] eksize Entry key size in bytes.
+ * @param[in] allocator Allocator to be used.
+ * @return New hash table.
+ */
+piojo_hash_t*
+piojo_hash_alloc_mode_eq(piojo_hash_mode_t mode, size_t evsize,
+                         piojo_eq_cb keyeq, size_t eksize,
+                         piojo_alloc_if allocator)
+{
+        piojo_hasher_if hasher;
+        hasher.hash_cb = piojo_bytes_hash;
+        hasher.eq_cb = keyeq;
+        return piojo_hash_alloc_mode_hash(mode, evsize, hasher, eksize,
+                                          allocator);
+}
+
+/**
+ * Allocates a new hash table.
+ * Each table gets a random seed for @a hasher, so iteration order
+ * differs between tables.
+ * With ::PIOJO_HASH_MODE_FLAT, pointers to keys and values are
+ * invalidated by insertions.
+ * Otherwise entries are allocated in slabs and reused after deletion,
+ * memory is released by piojo_hash_clear() and piojo_hash_free().
+ * @param[in] mode Table layout.
+ * @param[in] evsize Entry value size in bytes.
+ * @param[in] hasher Entry key hash and equality functions.
+ * @param[in] eksize Entry key size in bytes.
+ * @param[in] allocator Allocator to be used.
+ * @return New hash table.
+ */
+piojo_hash_t*
+piojo_hash_alloc_mode_hash(piojo_hash_mode_t mode, size_t evsize,
+                           piojo_hasher_if hasher, size_t eksize,
+                           piojo_alloc_if allocator)
+{
+        return alloc_hash(mode, evsize, hasher, eksize, allocator,
                           INITIAL_BUCKET_COUNT);
 }
 
@@ -224,11 +478,20 @@ piojo_hash_copy(const piojo_hash_t *hash)
         entry_t *kv;
         PIOJO_ASSERT(hash);
 
-        newhash = alloc_hash(hash->evsize, hash->eq_cb, hash->eksize,
-                             hash->allocator, hash->bucketcnt);
+        newhash = alloc_hash(hash->mode, hash->evsize, hash->hasher,
+                             hash->eksize, hash->allocator, hash->bucketcnt);
+        newhash->seed = hash->seed;
+
+        if (hash->mode == PIOJO_HASH_MODE_FLAT){
+                memcpy(newhash->ctrl, hash->ctrl,
+                       hash->bucketcnt * (1 + hash->slotsize));
+                newhash->ecount = hash->ecount;
+                newhash->delcnt = hash->delcnt;
+                return newhash;
+        }
 
-        for (bidx = 0; bidx < hash->bucketcnt; ++bidx){
-                kv = hash->buckets[bidx];
+        for (bidx = 0; bidx < chain_bucketcnt(hash); ++bidx){
+                kv = *chain_bucket(bidx, hash);
                 while (kv != NULL){
                         insert_entry(kv, INSERT_NEW, newhash);
                         kv = kv->next;
@@ -249,9 +512,15 @@ piojo_hash_free(const piojo_hash_t *hash)
 {
         PIOJO_ASSERT(hash);
 
-        finish_all(hash);
-
-        hash->allocator.free_cb(hash->buckets);
+        if (hash->mode == PIOJO_HASH_MODE_FLAT){
+                flat_free_slots(hash->ctrl, (piojo_hash_t*) hash);
+        }else{
+                finish_all(hash);
+                hash->allocator.free_cb(hash->buckets);
+                if (hash->oldbuckets != NULL){
+                        hash->allocator.free_cb(hash->oldbuckets);
+                }
+        }
         hash->allocator.free_cb(hash);
 }
 
@@ -264,9 +533,22 @@ piojo_hash_clear(piojo_hash_t *hash)
 {
         PIOJO_ASSERT(hash);
 
-        finish_all(hash);
-
-        memset(hash->buckets, 0, hash->bucketcnt * sizeof(entry_t*));
+        if (hash->mode == PIOJO_HASH_MODE_FLAT){
+                PIOJO_ASSERT(! hash->readonly_p);
+                memset(hash->ctrl, CTRL_EMPTY, hash->bucketcnt);
+                hash->delcnt = 0;
+        }else{
+                finish_all(hash);
+                hash->slabs = NULL;
+                hash->freelist = NULL;
+                hash->slabcnt = hash->slabfree = 0;
+                memset(hash->buckets, 0, hash->bucketcnt * sizeof(entry_t*));
+                if (hash->oldbuckets != NULL){
+                        hash->allocator.free_cb(hash->oldbuckets);
+                        hash->oldbuckets = NULL;
+                        hash->oldcnt = hash->rehashidx = 0;
+                }
+        }
         hash->ecount = 0;
 }
 
@@ -293,24 +575,49 @@ piojo_hash_size(const piojo_hash_t *hash)
 bool
 piojo_hash_insert(const void *key, const void *data, piojo_hash_t *hash)
 {
-        entry_t kv;
-        double lratio;
         PIOJO_ASSERT(hash);
         PIOJO_ASSERT(key);
         PIOJO_ASSERT(data || hash->evsize == sizeof(bool));
 
-        lratio = (double) hash->ecount / hash->bucketcnt;
-        if (lratio > LOAD_RATIO_MAX){
-                expand_table(hash);
-        }
+        return insert_hashed(key, data, calc_hash(key, hash), hash);
+}
 
-        kv.key = (void*) key;
-        kv.value = (void*) data;
-        if (insert_entry(&kv, INSERT_NEW, hash) == NULL){
-                ++hash->ecount;
-                return TRUE;
+/**
+ * Inserts @a n new entries.
+ * Keys are hashed and their buckets prefetched in small groups before
+ * being inserted, so cache misses overlap.
+ * If @a data is @b NULL, values are replaced with @b TRUE (useful for sets).
+ * @param[in] keys Array of @a n entry keys.
+ * @param[in] data Array of @a n entry values, can be @b NULL.
+ * @param[in] n Number of entries.
+ * @param[out] hash Hash table being modified.
+ * @return Number of inserted entries (duplicate keys are skipped).
+ */
+size_t
+piojo_hash_insert_batch(const void *keys, const void *data, size_t n,
+                        piojo_hash_t *hash)
+{
+        uint64_t hvals[BATCH_WIDTH];
+        size_t i, j, cnt, inscnt = 0;
+        const uint8_t *key = (const uint8_t*) keys;
+        const uint8_t *value = (const uint8_t*) data;
+        PIOJO_ASSERT(hash);
+        PIOJO_ASSERT(keys || n == 0);
+        PIOJO_ASSERT(data || hash->evsize == sizeof(bool));
+
+        for (i = 0; i < n; i += cnt){
+                cnt = (n - i < BATCH_WIDTH ? n - i : BATCH_WIDTH);
+                prefetch_batch(key, cnt, hvals, hash);
+                for (j = 0; j < cnt; ++j, key += hash->eksize){
+                        if (insert_hashed(key, value, hvals[j], hash)){
+                                ++inscnt;
+                        }
+                        if (value != NULL){
+                                value += hash->evsize;
+                        }
+                }
         }
-        return FALSE;
+        return inscnt;
 }
 
 /**
@@ -325,12 +632,28 @@ bool
 piojo_hash_set(const void *key, const void *data, piojo_hash_t *hash)
 {
         entry_t kv, *oldkv;
+        size_t idx;
+        bool new_p;
         PIOJO_ASSERT(hash);
         PIOJO_ASSERT(key);
         PIOJO_ASSERT(data || hash->evsize == sizeof(bool));
 
+        if (hash->mode == PIOJO_HASH_MODE_FLAT){
+                idx = flat_insert(key, data, calc_hash(key, hash), hash,
+                                  &new_p);
+                if (! new_p && data != NULL){
+                        memcpy(hash->slots + idx * hash->slotsize +
+                               hash->eksize, data, hash->evsize);
+                }
+                return new_p;
+        }
+
+        if (hash->oldbuckets != NULL){
+                rehash_buckets(REHASH_STEP, hash);
+        }
         kv.key = (void*) key;
         kv.value = (void*) data;
+        kv.hval = entry_hash(key, hash);
         oldkv = insert_entry(&kv, INSERT_NEW, hash);
         if (oldkv == NULL){
                 ++hash->ecount;
@@ -352,18 +675,43 @@ piojo_hash_set(const void *key, const void *data, piojo_hash_t *hash)
 void*
 piojo_hash_search(const void *key, const piojo_hash_t *hash)
 {
-        iter_t iter;
         PIOJO_ASSERT(hash);
         PIOJO_ASSERT(key);
 
-        iter = search_entry(key, hash);
-        if (iter.table != NULL){
-                if (iter.prev == NULL){
-                        return hash->buckets[iter.bidx]->value;
+        return search_hashed(key, calc_hash(key, hash), hash);
+}
+
+/**
+ * Searches @a n entries by key.
+ * Keys are hashed and their buckets prefetched in small groups before
+ * being searched, so cache misses overlap.
+ * @param[in] keys Array of @a n entry keys.
+ * @param[in] n Number of keys.
+ * @param[out] values Array of @a n entry values, @b NULL for missing keys.
+ * @param[in] hash Hash table.
+ * @return Number of keys found.
+ */
+size_t
+piojo_hash_search_batch(const void *keys, size_t n, void **values,
+                        const piojo_hash_t *hash)
+{
+        uint64_t hvals[BATCH_WIDTH];
+        size_t i, j, cnt, found = 0;
+        const uint8_t *key = (const uint8_t*) keys;
+        PIOJO_ASSERT(hash);
+        PIOJO_ASSERT((keys && values) || n == 0);
+
+        for (i = 0; i < n; i += cnt){
+                cnt = (n - i < BATCH_WIDTH ? n - i : BATCH_WIDTH);
+                prefetch_batch(key, cnt, hvals, hash);
+                for (j = 0; j < cnt; ++j, key += hash->eksize){
+                        values[i + j] = search_hashed(key, hvals[j], hash);
+                        if (values[i + j] != NULL){
+                                ++found;
+                        }
                 }
-                return iter.prev->next->value;
         }
-        return NULL;
+        return found;
 }
 
 /**
@@ -376,10 +724,23 @@ bool
 piojo_hash_delete(const void *key, piojo_hash_t *hash)
 {
         iter_t iter;
+        size_t idx;
         PIOJO_ASSERT(hash);
         PIOJO_ASSERT(key);
 
-        iter = search_entry(key, hash);
+        if (hash->mode == PIOJO_HASH_MODE_FLAT){
+                idx = flat_search(key, calc_hash(key, hash), hash);
+                if (idx != FLAT_NOT_FOUND){
+                        flat_delete(idx, hash);
+                        return TRUE;
+                }
+                return FALSE;
+        }
+
+        if (hash->oldbuckets != NULL){
+                rehash_buckets(REHASH_STEP, hash);
+        }
+        iter = search_entry(key, entry_hash(key, hash), hash);
         if (iter.table != NULL){
                 delete_entry(iter, hash);
                 --hash->ecount;
@@ -388,6 +749,161 @@ piojo_hash_delete(const void *key, piojo_hash_t *hash)
         return FALSE;
 }
 
+/**
+ * Writes a snapshot of @a hash to the file at @a path.
+ * The snapshot has the ::PIOJO_HASH_MODE_FLAT layout, chained tables
+ * are converted first. Entries are copied byte by byte, so keys and
+ * values must not hold pointers. The file can only be opened on
+ * machines with the same byte order and word size.
+ * @param[in] path File path, replaced if it exists. Tables mapped from
+ * the old file keep reading it.
+ * @param[in] hash Hash table.
+ * @return @b TRUE if written, @b FALSE on I/O error.
+ */
+bool
+piojo_hash_save(const char *path, const piojo_hash_t *hash)
+{
+        const piojo_hash_t *flat = hash;
+        snapshot_t hdr;
+        uint8_t pad[SNAPSHOT_ALIGN];
+        size_t size;
+        char *tmppath;
+        FILE *file;
+        bool ok_p;
+        PIOJO_ASSERT(hash);
+        PIOJO_ASSERT(path);
+
+        /*
+         * Truncating the file in place would fault its live mappings, the
+         * snapshot is written aside and renamed over it.
+         */
+        size = (size_t) snprintf(NULL, 0, SNAPSHOT_TMP_FORMAT, path,
+                                 (long) getpid()) + 1;
+        tmppath = (char*) hash->allocator.alloc_cb(size);
+        PIOJO_ASSERT(tmppath);
+        snprintf(tmppath, size, SNAPSHOT_TMP_FORMAT, path, (long) getpid());
+        file = fopen(tmppath, "wb");
+        if (file == NULL){
+                hash->allocator.free_cb(tmppath);
+                return FALSE;
+        }
+        if (hash->mode != PIOJO_HASH_MODE_FLAT){
+                flat = flat_compact_copy(hash);
+        }
+
+        memset(&hdr, 0, sizeof(hdr));
+        memcpy(hdr.magic, SNAPSHOT_MAGIC, sizeof(hdr.magic));
+        hdr.version = SNAPSHOT_VERSION;
+        hdr.byteorder = SNAPSHOT_BYTEORDER;
+        hdr.keykind = (uint32_t) flat->keytype;
+        hdr.groupwidth = GROUP_WIDTH;
+        hdr.wordsize = sizeof(size_t);
+        hdr.eksize = flat->eksize;
+        hdr.evsize = flat->evsize;
+        hdr.bucketcnt = flat->bucketcnt;
+        hdr.ecount = flat->ecount;
+        hdr.delcnt = flat->delcnt;
+        hdr.seed = flat->seed;
+        memset(pad, 0, sizeof(pad));
+
+        size = flat->bucketcnt * (flat->slotsize + 1);
+        ok_p = (fwrite(&hdr, sizeof(hdr), 1, file) == 1 &&
+                fwrite(pad, snapshot_offset() - sizeof(hdr), 1, file) == 1 &&
+                fwrite(flat->ctrl, size, 1, file) == 1 &&
+                fflush(file) == 0 && fsync(fileno(file)) == 0);
+        if (fclose(file) != 0){
+                ok_p = FALSE;
+        }
+        if (ok_p && rename(tmppath, path) != 0){
+                ok_p = FALSE;
+        }
+        if (! ok_p){
+                remove(tmppath);
+        }
+        hash->allocator.free_cb(tmppath);
+        if (flat != hash){
+                piojo_hash_free(flat);
+        }
+        return ok_p;
+}
+
+/**
+ * Maps a snapshot written by piojo_hash_save().
+ * Searches are served from the mapped file, pages are loaded on demand
+ * and shared with other processes mapping the same file. The table is
+ * read-only (returned values must not be modified) until promoted with
+ * piojo_hash_promote(). Uses default allocator, only keys of tables
+ * allocated with @b i32k, @b i64k or @b sizk functions are supported.
+ * @param[in] path Snapshot file path.
+ * @return New ::PIOJO_HASH_MODE_FLAT hash table or @b NULL if the file
+ * can't be mapped or isn't a valid snapshot.
+ */
+piojo_hash_t*
+piojo_hash_open_mapped(const char *path)
+{
+        PIOJO_ASSERT(path);
+        return open_mapped(path, NULL, piojo_alloc_default);
+}
+
+/**
+ * Maps a snapshot written by piojo_hash_save().
+ * Same as piojo_hash_open_mapped(), for any key type.
+ * @param[in] path Snapshot file path.
+ * @param[in] hasher Entry key hash and equality functions, must be the
+ * ones of the saved table.
+ * @param[in] allocator Allocator to be used.
+ * @return New ::PIOJO_HASH_MODE_FLAT hash table or @b NULL if the file
+ * can't be mapped or isn't a valid snapshot.
+ */
+piojo_hash_t*
+piojo_hash_open_mapped_hash(const char *path, piojo_hasher_if hasher,
+                            piojo_alloc_if allocator)
+{
+        PIOJO_ASSERT(path);
+        PIOJO_ASSERT(hasher.hash_cb && hasher.eq_cb);
+        return open_mapped(path, &hasher, allocator);
+}
+
+/**
+ * Makes a mapped hash table mutable.
+ * Pages are copied on first write, the snapshot file isn't modified and
+ * untouched pages stay shared. Does nothing on other tables.
+ * @param[out] hash Hash table.
+ */
+void
+piojo_hash_promote(piojo_hash_t *hash)
+{
+        int ret;
+        PIOJO_ASSERT(hash);
+
+        if (hash->readonly_p){
+                ret = mprotect(hash->mapping, hash->mapsize,
+                               PROT_READ | PROT_WRITE);
+                PIOJO_ASSERT(ret == 0);
+                hash->readonly_p = FALSE;
+        }
+}
+
+/**
+ * Migrates up to @a n buckets after @a hash has grown.
+ * Only ::PIOJO_HASH_MODE_INCR tables migrate buckets incrementally,
+ * this allows finishing the migration in idle time. Searches don't
+ * migrate buckets.
+ * @param[in] n Number of buckets.
+ * @param[out] hash Hash table.
+ * @return @b TRUE if there are buckets left to migrate, @b FALSE otherwise.
+ */
+bool
+piojo_hash_rehash_step(size_t n, piojo_hash_t *hash)
+{
+        PIOJO_ASSERT(hash);
+
+        if (hash->oldbuckets != NULL){
+                rehash_buckets(n, hash);
+        }
+        return (hash->oldbuckets != NULL);
+}
+
 /**
  * Reads the first entry in @a hash.
  * @param[in] hash Hash table.
@@ -398,16 +914,24 @@ const void*
 piojo_hash_first(const piojo_hash_t *hash, void **data)
 {
         size_t bidx = 0;
+        uint8_t *slot;
         PIOJO_ASSERT(hash);
 
-        if (hash->ecount > 0){
-                while (hash->buckets[bidx] == NULL){
+        if (hash->ecount > 0 && hash->mode == PIOJO_HASH_MODE_FLAT){
+                bidx = flat_next_full(0, hash);
+                slot = hash->slots + bidx * hash->slotsize;
+                if (data != NULL){
+                        *data = slot + hash->eksize;
+                }
+                return slot;
+        }else if (hash->ecount > 0){
+                while (*chain_bucket(bidx, hash) == NULL){
                         ++bidx;
                 }
                 if (data != NULL){
-                        *data = hash->buckets[bidx]->value;
+                        *data = (*chain_bucket(bidx, hash))->value;
                 }
-                return hash->buckets[bidx]->key;
+                return (*chain_bucket(bidx, hash))->key;
         }
         return NULL;
 
@@ -424,20 +948,36 @@ piojo_hash_next(const void *key, const piojo_hash_t *hash, void **data)
 {
         iter_t iter;
         entry_t *kv;
+        size_t idx;
+        uint8_t *slot;
         PIOJO_ASSERT(hash);
         PIOJO_ASSERT(key);
 
-        iter = search_entry(key, hash);
+        if (hash->mode == PIOJO_HASH_MODE_FLAT){
+                idx = flat_search(key, calc_hash(key, hash), hash);
+                PIOJO_ASSERT(idx != FLAT_NOT_FOUND);
+                idx = flat_next_full(idx + 1, hash);
+                if (idx == FLAT_NOT_FOUND){
+                        return NULL;
+                }
+                slot = hash->slots + idx * hash->slotsize;
+                if (data != NULL){
+                        *data = slot + hash->eksize;
+                }
+                return slot;
+        }
+
+        iter = search_entry(key, entry_hash(key, hash), hash);
         PIOJO_ASSERT(iter.table != NULL);
 
         if (iter.prev == NULL){
-                iter.prev = hash->buckets[iter.bidx];
+                iter.prev = *chain_bucket(iter.bidx, hash);
         }else{
                 iter.prev = iter.prev->next;
         }
         if (next_valid_entry(&iter) != NULL){
                 if (iter.prev == NULL){
-                        kv = hash->buckets[iter.bidx];
+                        kv = *chain_bucket(iter.bidx, hash);
                 }else{
                         kv = iter.prev->next;
                 }
@@ -449,130 +989,452 @@ piojo_hash_next(const void *key, const piojo_hash_t *hash, void **data)
         return NULL;
 }
 
-/** @}
- * Private functions.
+/**
+ * Positions @a cursor at the first entry in @a hash.
+ * @param[in] hash Hash table.
+ * @param[out] cursor Hash table cursor.
+ * @return first key or @b NULL if @a hash is empty.
  */
+const void*
+piojo_hash_cursor_first(const piojo_hash_t *hash,
+                        piojo_hash_cursor_t *cursor)
+{
+        PIOJO_ASSERT(hash);
+        PIOJO_ASSERT(cursor);
 
-/* 32 bit Fowler/Noll/Vo FNV-1a hash on a buffer. */
-static uint32_t
-calc_hash(const unsigned char *buf, size_t len)
+        return cursor_forward(0, hash, cursor);
+}
+
+/**
+ * Positions @a cursor at the last entry in @a hash.
+ * @param[in] hash Hash table.
+ * @param[out] cursor Hash table cursor.
+ * @return last key or @b NULL if @a hash is empty.
+ */
+const void*
+piojo_hash_cursor_last(const piojo_hash_t *hash,
+                       piojo_hash_cursor_t *cursor)
 {
-        uint32_t hval = (uint32_t)0x811c9dc5;
-        unsigned char *bp = (unsigned char *)buf;
-        unsigned char *be = bp + len;
-        while (bp < be) {
-                /* xor the bottom with the current octet */
-                hval ^= (uint32_t)*bp++;
-                /* multiply by the 32 bit FNV magic prime mod 2^32 */
-                hval *= (uint32_t)0x01000193;
+        PIOJO_ASSERT(hash);
+        PIOJO_ASSERT(cursor);
+
+        if (hash->mode == PIOJO_HASH_MODE_FLAT){
+                return cursor_backward(hash->bucketcnt, hash, cursor);
         }
-        return hval;
+        return cursor_backward(chain_bucketcnt(hash), hash, cursor);
 }
 
-static iter_t*
-next_valid_entry(iter_t *iter)
+/**
+ * Positions @a cursor at the entry with @a key.
+ * @param[in] key Entry key.
+ * @param[in] hash Hash table.
+ * @param[out] cursor Hash table cursor.
+ * @return @a key in @a hash or @b NULL if @a key doesn't exist.
+ */
+const void*
+piojo_hash_cursor_seek(const void *key, const piojo_hash_t *hash,
+                       piojo_hash_cursor_t *cursor)
 {
-        if (iter->prev->next == NULL){
-                iter->prev = NULL;
-                ++iter->bidx;
-                while (iter->bidx < iter->table->bucketcnt &&
-                       iter->table->buckets[iter->bidx] == NULL){
-                        ++iter->bidx;
-                }
-                if (iter->bidx >= iter->table->bucketcnt){
-                        return NULL;
+        iter_t iter;
+        PIOJO_ASSERT(hash);
+        PIOJO_ASSERT(key);
+        PIOJO_ASSERT(cursor);
+
+        cursor->entry = NULL;
+        if (hash->mode == PIOJO_HASH_MODE_FLAT){
+                cursor->bidx = flat_search(key, calc_hash(key, hash), hash);
+                if (cursor->bidx != FLAT_NOT_FOUND){
+                        cursor->entry = hash->slots +
+                                cursor->bidx * hash->slotsize;
                 }
+                return cursor_key(cursor, hash);
         }
-        return iter;
-}
+
+        iter = search_entry(key, entry_hash(key, hash), hash);
+        if (iter.table != NULL){
+                cursor->bidx = iter.bidx;
+                cursor->entry = (iter.prev == NULL ?
+                                 *chain_bucket(iter.bidx, hash) :
+                                 iter.prev->next);
+        }
+        return cursor_key(cursor, hash);
+}
+
+/**
+ * Moves @a cursor to the next entry.
+ * @param[in,out] cursor Hash table cursor.
+ * @param[in] hash Hash table.
+ * @return next key or @b NULL if @a cursor was at the last entry.
+ */
+const void*
+piojo_hash_cursor_next(piojo_hash_cursor_t *cursor,
+                       const piojo_hash_t *hash)
+{
+        entry_t *kv;
+        PIOJO_ASSERT(hash);
+        PIOJO_ASSERT(cursor && cursor->entry);
+
+        if (hash->mode != PIOJO_HASH_MODE_FLAT){
+                kv = (entry_t*) cursor->entry;
+                if (kv->next != NULL){
+                        cursor->entry = kv->next;
+                        return kv->next->key;
+                }
+        }
+        return cursor_forward(cursor->bidx + 1, hash, cursor);
+}
+
+/**
+ * Moves @a cursor to the previous entry.
+ * @param[in,out] cursor Hash table cursor.
+ * @param[in] hash Hash table.
+ * @return previous key or @b NULL if @a cursor was at the first entry.
+ */
+const void*
+piojo_hash_cursor_prev(piojo_hash_cursor_t *cursor,
+                       const piojo_hash_t *hash)
+{
+        entry_t *kv;
+        PIOJO_ASSERT(hash);
+        PIOJO_ASSERT(cursor && cursor->entry);
+
+        if (hash->mode != PIOJO_HASH_MODE_FLAT){
+                kv = *chain_bucket(cursor->bidx, hash);
+                if (kv != cursor->entry){
+                        while (kv->next != cursor->entry){
+                                kv = kv->next;
+                        }
+                        cursor->entry = kv;
+                        return kv->key;
+                }
+        }
+        return cursor_backward(cursor->bidx, hash, cursor);
+}
+
+/**
+ * Returns the entry value at @a cursor.
+ * @param[in] cursor Hash table cursor.
+ * @param[in] hash Hash table.
+ * @return Entry value.
+ */
+void*
+piojo_hash_cursor_value(const piojo_hash_cursor_t *cursor,
+                        const piojo_hash_t *hash)
+{
+        PIOJO_ASSERT(hash);
+        PIOJO_ASSERT(cursor && cursor->entry);
+
+        if (hash->mode == PIOJO_HASH_MODE_FLAT){
+                return (uint8_t*) cursor->entry + hash->eksize;
+        }
+        return ((entry_t*) cursor->entry)->value;
+}
+
+/**
+ * Deletes the entry at @a cursor and moves it to the next entry.
+ * @param[in,out] cursor Hash table cursor.
+ * @param[out] hash Hash table.
+ * @return next key or @b NULL if the deleted entry was the last one.
+ */
+const void*
+piojo_hash_cursor_delete(piojo_hash_cursor_t *cursor, piojo_hash_t *hash)
+{
+        iter_t iter;
+        entry_t *next;
+        PIOJO_ASSERT(hash);
+        PIOJO_ASSERT(cursor && cursor->entry);
+
+        if (hash->mode == PIOJO_HASH_MODE_FLAT){
+                flat_delete(cursor->bidx, hash);
+                return cursor_forward(cursor->bidx + 1, hash, cursor);
+        }
+
+        iter.table = hash;
+        iter.bidx = cursor->bidx;
+        iter.prev = NULL;
+        if (*chain_bucket(iter.bidx, hash) != cursor->entry){
+                iter.prev = *chain_bucket(iter.bidx, hash);
+                while (iter.prev->next != cursor->entry){
+                        iter.prev = iter.prev->next;
+                }
+        }
+        next = ((entry_t*) cursor->entry)->next;
+        delete_entry(iter, hash);
+        --hash->ecount;
+
+        if (next != NULL){
+                cursor->entry = next;
+                return next->key;
+        }
+        return cursor_forward(cursor->bidx + 1, hash, cursor);
+}
+
+/** @}
+ * Private functions.
+ */
+
+static const void*
+cursor_key(const piojo_hash_cursor_t *cursor, const piojo_hash_t *hash)
+{
+        if (cursor->entry == NULL){
+                return NULL;
+        }else if (hash->mode == PIOJO_HASH_MODE_FLAT){
+                return cursor->entry;
+        }
+        return ((entry_t*) cursor->entry)->key;
+}
+
+/* Moves cursor to the first entry at or after bucket/slot bidx. */
+static const void*
+cursor_forward(size_t bidx, const piojo_hash_t *hash,
+               piojo_hash_cursor_t *cursor)
+{
+        cursor->entry = NULL;
+        if (hash->mode == PIOJO_HASH_MODE_FLAT){
+                bidx = flat_next_full(bidx, hash);
+                if (bidx != FLAT_NOT_FOUND){
+                        cursor->bidx = bidx;
+                        cursor->entry = hash->slots + bidx * hash->slotsize;
+                }
+                return cursor_key(cursor, hash);
+        }
+
+        for (; bidx < chain_bucketcnt(hash); ++bidx){
+                if (*chain_bucket(bidx, hash) != NULL){
+                        cursor->bidx = bidx;
+                        cursor->entry = *chain_bucket(bidx, hash);
+                        break;
+                }
+        }
+        return cursor_key(cursor, hash);
+}
+
+/* Moves cursor to the last entry before bucket/slot bidx. */
+static const void*
+cursor_backward(size_t bidx, const piojo_hash_t *hash,
+                piojo_hash_cursor_t *cursor)
+{
+        entry_t *kv;
+
+        cursor->entry = NULL;
+        while (bidx > 0){
+                --bidx;
+                if (hash->mode == PIOJO_HASH_MODE_FLAT &&
+                    CTRL_FULL_P(hash->ctrl[bidx])){
+                        cursor->bidx = bidx;
+                        cursor->entry = hash->slots + bidx * hash->slotsize;
+                        break;
+                }else if (hash->mode != PIOJO_HASH_MODE_FLAT &&
+                          *chain_bucket(bidx, hash) != NULL){
+                        kv = *chain_bucket(bidx, hash);
+                        while (kv->next != NULL){
+                                kv = kv->next;
+                        }
+                        cursor->bidx = bidx;
+                        cursor->entry = kv;
+                        break;
+                }
+        }
+        return cursor_key(cursor, hash);
+}
+
+static uint64_t
+calc_hash(const void *key, const piojo_hash_t *hash)
+{
+        return hash->hasher.hash_cb(key, hash->eksize, hash->seed);
+}
+
+static uint32_t
+entry_hash(const void *key, const piojo_hash_t *hash)
+{
+        return (uint32_t) calc_hash(key, hash);
+}
+
+static bool
+entry_eq_p(const void *key, uint32_t hval, const entry_t *kv,
+           const piojo_hash_t *hash)
+{
+        return kv->hval == hval && key_eq(key, kv->key, hash);
+}
+
+static iter_t*
+next_valid_entry(iter_t *iter)
+{
+        if (iter->prev->next == NULL){
+                iter->prev = NULL;
+                ++iter->bidx;
+                while (iter->bidx < chain_bucketcnt(iter->table) &&
+                       *chain_bucket(iter->bidx, iter->table) == NULL){
+                        ++iter->bidx;
+                }
+                if (iter->bidx >= chain_bucketcnt(iter->table)){
+                        return NULL;
+                }
+        }
+        return iter;
+}
 
 static entry_t*
-init_entry(const void *key, const void *data, const piojo_hash_t *hash)
+init_entry(const void *key, const void *data, uint32_t hval,
+           piojo_hash_t *hash)
 {
         bool null_p = TRUE;
         entry_t *kv;
-        piojo_alloc_if ator = hash->allocator;
-        size_t kvsize, ksize = hash->eksize;
 
         if (data == NULL){
                 data = &null_p;
         }
 
-        PIOJO_ASSERT(piojo_safe_addsiz_p(sizeof(entry_t), ksize));
-        kvsize = sizeof(entry_t) + ksize;
-        PIOJO_ASSERT(piojo_safe_addsiz_p(kvsize, hash->evsize));
-        kvsize += hash->evsize;
-
-        kv = (entry_t*) ator.alloc_cb(kvsize);
-        PIOJO_ASSERT(kv);
+        if (hash->freelist != NULL){
+                kv = hash->freelist;
+                hash->freelist = kv->next;
+        }else{
+                if (hash->slabfree == 0){
+                        alloc_slab(hash);
+                }
+                kv = (entry_t*) hash->slabnext;
+                hash->slabnext += hash->entrysize;
+                --hash->slabfree;
+        }
 
         kv->key = (uint8_t*)kv + sizeof(entry_t);
-        memcpy(kv->key, key, ksize);
+        piojo_key_copy(kv->key, key, hash->eksize);
 
-        kv->value = (uint8_t*)kv->key + ksize;
+        kv->value = (uint8_t*)kv->key + hash->eksize;
         memcpy(kv->value, data, hash->evsize);
 
         kv->next = NULL;
+        kv->hval = hval;
 
         return kv;
 }
 
 static void
-finish_entry(const piojo_hash_t *hash, entry_t *kv)
+finish_entry(piojo_hash_t *hash, entry_t *kv)
 {
-        piojo_alloc_if ator = hash->allocator;
+        kv->next = hash->freelist;
+        hash->freelist = kv;
+}
 
-        ator.free_cb(kv);
+/* Slabs double in size from SLAB_ENTRIES_MIN up to SLAB_ENTRIES_MAX. */
+static void
+alloc_slab(piojo_hash_t *hash)
+{
+        slab_t *slab;
+        size_t cnt = SLAB_ENTRIES_MIN;
+
+        if (hash->slabcnt > 0 && hash->slabcnt < SLAB_ENTRIES_MAX){
+                cnt = hash->slabcnt * 2;
+        }else if (hash->slabcnt > 0){
+                cnt = SLAB_ENTRIES_MAX;
+        }
+
+        PIOJO_ASSERT(piojo_safe_mulsiz_p(cnt, hash->entrysize));
+        PIOJO_ASSERT(piojo_safe_addsiz_p(sizeof(slab_t),
+                                         cnt * hash->entrysize));
+        slab = (slab_t*) hash->allocator.alloc_cb(sizeof(slab_t) +
+                                                  cnt * hash->entrysize);
+        PIOJO_ASSERT(slab);
+
+        slab->next = hash->slabs;
+        hash->slabs = slab;
+        hash->slabnext = (uint8_t*)slab + sizeof(slab_t);
+        hash->slabcnt = hash->slabfree = cnt;
 }
 
 static void
 finish_all(const piojo_hash_t *hash)
 {
-        size_t bidx;
-        entry_t *kv, *next;
-        for (bidx = 0; bidx < hash->bucketcnt; ++bidx){
-                kv = hash->buckets[bidx];
-                while (kv != NULL){
-                        next = kv->next;
-                        finish_entry(hash, kv);
-                        kv = next;
-                }
+        slab_t *slab, *next;
+        slab = hash->slabs;
+        while (slab != NULL){
+                next = slab->next;
+                hash->allocator.free_cb(slab);
+                slab = next;
         }
 }
 
 static void
 expand_table(piojo_hash_t *hash)
 {
-        size_t bidx;
-        entry_t *kv, *nextkv;
-        entry_t **olddata = hash->buckets;
-        size_t newcnt, newsiz, oldcnt = hash->bucketcnt;
+        size_t newcnt, newsiz;
         piojo_alloc_if ator = hash->allocator;
         PIOJO_ASSERT(hash->bucketcnt < SIZE_MAX);
 
+        if (hash->oldbuckets != NULL){
+                rehash_buckets(hash->oldcnt, hash);
+        }
+
         newcnt = hash->bucketcnt * GROWTH_FACTOR;
         PIOJO_ASSERT(newcnt > hash->bucketcnt);
-        hash->bucketcnt = newcnt;
 
-        PIOJO_ASSERT(piojo_safe_mulsiz_p(hash->bucketcnt,
-                                         sizeof(entry_t*)));
-        newsiz = hash->bucketcnt * sizeof(entry_t*);
+        PIOJO_ASSERT(piojo_safe_mulsiz_p(newcnt, sizeof(entry_t*)));
+        newsiz = newcnt * sizeof(entry_t*);
 
+        hash->oldbuckets = hash->buckets;
+        hash->oldcnt = hash->bucketcnt;
+        hash->rehashidx = 0;
+
+        hash->bucketcnt = newcnt;
         hash->buckets = (entry_t**) ator.alloc_cb(newsiz);
         PIOJO_ASSERT(hash->buckets);
         memset(hash->buckets, 0, newsiz);
 
-        for (bidx = 0; bidx < oldcnt; ++bidx){
-                kv = olddata[bidx];
+        if (hash->mode != PIOJO_HASH_MODE_INCR){
+                rehash_buckets(hash->oldcnt, hash);
+        }
+}
+
+/*
+ * Moves up to n non-empty old buckets to the new buckets, visiting at
+ * most REHASH_EMPTY_VISITS empty buckets per moved bucket.
+ */
+static void
+rehash_buckets(size_t n, piojo_hash_t *hash)
+{
+        entry_t *kv, *nextkv;
+        size_t visits = n;
+
+        if (piojo_safe_mulsiz_p(n, REHASH_EMPTY_VISITS)){
+                visits = n * REHASH_EMPTY_VISITS;
+        }
+        while (n > 0 && visits > 0 && hash->rehashidx < hash->oldcnt){
+                kv = hash->oldbuckets[hash->rehashidx];
+                hash->oldbuckets[hash->rehashidx] = NULL;
+                ++hash->rehashidx;
+                if (kv == NULL){
+                        --visits;
+                        continue;
+                }
                 while (kv != NULL){
                         nextkv = kv->next;
-                        kv->next = NULL;
                         insert_entry(kv, INSERT_PTR, hash);
                         kv = nextkv;
                 }
+                --n;
         }
 
-        ator.free_cb(olddata);
+        if (hash->rehashidx >= hash->oldcnt){
+                hash->allocator.free_cb(hash->oldbuckets);
+                hash->oldbuckets = NULL;
+                hash->oldcnt = hash->rehashidx = 0;
+        }
+}
+
+static size_t
+chain_bucketcnt(const piojo_hash_t *hash)
+{
+        return hash->bucketcnt + hash->oldcnt;
+}
+
+/* Buckets after bucketcnt are old buckets waiting to be migrated. */
+static entry_t**
+chain_bucket(size_t bidx, const piojo_hash_t *hash)
+{
+        if (bidx < hash->bucketcnt){
+                return &hash->buckets[bidx];
+        }
+        return &hash->oldbuckets[bidx - hash->bucketcnt];
 }
 
 #ifdef PIOJO_DEBUG
@@ -599,26 +1461,45 @@ insert_entry(entry_t *newkv, insert_t op, piojo_hash_t *hash)
 {
         size_t bidx;
         entry_t *kv;
+        uint32_t hval = newkv->hval;
+
+        if (op == INSERT_PTR){
+                /* Moved entries are unique, link them at the bucket head. */
+                bidx = hval % hash->bucketcnt;
+                newkv->next = hash->buckets[bidx];
+                hash->buckets[bidx] = newkv;
+                return NULL;
+        }
 
-        bidx = calc_hash((const unsigned char*)newkv->key,
-                         hash->eksize) % hash->bucketcnt;
+        if (hash->oldbuckets != NULL){
+                /* Keys in old buckets are moved by rehash_buckets(). */
+                bidx = hval % hash->oldcnt;
+                if (bidx >= hash->rehashidx){
+                        kv = hash->oldbuckets[bidx];
+                        while (kv != NULL){
+                                if (entry_eq_p(newkv->key, hval, kv, hash)){
+                                        return kv;
+                                }
+                                kv = kv->next;
+                        }
+                }
+        }
 
+        bidx = hval % hash->bucketcnt;
         kv = hash->buckets[bidx];
         if (kv != NULL){
-                if (hash->eq_cb(newkv->key, kv->key)){
+                if (entry_eq_p(newkv->key, hval, kv, hash)){
                         return kv;
                 }
                 while (kv->next != NULL){
                         kv = kv->next;
-                        if (hash->eq_cb(newkv->key, kv->key)){
+                        if (entry_eq_p(newkv->key, hval, kv, hash)){
                                 return kv;
                         }
                 }
         }
 
-        if (op == INSERT_NEW){
-                newkv = init_entry(newkv->key, newkv->value, hash);
-        }
+        newkv = init_entry(newkv->key, newkv->value, hval, hash);
         if (kv != NULL){
                 kv->next = newkv;
         }else{
@@ -628,22 +1509,128 @@ insert_entry(entry_t *newkv, insert_t op, piojo_hash_t *hash)
         return NULL;
 }
 
+static bool
+insert_hashed(const void *key, const void *data, uint64_t hval,
+              piojo_hash_t *hash)
+{
+        entry_t kv;
+        double lratio;
+        bool new_p;
+
+        if (hash->mode == PIOJO_HASH_MODE_FLAT){
+                flat_insert(key, data, hval, hash, &new_p);
+                return new_p;
+        }
+
+        if (hash->oldbuckets != NULL){
+                rehash_buckets(REHASH_STEP, hash);
+        }
+        lratio = (double) hash->ecount / hash->bucketcnt;
+        if (lratio > LOAD_RATIO_MAX){
+                expand_table(hash);
+        }
+
+        kv.key = (void*) key;
+        kv.value = (void*) data;
+        kv.hval = (uint32_t) hval;
+        if (insert_entry(&kv, INSERT_NEW, hash) == NULL){
+                ++hash->ecount;
+                return TRUE;
+        }
+        return FALSE;
+}
+
+static void*
+search_hashed(const void *key, uint64_t hval, const piojo_hash_t *hash)
+{
+        iter_t iter;
+        size_t idx;
+
+        if (hash->mode == PIOJO_HASH_MODE_FLAT){
+                idx = flat_search(key, hval, hash);
+                if (idx != FLAT_NOT_FOUND){
+                        return hash->slots + idx * hash->slotsize +
+                                hash->eksize;
+                }
+                return NULL;
+        }
+
+        iter = search_entry(key, (uint32_t) hval, hash);
+        if (iter.table != NULL){
+                if (iter.prev == NULL){
+                        return (*chain_bucket(iter.bidx, hash))->value;
+                }
+                return iter.prev->next->value;
+        }
+        return NULL;
+}
+
+/*
+ * Hashes n keys and prefetches their first probe group (flat mode) or
+ * their bucket and its first entry (chain modes).
+ */
+static void
+prefetch_batch(const uint8_t *keys, size_t n, uint64_t *hvals,
+               const piojo_hash_t *hash)
+{
+        size_t i, gidx, gmask;
+        entry_t *kv;
+
+        for (i = 0; i < n; ++i, keys += hash->eksize){
+                hvals[i] = calc_hash(keys, hash);
+                if (hash->mode == PIOJO_HASH_MODE_FLAT){
+                        gmask = hash->bucketcnt / GROUP_WIDTH - 1;
+                        gidx = FLAT_H1(hvals[i]) & gmask;
+                        PIOJO_PREFETCH(hash->ctrl + gidx * GROUP_WIDTH);
+                        PIOJO_PREFETCH(hash->slots +
+                                       gidx * GROUP_WIDTH * hash->slotsize);
+                }else{
+                        PIOJO_PREFETCH(&hash->buckets[(uint32_t) hvals[i] %
+                                                      hash->bucketcnt]);
+                }
+        }
+        if (hash->mode == PIOJO_HASH_MODE_FLAT){
+                return;
+        }
+        for (i = 0; i < n; ++i){
+                kv = hash->buckets[(uint32_t) hvals[i] % hash->bucketcnt];
+                if (kv != NULL){
+                        PIOJO_PREFETCH(kv);
+                }
+        }
+}
+
 static iter_t
-search_entry(const void *key, const piojo_hash_t *hash)
+search_entry(const void *key, uint32_t hval, const piojo_hash_t *hash)
 {
-        size_t bidx;
+        size_t oidx;
         iter_t iter;
-        entry_t *kv, *prevkv=NULL;
         PIOJO_ASSERT(hash);
         PIOJO_ASSERT(key);
 
+        iter = search_bucket(key, hval, hval % hash->bucketcnt, hash);
+        if (iter.table == NULL && hash->oldbuckets != NULL){
+                oidx = hval % hash->oldcnt;
+                if (oidx >= hash->rehashidx){
+                        iter = search_bucket(key, hval,
+                                             hash->bucketcnt + oidx, hash);
+                }
+        }
+        return iter;
+}
+
+static iter_t
+search_bucket(const void *key, uint32_t hval, size_t bidx,
+              const piojo_hash_t *hash)
+{
+        iter_t iter;
+        entry_t *kv, *prevkv=NULL;
+
         iter.table = NULL;
 
-        bidx = calc_hash((const unsigned char*)key,
-                         hash->eksize) % hash->bucketcnt;
-        kv = hash->buckets[bidx];
+        kv = *chain_bucket(bidx, hash);
         while (kv != NULL){
-                if (hash->eq_cb(key, kv->key)){
+                if (entry_eq_p(key, hval, kv, hash)){
                         iter.table = hash;
                         iter.bidx = bidx;
                         iter.prev = prevkv;
@@ -664,34 +1651,67 @@ delete_entry(iter_t iter, piojo_hash_t *hash)
                 kv = iter.prev->next;
                 iter.prev->next = kv->next;
         }else{
-                kv = hash->buckets[iter.bidx];
-                hash->buckets[iter.bidx] = kv->next;
+                kv = *chain_bucket(iter.bidx, hash);
+                *chain_bucket(iter.bidx, hash) = kv->next;
         }
 
         finish_entry(hash, kv);
 }
 
 static piojo_hash_t*
-alloc_hash(size_t evsize, piojo_eq_cb keyeq, size_t eksize,
-           piojo_alloc_if allocator, size_t bucketcnt)
+alloc_hash(piojo_hash_mode_t mode, size_t evsize, piojo_hasher_if hasher,
+           size_t eksize, piojo_alloc_if allocator, size_t bucketcnt)
 {
 
         piojo_hash_t * hash;
         size_t size;
         PIOJO_ASSERT(eksize > 0 && evsize > 0);
         PIOJO_ASSERT(bucketcnt > 0);
-        PIOJO_ASSERT(piojo_safe_mulsiz_p(bucketcnt,
-                                         sizeof(entry_t*)));
-        size = bucketcnt * sizeof(entry_t*);
+        PIOJO_ASSERT(hasher.hash_cb && hasher.eq_cb);
+        PIOJO_ASSERT(mode == PIOJO_HASH_MODE_CHAIN ||
+                     mode == PIOJO_HASH_MODE_FLAT ||
+                     mode == PIOJO_HASH_MODE_INCR);
 
         hash = (piojo_hash_t *) allocator.alloc_cb(sizeof(piojo_hash_t));
         PIOJO_ASSERT(hash);
 
+        hash->mode = mode;
         hash->allocator = allocator;
         hash->eksize = eksize;
         hash->evsize = evsize;
         hash->ecount = 0;
-        hash->eq_cb = keyeq;
+        hash->delcnt = 0;
+        hash->hasher = hasher;
+        hash->keytype = key_type(hasher);
+        hash->seed = piojo_rand_seed();
+        hash->buckets = hash->oldbuckets = NULL;
+        hash->oldcnt = hash->rehashidx = 0;
+        hash->slabs = NULL;
+        hash->freelist = NULL;
+        hash->slabnext = NULL;
+        hash->slabcnt = hash->slabfree = 0;
+        hash->ctrl = hash->slots = NULL;
+        hash->mapping = NULL;
+        hash->mapsize = 0;
+        hash->readonly_p = FALSE;
+        PIOJO_ASSERT(piojo_safe_addsiz_p(eksize, evsize));
+        hash->slotsize = eksize + evsize;
+
+        /* Keep slab entries aligned for entry_t. */
+        PIOJO_ASSERT(piojo_safe_addsiz_p(sizeof(entry_t) +
+                                         sizeof(entry_t*), hash->slotsize));
+        hash->entrysize = sizeof(entry_t) + hash->slotsize;
+        hash->entrysize += sizeof(entry_t*) - 1;
+        hash->entrysize -= hash->entrysize % sizeof(entry_t*);
+
+        if (mode == PIOJO_HASH_MODE_FLAT){
+                flat_alloc_slots(bucketcnt, hash);
+                return hash;
+        }
+
+        PIOJO_ASSERT(piojo_safe_mulsiz_p(bucketcnt,
+                                         sizeof(entry_t*)));
+        size = bucketcnt * sizeof(entry_t*);
         hash->bucketcnt = bucketcnt;
         hash->buckets = (entry_t**) allocator.alloc_cb(size);
         PIOJO_ASSERT(hash->buckets);
@@ -700,6 +1720,399 @@ alloc_hash(size_t evsize, piojo_eq_cb keyeq, size_t eksize,
         return hash;
 }
 
+/*
+ * Flat mode functions.
+ */
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+
+static uint32_t
+group_match(const uint8_t *group, uint8_t byte)
+{
+        __m128i ctrl = _mm_loadu_si128((const __m128i*) group);
+        __m128i match = _mm_set1_epi8((char) byte);
+        return (uint32_t) _mm_movemask_epi8(_mm_cmpeq_epi8(ctrl, match));
+}
+
+static uint32_t
+group_match_free(const uint8_t *group)
+{
+        __m128i ctrl = _mm_loadu_si128((const __m128i*) group);
+        return (uint32_t) _mm_movemask_epi8(ctrl);
+}
+#else
+static uint32_t
+group_match(const uint8_t *group, uint8_t byte)
+{
+        uint32_t i, mask = 0;
+        for (i = 0; i < GROUP_WIDTH; ++i){
+                mask |= (uint32_t)(group[i] == byte) << i;
+        }
+        return mask;
+}
+
+static uint32_t
+group_match_free(const uint8_t *group)
+{
+        uint32_t i, mask = 0;
+        for (i = 0; i < GROUP_WIDTH; ++i){
+                mask |= (uint32_t)(group[i] >> 7) << i;
+        }
+        return mask;
+}
+#endif
+
+static unsigned int
+first_bit(uint32_t mask)
+{
+        unsigned int i = 0;
+        PIOJO_ASSERT(mask != 0);
+#if defined(__GNUC__)
+        i = (unsigned int) __builtin_ctz(mask);
+#else
+        while ((mask & 1) == 0){
+                mask >>= 1;
+                ++i;
+        }
+#endif
+        return i;
+}
+
+static void
+flat_alloc_slots(size_t slotcnt, piojo_hash_t *hash)
+{
+        size_t size;
+        PIOJO_ASSERT(slotcnt >= GROUP_WIDTH);
+        PIOJO_ASSERT((slotcnt & (slotcnt - 1)) == 0);
+        PIOJO_ASSERT(piojo_safe_addsiz_p(hash->slotsize, 1));
+        PIOJO_ASSERT(piojo_safe_mulsiz_p(slotcnt, hash->slotsize + 1));
+        size = slotcnt * (hash->slotsize + 1);
+
+        hash->ctrl = (uint8_t*) hash->allocator.alloc_cb(size);
+        PIOJO_ASSERT(hash->ctrl);
+        memset(hash->ctrl, CTRL_EMPTY, slotcnt);
+        hash->slots = hash->ctrl + slotcnt;
+        hash->bucketcnt = slotcnt;
+        hash->delcnt = 0;
+}
+
+/* Defines flat_search_<suffix>(), a probe comparing keys with 'eq'. */
+#define DEFINE_FLAT_SEARCH(suffix, eq)                                  \
+        static size_t                                                   \
+        flat_search_##suffix(const void *key, uint64_t hval,            \
+                             const piojo_hash_t *hash)                  \
+        {                                                               \
+                uint32_t match;                                         \
+                size_t gidx, idx, step = 0;                             \
+                size_t gmask = hash->bucketcnt / GROUP_WIDTH - 1;       \
+                const uint8_t *group;                                   \
+                                                                        \
+                gidx = FLAT_H1(hval) & gmask;                           \
+                while (step <= gmask){                                  \
+                        group = hash->ctrl + gidx * GROUP_WIDTH;        \
+                        match = group_match(group, FLAT_H2(hval));      \
+                        while (match != 0){                             \
+                                idx = gidx * GROUP_WIDTH +              \
+                                        first_bit(match);               \
+                                if (eq(key, hash->slots +               \
+                                       idx * hash->slotsize)){          \
+                                        return idx;                     \
+                                }                                       \
+                                match &= match - 1;                     \
+                        }                                               \
+                        if (group_match(group, CTRL_EMPTY) != 0){       \
+                                break;                                  \
+                        }                                               \
+                        gidx = (gidx + ++step) & gmask;                 \
+                }                                                       \
+                return FLAT_NOT_FOUND;                                  \
+        }
+
+#define DEFINE_FLAT_SEARCH_KEY(suffix, type)                            \
+        DEFINE_FLAT_SEARCH(suffix, piojo_key_eq_##suffix)
+
+DEFINE_FLAT_SEARCH(cb, hash->hasher.eq_cb)
+PIOJO_KEYTYPE_EXPAND(DEFINE_FLAT_SEARCH_KEY)
+
+static size_t
+flat_search(const void *key, uint64_t hval, const piojo_hash_t *hash)
+{
+        switch (hash->keytype){
+        case PIOJO_KEY_I32:
+                return flat_search_i32(key, hval, hash);
+        case PIOJO_KEY_I64:
+                return flat_search_i64(key, hval, hash);
+        case PIOJO_KEY_SIZ:
+                return flat_search_siz(key, hval, hash);
+        default:
+                return flat_search_cb(key, hval, hash);
+        }
+}
+
+static size_t
+flat_free_slot(uint64_t hval, const piojo_hash_t *hash)
+{
+        uint32_t match;
+        size_t gidx, step = 0, gmask = hash->bucketcnt / GROUP_WIDTH - 1;
+
+        gidx = FLAT_H1(hval) & gmask;
+        while ((match = group_match_free(hash->ctrl +
+                                         gidx * GROUP_WIDTH)) == 0){
+                gidx = (gidx + ++step) & gmask;
+        }
+        return gidx * GROUP_WIDTH + first_bit(match);
+}
+
+static size_t
+flat_insert(const void *key, const void *data, uint64_t hval,
+            piojo_hash_t *hash, bool *new_p)
+{
+        bool null_p = TRUE;
+        size_t idx, maxcnt;
+        uint8_t *slot;
+        PIOJO_ASSERT(! hash->readonly_p);
+
+        idx = flat_search(key, hval, hash);
+        if (idx != FLAT_NOT_FOUND){
+                *new_p = FALSE;
+                return idx;
+        }
+
+        /* Keep at least 1/8 of the slots empty. */
+        maxcnt = hash->bucketcnt - hash->bucketcnt / 8;
+        if (hash->ecount + hash->delcnt >= maxcnt){
+                if (hash->ecount >= maxcnt / 2){
+                        PIOJO_ASSERT(piojo_safe_mulsiz_p(hash->bucketcnt, 2));
+                        flat_resize(hash->bucketcnt * 2, hash);
+                }else{
+                        flat_resize(hash->bucketcnt, hash);
+                }
+        }
+
+        if (data == NULL){
+                data = &null_p;
+        }
+        idx = flat_free_slot(hval, hash);
+        if (hash->ctrl[idx] == CTRL_DELETED){
+                --hash->delcnt;
+        }
+        hash->ctrl[idx] = FLAT_H2(hval);
+        slot = hash->slots + idx * hash->slotsize;
+        piojo_key_copy(slot, key, hash->eksize);
+        memcpy(slot + hash->eksize, data, hash->evsize);
+        ++hash->ecount;
+
+        *new_p = TRUE;
+        return idx;
+}
+
+static void
+flat_delete(size_t idx, piojo_hash_t *hash)
+{
+        const uint8_t *group = hash->ctrl + (idx & ~(size_t)(GROUP_WIDTH - 1));
+        PIOJO_ASSERT(! hash->readonly_p);
+
+        /* A group that was never full doesn't need tombstones. */
+        if (group_match(group, CTRL_EMPTY) != 0){
+                hash->ctrl[idx] = CTRL_EMPTY;
+        }else{
+                hash->ctrl[idx] = CTRL_DELETED;
+                ++hash->delcnt;
+        }
+        --hash->ecount;
+}
+
+static size_t
+flat_next_full(size_t idx, const piojo_hash_t *hash)
+{
+        for (; idx < hash->bucketcnt; ++idx){
+                if (CTRL_FULL_P(hash->ctrl[idx])){
+                        return idx;
+                }
+        }
+        return FLAT_NOT_FOUND;
+}
+
+static void
+flat_resize(size_t slotcnt, piojo_hash_t *hash)
+{
+        uint8_t *oldctrl = hash->ctrl, *oldslots = hash->slots, *slot;
+        size_t idx, newidx, oldcnt = hash->bucketcnt;
+        uint64_t hval;
+
+        flat_alloc_slots(slotcnt, hash);
+        for (idx = 0; idx < oldcnt; ++idx){
+                if (CTRL_FULL_P(oldctrl[idx])){
+                        slot = oldslots + idx * hash->slotsize;
+                        hval = calc_hash(slot, hash);
+                        newidx = flat_free_slot(hval, hash);
+                        hash->ctrl[newidx] = FLAT_H2(hval);
+                        memcpy(hash->slots + newidx * hash->slotsize, slot,
+                               hash->slotsize);
+                }
+        }
+        flat_free_slots(oldctrl, hash);
+}
+
+/* Mapped slots are unmapped, once resized the table is on the heap. */
+static void
+flat_free_slots(uint8_t *ctrl, piojo_hash_t *hash)
+{
+        if (hash->mapping != NULL){
+                munmap(hash->mapping, hash->mapsize);
+                hash->mapping = NULL;
+                hash->mapsize = 0;
+                return;
+        }
+        hash->allocator.free_cb(ctrl);
+}
+
+/* Returns a flat copy of hash, sized so inserting doesn't resize it. */
+static piojo_hash_t*
+flat_compact_copy(const piojo_hash_t *hash)
+{
+        piojo_hash_t *flat;
+        piojo_hash_cursor_t cursor;
+        const void *key;
+        size_t slotcnt = GROUP_WIDTH;
+
+        while (hash->ecount >= slotcnt - slotcnt / 8){
+                PIOJO_ASSERT(piojo_safe_mulsiz_p(slotcnt, 2));
+                slotcnt *= 2;
+        }
+        flat = alloc_hash(PIOJO_HASH_MODE_FLAT, hash->evsize, hash->hasher,
+                          hash->eksize, hash->allocator, slotcnt);
+        key = piojo_hash_cursor_first(hash, &cursor);
+        while (key != NULL){
+                piojo_hash_insert(key, piojo_hash_cursor_value(&cursor, hash),
+                                  flat);
+                key = piojo_hash_cursor_next(&cursor, hash);
+        }
+        return flat;
+}
+
+/*
+ * Snapshot functions.
+ */
+
+static bool
+key_eq(const void *k1, const void *k2, const piojo_hash_t *hash)
+{
+        switch (hash->keytype){
+        case PIOJO_KEY_I32:
+                return piojo_key_eq_i32(k1, k2);
+        case PIOJO_KEY_I64:
+                return piojo_key_eq_i64(k1, k2);
+        case PIOJO_KEY_SIZ:
+                return piojo_key_eq_siz(k1, k2);
+        default:
+                return hash->hasher.eq_cb(k1, k2);
+        }
+}
+
+/* Keys of the *_i32k/i64k/sizk allocators are compared inline. */
+static piojo_keytype_t
+key_type(piojo_hasher_if hasher)
+{
+        if (hasher.hash_cb == I32_HASHER.hash_cb &&
+            hasher.eq_cb == I32_HASHER.eq_cb){
+                return PIOJO_KEY_I32;
+        }else if (hasher.hash_cb == I64_HASHER.hash_cb &&
+                  hasher.eq_cb == I64_HASHER.eq_cb){
+                return PIOJO_KEY_I64;
+        }else if (hasher.hash_cb == SIZ_HASHER.hash_cb &&
+                  hasher.eq_cb == SIZ_HASHER.eq_cb){
+                return PIOJO_KEY_SIZ;
+        }
+        return PIOJO_KEY_CB;
+}
+
+static size_t
+snapshot_offset(void)
+{
+        return (sizeof(snapshot_t) + SNAPSHOT_ALIGN - 1) / SNAPSHOT_ALIGN *
+                SNAPSHOT_ALIGN;
+}
+
+/* Returns NULL if the file can't be mapped or isn't a valid snapshot. */
+static piojo_hash_t*
+open_mapped(const char *path, const piojo_hasher_if *hasher,
+            piojo_alloc_if allocator)
+{
+        piojo_hash_t *hash;
+        const snapshot_t *hdr;
+        piojo_hasher_if keyhasher;
+        struct stat st;
+        uint8_t *map;
+        size_t mapsize, slotsize, offset = snapshot_offset();
+        int fd;
+
+        fd = open(path, O_RDONLY);
+        if (fd < 0){
+                return NULL;
+        }
+        if (fstat(fd, &st) != 0 || st.st_size < (off_t) offset){
+                close(fd);
+                return NULL;
+        }
+        mapsize = (size_t) st.st_size;
+        /* Private pages are shared with the page cache until written. */
+        map = (uint8_t*) mmap(NULL, mapsize, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+        if (map == (uint8_t*) MAP_FAILED){
+                return NULL;
+        }
+
+        hdr = (const snapshot_t*) map;
+        slotsize = hdr->eksize + hdr->evsize;
+        if (memcmp(hdr->magic, SNAPSHOT_MAGIC, sizeof(hdr->magic)) != 0 ||
+            hdr->version != SNAPSHOT_VERSION ||
+            hdr->byteorder != SNAPSHOT_BYTEORDER ||
+            hdr->wordsize != sizeof(size_t) ||
+            hdr->groupwidth != GROUP_WIDTH ||
+            hdr->eksize == 0 || hdr->evsize == 0 ||
+            slotsize < hdr->eksize || slotsize == SIZE_MAX ||
+            hdr->bucketcnt < GROUP_WIDTH ||
+            (hdr->bucketcnt & (hdr->bucketcnt - 1)) != 0 ||
+            hdr->ecount + hdr->delcnt >= hdr->bucketcnt ||
+            ! piojo_safe_mulsiz_p(hdr->bucketcnt, slotsize + 1) ||
+            mapsize - offset != hdr->bucketcnt * (slotsize + 1)){
+                munmap(map, mapsize);
+                return NULL;
+        }
+
+        if (hasher != NULL){
+                keyhasher = *hasher;
+        }else if (hdr->keykind == PIOJO_KEY_I32 &&
+                  hdr->eksize == sizeof(int32_t)){
+                keyhasher = I32_HASHER;
+        }else if (hdr->keykind == PIOJO_KEY_I64 &&
+                  hdr->eksize == sizeof(int64_t)){
+                keyhasher = I64_HASHER;
+        }else if (hdr->keykind == PIOJO_KEY_SIZ &&
+                  hdr->eksize == sizeof(size_t)){
+                keyhasher = SIZ_HASHER;
+        }else{
+                munmap(map, mapsize);
+                return NULL;
+        }
+
+        hash = alloc_hash(PIOJO_HASH_MODE_FLAT, hdr->evsize, keyhasher,
+                          hdr->eksize, allocator, GROUP_WIDTH);
+        allocator.free_cb(hash->ctrl);
+        hash->ctrl = map + offset;
+        hash->slots = hash->ctrl + hdr->bucketcnt;
+        hash->bucketcnt = hdr->bucketcnt;
+        hash->ecount = hdr->ecount;
+        hash->delcnt = hdr->delcnt;
+        hash->seed = hdr->seed;
+        hash->mapping = map;
+        hash->mapsize = mapsize;
+        hash->readonly_p = TRUE;
+        return hash;
+}
+
 /*
  * Private equality functions.
  */
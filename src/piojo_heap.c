@@ -27,6 +27,8 @@
  * @addtogroup piojoheap Piojo Heap
  * @{
  * Piojo Heap (min-heap) implementation.
+ * Entry positions are tracked to decrease keys, either in a hash table
+ * by value or in an array indexed by handle.
  */
 
 #include <piojo/piojo_heap.h>
@@ -34,15 +36,28 @@
 #include <piojo/piojo_array.h>
 #include <piojo_defs.h>
 
+/* Entry in handle mode, the value comes first in both modes. */
+typedef struct {
+        piojo_opaque_t data;
+        piojo_heap_handle_t handle;
+} hentry_t;
+
 struct piojo_heap_t {
+        piojo_heap_mode_t mode;
         piojo_array_t *data;
+        /* Data mode. */
         piojo_hash_t *indices_by_data;
+        /* Handle mode, free handles are reused first. */
+        piojo_array_t *indices_by_handle, *free_handles;
         piojo_heap_leq_cb leq;
         piojo_alloc_if allocator;
 };
 /** @hideinitializer Size of heap in bytes */
 const size_t piojo_heap_sizeof = sizeof(piojo_heap_t);
 
+/* Position of handles whose entry left the heap. */
+static const size_t NO_INDEX = SIZE_MAX;
+
 static void
 sort_up(size_t idx, piojo_heap_t *heap);
 
@@ -55,6 +70,12 @@ entry_leq(size_t idx1, size_t idx2, piojo_heap_t *heap);
 static void
 swap(size_t idx1, size_t idx2, piojo_heap_t *heap);
 
+static void
+set_index(size_t idx, piojo_heap_t *heap);
+
+static void
+delete_last(piojo_heap_t *heap);
+
 /**
  * Allocates a new heap.
  * Uses default allocator.
@@ -75,6 +96,20 @@ piojo_heap_alloc(piojo_heap_leq_cb leq)
  */
 piojo_heap_t*
 piojo_heap_alloc_cb(piojo_heap_leq_cb leq, piojo_alloc_if allocator)
+{
+        return piojo_heap_alloc_mode(PIOJO_HEAP_MODE_DATA, leq, allocator);
+}
+
+/**
+ * Allocates a new heap that finds entries by value or by handle.
+ * @param[in] mode How entries are found.
+ * @param[in] leq Entry comparison function.
+ * @param[in] allocator Allocator to be used.
+ * @return New heap.
+ */
+piojo_heap_t*
+piojo_heap_alloc_mode(piojo_heap_mode_t mode, piojo_heap_leq_cb leq,
+                      piojo_alloc_if allocator)
 {
         piojo_alloc_if ator = piojo_alloc_default;
         piojo_heap_t * h;
@@ -86,15 +121,27 @@ piojo_heap_alloc_cb(piojo_heap_leq_cb leq, piojo_alloc_if allocator)
         h = (piojo_heap_t *) allocator.alloc_cb(sizeof(piojo_heap_t));
         PIOJO_ASSERT(h);
 
+        h->mode = mode;
         h->allocator = allocator;
         h->leq = leq;
-        h->data = piojo_array_alloc_cb(sizeof(piojo_opaque_t), h->allocator);
+        h->indices_by_data = NULL;
+        h->indices_by_handle = h->free_handles = NULL;
+        if (mode == PIOJO_HEAP_MODE_HANDLE){
+                h->data = piojo_array_alloc_cb(sizeof(hentry_t), h->allocator);
+                h->indices_by_handle = piojo_array_alloc_cb(sizeof(size_t),
+                                                            h->allocator);
+                h->free_handles = piojo_array_alloc_cb(sizeof(size_t),
+                                                       h->allocator);
+                PIOJO_ASSERT(h->indices_by_handle && h->free_handles);
+        }else{
+                h->data = piojo_array_alloc_cb(sizeof(piojo_opaque_t),
+                                               h->allocator);
+                h->indices_by_data =
+                        piojo_hash_alloc_cb_eq(sizeof(size_t), piojo_opaque_eq,
+                                               sizeof(piojo_opaque_t), ator);
+                PIOJO_ASSERT(h->indices_by_data);
+        }
         PIOJO_ASSERT(h->data);
-        h->indices_by_data = piojo_hash_alloc_cb_eq(sizeof(size_t),
-                                                    piojo_opaque_eq,
-                                                    sizeof(piojo_opaque_t),
-                                                    ator);
-        PIOJO_ASSERT(h->indices_by_data);
 
         return h;
 }
@@ -115,12 +162,18 @@ piojo_heap_copy(const piojo_heap_t *heap)
         newh = (piojo_heap_t *) allocator.alloc_cb(sizeof(piojo_heap_t));
         PIOJO_ASSERT(newh);
 
-        newh->allocator = allocator;
-        newh->leq = heap->leq;
+        *newh = *heap;
         newh->data = piojo_array_copy(heap->data);
         PIOJO_ASSERT(newh->data);
-        newh->indices_by_data = piojo_hash_copy(heap->indices_by_data);
-        PIOJO_ASSERT(newh->indices_by_data);
+        if (heap->mode == PIOJO_HEAP_MODE_HANDLE){
+                newh->indices_by_handle =
+                        piojo_array_copy(heap->indices_by_handle);
+                newh->free_handles = piojo_array_copy(heap->free_handles);
+                PIOJO_ASSERT(newh->indices_by_handle && newh->free_handles);
+        }else{
+                newh->indices_by_data = piojo_hash_copy(heap->indices_by_data);
+                PIOJO_ASSERT(newh->indices_by_data);
+        }
 
         return newh;
 }
@@ -135,7 +188,12 @@ piojo_heap_free(const piojo_heap_t *heap)
         piojo_alloc_if allocator;
         PIOJO_ASSERT(heap);
 
-        piojo_hash_free(heap->indices_by_data);
+        if (heap->mode == PIOJO_HEAP_MODE_HANDLE){
+                piojo_array_free(heap->indices_by_handle);
+                piojo_array_free(heap->free_handles);
+        }else{
+                piojo_hash_free(heap->indices_by_data);
+        }
         piojo_array_free(heap->data);
         allocator = heap->allocator;
         allocator.free_cb(heap);
@@ -143,6 +201,7 @@ piojo_heap_free(const piojo_heap_t *heap)
 
 /**
  * Deletes all entries in @a heap.
+ * Handles are given out from the start again.
  * @param[out] heap Heap being cleared.
  */
 void
@@ -150,7 +209,12 @@ piojo_heap_clear(piojo_heap_t *heap)
 {
         PIOJO_ASSERT(heap);
 
-        piojo_hash_clear(heap->indices_by_data);
+        if (heap->mode == PIOJO_HEAP_MODE_HANDLE){
+                piojo_array_clear(heap->indices_by_handle);
+                piojo_array_clear(heap->free_handles);
+        }else{
+                piojo_hash_clear(heap->indices_by_data);
+        }
         piojo_array_clear(heap->data);
 }
 
@@ -185,7 +249,7 @@ piojo_heap_size(const piojo_heap_t *heap)
  * Inserts a new entry.
  * @warning @a data can't be inserted more than once.
  * @param[in] data Entry value.
- * @param[out] heap Heap being modified.
+ * @param[out] heap Heap being modified (data mode).
  */
 void
 piojo_heap_push(piojo_opaque_t data, piojo_heap_t *heap)
@@ -193,6 +257,7 @@ piojo_heap_push(piojo_opaque_t data, piojo_heap_t *heap)
         size_t idx;
         bool inserted_p;
         PIOJO_ASSERT(heap);
+        PIOJO_ASSERT(heap->mode == PIOJO_HEAP_MODE_DATA);
 
         piojo_array_push(&data, heap->data);
 
@@ -207,13 +272,14 @@ piojo_heap_push(piojo_opaque_t data, piojo_heap_t *heap)
 /**
  * Decreases existing entry key.
  * @param[in] data Entry value.
- * @param[out] heap Heap being modified.
+ * @param[out] heap Heap being modified (data mode).
  */
 void
 piojo_heap_decrease(piojo_opaque_t data, piojo_heap_t *heap)
 {
         size_t *idx;
         PIOJO_ASSERT(heap);
+        PIOJO_ASSERT(heap->mode == PIOJO_HEAP_MODE_DATA);
 
         idx = (size_t*)piojo_hash_search(&data, heap->indices_by_data);
         PIOJO_ASSERT(idx != NULL);
@@ -223,6 +289,7 @@ piojo_heap_decrease(piojo_opaque_t data, piojo_heap_t *heap)
 
 /**
  * Deletes the minimum entry according to key.
+ * In handle mode, its handle can be returned by later pushes.
  * @param[out] heap Non-empty heap.
  */
 void
@@ -236,10 +303,7 @@ piojo_heap_pop(piojo_heap_t *heap)
         if (lastidx > 0){
                 swap(0, lastidx, heap);
         }
-
-        piojo_hash_delete(piojo_array_at(lastidx, heap->data),
-                          heap->indices_by_data);
-        piojo_array_delete(lastidx, heap->data);
+        delete_last(heap);
 
         sort_down(0, lastidx, heap);
 }
@@ -261,15 +325,108 @@ piojo_heap_peek(const piojo_heap_t *heap)
 /**
  * Searches entry in heap.
  * @param[in] data Entry value.
- * @param[in] heap
+ * @param[in] heap Heap in data mode.
  * @return @b TRUE if entry is in heap, @b FALSE otherwise.
  */
 bool
 piojo_heap_contain_p(piojo_opaque_t data, const piojo_heap_t *heap)
 {
+        PIOJO_ASSERT(heap);
+        PIOJO_ASSERT(heap->mode == PIOJO_HEAP_MODE_DATA);
+
         return (piojo_hash_search(&data, heap->indices_by_data) != NULL);
 }
 
+/**
+ * Inserts a new entry.
+ * Values don't need to be unique, entries are found by handle.
+ * @param[in] data Entry value.
+ * @param[out] heap Heap being modified (handle mode).
+ * @return Entry handle, valid until the entry is popped or removed.
+ */
+piojo_heap_handle_t
+piojo_heap_push_handle(piojo_opaque_t data, piojo_heap_t *heap)
+{
+        hentry_t entry;
+        size_t idx, hcnt;
+        PIOJO_ASSERT(heap);
+        PIOJO_ASSERT(heap->mode == PIOJO_HEAP_MODE_HANDLE);
+
+        idx = piojo_heap_size(heap);
+        hcnt = piojo_array_size(heap->free_handles);
+        if (hcnt > 0){
+                entry.handle = *(size_t*) piojo_array_last(heap->free_handles);
+                piojo_array_pop(heap->free_handles);
+                piojo_array_set(entry.handle, &idx, heap->indices_by_handle);
+        }else{
+                entry.handle = piojo_array_size(heap->indices_by_handle);
+                piojo_array_push(&idx, heap->indices_by_handle);
+        }
+        entry.data = data;
+        piojo_array_push(&entry, heap->data);
+
+        sort_up(idx, heap);
+        return entry.handle;
+}
+
+/**
+ * Decreases existing entry key.
+ * @param[in] handle Entry handle.
+ * @param[out] heap Heap being modified (handle mode).
+ */
+void
+piojo_heap_decrease_handle(piojo_heap_handle_t handle, piojo_heap_t *heap)
+{
+        PIOJO_ASSERT(piojo_heap_contain_handle_p(handle, heap));
+
+        sort_up(*(size_t*) piojo_array_at(handle, heap->indices_by_handle),
+                heap);
+}
+
+/**
+ * Deletes an entry by handle, its handle can be returned by later pushes.
+ * @param[in] handle Entry handle.
+ * @param[out] heap Heap being modified (handle mode).
+ */
+void
+piojo_heap_remove_handle(piojo_heap_handle_t handle, piojo_heap_t *heap)
+{
+        size_t idx, lastidx;
+        PIOJO_ASSERT(piojo_heap_contain_handle_p(handle, heap));
+
+        idx = *(size_t*) piojo_array_at(handle, heap->indices_by_handle);
+        lastidx = piojo_array_size(heap->data) - 1;
+        if (idx != lastidx){
+                swap(idx, lastidx, heap);
+        }
+        delete_last(heap);
+
+        /* The moved entry may belong above or below its new position. */
+        if (idx < lastidx){
+                sort_down(idx, lastidx, heap);
+                sort_up(idx, heap);
+        }
+}
+
+/**
+ * Searches entry in heap.
+ * @param[in] handle Entry handle.
+ * @param[in] heap Heap in handle mode.
+ * @return @b TRUE if entry is in heap, @b FALSE if it was popped, removed
+ *         or @a handle was never returned.
+ */
+bool
+piojo_heap_contain_handle_p(piojo_heap_handle_t handle,
+                            const piojo_heap_t *heap)
+{
+        PIOJO_ASSERT(heap);
+        PIOJO_ASSERT(heap->mode == PIOJO_HEAP_MODE_HANDLE);
+
+        return (handle < piojo_array_size(heap->indices_by_handle) &&
+                *(size_t*) piojo_array_at(handle, heap->indices_by_handle) !=
+                NO_INDEX);
+}
+
 /** @}
  * Private functions.
  */
@@ -330,17 +487,54 @@ entry_leq(size_t idx1, size_t idx2, piojo_heap_t *heap)
 static void
 swap(size_t idx1, size_t idx2, piojo_heap_t *heap)
 {
-        piojo_opaque_t *e1, *e2;
-        piojo_opaque_t tmp;
-        const size_t esize = sizeof(piojo_opaque_t);
+        hentry_t tmp;
+        void *e1, *e2;
+        size_t esize = sizeof(piojo_opaque_t);
 
-        e1 = (piojo_opaque_t *)piojo_array_at(idx1, heap->data);
-        e2 = (piojo_opaque_t *)piojo_array_at(idx2, heap->data);
-
-        piojo_hash_set(e1, &idx2, heap->indices_by_data);
-        piojo_hash_set(e2, &idx1, heap->indices_by_data);
+        if (heap->mode == PIOJO_HEAP_MODE_HANDLE){
+                esize = sizeof(hentry_t);
+        }
+        e1 = piojo_array_at(idx1, heap->data);
+        e2 = piojo_array_at(idx2, heap->data);
 
         memcpy(&tmp, e1, esize);
         memcpy(e1, e2, esize);
         memcpy(e2, &tmp, esize);
+
+        set_index(idx1, heap);
+        set_index(idx2, heap);
+}
+
+/* Records the position of the entry at idx. */
+static void
+set_index(size_t idx, piojo_heap_t *heap)
+{
+        hentry_t *entry;
+
+        if (heap->mode == PIOJO_HEAP_MODE_HANDLE){
+                entry = (hentry_t*) piojo_array_at(idx, heap->data);
+                piojo_array_set(entry->handle, &idx, heap->indices_by_handle);
+        }else{
+                piojo_hash_set(piojo_array_at(idx, heap->data), &idx,
+                               heap->indices_by_data);
+        }
+}
+
+/* Deletes the last entry and its position. */
+static void
+delete_last(piojo_heap_t *heap)
+{
+        size_t lastidx = piojo_array_size(heap->data) - 1;
+        hentry_t *entry;
+
+        if (heap->mode == PIOJO_HEAP_MODE_HANDLE){
+                entry = (hentry_t*) piojo_array_at(lastidx, heap->data);
+                piojo_array_set(entry->handle, &NO_INDEX,
+                                heap->indices_by_handle);
+                piojo_array_push(&entry->handle, heap->free_handles);
+        }else{
+                piojo_hash_delete(piojo_array_at(lastidx, heap->data),
+                                  heap->indices_by_data);
+        }
+        piojo_array_delete(lastidx, heap->data);
 }
@@ -0,0 +1,1696 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2013 G. Elian Gidoni
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+
+/**
+ * @file
+ * @addtogroup piojopbtree Piojo Paged B-tree
+ * @{
+ * Piojo Paged B-tree implementation.
+ * Nodes are fixed-size pages of a file, read and written through a
+ * buffer pool with clock eviction, so trees can be larger than memory.
+ * Entries are kept in leaves (B+ tree).
+ * Pages of the last commit are never modified (shadow paging): a page
+ * is copied to a free page before its first change. A commit writes and
+ * syncs the dirty pages, then writes the new root to one of two meta
+ * pages, so a crash leaves the file at the previous commit.
+ * A failed page read or write leaves the tree failed: every call returns
+ * @b FALSE until it's reopened at its last commit.
+ */
+
+/* Must be defined before any system header for pread()/pwrite(). */
+#define _POSIX_C_SOURCE 200809L
+#define _FILE_OFFSET_BITS 64
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <stddef.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <piojo/piojo_pbtree.h>
+#include <piojo/piojo_array.h>
+#include <piojo/piojo_bitset.h>
+#include <piojo/piojo_hash.h>
+#include <piojo_defs.h>
+
+/* Header of every node page, leaves are at level 0. */
+typedef struct {
+        uint64_t txid;
+        uint32_t level, ecnt;
+} page_t;
+
+/*
+ * Meta pages 0 and 1 are written by alternate commits, the valid one
+ * with the highest txid holds the current root. Only readable on the
+ * same byte order and word size.
+ */
+typedef struct {
+        char magic[8];
+        uint32_t version, byteorder;
+        uint32_t keytype, pagesize;
+        uint64_t wordsize, eksize, evsize, txid, root, pagecnt, ecount;
+        uint64_t checksum;
+} meta_t;
+
+/* Buffer pool slot, pinned frames aren't evicted. */
+typedef struct {
+        uint64_t pageid;
+        size_t pins;
+        bool used_p, dirty_p, ref_p;
+        uint8_t *data;
+} frame_t;
+
+/* Insertion passed down the tree, split results passed back up. */
+typedef struct {
+        const void *key, *data;
+        bool replace_p, new_p, split_p;
+        uint64_t right;
+} insert_t;
+
+struct piojo_pbtree_t {
+        int fd;
+        uint64_t txid, root, pagecnt;
+        size_t ecount, eksize, evsize, leafmax, innermax;
+        piojo_cmp_cb cmp_cb;
+        piojo_keytype_t keytype;
+        frame_t *frames;
+        uint8_t *buffers;
+        size_t framecnt, hand;
+        piojo_hash_t *pagemap;
+        piojo_array_t *freepages, *pendingpages;
+        /* Set on I/O error, the uncommitted pages may be inconsistent. */
+        bool failed_p;
+        /* Separator moving up after a split, and a spare one. */
+        uint8_t *keybuf;
+        piojo_alloc_if allocator;
+};
+/** @hideinitializer Size of paged tree in bytes */
+const size_t piojo_pbtree_sizeof = sizeof(piojo_pbtree_t);
+
+static const size_t TREE_PAGE_SIZE = 4096;
+static const uint64_t TREE_META_PAGES = 2;
+static const size_t DEFAULT_FRAME_COUNT = 256;
+/* Enough for the pages an operation keeps pinned at once. */
+static const size_t FRAME_COUNT_MIN = 8;
+
+static const char META_MAGIC[8] = "PIOJOBT";
+static const uint32_t META_VERSION = 2;
+static const uint32_t META_BYTEORDER = 0x01020304;
+
+static piojo_pbtree_t*
+open_tree(const char *path, size_t framecnt, size_t evsize,
+          piojo_cmp_cb keycmp, size_t eksize, piojo_alloc_if allocator);
+
+static piojo_pbtree_t*
+alloc_tree(int fd, size_t framecnt, size_t evsize, piojo_cmp_cb keycmp,
+           size_t eksize, piojo_alloc_if allocator);
+
+static void
+free_tree(piojo_pbtree_t *tree);
+
+static bool
+read_meta_p(uint64_t pageid, meta_t *meta, const piojo_pbtree_t *tree);
+
+static bool
+load_meta_p(piojo_pbtree_t *tree);
+
+static void
+meta_checksum(meta_t *meta);
+
+static bool
+mark_pages_p(uint64_t pageid, piojo_bitset_t *used, piojo_pbtree_t *tree);
+
+static bool
+load_free_pages_p(piojo_pbtree_t *tree);
+
+static frame_t*
+pool_victim(piojo_pbtree_t *tree);
+
+static frame_t*
+pool_claim(uint64_t pageid, piojo_pbtree_t *tree);
+
+static void
+pool_drop(frame_t *frame, piojo_pbtree_t *tree);
+
+static bool
+write_page_p(const frame_t *frame, const piojo_pbtree_t *tree);
+
+static frame_t*
+page_fetch(uint64_t pageid, piojo_pbtree_t *tree);
+
+static void
+page_release(frame_t *frame);
+
+static frame_t*
+page_alloc(uint32_t level, piojo_pbtree_t *tree);
+
+static frame_t*
+page_writable(frame_t *frame, piojo_pbtree_t *tree);
+
+static bool
+page_free_p(uint64_t pageid, piojo_pbtree_t *tree);
+
+static page_t*
+page_hdr(const frame_t *frame);
+
+static uint64_t*
+page_children(const frame_t *frame);
+
+static uint8_t*
+page_key(size_t eidx, const frame_t *frame, const piojo_pbtree_t *tree);
+
+static uint8_t*
+page_val(size_t eidx, const frame_t *frame, const piojo_pbtree_t *tree);
+
+static void
+write_entry(insert_t *ins, piojo_pbtree_t *tree);
+
+static void
+insert_page(uint64_t *pageid, insert_t *ins, piojo_pbtree_t *tree);
+
+static void
+insert_leaf(frame_t *frame, uint64_t *pageid, insert_t *ins,
+            piojo_pbtree_t *tree);
+
+static void
+leaf_insert_at(size_t idx, const insert_t *ins, frame_t *frame,
+               const piojo_pbtree_t *tree);
+
+static void
+insert_separator(size_t idx, frame_t *frame, insert_t *ins,
+                 piojo_pbtree_t *tree);
+
+static void
+inner_insert_at(size_t idx, const void *key, uint64_t right,
+                frame_t *frame, const piojo_pbtree_t *tree);
+
+static frame_t*
+split_page(frame_t *frame, void *sepkey, piojo_pbtree_t *tree);
+
+static bool
+delete_page(uint64_t *pageid, const void *key, bool *empty_p,
+            piojo_pbtree_t *tree);
+
+static void
+inner_remove(size_t idx, frame_t *frame, const piojo_pbtree_t *tree);
+
+static void
+shrink_root(piojo_pbtree_t *tree);
+
+static bool
+edge_entry(uint64_t pageid, bool last_p, void *key, void *data,
+           piojo_pbtree_t *tree);
+
+static bool
+next_entry(uint64_t pageid, const void *key, void *nextkey, void *data,
+           piojo_pbtree_t *tree);
+
+static bool
+prev_entry(uint64_t pageid, const void *key, void *prevkey, void *data,
+           piojo_pbtree_t *tree);
+
+static void
+copy_entry(size_t eidx, const frame_t *frame, void *key, void *data,
+           const piojo_pbtree_t *tree);
+
+static size_t
+key_index(const void *key, const frame_t *frame, bool *found_p,
+          const piojo_pbtree_t *tree);
+
+static size_t
+child_index(const void *key, const frame_t *frame,
+            const piojo_pbtree_t *tree);
+
+static int
+key_cmp(const void *k1, const void *k2, const piojo_pbtree_t *tree);
+
+static piojo_keytype_t
+key_type(piojo_cmp_cb keycmp);
+
+static int
+i32_cmp(const void *e1, const void *e2);
+
+static int
+i64_cmp(const void *e1, const void *e2);
+
+static int
+siz_cmp(const void *e1, const void *e2);
+
+/**
+ * Opens a paged tree, the file is created if it doesn't exist.
+ * Uses default allocator, default buffer pool size and key size of
+ * @b int32_t.
+ * @param[in] path File path.
+ * @param[in] evsize Entry value size in bytes.
+ * @return Paged tree at its last commit or @b NULL if the file can't be
+ * opened or isn't a tree with the same key and value sizes.
+ */
+piojo_pbtree_t*
+piojo_pbtree_open_i32k(const char *path, size_t evsize)
+{
+        return piojo_pbtree_open_cb_i32k(path, 0, evsize,
+                                         piojo_alloc_default);
+}
+
+/**
+ * Opens a paged tree, the file is created if it doesn't exist.
+ * Uses default allocator, default buffer pool size and key size of
+ * @b int64_t.
+ * @param[in] path File path.
+ * @param[in] evsize Entry value size in bytes.
+ * @return Paged tree at its last commit or @b NULL if the file can't be
+ * opened or isn't a tree with the same key and value sizes.
+ */
+piojo_pbtree_t*
+piojo_pbtree_open_i64k(const char *path, size_t evsize)
+{
+        return piojo_pbtree_open_cb_i64k(path, 0, evsize,
+                                         piojo_alloc_default);
+}
+
+/**
+ * Opens a paged tree, the file is created if it doesn't exist.
+ * Uses default allocator, default buffer pool size and key size of
+ * @b size_t.
+ * @param[in] path File path.
+ * @param[in] evsize Entry value size in bytes.
+ * @return Paged tree at its last commit or @b NULL if the file can't be
+ * opened or isn't a tree with the same key and value sizes.
+ */
+piojo_pbtree_t*
+piojo_pbtree_open_sizk(const char *path, size_t evsize)
+{
+        return piojo_pbtree_open_cb_sizk(path, 0, evsize,
+                                         piojo_alloc_default);
+}
+
+/**
+ * Opens a paged tree, the file is created if it doesn't exist.
+ * Uses key size of @b int32_t.
+ * @param[in] path File path.
+ * @param[in] framecnt Pages kept in memory (at least 8), or @b 0 for
+ *            the default.
+ * @param[in] evsize Entry value size in bytes.
+ * @param[in] allocator Allocator to be used.
+ * @return Paged tree at its last commit or @b NULL if the file can't be
+ * opened or isn't a tree with the same key and value sizes.
+ */
+piojo_pbtree_t*
+piojo_pbtree_open_cb_i32k(const char *path, size_t framecnt, size_t evsize,
+                          piojo_alloc_if allocator)
+{
+        return piojo_pbtree_open_cb_cmp(path, framecnt, evsize, i32_cmp,
+                                        sizeof(int32_t), allocator);
+}
+
+/**
+ * Opens a paged tree, the file is created if it doesn't exist.
+ * Uses key size of @b int64_t.
+ * @param[in] path File path.
+ * @param[in] framecnt Pages kept in memory (at least 8), or @b 0 for
+ *            the default.
+ * @param[in] evsize Entry value size in bytes.
+ * @param[in] allocator Allocator to be used.
+ * @return Paged tree at its last commit or @b NULL if the file can't be
+ * opened or isn't a tree with the same key and value sizes.
+ */
+piojo_pbtree_t*
+piojo_pbtree_open_cb_i64k(const char *path, size_t framecnt, size_t evsize,
+                          piojo_alloc_if allocator)
+{
+        return piojo_pbtree_open_cb_cmp(path, framecnt, evsize, i64_cmp,
+                                        sizeof(int64_t), allocator);
+}
+
+/**
+ * Opens a paged tree, the file is created if it doesn't exist.
+ * Uses key size of @b size_t.
+ * @param[in] path File path.
+ * @param[in] framecnt Pages kept in memory (at least 8), or @b 0 for
+ *            the default.
+ * @param[in] evsize Entry value size in bytes.
+ * @param[in] allocator Allocator to be used.
+ * @return Paged tree at its last commit or @b NULL if the file can't be
+ * opened or isn't a tree with the same key and value sizes.
+ */
+piojo_pbtree_t*
+piojo_pbtree_open_cb_sizk(const char *path, size_t framecnt, size_t evsize,
+                          piojo_alloc_if allocator)
+{
+        return piojo_pbtree_open_cb_cmp(path, framecnt, evsize, siz_cmp,
+                                        sizeof(size_t), allocator);
+}
+
+/**
+ * Opens a paged tree, the file is created if it doesn't exist.
+ * Keys and values are copied byte by byte to the file, so they must not
+ * hold pointers. Each page holds entries of at most a few hundred bytes.
+ * @param[in] path File path.
+ * @param[in] framecnt Pages kept in memory (at least 8), or @b 0 for
+ *            the default.
+ * @param[in] evsize Entry value size in bytes.
+ * @param[in] keycmp Entry key comparison function, must be the one the
+ *            tree was created with.
+ * @param[in] eksize Entry key size in bytes.
+ * @param[in] allocator Allocator to be used.
+ * @return Paged tree at its last commit or @b NULL if the file can't be
+ * opened or isn't a tree with the same key and value sizes.
+ */
+piojo_pbtree_t*
+piojo_pbtree_open_cb_cmp(const char *path, size_t framecnt, size_t evsize,
+                         piojo_cmp_cb keycmp, size_t eksize,
+                         piojo_alloc_if allocator)
+{
+        PIOJO_ASSERT(path);
+        PIOJO_ASSERT(keycmp);
+        PIOJO_ASSERT(eksize > 0 && evsize > 0);
+        PIOJO_ASSERT(framecnt == 0 || framecnt >= FRAME_COUNT_MIN);
+
+        if (framecnt == 0){
+                framecnt = DEFAULT_FRAME_COUNT;
+        }
+        return open_tree(path, framecnt, evsize, keycmp, eksize, allocator);
+}
+
+/**
+ * Closes @a tree and frees its memory.
+ * Changes since the last commit are discarded.
+ * @param[in] tree Paged tree being closed.
+ */
+void
+piojo_pbtree_close(piojo_pbtree_t *tree)
+{
+        PIOJO_ASSERT(tree);
+
+        close(tree->fd);
+        free_tree(tree);
+}
+
+/**
+ * Makes all changes durable.
+ * Dirty pages are written and synced before the meta page pointing to
+ * them, a crash at any point leaves either the previous or the new
+ * commit. Pages replaced since the previous commit are reused after.
+ * @param[out] tree Paged tree.
+ * @return @b TRUE if committed, @b FALSE on I/O error (the tree keeps
+ * its changes and the file its previous commit).
+ */
+bool
+piojo_pbtree_commit(piojo_pbtree_t *tree)
+{
+        meta_t meta;
+        frame_t *frame;
+        size_t i;
+        off_t off;
+        PIOJO_ASSERT(tree);
+
+        if (tree->failed_p){
+                return FALSE;
+        }
+        for (i = 0; i < tree->framecnt; ++i){
+                frame = &tree->frames[i];
+                if (frame->used_p && frame->dirty_p){
+                        if (! write_page_p(frame, tree)){
+                                return FALSE;
+                        }
+                        frame->dirty_p = FALSE;
+                }
+        }
+        if (fsync(tree->fd) != 0){
+                return FALSE;
+        }
+
+        memset(&meta, 0, sizeof(meta));
+        memcpy(meta.magic, META_MAGIC, sizeof(meta.magic));
+        meta.version = META_VERSION;
+        meta.byteorder = META_BYTEORDER;
+        meta.keytype = (uint32_t) tree->keytype;
+        meta.pagesize = TREE_PAGE_SIZE;
+        meta.wordsize = sizeof(size_t);
+        meta.eksize = tree->eksize;
+        meta.evsize = tree->evsize;
+        meta.txid = tree->txid;
+        meta.root = tree->root;
+        meta.pagecnt = tree->pagecnt;
+        meta.ecount = tree->ecount;
+        meta_checksum(&meta);
+
+        off = (off_t) ((tree->txid % TREE_META_PAGES) * TREE_PAGE_SIZE);
+        if (pwrite(tree->fd, &meta, sizeof(meta), off) !=
+            (ssize_t) sizeof(meta) || fsync(tree->fd) != 0){
+                return FALSE;
+        }
+
+        for (i = 0; i < piojo_array_size(tree->pendingpages); ++i){
+                piojo_array_push(piojo_array_at(i, tree->pendingpages),
+                                 tree->freepages);
+        }
+        piojo_array_clear(tree->pendingpages);
+        ++tree->txid;
+        return TRUE;
+}
+
+/**
+ * Returns number of entries.
+ * @param[in] tree Paged tree.
+ * @return Number of entries in @a tree.
+ */
+size_t
+piojo_pbtree_size(const piojo_pbtree_t *tree)
+{
+        PIOJO_ASSERT(tree);
+        return tree->ecount;
+}
+
+/**
+ * Inserts a new entry.
+ * If @a data is @b NULL, the value is replaced with @b TRUE (useful for sets).
+ * @param[in] key Entry key.
+ * @param[in] data Entry value.
+ * @param[out] tree Paged tree being modified.
+ * @return @b TRUE if inserted, @b FALSE if @a key is duplicate or on I/O
+ * error.
+ */
+bool
+piojo_pbtree_insert(const void *key, const void *data, piojo_pbtree_t *tree)
+{
+        insert_t ins;
+        PIOJO_ASSERT(tree);
+        PIOJO_ASSERT(key);
+        PIOJO_ASSERT(data || tree->evsize == sizeof(bool));
+
+        ins.key = key;
+        ins.data = data;
+        ins.replace_p = FALSE;
+        if (tree->failed_p){
+                return FALSE;
+        }
+        write_entry(&ins, tree);
+        return (ins.new_p && ! tree->failed_p);
+}
+
+/**
+ * Replaces or inserts an entry.
+ * If @a data is @b NULL, the value is replaced with @b TRUE (useful for sets).
+ * @param[in] key Entry key.
+ * @param[in] data Entry value.
+ * @param[out] tree Paged tree being modified.
+ * @return @b TRUE if @a key is new, @b FALSE if it existed or on I/O
+ * error.
+ */
+bool
+piojo_pbtree_set(const void *key, const void *data, piojo_pbtree_t *tree)
+{
+        insert_t ins;
+        PIOJO_ASSERT(tree);
+        PIOJO_ASSERT(key);
+        PIOJO_ASSERT(data || tree->evsize == sizeof(bool));
+
+        ins.key = key;
+        ins.data = data;
+        ins.replace_p = TRUE;
+        if (tree->failed_p){
+                return FALSE;
+        }
+        write_entry(&ins, tree);
+        return (ins.new_p && ! tree->failed_p);
+}
+
+/**
+ * Searches an entry by key.
+ * The value is copied because its page may be evicted afterwards.
+ * Reads one page per tree level at most.
+ * @param[in] key Entry key.
+ * @param[out] data Entry value copy, can be @b NULL.
+ * @param[in] tree Paged tree.
+ * @return @b TRUE if found, @b FALSE if @a key doesn't exist or on I/O
+ * error.
+ */
+bool
+piojo_pbtree_search(const void *key, void *data, piojo_pbtree_t *tree)
+{
+        frame_t *frame;
+        uint64_t pageid;
+        size_t idx;
+        bool found_p;
+        PIOJO_ASSERT(tree);
+        PIOJO_ASSERT(key);
+
+        if (tree->failed_p){
+                return FALSE;
+        }
+        frame = page_fetch(tree->root, tree);
+        while (frame != NULL && page_hdr(frame)->level > 0){
+                pageid = page_children(frame)[child_index(key, frame, tree)];
+                page_release(frame);
+                frame = page_fetch(pageid, tree);
+        }
+        if (frame == NULL){
+                return FALSE;
+        }
+        idx = key_index(key, frame, &found_p, tree);
+        if (found_p){
+                copy_entry(idx, frame, NULL, data, tree);
+        }
+        page_release(frame);
+        return found_p;
+}
+
+/**
+ * Deletes an entry by key.
+ * Emptied pages are removed from the tree, other pages aren't merged.
+ * @param[in] key Entry key.
+ * @param[out] tree Paged tree being modified.
+ * @return @b TRUE if deleted, @b FALSE if @a key doesn't exist or on I/O
+ * error.
+ */
+bool
+piojo_pbtree_delete(const void *key, piojo_pbtree_t *tree)
+{
+        bool empty_p;
+        PIOJO_ASSERT(tree);
+        PIOJO_ASSERT(key);
+
+        if (tree->failed_p || ! delete_page(&tree->root, key, &empty_p,
+                                             tree)){
+                return FALSE;
+        }
+        /* An emptied root leaf is kept, the root is never empty inside. */
+        shrink_root(tree);
+        --tree->ecount;
+        return ! tree->failed_p;
+}
+
+/**
+ * Reads the first entry in @a tree (order given by @a keycmp function).
+ * @param[out] key Entry key copy, can be @b NULL.
+ * @param[out] data Entry value copy, can be @b NULL.
+ * @param[in] tree Paged tree.
+ * @return @b TRUE if read, @b FALSE if @a tree is empty or on I/O error.
+ */
+bool
+piojo_pbtree_first(void *key, void *data, piojo_pbtree_t *tree)
+{
+        PIOJO_ASSERT(tree);
+        return (! tree->failed_p &&
+                edge_entry(tree->root, FALSE, key, data, tree));
+}
+
+/**
+ * Reads the last entry in @a tree (order given by @a keycmp function).
+ * @param[out] key Entry key copy, can be @b NULL.
+ * @param[out] data Entry value copy, can be @b NULL.
+ * @param[in] tree Paged tree.
+ * @return @b TRUE if read, @b FALSE if @a tree is empty or on I/O error.
+ */
+bool
+piojo_pbtree_last(void *key, void *data, piojo_pbtree_t *tree)
+{
+        PIOJO_ASSERT(tree);
+        return (! tree->failed_p &&
+                edge_entry(tree->root, TRUE, key, data, tree));
+}
+
+/**
+ * Reads the entry following @a key (which doesn't need to exist).
+ * @param[in] key Entry key.
+ * @param[out] nextkey Next entry key copy, can be @b NULL.
+ * @param[out] data Next entry value copy, can be @b NULL.
+ * @param[in] tree Paged tree.
+ * @return @b TRUE if read, @b FALSE if there's no entry after @a key or
+ * on I/O error.
+ */
+bool
+piojo_pbtree_next(const void *key, void *nextkey, void *data,
+                  piojo_pbtree_t *tree)
+{
+        PIOJO_ASSERT(tree);
+        PIOJO_ASSERT(key);
+        return (! tree->failed_p &&
+                next_entry(tree->root, key, nextkey, data, tree));
+}
+
+/**
+ * Reads the entry preceding @a key (which doesn't need to exist).
+ * @param[in] key Entry key.
+ * @param[out] prevkey Previous entry key copy, can be @b NULL.
+ * @param[out] data Previous entry value copy, can be @b NULL.
+ * @param[in] tree Paged tree.
+ * @return @b TRUE if read, @b FALSE if there's no entry before @a key or
+ * on I/O error.
+ */
+bool
+piojo_pbtree_prev(const void *key, void *prevkey, void *data,
+                  piojo_pbtree_t *tree)
+{
+        PIOJO_ASSERT(tree);
+        PIOJO_ASSERT(key);
+        return (! tree->failed_p &&
+                prev_entry(tree->root, key, prevkey, data, tree));
+}
+
+/**
+ * Returns whether a page read or write failed.
+ * A failed tree can only be closed, reopening it returns its last commit.
+ * @param[in] tree Paged tree.
+ * @return @b TRUE if @a tree failed, @b FALSE otherwise.
+ */
+bool
+piojo_pbtree_failed_p(const piojo_pbtree_t *tree)
+{
+        PIOJO_ASSERT(tree);
+        return tree->failed_p;
+}
+
+/** @}
+ * Private functions.
+ */
+
+static piojo_pbtree_t*
+open_tree(const char *path, size_t framecnt, size_t evsize,
+          piojo_cmp_cb keycmp, size_t eksize, piojo_alloc_if allocator)
+{
+        piojo_pbtree_t *tree;
+        struct stat st;
+        int fd;
+
+        fd = open(path, O_RDWR | O_CREAT, 0644);
+        if (fd < 0){
+                return NULL;
+        }
+        if (fstat(fd, &st) != 0){
+                close(fd);
+                return NULL;
+        }
+        tree = alloc_tree(fd, framecnt, evsize, keycmp, eksize, allocator);
+        if (st.st_size == 0){
+                tree->txid = 1;
+                tree->pagecnt = TREE_META_PAGES;
+                page_release(page_alloc(0, tree));
+                tree->root = TREE_META_PAGES;
+                if (piojo_pbtree_commit(tree)){
+                        return tree;
+                }
+        }else if (load_meta_p(tree) && load_free_pages_p(tree)){
+                return tree;
+        }
+        piojo_pbtree_close(tree);
+        return NULL;
+}
+
+static piojo_pbtree_t*
+alloc_tree(int fd, size_t framecnt, size_t evsize, piojo_cmp_cb keycmp,
+           size_t eksize, piojo_alloc_if allocator)
+{
+        piojo_pbtree_t *tree;
+        size_t i, avail = TREE_PAGE_SIZE - sizeof(page_t);
+
+        tree = (piojo_pbtree_t*) allocator.alloc_cb(sizeof(piojo_pbtree_t));
+        PIOJO_ASSERT(tree);
+        tree->fd = fd;
+        tree->txid = tree->root = tree->pagecnt = 0;
+        tree->ecount = 0;
+        tree->eksize = eksize;
+        tree->evsize = evsize;
+        tree->leafmax = avail / (eksize + evsize);
+        tree->innermax = (avail - sizeof(uint64_t)) /
+                (eksize + sizeof(uint64_t));
+        PIOJO_ASSERT(tree->leafmax >= 3 && tree->innermax >= 3);
+        tree->cmp_cb = keycmp;
+        tree->keytype = key_type(keycmp);
+        tree->allocator = allocator;
+        tree->failed_p = FALSE;
+
+        PIOJO_ASSERT(piojo_safe_mulsiz_p(framecnt, TREE_PAGE_SIZE));
+        tree->frames = (frame_t*) allocator.alloc_cb(framecnt *
+                                                     sizeof(frame_t));
+        tree->buffers = (uint8_t*) allocator.alloc_cb(framecnt *
+                                                      TREE_PAGE_SIZE);
+        PIOJO_ASSERT(tree->frames && tree->buffers);
+        tree->framecnt = framecnt;
+        tree->hand = 0;
+        for (i = 0; i < framecnt; ++i){
+                tree->frames[i].used_p = FALSE;
+                tree->frames[i].data = &tree->buffers[i * TREE_PAGE_SIZE];
+        }
+        tree->pagemap = piojo_hash_alloc_mode_i64k(PIOJO_HASH_MODE_FLAT,
+                                                   sizeof(size_t),
+                                                   allocator);
+        tree->freepages = piojo_array_alloc_cb(sizeof(uint64_t), allocator);
+        tree->pendingpages = piojo_array_alloc_cb(sizeof(uint64_t),
+                                                  allocator);
+        tree->keybuf = (uint8_t*) allocator.alloc_cb(2 * eksize);
+        PIOJO_ASSERT(tree->keybuf);
+        return tree;
+}
+
+static void
+free_tree(piojo_pbtree_t *tree)
+{
+        piojo_alloc_if ator = tree->allocator;
+
+        piojo_hash_free(tree->pagemap);
+        piojo_array_free(tree->freepages);
+        piojo_array_free(tree->pendingpages);
+        ator.free_cb(tree->keybuf);
+        ator.free_cb(tree->buffers);
+        ator.free_cb(tree->frames);
+        ator.free_cb(tree);
+}
+
+static bool
+read_meta_p(uint64_t pageid, meta_t *meta, const piojo_pbtree_t *tree)
+{
+        uint64_t checksum;
+
+        if (pread(tree->fd, meta, sizeof(*meta),
+                  (off_t) (pageid * TREE_PAGE_SIZE)) !=
+            (ssize_t) sizeof(*meta)){
+                return FALSE;
+        }
+        checksum = meta->checksum;
+        meta_checksum(meta);
+        return (checksum == meta->checksum &&
+                memcmp(meta->magic, META_MAGIC, sizeof(meta->magic)) == 0 &&
+                meta->version == META_VERSION &&
+                meta->byteorder == META_BYTEORDER &&
+                meta->keytype == (uint32_t) tree->keytype &&
+                meta->pagesize == TREE_PAGE_SIZE &&
+                meta->wordsize == sizeof(size_t) &&
+                meta->eksize == tree->eksize &&
+                meta->evsize == tree->evsize &&
+                meta->root >= TREE_META_PAGES &&
+                meta->root < meta->pagecnt);
+}
+
+/* Loads the newest valid meta page, the other may be a torn write. */
+static bool
+load_meta_p(piojo_pbtree_t *tree)
+{
+        meta_t metas[2], *meta = NULL;
+        bool valid0_p, valid1_p;
+
+        valid0_p = read_meta_p(0, &metas[0], tree);
+        valid1_p = read_meta_p(1, &metas[1], tree);
+        if (valid0_p && (! valid1_p || metas[0].txid > metas[1].txid)){
+                meta = &metas[0];
+        }else if (valid1_p){
+                meta = &metas[1];
+        }
+        if (meta == NULL){
+                return FALSE;
+        }
+        tree->txid = meta->txid + 1;
+        tree->root = meta->root;
+        tree->pagecnt = meta->pagecnt;
+        tree->ecount = meta->ecount;
+        return TRUE;
+}
+
+static void
+meta_checksum(meta_t *meta)
+{
+        meta->checksum = piojo_bytes_hash(meta, offsetof(meta_t, checksum),
+                                          0);
+}
+
+/* Marks pages reachable from @a pageid, leaves aren't read. */
+static bool
+mark_pages_p(uint64_t pageid, piojo_bitset_t *used, piojo_pbtree_t *tree)
+{
+        frame_t *frame;
+        uint64_t child;
+        uint32_t level;
+        size_t i, cnt;
+
+        PIOJO_ASSERT(pageid < tree->pagecnt);
+        piojo_bitset_set(pageid, used);
+        frame = page_fetch(pageid, tree);
+        if (frame == NULL){
+                return FALSE;
+        }
+        cnt = page_hdr(frame)->ecnt;
+        level = page_hdr(frame)->level;
+        page_release(frame);
+        for (i = 0; level > 0 && i <= cnt; ++i){
+                frame = page_fetch(pageid, tree);
+                if (frame == NULL){
+                        return FALSE;
+                }
+                child = page_children(frame)[i];
+                page_release(frame);
+                if (level == 1){
+                        PIOJO_ASSERT(child < tree->pagecnt);
+                        piojo_bitset_set(child, used);
+                }else if (! mark_pages_p(child, used, tree)){
+                        return FALSE;
+                }
+        }
+        return TRUE;
+}
+
+/* Pages unreachable from the committed root are free. */
+static bool
+load_free_pages_p(piojo_pbtree_t *tree)
+{
+        piojo_bitset_t *used;
+        uint64_t pageid;
+        bool marked_p;
+
+        used = piojo_bitset_alloc_cb(tree->pagecnt, tree->allocator);
+        marked_p = mark_pages_p(tree->root, used, tree);
+        /* Lowest pages are reused first. */
+        pageid = tree->pagecnt;
+        while (marked_p && pageid-- > TREE_META_PAGES){
+                if (! piojo_bitset_set_p(pageid, used)){
+                        piojo_array_push(&pageid, tree->freepages);
+                }
+        }
+        piojo_bitset_free(used);
+        return marked_p;
+}
+
+/*
+ * Takes a frame with the clock algorithm, writing it back if dirty.
+ * Returns @b NULL if the write fails, the frame is kept dirty.
+ */
+static frame_t*
+pool_victim(piojo_pbtree_t *tree)
+{
+        frame_t *frame;
+        size_t i;
+
+        /* The first sweep clears reference bits, the second one evicts. */
+        for (i = 0; i <= 2 * tree->framecnt; ++i){
+                frame = &tree->frames[tree->hand];
+                tree->hand = (tree->hand + 1) % tree->framecnt;
+                if (! frame->used_p){
+                        return frame;
+                }
+                if (frame->pins > 0){
+                        continue;
+                }
+                if (frame->ref_p){
+                        frame->ref_p = FALSE;
+                        continue;
+                }
+                if (frame->dirty_p && ! write_page_p(frame, tree)){
+                        return NULL;
+                }
+                pool_drop(frame, tree);
+                return frame;
+        }
+        /* Every frame is pinned. */
+        PIOJO_ASSERT(FALSE);
+        return NULL;
+}
+
+static frame_t*
+pool_claim(uint64_t pageid, piojo_pbtree_t *tree)
+{
+        frame_t *frame = pool_victim(tree);
+        size_t fidx;
+
+        if (frame == NULL){
+                return NULL;
+        }
+        fidx = (size_t) (frame - tree->frames);
+        frame->pageid = pageid;
+        frame->pins = 0;
+        frame->used_p = TRUE;
+        frame->dirty_p = FALSE;
+        frame->ref_p = TRUE;
+        piojo_hash_insert(&pageid, &fidx, tree->pagemap);
+        return frame;
+}
+
+/* Forgets the page in @a frame without writing it. */
+static void
+pool_drop(frame_t *frame, piojo_pbtree_t *tree)
+{
+        piojo_hash_delete(&frame->pageid, tree->pagemap);
+        frame->used_p = FALSE;
+        frame->dirty_p = FALSE;
+}
+
+static bool
+write_page_p(const frame_t *frame, const piojo_pbtree_t *tree)
+{
+        return (pwrite(tree->fd, frame->data, TREE_PAGE_SIZE,
+                       (off_t) (frame->pageid * TREE_PAGE_SIZE)) ==
+                (ssize_t) TREE_PAGE_SIZE);
+}
+
+/*
+ * Returns the pinned frame of @a pageid, reading the page if needed.
+ * Returns @b NULL and fails the tree on I/O error or a bad page.
+ */
+static frame_t*
+page_fetch(uint64_t pageid, piojo_pbtree_t *tree)
+{
+        frame_t *frame;
+        page_t *page;
+        size_t *fidx;
+        ssize_t ret;
+
+        fidx = (size_t*) piojo_hash_search(&pageid, tree->pagemap);
+        if (fidx != NULL){
+                frame = &tree->frames[*fidx];
+        }else{
+                frame = pool_claim(pageid, tree);
+                if (frame == NULL){
+                        tree->failed_p = TRUE;
+                        return NULL;
+                }
+                ret = pread(tree->fd, frame->data, TREE_PAGE_SIZE,
+                            (off_t) (pageid * TREE_PAGE_SIZE));
+                page = page_hdr(frame);
+                if (ret != (ssize_t) TREE_PAGE_SIZE ||
+                    page->ecnt > ((page->level == 0) ? tree->leafmax :
+                                  tree->innermax)){
+                        pool_drop(frame, tree);
+                        tree->failed_p = TRUE;
+                        return NULL;
+                }
+        }
+        ++frame->pins;
+        frame->ref_p = TRUE;
+        return frame;
+}
+
+static void
+page_release(frame_t *frame)
+{
+        PIOJO_ASSERT(frame->pins > 0);
+        --frame->pins;
+}
+
+/*
+ * Returns the pinned frame of a new empty page of this transaction.
+ * Returns @b NULL and fails the tree if no frame can be written back.
+ */
+static frame_t*
+page_alloc(uint32_t level, piojo_pbtree_t *tree)
+{
+        frame_t *frame;
+        page_t *page;
+        uint64_t pageid = tree->pagecnt;
+        size_t *fidx;
+        bool reuse_p = (piojo_array_size(tree->freepages) > 0);
+
+        if (reuse_p){
+                pageid = *(uint64_t*) piojo_array_last(tree->freepages);
+        }
+        /* A freed page of an old commit may still be cached. */
+        fidx = (size_t*) piojo_hash_search(&pageid, tree->pagemap);
+        if (fidx != NULL){
+                frame = &tree->frames[*fidx];
+                PIOJO_ASSERT(frame->pins == 0);
+        }else{
+                frame = pool_claim(pageid, tree);
+                if (frame == NULL){
+                        tree->failed_p = TRUE;
+                        return NULL;
+                }
+        }
+        if (reuse_p){
+                piojo_array_pop(tree->freepages);
+        }else{
+                ++tree->pagecnt;
+        }
+        memset(frame->data, 0, TREE_PAGE_SIZE);
+        page = page_hdr(frame);
+        page->txid = tree->txid;
+        page->level = level;
+        frame->dirty_p = TRUE;
+        ++frame->pins;
+        return frame;
+}
+
+/*
+ * Returns @a frame ready to be modified. Pages of a previous commit are
+ * copied to a new page (the caller must update the parent link), and
+ * freed once this transaction commits.
+ */
+static frame_t*
+page_writable(frame_t *frame, piojo_pbtree_t *tree)
+{
+        frame_t *copy;
+
+        if (page_hdr(frame)->txid == tree->txid){
+                frame->dirty_p = TRUE;
+                return frame;
+        }
+        copy = page_alloc(page_hdr(frame)->level, tree);
+        if (copy == NULL){
+                page_release(frame);
+                return NULL;
+        }
+        memcpy(copy->data, frame->data, TREE_PAGE_SIZE);
+        page_hdr(copy)->txid = tree->txid;
+        piojo_array_push(&frame->pageid, tree->pendingpages);
+        page_release(frame);
+        return copy;
+}
+
+static bool
+page_free_p(uint64_t pageid, piojo_pbtree_t *tree)
+{
+        frame_t *frame = page_fetch(pageid, tree);
+
+        if (frame == NULL){
+                return FALSE;
+        }
+        page_release(frame);
+        if (page_hdr(frame)->txid == tree->txid){
+                pool_drop(frame, tree);
+                piojo_array_push(&pageid, tree->freepages);
+        }else{
+                piojo_array_push(&pageid, tree->pendingpages);
+        }
+        return TRUE;
+}
+
+static page_t*
+page_hdr(const frame_t *frame)
+{
+        return (page_t*) frame->data;
+}
+
+static uint64_t*
+page_children(const frame_t *frame)
+{
+        return (uint64_t*) (frame->data + sizeof(page_t));
+}
+
+/* Leaves hold keys then values, inner pages children then keys. */
+static uint8_t*
+page_key(size_t eidx, const frame_t *frame, const piojo_pbtree_t *tree)
+{
+        size_t off = sizeof(page_t);
+
+        if (page_hdr(frame)->level > 0){
+                off += (tree->innermax + 1) * sizeof(uint64_t);
+        }
+        return frame->data + off + eidx * tree->eksize;
+}
+
+static uint8_t*
+page_val(size_t eidx, const frame_t *frame, const piojo_pbtree_t *tree)
+{
+        return frame->data + sizeof(page_t) + tree->leafmax * tree->eksize +
+                eidx * tree->evsize;
+}
+
+static void
+write_entry(insert_t *ins, piojo_pbtree_t *tree)
+{
+        frame_t *frame;
+        uint32_t level;
+
+        insert_page(&tree->root, ins, tree);
+        if (tree->failed_p){
+                return;
+        }
+        if (ins->new_p){
+                PIOJO_ASSERT(tree->ecount < SIZE_MAX);
+                ++tree->ecount;
+        }
+        if (ins->split_p){
+                frame = page_fetch(tree->root, tree);
+                if (frame == NULL){
+                        return;
+                }
+                level = page_hdr(frame)->level;
+                page_release(frame);
+
+                frame = page_alloc(level + 1, tree);
+                if (frame == NULL){
+                        return;
+                }
+                page_children(frame)[0] = tree->root;
+                inner_insert_at(0, tree->keybuf, ins->right, frame, tree);
+                tree->root = frame->pageid;
+                page_release(frame);
+        }
+}
+
+/*
+ * Inserts in the subtree at @a pageid, which is updated if copied.
+ * Stops at the first I/O error, leaving the tree failed.
+ */
+static void
+insert_page(uint64_t *pageid, insert_t *ins, piojo_pbtree_t *tree)
+{
+        frame_t *frame;
+        uint64_t child, oldchild;
+        size_t idx;
+
+        ins->split_p = FALSE;
+        ins->new_p = FALSE;
+        frame = page_fetch(*pageid, tree);
+        if (frame == NULL){
+                return;
+        }
+        if (page_hdr(frame)->level == 0){
+                insert_leaf(frame, pageid, ins, tree);
+                return;
+        }
+        idx = child_index(ins->key, frame, tree);
+        child = oldchild = page_children(frame)[idx];
+        page_release(frame);
+
+        insert_page(&child, ins, tree);
+        if (tree->failed_p || (child == oldchild && ! ins->split_p)){
+                return;
+        }
+        frame = page_fetch(*pageid, tree);
+        if (frame == NULL || (frame = page_writable(frame, tree)) == NULL){
+                return;
+        }
+        *pageid = frame->pageid;
+        page_children(frame)[idx] = child;
+        if (ins->split_p){
+                insert_separator(idx, frame, ins, tree);
+        }
+        page_release(frame);
+}
+
+static void
+insert_leaf(frame_t *frame, uint64_t *pageid, insert_t *ins,
+            piojo_pbtree_t *tree)
+{
+        frame_t *right;
+        size_t idx, mid;
+        bool found_p;
+
+        idx = key_index(ins->key, frame, &found_p, tree);
+        ins->new_p = ! found_p;
+        if (found_p && (! ins->replace_p || ins->data == NULL)){
+                page_release(frame);
+                return;
+        }
+        frame = page_writable(frame, tree);
+        if (frame == NULL){
+                return;
+        }
+        *pageid = frame->pageid;
+        if (found_p){
+                memcpy(page_val(idx, frame, tree), ins->data, tree->evsize);
+        }else if (page_hdr(frame)->ecnt < tree->leafmax){
+                leaf_insert_at(idx, ins, frame, tree);
+        }else{
+                mid = page_hdr(frame)->ecnt / 2;
+                right = split_page(frame, tree->keybuf, tree);
+                if (right == NULL){
+                        page_release(frame);
+                        return;
+                }
+                /* Entries before the separator stay in the left page. */
+                if (idx <= mid){
+                        leaf_insert_at(idx, ins, frame, tree);
+                }else{
+                        leaf_insert_at(idx - mid, ins, right, tree);
+                }
+                ins->split_p = TRUE;
+                ins->right = right->pageid;
+                page_release(right);
+        }
+        page_release(frame);
+}
+
+static void
+leaf_insert_at(size_t idx, const insert_t *ins, frame_t *frame,
+               const piojo_pbtree_t *tree)
+{
+        bool null_p = TRUE;
+        const void *data = (ins->data != NULL) ? ins->data : &null_p;
+        page_t *page = page_hdr(frame);
+        size_t cnt = page->ecnt - idx;
+
+        memmove(page_key(idx + 1, frame, tree), page_key(idx, frame, tree),
+                cnt * tree->eksize);
+        memmove(page_val(idx + 1, frame, tree), page_val(idx, frame, tree),
+                cnt * tree->evsize);
+        piojo_key_copy(page_key(idx, frame, tree), ins->key, tree->eksize);
+        memcpy(page_val(idx, frame, tree), data, tree->evsize);
+        ++page->ecnt;
+}
+
+/*
+ * Adds the separator in tree->keybuf and its right child after child
+ * @a idx, splitting @a frame first if it's full.
+ */
+static void
+insert_separator(size_t idx, frame_t *frame, insert_t *ins,
+                 piojo_pbtree_t *tree)
+{
+        frame_t *right;
+        uint8_t *sepkey = tree->keybuf + tree->eksize;
+        size_t mid = page_hdr(frame)->ecnt / 2;
+
+        if (page_hdr(frame)->ecnt < tree->innermax){
+                inner_insert_at(idx, tree->keybuf, ins->right, frame, tree);
+                ins->split_p = FALSE;
+                return;
+        }
+        right = split_page(frame, sepkey, tree);
+        if (right == NULL){
+                return;
+        }
+        if (idx <= mid){
+                inner_insert_at(idx, tree->keybuf, ins->right, frame, tree);
+        }else{
+                inner_insert_at(idx - mid - 1, tree->keybuf, ins->right,
+                                right, tree);
+        }
+        piojo_key_copy(tree->keybuf, sepkey, tree->eksize);
+        ins->right = right->pageid;
+        page_release(right);
+}
+
+static void
+inner_insert_at(size_t idx, const void *key, uint64_t right,
+                frame_t *frame, const piojo_pbtree_t *tree)
+{
+        page_t *page = page_hdr(frame);
+        uint64_t *children = page_children(frame);
+        size_t cnt = page->ecnt - idx;
+
+        memmove(page_key(idx + 1, frame, tree), page_key(idx, frame, tree),
+                cnt * tree->eksize);
+        memmove(&children[idx + 2], &children[idx + 1],
+                cnt * sizeof(uint64_t));
+        piojo_key_copy(page_key(idx, frame, tree), key, tree->eksize);
+        children[idx + 1] = right;
+        ++page->ecnt;
+}
+
+/*
+ * Moves the upper half of @a frame to a new pinned page and copies the
+ * separator to @a sepkey. Inner pages move their middle key up.
+ * Returns @b NULL if the new page can't be allocated.
+ */
+static frame_t*
+split_page(frame_t *frame, void *sepkey, piojo_pbtree_t *tree)
+{
+        page_t *page = page_hdr(frame);
+        frame_t *right = page_alloc(page->level, tree);
+        size_t mid = page->ecnt / 2, from = mid, cnt;
+
+        if (right == NULL){
+                return NULL;
+        }
+        if (page->level > 0){
+                from = mid + 1;
+        }
+        cnt = page->ecnt - from;
+        memcpy(page_key(0, right, tree), page_key(from, frame, tree),
+               cnt * tree->eksize);
+        if (page->level == 0){
+                memcpy(page_val(0, right, tree), page_val(from, frame, tree),
+                       cnt * tree->evsize);
+        }else{
+                memcpy(page_children(right), &page_children(frame)[from],
+                       (cnt + 1) * sizeof(uint64_t));
+        }
+        piojo_key_copy(sepkey, page_key(mid, frame, tree), tree->eksize);
+        page_hdr(right)->ecnt = cnt;
+        page->ecnt = mid;
+        return right;
+}
+
+/*
+ * Deletes from the subtree at @a pageid, which is updated if copied.
+ * Sets @a empty_p if the subtree was left empty (and must be unlinked).
+ * Returns @b FALSE if @a key doesn't exist or on I/O error.
+ */
+static bool
+delete_page(uint64_t *pageid, const void *key, bool *empty_p,
+            piojo_pbtree_t *tree)
+{
+        frame_t *frame;
+        uint64_t child;
+        size_t idx;
+        bool found_p, cempty_p;
+
+        *empty_p = FALSE;
+        frame = page_fetch(*pageid, tree);
+        if (frame == NULL){
+                return FALSE;
+        }
+        if (page_hdr(frame)->level == 0){
+                idx = key_index(key, frame, &found_p, tree);
+                if (! found_p){
+                        page_release(frame);
+                        return FALSE;
+                }
+                frame = page_writable(frame, tree);
+                if (frame == NULL){
+                        return FALSE;
+                }
+                *pageid = frame->pageid;
+                memmove(page_key(idx, frame, tree),
+                        page_key(idx + 1, frame, tree),
+                        (page_hdr(frame)->ecnt - idx - 1) * tree->eksize);
+                memmove(page_val(idx, frame, tree),
+                        page_val(idx + 1, frame, tree),
+                        (page_hdr(frame)->ecnt - idx - 1) * tree->evsize);
+                *empty_p = (--page_hdr(frame)->ecnt == 0);
+                page_release(frame);
+                return TRUE;
+        }
+        idx = child_index(key, frame, tree);
+        child = page_children(frame)[idx];
+        page_release(frame);
+
+        if (! delete_page(&child, key, &cempty_p, tree)){
+                return FALSE;
+        }
+        frame = page_fetch(*pageid, tree);
+        if (frame == NULL || (frame = page_writable(frame, tree)) == NULL){
+                return FALSE;
+        }
+        *pageid = frame->pageid;
+        page_children(frame)[idx] = child;
+        if (cempty_p){
+                if (! page_free_p(child, tree)){
+                        page_release(frame);
+                        return FALSE;
+                }
+                *empty_p = (page_hdr(frame)->ecnt == 0);
+                if (! *empty_p){
+                        inner_remove(idx, frame, tree);
+                }
+        }
+        page_release(frame);
+        return TRUE;
+}
+
+/* Removes child @a idx and one of its separators. */
+static void
+inner_remove(size_t idx, frame_t *frame, const piojo_pbtree_t *tree)
+{
+        page_t *page = page_hdr(frame);
+        uint64_t *children = page_children(frame);
+        size_t kidx = (idx > 0) ? idx - 1 : 0;
+
+        memmove(page_key(kidx, frame, tree), page_key(kidx + 1, frame, tree),
+                (page->ecnt - kidx - 1) * tree->eksize);
+        memmove(&children[idx], &children[idx + 1],
+                (page->ecnt - idx) * sizeof(uint64_t));
+        --page->ecnt;
+}
+
+/* Replaces a root with a single child by the child. */
+static void
+shrink_root(piojo_pbtree_t *tree)
+{
+        frame_t *frame;
+        uint64_t child;
+
+        while (TRUE){
+                frame = page_fetch(tree->root, tree);
+                if (frame == NULL){
+                        return;
+                }
+                if (page_hdr(frame)->level == 0 ||
+                    page_hdr(frame)->ecnt > 0){
+                        page_release(frame);
+                        return;
+                }
+                child = page_children(frame)[0];
+                page_release(frame);
+                if (! page_free_p(tree->root, tree)){
+                        return;
+                }
+                tree->root = child;
+        }
+}
+
+/* Pages other than the root are never empty. */
+static bool
+edge_entry(uint64_t pageid, bool last_p, void *key, void *data,
+           piojo_pbtree_t *tree)
+{
+        frame_t *frame = page_fetch(pageid, tree);
+        page_t *page;
+        bool found_p;
+
+        while (frame != NULL && (page = page_hdr(frame))->level > 0){
+                pageid = page_children(frame)[last_p ? page->ecnt : 0];
+                page_release(frame);
+                frame = page_fetch(pageid, tree);
+        }
+        if (frame == NULL){
+                return FALSE;
+        }
+        found_p = (page->ecnt > 0);
+        if (found_p){
+                copy_entry(last_p ? page->ecnt - 1 : 0, frame, key, data,
+                           tree);
+        }
+        page_release(frame);
+        return found_p;
+}
+
+static bool
+next_entry(uint64_t pageid, const void *key, void *nextkey, void *data,
+           piojo_pbtree_t *tree)
+{
+        frame_t *frame = page_fetch(pageid, tree);
+        uint64_t child, sibling = 0;
+        size_t idx, cnt;
+        bool found_p;
+
+        if (frame == NULL){
+                return FALSE;
+        }
+        cnt = page_hdr(frame)->ecnt;
+        if (page_hdr(frame)->level == 0){
+                idx = key_index(key, frame, &found_p, tree);
+                idx += (found_p) ? 1 : 0;
+                found_p = (idx < cnt);
+                if (found_p){
+                        copy_entry(idx, frame, nextkey, data, tree);
+                }
+                page_release(frame);
+                return found_p;
+        }
+        idx = child_index(key, frame, tree);
+        child = page_children(frame)[idx];
+        if (idx < cnt){
+                sibling = page_children(frame)[idx + 1];
+        }
+        page_release(frame);
+
+        if (next_entry(child, key, nextkey, data, tree)){
+                return TRUE;
+        }
+        return (! tree->failed_p && idx < cnt &&
+                edge_entry(sibling, FALSE, nextkey, data, tree));
+}
+
+static bool
+prev_entry(uint64_t pageid, const void *key, void *prevkey, void *data,
+           piojo_pbtree_t *tree)
+{
+        frame_t *frame = page_fetch(pageid, tree);
+        uint64_t child, sibling = 0;
+        size_t idx;
+        bool found_p;
+
+        if (frame == NULL){
+                return FALSE;
+        }
+        if (page_hdr(frame)->level == 0){
+                idx = key_index(key, frame, &found_p, tree);
+                found_p = (idx > 0);
+                if (found_p){
+                        copy_entry(idx - 1, frame, prevkey, data, tree);
+                }
+                page_release(frame);
+                return found_p;
+        }
+        idx = child_index(key, frame, tree);
+        child = page_children(frame)[idx];
+        if (idx > 0){
+                sibling = page_children(frame)[idx - 1];
+        }
+        page_release(frame);
+
+        if (prev_entry(child, key, prevkey, data, tree)){
+                return TRUE;
+        }
+        return (! tree->failed_p && idx > 0 &&
+                edge_entry(sibling, TRUE, prevkey, data, tree));
+}
+
+static void
+copy_entry(size_t eidx, const frame_t *frame, void *key, void *data,
+           const piojo_pbtree_t *tree)
+{
+        if (key != NULL){
+                piojo_key_copy(key, page_key(eidx, frame, tree),
+                               tree->eksize);
+        }
+        if (data != NULL){
+                memcpy(data, page_val(eidx, frame, tree), tree->evsize);
+        }
+}
+
+/*
+ * Defines lower_bound_<suffix>(), a branchless binary search returning
+ * the index of the first key not less than @a key in keys [0, cnt).
+ */
+#define DEFINE_LOWER_BOUND(suffix, cmp, ksize)                          \
+        static size_t                                                   \
+        lower_bound_##suffix(const void *key, const uint8_t *keys,      \
+                             size_t cnt, const piojo_pbtree_t *tree)    \
+        {                                                               \
+                size_t half, base = 0;                                  \
+                PIOJO_UNUSED(tree);                                     \
+                                                                        \
+                if (cnt == 0){                                          \
+                        return 0;                                       \
+                }                                                       \
+                while (cnt > 1){                                        \
+                        half = cnt / 2;                                 \
+                        base += (cmp(&keys[(base + half) * ksize],      \
+                                     key) < 0) ? half : 0;              \
+                        cnt -= half;                                    \
+                }                                                       \
+                return base + (cmp(&keys[base * ksize], key) < 0);      \
+        }
+
+#define DEFINE_LOWER_BOUND_KEY(suffix, type)                            \
+        DEFINE_LOWER_BOUND(suffix, piojo_key_cmp_##suffix, sizeof(type))
+
+DEFINE_LOWER_BOUND(cb, tree->cmp_cb, tree->eksize)
+PIOJO_KEYTYPE_EXPAND(DEFINE_LOWER_BOUND_KEY)
+
+static size_t
+key_index(const void *key, const frame_t *frame, bool *found_p,
+          const piojo_pbtree_t *tree)
+{
+        const uint8_t *keys = page_key(0, frame, tree);
+        size_t idx, cnt = page_hdr(frame)->ecnt;
+
+        switch (tree->keytype){
+        case PIOJO_KEY_I32:
+                idx = lower_bound_i32(key, keys, cnt, tree);
+                break;
+        case PIOJO_KEY_I64:
+                idx = lower_bound_i64(key, keys, cnt, tree);
+                break;
+        case PIOJO_KEY_SIZ:
+                idx = lower_bound_siz(key, keys, cnt, tree);
+                break;
+        default:
+                idx = lower_bound_cb(key, keys, cnt, tree);
+                break;
+        }
+        *found_p = (idx < cnt &&
+                    key_cmp(key, page_key(idx, frame, tree), tree) == 0);
+        return idx;
+}
+
+/* Separators equal to @a key lead to the right child. */
+static size_t
+child_index(const void *key, const frame_t *frame,
+            const piojo_pbtree_t *tree)
+{
+        bool found_p;
+        size_t idx = key_index(key, frame, &found_p, tree);
+
+        return (found_p) ? idx + 1 : idx;
+}
+
+static int
+key_cmp(const void *k1, const void *k2, const piojo_pbtree_t *tree)
+{
+        switch (tree->keytype){
+        case PIOJO_KEY_I32:
+                return piojo_key_cmp_i32(k1, k2);
+        case PIOJO_KEY_I64:
+                return piojo_key_cmp_i64(k1, k2);
+        case PIOJO_KEY_SIZ:
+                return piojo_key_cmp_siz(k1, k2);
+        default:
+                return tree->cmp_cb(k1, k2);
+        }
+}
+
+/* Keys of the *_i32k/i64k/sizk functions are compared inline. */
+static piojo_keytype_t
+key_type(piojo_cmp_cb keycmp)
+{
+        if (keycmp == i32_cmp){
+                return PIOJO_KEY_I32;
+        }else if (keycmp == i64_cmp){
+                return PIOJO_KEY_I64;
+        }else if (keycmp == siz_cmp){
+                return PIOJO_KEY_SIZ;
+        }
+        return PIOJO_KEY_CB;
+}
+
+static int
+i32_cmp(const void *e1, const void *e2)
+{
+        int32_t v1 = *(int32_t*) e1;
+        int32_t v2 = *(int32_t*) e2;
+        if (v1 > v2){
+                return 1;
+        }else if (v1 < v2){
+                return -1;
+        }
+        return 0;
+}
+
+static int
+i64_cmp(const void *e1, const void *e2)
+{
+        int64_t v1 = *(int64_t*) e1;
+        int64_t v2 = *(int64_t*) e2;
+        if (v1 > v2){
+                return 1;
+        }else if (v1 < v2){
+                return -1;
+        }
+        return 0;
+}
+
+static int
+siz_cmp(const void *e1, const void *e2)
+{
+        size_t v1 = *(size_t*) e1;
+        size_t v2 = *(size_t*) e2;
+        if (v1 > v2){
+                return 1;
+        }else if (v1 < v2){
+                return -1;
+        }
+        return 0;
+}
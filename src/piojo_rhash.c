@@ -0,0 +1,763 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2013 G. Elian Gidoni
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+
+/**
+ * @file
+ * @addtogroup piojorhash Piojo Read-Mostly Hash Table
+ * @{
+ * Piojo Read-Mostly Hash Table implementation.
+ * Searches take no lock: entries are immutable once published, writers
+ * are serialized by a mutex and publish changes with atomic pointer
+ * stores. Unlinked entries and tables are freed once every reader that
+ * could still see them has left (epoch based reclamation).
+ */
+
+#define _POSIX_C_SOURCE 200112L
+
+#include <pthread.h>
+#include <piojo/piojo_rhash.h>
+#include <piojo_defs.h>
+
+typedef struct node_t node_t;
+struct node_t {
+        node_t *next;
+        uint64_t hval;
+        uint8_t kv[];
+};
+
+typedef struct {
+        node_t **buckets;
+        size_t bucketcnt;
+} table_t;
+
+typedef struct retired_t retired_t;
+struct retired_t {
+        retired_t *next;
+        uint64_t epoch;
+        node_t *node;
+        table_t *table;
+};
+
+struct piojo_rhash_reader_t {
+        uint64_t epoch;
+        bool used_p;
+        piojo_rhash_reader_t *next;
+        /* Allocated block, the state starts at its first cache line. */
+        void *block;
+};
+
+struct piojo_rhash_t {
+        table_t *table;
+        uint64_t epoch;
+        size_t ecount;
+        pthread_mutex_t lock;
+        piojo_rhash_reader_t *readers;
+        retired_t *retired;
+        size_t eksize, evsize;
+        uint64_t seed;
+        piojo_hasher_if hasher;
+        piojo_alloc_if allocator;
+};
+/** @hideinitializer Size of read-mostly hash table in bytes */
+const size_t piojo_rhash_sizeof = sizeof(piojo_rhash_t);
+
+static const size_t INITIAL_BUCKET_COUNT = 32;
+static const double LOAD_RATIO_MAX = 0.8f;
+
+/* Reader states are padded to a cache line to avoid false sharing. */
+static const size_t CACHE_LINE_SIZE = 64;
+
+/* Epoch of readers outside a search. */
+static const uint64_t QUIESCENT_EPOCH = 0;
+
+static table_t*
+alloc_table(size_t bucketcnt, const piojo_rhash_t *rhash);
+
+static void
+free_table(table_t *table, const piojo_rhash_t *rhash);
+
+static node_t*
+alloc_node(const void *key, const void *data, uint64_t hval,
+           const node_t *next, const piojo_rhash_t *rhash);
+
+static node_t**
+search_link(const void *key, uint64_t hval, const table_t *table,
+            const piojo_rhash_t *rhash);
+
+static void
+expand_table(piojo_rhash_t *rhash);
+
+static bool
+insert_node(const void *key, const void *data, uint64_t hval,
+            piojo_rhash_t *rhash);
+
+static void
+retire(node_t *node, table_t *table, piojo_rhash_t *rhash);
+
+static void
+reclaim_retired(piojo_rhash_t *rhash);
+
+static void
+lock(piojo_rhash_t *rhash);
+
+static void
+unlock(piojo_rhash_t *rhash);
+
+static bool
+i32_eq(const void *e1, const void *e2);
+
+static bool
+i64_eq(const void *e1, const void *e2);
+
+static bool
+siz_eq(const void *e1, const void *e2);
+
+static const piojo_hasher_if I32_HASHER = { piojo_i32_hash, i32_eq };
+static const piojo_hasher_if I64_HASHER = { piojo_i64_hash, i64_eq };
+static const piojo_hasher_if SIZ_HASHER = { piojo_siz_hash, siz_eq };
+
+/**
+ * Allocates a new read-mostly hash table.
+ * Uses default allocator and key size of @b int32_t.
+ * @param[in] evsize Entry value size in bytes.
+ * @return New read-mostly hash table.
+ */
+piojo_rhash_t*
+piojo_rhash_alloc_i32k(size_t evsize)
+{
+        return piojo_rhash_alloc_cb_i32k(evsize, piojo_alloc_default);
+}
+
+/**
+ * Allocates a new read-mostly hash table.
+ * Uses default allocator and key size of @b int64_t.
+ * @param[in] evsize Entry value size in bytes.
+ * @return New read-mostly hash table.
+ */
+piojo_rhash_t*
+piojo_rhash_alloc_i64k(size_t evsize)
+{
+        return piojo_rhash_alloc_cb_i64k(evsize, piojo_alloc_default);
+}
+
+/**
+ * Allocates a new read-mostly hash table.
+ * Uses default allocator and key size of @b size_t.
+ * @param[in] evsize Entry value size in bytes.
+ * @return New read-mostly hash table.
+ */
+piojo_rhash_t*
+piojo_rhash_alloc_sizk(size_t evsize)
+{
+        return piojo_rhash_alloc_cb_sizk(evsize, piojo_alloc_default);
+}
+
+/**
+ * Allocates a new read-mostly hash table.
+ * Uses key size of @b int32_t.
+ * @param[in] evsize Entry value size in bytes.
+ * @param[in] allocator Allocator to be used, deferred frees use it too.
+ * @return New read-mostly hash table.
+ */
+piojo_rhash_t*
+piojo_rhash_alloc_cb_i32k(size_t evsize, piojo_alloc_if allocator)
+{
+        return piojo_rhash_alloc_cb_hash(evsize, I32_HASHER, sizeof(int32_t),
+                                         allocator);
+}
+
+/**
+ * Allocates a new read-mostly hash table.
+ * Uses key size of @b int64_t.
+ * @param[in] evsize Entry value size in bytes.
+ * @param[in] allocator Allocator to be used, deferred frees use it too.
+ * @return New read-mostly hash table.
+ */
+piojo_rhash_t*
+piojo_rhash_alloc_cb_i64k(size_t evsize, piojo_alloc_if allocator)
+{
+        return piojo_rhash_alloc_cb_hash(evsize, I64_HASHER, sizeof(int64_t),
+                                         allocator);
+}
+
+/**
+ * Allocates a new read-mostly hash table.
+ * Uses key size of @b size_t.
+ * @param[in] evsize Entry value size in bytes.
+ * @param[in] allocator Allocator to be used, deferred frees use it too.
+ * @return New read-mostly hash table.
+ */
+piojo_rhash_t*
+piojo_rhash_alloc_cb_sizk(size_t evsize, piojo_alloc_if allocator)
+{
+        return piojo_rhash_alloc_cb_hash(evsize, SIZ_HASHER, sizeof(size_t),
+                                         allocator);
+}
+
+/**
+ * Allocates a new read-mostly hash table.
+ * @param[in] evsize Entry value size in bytes.
+ * @param[in] hasher Entry key hash and equality functions.
+ * @param[in] eksize Entry key size in bytes.
+ * @param[in] allocator Allocator to be used, deferred frees use it too.
+ * @return New read-mostly hash table.
+ */
+piojo_rhash_t*
+piojo_rhash_alloc_cb_hash(size_t evsize, piojo_hasher_if hasher,
+                          size_t eksize, piojo_alloc_if allocator)
+{
+        piojo_rhash_t *rhash;
+        int ret;
+        PIOJO_ASSERT(eksize > 0 && evsize > 0);
+        PIOJO_ASSERT(hasher.hash_cb && hasher.eq_cb);
+        PIOJO_ASSERT(piojo_safe_addsiz_p(eksize, evsize));
+        PIOJO_ASSERT(piojo_safe_addsiz_p(sizeof(node_t), eksize + evsize));
+
+        rhash = (piojo_rhash_t*) allocator.alloc_cb(sizeof(piojo_rhash_t));
+        PIOJO_ASSERT(rhash);
+
+        rhash->eksize = eksize;
+        rhash->evsize = evsize;
+        rhash->hasher = hasher;
+        rhash->allocator = allocator;
+        rhash->seed = piojo_rand_seed();
+        rhash->epoch = 1;
+        rhash->ecount = 0;
+        rhash->readers = NULL;
+        rhash->retired = NULL;
+        rhash->table = alloc_table(INITIAL_BUCKET_COUNT, rhash);
+
+        ret = pthread_mutex_init(&rhash->lock, NULL);
+        PIOJO_ASSERT(ret == 0);
+        return rhash;
+}
+
+/**
+ * Frees @a rhash, all its entries and reader states.
+ * Must not be called concurrently with other functions.
+ * @param[in] rhash Read-mostly hash table being freed.
+ */
+void
+piojo_rhash_free(const piojo_rhash_t *rhash)
+{
+        piojo_rhash_reader_t *reader, *nextreader;
+        retired_t *rec, *nextrec;
+        PIOJO_ASSERT(rhash);
+
+        rec = rhash->retired;
+        while (rec != NULL){
+                nextrec = rec->next;
+                if (rec->node != NULL){
+                        rhash->allocator.free_cb(rec->node);
+                }else{
+                        free_table(rec->table, rhash);
+                }
+                rhash->allocator.free_cb(rec);
+                rec = nextrec;
+        }
+
+        reader = rhash->readers;
+        while (reader != NULL){
+                nextreader = reader->next;
+                rhash->allocator.free_cb(reader->block);
+                reader = nextreader;
+        }
+
+        free_table(rhash->table, rhash);
+        pthread_mutex_destroy((pthread_mutex_t*) &rhash->lock);
+        rhash->allocator.free_cb(rhash);
+}
+
+/**
+ * Deletes all entries in @a rhash.
+ * The old entries are reclaimed once concurrent searches are done.
+ * @param[out] rhash Read-mostly hash table being cleared.
+ */
+void
+piojo_rhash_clear(piojo_rhash_t *rhash)
+{
+        table_t *table;
+        PIOJO_ASSERT(rhash);
+
+        lock(rhash);
+        table = rhash->table;
+        PIOJO_ATOMIC_STORE(&rhash->table,
+                           alloc_table(INITIAL_BUCKET_COUNT, rhash));
+        PIOJO_ATOMIC_STORE(&rhash->ecount, 0);
+        retire(NULL, table, rhash);
+        reclaim_retired(rhash);
+        unlock(rhash);
+}
+
+/**
+ * Returns number of entries.
+ * @param[in] rhash Read-mostly hash table.
+ * @return Number of entries in @a rhash.
+ */
+size_t
+piojo_rhash_size(const piojo_rhash_t *rhash)
+{
+        PIOJO_ASSERT(rhash);
+        return PIOJO_ATOMIC_LOAD(&rhash->ecount);
+}
+
+/**
+ * Registers a reader thread.
+ * Each thread searching @a rhash needs its own reader state, which can't be
+ * shared with other threads.
+ * @param[out] rhash Read-mostly hash table.
+ * @return New reader state.
+ */
+piojo_rhash_reader_t*
+piojo_rhash_register(piojo_rhash_t *rhash)
+{
+        piojo_rhash_reader_t *reader;
+        uint8_t *block;
+        size_t size;
+        PIOJO_ASSERT(rhash);
+
+        lock(rhash);
+        reader = rhash->readers;
+        while (reader != NULL && reader->used_p){
+                reader = reader->next;
+        }
+        if (reader == NULL){
+                size = sizeof(piojo_rhash_reader_t);
+                size = (size + CACHE_LINE_SIZE - 1) / CACHE_LINE_SIZE *
+                        CACHE_LINE_SIZE;
+                block = (uint8_t*)
+                        rhash->allocator.alloc_cb(size + CACHE_LINE_SIZE - 1);
+                PIOJO_ASSERT(block);
+                reader = (piojo_rhash_reader_t*)
+                        (((uintptr_t) block + CACHE_LINE_SIZE - 1) /
+                         CACHE_LINE_SIZE * CACHE_LINE_SIZE);
+                reader->block = block;
+                reader->next = rhash->readers;
+                rhash->readers = reader;
+        }
+        reader->epoch = QUIESCENT_EPOCH;
+        reader->used_p = TRUE;
+        unlock(rhash);
+        return reader;
+}
+
+/**
+ * Unregisters a reader thread.
+ * The state is kept for reuse by piojo_rhash_register().
+ * @param[in] reader Reader state.
+ * @param[out] rhash Read-mostly hash table.
+ */
+void
+piojo_rhash_unregister(piojo_rhash_reader_t *reader, piojo_rhash_t *rhash)
+{
+        PIOJO_ASSERT(rhash);
+        PIOJO_ASSERT(reader && reader->used_p);
+
+        lock(rhash);
+        PIOJO_ATOMIC_STORE(&reader->epoch, QUIESCENT_EPOCH);
+        reader->used_p = FALSE;
+        unlock(rhash);
+}
+
+/**
+ * Inserts a new entry.
+ * If @a data is @b NULL, the value is replaced with @b TRUE (useful for sets).
+ * @param[in] key Entry key.
+ * @param[in] data Entry value.
+ * @param[out] rhash Read-mostly hash table being modified.
+ * @return @b TRUE if inserted, @b FALSE if @a key is duplicate.
+ */
+bool
+piojo_rhash_insert(const void *key, const void *data, piojo_rhash_t *rhash)
+{
+        uint64_t hval;
+        bool inserted_p;
+        PIOJO_ASSERT(rhash);
+        PIOJO_ASSERT(key);
+        PIOJO_ASSERT(data || rhash->evsize == sizeof(bool));
+
+        hval = rhash->hasher.hash_cb(key, rhash->eksize, rhash->seed);
+        lock(rhash);
+        inserted_p = insert_node(key, data, hval, rhash);
+        unlock(rhash);
+        return inserted_p;
+}
+
+/**
+ * Replaces or inserts an entry.
+ * The entry is replaced by a new one, so searches see either the old or
+ * the new value.
+ * If @a data is @b NULL, the value is replaced with @b TRUE (useful for sets).
+ * @param[in] key Entry key.
+ * @param[in] data Entry value.
+ * @param[out] rhash Read-mostly hash table being modified.
+ * @return @b TRUE if @a key is new, @b FALSE otherwise.
+ */
+bool
+piojo_rhash_set(const void *key, const void *data, piojo_rhash_t *rhash)
+{
+        node_t **link, *node;
+        uint64_t hval;
+        PIOJO_ASSERT(rhash);
+        PIOJO_ASSERT(key);
+        PIOJO_ASSERT(data || rhash->evsize == sizeof(bool));
+
+        hval = rhash->hasher.hash_cb(key, rhash->eksize, rhash->seed);
+        lock(rhash);
+        link = search_link(key, hval, rhash->table, rhash);
+        if (link != NULL){
+                node = *link;
+                PIOJO_ATOMIC_STORE(link, alloc_node(key, data, hval,
+                                                    node->next, rhash));
+                retire(node, NULL, rhash);
+                reclaim_retired(rhash);
+                unlock(rhash);
+                return FALSE;
+        }
+        insert_node(key, data, hval, rhash);
+        unlock(rhash);
+        return TRUE;
+}
+
+/**
+ * Searches an entry by key.
+ * Takes no lock, the value is copied because its entry may be reclaimed
+ * once the search returns.
+ * @param[in] key Entry key.
+ * @param[out] data Entry value copy, can be @b NULL.
+ * @param[in] reader Reader state of the calling thread.
+ * @param[in] rhash Read-mostly hash table.
+ * @return @b TRUE if found, @b FALSE if @a key doesn't exist.
+ */
+bool
+piojo_rhash_search(const void *key, void *data,
+                   piojo_rhash_reader_t *reader, const piojo_rhash_t *rhash)
+{
+        const table_t *table;
+        const node_t *node;
+        uint64_t hval;
+        bool found_p = FALSE;
+        PIOJO_ASSERT(rhash);
+        PIOJO_ASSERT(key);
+        PIOJO_ASSERT(reader && reader->used_p);
+
+        hval = rhash->hasher.hash_cb(key, rhash->eksize, rhash->seed);
+
+        /* Announce the epoch before reading any shared pointer. */
+        PIOJO_ATOMIC_STORE(&reader->epoch, PIOJO_ATOMIC_LOAD(&rhash->epoch));
+        PIOJO_ATOMIC_FENCE();
+
+        table = PIOJO_ATOMIC_LOAD(&rhash->table);
+        node = PIOJO_ATOMIC_LOAD(&table->buckets[hval &
+                                                 (table->bucketcnt - 1)]);
+        while (node != NULL){
+                if (node->hval == hval &&
+                    rhash->hasher.eq_cb(node->kv, key)){
+                        if (data != NULL){
+                                memcpy(data, node->kv + rhash->eksize,
+                                       rhash->evsize);
+                        }
+                        found_p = TRUE;
+                        break;
+                }
+                node = PIOJO_ATOMIC_LOAD(&node->next);
+        }
+
+        PIOJO_ATOMIC_STORE(&reader->epoch, QUIESCENT_EPOCH);
+        return found_p;
+}
+
+/**
+ * Deletes an entry by key.
+ * @param[in] key Entry key.
+ * @param[out] rhash Read-mostly hash table.
+ * @return @b TRUE if deleted, @b FALSE if @a key doesn't exist.
+ */
+bool
+piojo_rhash_delete(const void *key, piojo_rhash_t *rhash)
+{
+        node_t **link, *node;
+        uint64_t hval;
+        PIOJO_ASSERT(rhash);
+        PIOJO_ASSERT(key);
+
+        hval = rhash->hasher.hash_cb(key, rhash->eksize, rhash->seed);
+        lock(rhash);
+        link = search_link(key, hval, rhash->table, rhash);
+        if (link == NULL){
+                unlock(rhash);
+                return FALSE;
+        }
+        node = *link;
+        PIOJO_ATOMIC_STORE(link, node->next);
+        PIOJO_ATOMIC_STORE(&rhash->ecount, rhash->ecount - 1);
+        retire(node, NULL, rhash);
+        reclaim_retired(rhash);
+        unlock(rhash);
+        return TRUE;
+}
+
+/**
+ * Frees retired entries no reader can see anymore.
+ * Writers already do this on each change, this is useful when no more
+ * changes are expected.
+ * @param[out] rhash Read-mostly hash table.
+ */
+void
+piojo_rhash_reclaim(piojo_rhash_t *rhash)
+{
+        PIOJO_ASSERT(rhash);
+
+        lock(rhash);
+        reclaim_retired(rhash);
+        unlock(rhash);
+}
+
+/** @}
+ * Private functions.
+ */
+
+static table_t*
+alloc_table(size_t bucketcnt, const piojo_rhash_t *rhash)
+{
+        table_t *table;
+        PIOJO_ASSERT(piojo_safe_mulsiz_p(bucketcnt, sizeof(node_t*)));
+
+        table = (table_t*) rhash->allocator.alloc_cb(sizeof(table_t));
+        PIOJO_ASSERT(table);
+        table->bucketcnt = bucketcnt;
+        table->buckets = (node_t**) rhash->allocator.alloc_cb(bucketcnt *
+                                                              sizeof(node_t*));
+        PIOJO_ASSERT(table->buckets);
+        memset(table->buckets, 0, bucketcnt * sizeof(node_t*));
+        return table;
+}
+
+static void
+free_table(table_t *table, const piojo_rhash_t *rhash)
+{
+        node_t *node, *next;
+        size_t i;
+
+        for (i = 0; i < table->bucketcnt; ++i){
+                node = table->buckets[i];
+                while (node != NULL){
+                        next = node->next;
+                        rhash->allocator.free_cb(node);
+                        node = next;
+                }
+        }
+        rhash->allocator.free_cb(table->buckets);
+        rhash->allocator.free_cb(table);
+}
+
+static node_t*
+alloc_node(const void *key, const void *data, uint64_t hval,
+           const node_t *next, const piojo_rhash_t *rhash)
+{
+        bool null_p = TRUE;
+        node_t *node;
+
+        if (data == NULL){
+                data = &null_p;
+        }
+
+        node = (node_t*) rhash->allocator.alloc_cb(sizeof(node_t) +
+                                                   rhash->eksize +
+                                                   rhash->evsize);
+        PIOJO_ASSERT(node);
+        node->next = (node_t*) next;
+        node->hval = hval;
+        memcpy(node->kv, key, rhash->eksize);
+        memcpy(node->kv + rhash->eksize, data, rhash->evsize);
+        return node;
+}
+
+/* Returns the link pointing to the entry of key, only used by writers. */
+static node_t**
+search_link(const void *key, uint64_t hval, const table_t *table,
+            const piojo_rhash_t *rhash)
+{
+        node_t **link = &table->buckets[hval & (table->bucketcnt - 1)];
+        while (*link != NULL){
+                if ((*link)->hval == hval &&
+                    rhash->hasher.eq_cb((*link)->kv, key)){
+                        return link;
+                }
+                link = &(*link)->next;
+        }
+        return NULL;
+}
+
+/*
+ * Entries are linked in place, so growing copies them into a new table
+ * which is published at once; the old one is retired as a whole.
+ */
+static void
+expand_table(piojo_rhash_t *rhash)
+{
+        table_t *table = rhash->table, *newtable;
+        node_t *node, **link;
+        size_t i;
+        double lratio;
+
+        lratio = (rhash->ecount + 1) / (double) table->bucketcnt;
+        if (lratio <= LOAD_RATIO_MAX){
+                return;
+        }
+        PIOJO_ASSERT(table->bucketcnt <= SIZE_MAX / 2);
+
+        newtable = alloc_table(table->bucketcnt * 2, rhash);
+        for (i = 0; i < table->bucketcnt; ++i){
+                for (node = table->buckets[i]; node != NULL;
+                     node = node->next){
+                        link = &newtable->buckets[node->hval &
+                                                  (newtable->bucketcnt - 1)];
+                        *link = alloc_node(node->kv, node->kv + rhash->eksize,
+                                           node->hval, *link, rhash);
+                }
+        }
+        PIOJO_ATOMIC_STORE(&rhash->table, newtable);
+        retire(NULL, table, rhash);
+}
+
+/* Writer lock must be held. */
+static bool
+insert_node(const void *key, const void *data, uint64_t hval,
+            piojo_rhash_t *rhash)
+{
+        node_t **link;
+
+        if (search_link(key, hval, rhash->table, rhash) != NULL){
+                return FALSE;
+        }
+        expand_table(rhash);
+        link = &rhash->table->buckets[hval & (rhash->table->bucketcnt - 1)];
+        PIOJO_ATOMIC_STORE(link, alloc_node(key, data, hval, *link, rhash));
+        PIOJO_ATOMIC_STORE(&rhash->ecount, rhash->ecount + 1);
+        reclaim_retired(rhash);
+        return TRUE;
+}
+
+/* Defers freeing of node or table, writer lock must be held. */
+static void
+retire(node_t *node, table_t *table, piojo_rhash_t *rhash)
+{
+        retired_t *rec;
+
+        rec = (retired_t*) rhash->allocator.alloc_cb(sizeof(retired_t));
+        PIOJO_ASSERT(rec);
+        rec->node = node;
+        rec->table = table;
+        rec->epoch = PIOJO_ATOMIC_LOAD(&rhash->epoch);
+        rec->next = rhash->retired;
+        rhash->retired = rec;
+}
+
+/* Writer lock must be held. */
+static void
+reclaim_retired(piojo_rhash_t *rhash)
+{
+        piojo_rhash_reader_t *reader;
+        retired_t *rec, **link;
+        uint64_t minepoch, epoch;
+
+        if (rhash->retired == NULL){
+                return;
+        }
+
+        /* New readers won't see entries retired up to now. */
+        minepoch = PIOJO_ATOMIC_ADD(&rhash->epoch, 1) + 1;
+        PIOJO_ATOMIC_FENCE();
+        for (reader = rhash->readers; reader != NULL; reader = reader->next){
+                epoch = PIOJO_ATOMIC_LOAD(&reader->epoch);
+                if (epoch != QUIESCENT_EPOCH && epoch < minepoch){
+                        minepoch = epoch;
+                }
+        }
+
+        link = &rhash->retired;
+        while (*link != NULL){
+                rec = *link;
+                if (rec->epoch < minepoch){
+                        *link = rec->next;
+                        if (rec->node != NULL){
+                                rhash->allocator.free_cb(rec->node);
+                        }else{
+                                free_table(rec->table, rhash);
+                        }
+                        rhash->allocator.free_cb(rec);
+                }else{
+                        link = &rec->next;
+                }
+        }
+}
+
+static void
+lock(piojo_rhash_t *rhash)
+{
+        int ret = pthread_mutex_lock(&rhash->lock);
+        PIOJO_ASSERT(ret == 0);
+}
+
+static void
+unlock(piojo_rhash_t *rhash)
+{
+        int ret = pthread_mutex_unlock(&rhash->lock);
+        PIOJO_ASSERT(ret == 0);
+}
+
+static bool
+i32_eq(const void *e1, const void *e2)
+{
+        int32_t v1 = *(int32_t*) e1;
+        int32_t v2 = *(int32_t*) e2;
+        if (v1 == v2){
+                return TRUE;
+        }
+        return FALSE;
+}
+
+static bool
+i64_eq(const void *e1, const void *e2)
+{
+        int64_t v1 = *(int64_t*) e1;
+        int64_t v2 = *(int64_t*) e2;
+        if (v1 == v2){
+                return TRUE;
+        }
+        return FALSE;
+}
+
+static bool
+siz_eq(const void *e1, const void *e2)
+{
+        size_t v1 = *(size_t*) e1;
+        size_t v2 = *(size_t*) e2;
+        if (v1 == v2){
+                return TRUE;
+        }
+        return FALSE;
+}
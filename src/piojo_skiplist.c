@@ -27,29 +27,49 @@
  * @addtogroup piojolist Piojo Skip List
  * @{
  * Piojo Skip List implementation.
+ * Each node holds its links, key and value in one block, deleted nodes are
+ * kept in per-level free lists for reuse.
+ * Each link also stores its width (number of entries it skips plus one),
+ * so entries are found by position and ranked in O(log n).
  */
 
 #include <piojo/piojo_skiplist.h>
 #include <piojo_defs.h>
 
+#define MAX_LEVELS 24
+
+/*
+ * Each link keeps its width next to it, the width of a NULL link reaches
+ * one past the last entry.
+ */
+typedef struct {
+        piojo_skiplist_node_t *next;
+        size_t width;
+} link_t;
+
+/*
+ * Key and value follow the level + 1 links, their offsets depend on the
+ * node level so they are kept in the node.
+ */
 struct piojo_skiplist_node_t {
         void *data, *key;
         int level;
-        piojo_skiplist_node_t **nexts;
+        link_t links[];
 };
 
 struct piojo_skiplist_t {
         piojo_skiplist_node_t *head;
         size_t eksize, esize, ecount;
         int level, max_levels;
+        /* Freed nodes by level, linked through their first link. */
+        piojo_skiplist_node_t *freelists[MAX_LEVELS + 1];
         piojo_cmp_cb cmp_cb;
+        piojo_keytype_t keytype;
         piojo_alloc_if allocator;
 };
 /** @hideinitializer Size of list in bytes */
 const size_t piojo_skiplist_sizeof = sizeof(piojo_skiplist_t);
 
-static const int MAX_LEVELS = 24;
-
 static int
 i32_cmp(const void *e1, const void *e2);
 
@@ -60,20 +80,40 @@ static int
 siz_cmp(const void *e1, const void *e2);
 
 static piojo_skiplist_node_t*
-init_node(const void *key, const void *data, const piojo_skiplist_t *list, size_t level);
+init_node(const void *key, const void *data, piojo_skiplist_t *list,
+          int level);
+
+static piojo_skiplist_node_t*
+insert_node(const void *key, const void *data, piojo_skiplist_t *list);
 
 static void
-finish_node(const piojo_skiplist_node_t *node, const piojo_skiplist_t *list);
+finish_node(piojo_skiplist_node_t *node, piojo_skiplist_t *list);
 
 static void
 finish_all(const piojo_skiplist_t *list);
 
 static piojo_skiplist_node_t*
-alloc_node(const piojo_skiplist_t *list, size_t level);
+alloc_node(const piojo_skiplist_t *list, int level);
 
 static int
 node_level(const piojo_skiplist_t *list);
 
+static piojo_skiplist_node_t*
+search_less(const void *key, const piojo_skiplist_t *list,
+            piojo_skiplist_node_t **update, size_t *ranks);
+
+static size_t
+count_less(const void *key, bool equal_p, const piojo_skiplist_t *list);
+
+static int
+key_cmp(const void *k1, const void *k2, const piojo_skiplist_t *list);
+
+static piojo_keytype_t
+key_type(piojo_cmp_cb keycmp);
+
+static const void*
+cursor_key(piojo_skiplist_node_t *node, piojo_skiplist_cursor_t *cursor);
+
 /**
  * Allocates a new list.
  * Uses default allocator and key size of @b int32_t.
@@ -194,13 +234,14 @@ piojo_skiplist_alloc_cb_cmp(size_t evsize, piojo_cmp_cb keycmp, size_t eksize,
         list->esize = evsize;
         list->eksize = eksize;
         list->cmp_cb = keycmp;
+        list->keytype = key_type(keycmp);
         list->ecount = 0;
         list->level = 0;
         list->max_levels = MAX_LEVELS;
+        memset(list->freelists, 0, sizeof(list->freelists));
 
         list->head = alloc_node(list, list->max_levels);
-        PIOJO_ASSERT(list->head);
-
+        list->head->links[0].width = 1;
         return list;
 }
 
@@ -220,10 +261,10 @@ piojo_skiplist_copy(const piojo_skiplist_t *list)
                 list->eksize, list->allocator);
         PIOJO_ASSERT(newlist);
 
-        current = list->head->nexts[0];
+        current = list->head->links[0].next;
         while (current != NULL){
                 piojo_skiplist_insert(current->key, current->data, newlist);
-                current = current->nexts[0];
+                current = current->links[0].next;
         }
         return newlist;
 }
@@ -254,8 +295,10 @@ piojo_skiplist_clear(piojo_skiplist_t *list)
         PIOJO_ASSERT(list);
         finish_all(list);
         list->ecount = 0;
+        list->level = 0;
+        memset(list->freelists, 0, sizeof(list->freelists));
         list->head = alloc_node(list, list->max_levels);
-        PIOJO_ASSERT(list->head);
+        list->head->links[0].width = 1;
 }
 
 /**
@@ -286,40 +329,11 @@ piojo_skiplist_insert(const void *key, const void *data, piojo_skiplist_t *list)
         PIOJO_ASSERT(list->ecount < SIZE_MAX);
         PIOJO_ASSERT(data || list->esize == sizeof(bool));
 
-        piojo_skiplist_node_t **update = list->allocator.alloc_cb(sizeof(piojo_skiplist_node_t*) * (list->max_levels + 1));
-        PIOJO_ASSERT(update);
-        memset(update, 0, sizeof(piojo_skiplist_node_t*) * (list->max_levels + 1));
-
-        piojo_skiplist_node_t *current = list->head;
-        for (int i = list->level; i >= 0; i--) {
-                while (current->nexts[i] != NULL && list->cmp_cb(key, current->nexts[i]->key) > 0) {
-                        current = current->nexts[i];
-                }
-                update[i] = current;
-        }
-
-        current = current->nexts[0];
-        if (current != NULL && list->cmp_cb(key, current->key) == 0) {
-                list->allocator.free_cb(update);
-                return FALSE;
-        }
-
-        int new_level = node_level(list);
-        if (new_level > list->level) {
-                for (int i = list->level + 1; i <= new_level; i++) {
-                        update[i] = list->head;
-                }
-                list->level = new_level;
-        }
-
-        piojo_skiplist_node_t *newnode = init_node(key, data, list, new_level);
-        for (int i = 0; i <= new_level; i++) {
-                newnode->nexts[i] = update[i]->nexts[i];
-                update[i]->nexts[i] = newnode;
+        if (insert_node(key, data, list) == NULL){
+                ++list->ecount;
+                return TRUE;
         }
-        list->allocator.free_cb(update);
-        ++list->ecount;
-        return TRUE;
+        return FALSE;
 }
 
 /**
@@ -337,43 +351,16 @@ piojo_skiplist_set(const void *key, const void *data, piojo_skiplist_t *list)
         PIOJO_ASSERT(key);
         PIOJO_ASSERT(data || list->esize == sizeof(bool));
 
-        piojo_skiplist_node_t **update = list->allocator.alloc_cb(sizeof(piojo_skiplist_node_t*) * (list->max_levels + 1));
-        PIOJO_ASSERT(update);
-        memset(update, 0, sizeof(piojo_skiplist_node_t*) * (list->max_levels + 1));
-
-        piojo_skiplist_node_t *current = list->head;
-        for (int i = list->level; i >= 0; i--) {
-                while (current->nexts[i] != NULL && list->cmp_cb(key, current->nexts[i]->key) > 0) {
-                        current = current->nexts[i];
-                }
-                update[i] = current;
-        }
-
-        current = current->nexts[0];
-        if (current != NULL && list->cmp_cb(key, current->key) == 0) {
-                if (data != NULL){
-                        memcpy(current->data, data, list->esize);
-                }
-                list->allocator.free_cb(update);
-                return FALSE;
-        }
-
-        int new_level = node_level(list);
-        if (new_level > list->level) {
-                for (int i = list->level + 1; i <= new_level; i++) {
-                        update[i] = list->head;
-                }
-                list->level = new_level;
+        piojo_skiplist_node_t *current = insert_node(key, data, list);
+        if (current == NULL){
+                PIOJO_ASSERT(list->ecount < SIZE_MAX);
+                ++list->ecount;
+                return TRUE;
         }
-
-        piojo_skiplist_node_t *newnode = init_node(key, data, list, new_level);
-        for (int i = 0; i <= new_level; i++) {
-                newnode->nexts[i] = update[i]->nexts[i];
-                update[i]->nexts[i] = newnode;
+        if (data != NULL){
+                memcpy(current->data, data, list->esize);
         }
-        list->allocator.free_cb(update);
-        ++list->ecount;
-        return TRUE;
+        return FALSE;
 }
 
 /**
@@ -388,14 +375,9 @@ piojo_skiplist_search(const void *key, const piojo_skiplist_t *list)
         PIOJO_ASSERT(list);
         PIOJO_ASSERT(key);
 
-        piojo_skiplist_node_t *current = list->head;
-        for (int i = list->level; i >= 0; i--) {
-                while (current->nexts[i] != NULL && list->cmp_cb(key, current->nexts[i]->key) > 0) {
-                        current = current->nexts[i];
-                }
-        }
-        current = current->nexts[0];
-        if (current != NULL && list->cmp_cb(key, current->key) == 0) {
+        piojo_skiplist_node_t *current = search_less(key, list, NULL, NULL);
+        current = current->links[0].next;
+        if (current != NULL && key_cmp(key, current->key, list) == 0) {
                 return current->data;
         }
         return NULL;
@@ -414,34 +396,27 @@ piojo_skiplist_delete(const void *key, piojo_skiplist_t *list)
         PIOJO_ASSERT(key);
         PIOJO_ASSERT(list->ecount > 0);
 
-        piojo_skiplist_node_t **update = list->allocator.alloc_cb(sizeof(piojo_skiplist_node_t*) * (list->max_levels + 1));
-        PIOJO_ASSERT(update);
-        memset(update, 0, sizeof(piojo_skiplist_node_t*) * (list->max_levels + 1));
-        piojo_skiplist_node_t *current = list->head;
-        for (int i = list->level; i >= 0; i--) {
-                while (current->nexts[i] != NULL && list->cmp_cb(key, current->nexts[i]->key) > 0) {
-                        current = current->nexts[i];
-                }
-                update[i] = current;
-        }
-
-        current = current->nexts[0];
-        if (current != NULL && list->cmp_cb(key, current->key) == 0) {
+        piojo_skiplist_node_t *update[MAX_LEVELS + 1];
+        piojo_skiplist_node_t *current = search_less(key, list, update, NULL);
+        current = current->links[0].next;
+        if (current != NULL && key_cmp(key, current->key, list) == 0) {
                 for (int i = 0; i <= list->level; i++) {
-                        if (update[i]->nexts[i] != current) {
-                                break;
+                        if (update[i]->links[i].next != current) {
+                                /* Links above the node skip one less. */
+                                --update[i]->links[i].width;
+                                continue;
                         }
-                        update[i]->nexts[i] = current->nexts[i];
+                        update[i]->links[i].next = current->links[i].next;
+                        update[i]->links[i].width +=
+                                current->links[i].width - 1;
                 }
-                while (list->level > 0 && list->head->nexts[list->level] == NULL) {
+                while (list->level > 0 && list->head->links[list->level].next == NULL) {
                         list->level--;
                 }
                 --list->ecount;
                 finish_node(current, list);
-                list->allocator.free_cb(update);
                 return TRUE;
         }
-        list->allocator.free_cb(update);
         return FALSE;
 }
 
@@ -456,11 +431,11 @@ piojo_skiplist_first(const piojo_skiplist_t *list, void **data)
 {
         PIOJO_ASSERT(list);
         // skip sentinel
-        if (list->head->nexts[0] != NULL){
+        if (list->head->links[0].next != NULL){
                 if (data != NULL){
-                        *data = list->head->nexts[0]->data;
+                        *data = list->head->links[0].next->data;
                 }
-                return list->head->nexts[0]->key;
+                return list->head->links[0].next->key;
         }
         return NULL;
 }
@@ -478,8 +453,8 @@ piojo_skiplist_last(const piojo_skiplist_t *list, void **data)
 
         piojo_skiplist_node_t *current = list->head;
         for (int i = list->level; i >= 0; i--) {
-                while (current->nexts[i] != NULL) {
-                        current = current->nexts[i];
+                while (current->links[i].next != NULL) {
+                        current = current->links[i].next;
                 }
         }
         if (current != NULL && current != list->head) {
@@ -506,11 +481,11 @@ piojo_skiplist_next(const void *key, const piojo_skiplist_t *list, void **data)
 
         piojo_skiplist_node_t *current = list->head;
         for (int i = list->level; i >= 0; i--) {
-                while (current->nexts[i] != NULL && list->cmp_cb(key, current->nexts[i]->key) >= 0) {
-                        current = current->nexts[i];
+                while (current->links[i].next != NULL && key_cmp(key, current->links[i].next->key, list) >= 0) {
+                        current = current->links[i].next;
                 }
         }
-        current = current->nexts[0];
+        current = current->links[0].next;
         if (current != NULL) {
                 if (data != NULL){
                         *data = current->data;
@@ -532,13 +507,7 @@ piojo_skiplist_prev(const void *key, const piojo_skiplist_t *list, void **data)
 {
         PIOJO_ASSERT(list);
         PIOJO_ASSERT(key);
-        piojo_skiplist_node_t *current = list->head, *prev = NULL;
-        for (int i = list->level; i >= 0; i--) {
-                while (current->nexts[i] != NULL && list->cmp_cb(key, current->nexts[i]->key) > 0) {
-                        current = current->nexts[i];
-                }
-                prev = current;
-        }
+        piojo_skiplist_node_t *prev = search_less(key, list, NULL, NULL);
 
         if (prev != NULL && prev != list->head) {
                 if (data != NULL) {
@@ -549,68 +518,405 @@ piojo_skiplist_prev(const void *key, const piojo_skiplist_t *list, void **data)
         return NULL;
 }
 
+/**
+ * Reads the key at position @a idx (order given by @a keycmp function).
+ * @param[in] idx Entry position, first key is at @b 0.
+ * @param[in] list
+ * @param[out] data Entry value, can be @b NULL.
+ * @return key or @b NULL if @a idx is not less than the list size.
+ */
+const void*
+piojo_skiplist_at(size_t idx, const piojo_skiplist_t *list, void **data)
+{
+        PIOJO_ASSERT(list);
+
+        if (idx >= list->ecount){
+                return NULL;
+        }
+        piojo_skiplist_node_t *current = list->head;
+        size_t rank = 0;
+        for (int i = list->level; i >= 0; i--) {
+                while (current->links[i].next != NULL &&
+                       rank + current->links[i].width <= idx + 1) {
+                        rank += current->links[i].width;
+                        current = current->links[i].next;
+                }
+        }
+        if (data != NULL){
+                *data = current->data;
+        }
+        return current->key;
+}
+
+/**
+ * Returns the position @a key has or would have if inserted.
+ * @param[in] key Entry key, doesn't need to be in @a list.
+ * @param[in] list
+ * @return Number of keys less than @a key.
+ */
+size_t
+piojo_skiplist_rank(const void *key, const piojo_skiplist_t *list)
+{
+        PIOJO_ASSERT(list);
+        PIOJO_ASSERT(key);
+        return count_less(key, FALSE, list);
+}
+
+/**
+ * Counts the keys in [@a lo, @a hi] without walking them.
+ * @param[in] lo Lowest key, doesn't need to be in @a list.
+ * @param[in] hi Highest key, doesn't need to be in @a list.
+ * @param[in] list
+ * @return Number of keys not less than @a lo and not greater than @a hi.
+ */
+size_t
+piojo_skiplist_count_range(const void *lo, const void *hi,
+                           const piojo_skiplist_t *list)
+{
+        size_t lorank, hirank;
+        PIOJO_ASSERT(list);
+        PIOJO_ASSERT(lo && hi);
+
+        lorank = count_less(lo, FALSE, list);
+        hirank = count_less(hi, TRUE, list);
+        return hirank > lorank ? hirank - lorank : 0;
+}
+
+/**
+ * Positions @a cursor at the first key (order given by @a keycmp function).
+ * @param[in] list
+ * @param[out] cursor List cursor.
+ * @return first key or @b NULL if @a list is empty.
+ */
+const void*
+piojo_skiplist_cursor_first(const piojo_skiplist_t *list,
+                            piojo_skiplist_cursor_t *cursor)
+{
+        PIOJO_ASSERT(list);
+        PIOJO_ASSERT(cursor);
+        return cursor_key(list->head->links[0].next, cursor);
+}
+
+/**
+ * Positions @a cursor at the last key (order given by @a keycmp function).
+ * @param[in] list
+ * @param[out] cursor List cursor.
+ * @return last key or @b NULL if @a list is empty.
+ */
+const void*
+piojo_skiplist_cursor_last(const piojo_skiplist_t *list,
+                           piojo_skiplist_cursor_t *cursor)
+{
+        PIOJO_ASSERT(list);
+        PIOJO_ASSERT(cursor);
+
+        piojo_skiplist_node_t *current = list->head;
+        for (int i = list->level; i >= 0; i--) {
+                while (current->links[i].next != NULL) {
+                        current = current->links[i].next;
+                }
+        }
+        return cursor_key(current != list->head ? current : NULL, cursor);
+}
+
+/**
+ * Positions @a cursor at the first key not less than @a key.
+ * @param[in] key
+ * @param[in] list
+ * @param[out] cursor List cursor.
+ * @return found key or @b NULL if all keys are less than @a key.
+ */
+const void*
+piojo_skiplist_cursor_seek(const void *key, const piojo_skiplist_t *list,
+                           piojo_skiplist_cursor_t *cursor)
+{
+        PIOJO_ASSERT(list);
+        PIOJO_ASSERT(key);
+        PIOJO_ASSERT(cursor);
+        return cursor_key(search_less(key, list, NULL, NULL)->links[0].next,
+                          cursor);
+}
+
+/**
+ * Moves @a cursor to the next key (order given by @a keycmp function).
+ * @param[in,out] cursor List cursor.
+ * @param[in] list
+ * @return next key or @b NULL if @a cursor was at the last key.
+ */
+const void*
+piojo_skiplist_cursor_next(piojo_skiplist_cursor_t *cursor,
+                           const piojo_skiplist_t *list)
+{
+        PIOJO_ASSERT(list);
+        PIOJO_ASSERT(cursor && cursor->node);
+        return cursor_key(cursor->node->links[0].next, cursor);
+}
+
+/**
+ * Moves @a cursor to the previous key (order given by @a keycmp function).
+ * Nodes don't link backwards, so the key is searched in O(log n).
+ * @param[in,out] cursor List cursor.
+ * @param[in] list
+ * @return previous key or @b NULL if @a cursor was at the first key.
+ */
+const void*
+piojo_skiplist_cursor_prev(piojo_skiplist_cursor_t *cursor,
+                           const piojo_skiplist_t *list)
+{
+        PIOJO_ASSERT(list);
+        PIOJO_ASSERT(cursor && cursor->node);
+
+        piojo_skiplist_node_t *prev = search_less(cursor->node->key, list,
+                                                  NULL, NULL);
+        return cursor_key(prev != list->head ? prev : NULL, cursor);
+}
+
+/**
+ * Returns the entry value at @a cursor.
+ * @param[in] cursor List cursor.
+ * @param[in] list
+ * @return Entry value.
+ */
+void*
+piojo_skiplist_cursor_value(const piojo_skiplist_cursor_t *cursor,
+                            const piojo_skiplist_t *list)
+{
+        PIOJO_ASSERT(list);
+        PIOJO_ASSERT(cursor && cursor->node);
+        return cursor->node->data;
+}
+
+/**
+ * Deletes the entry at @a cursor and moves it to the next key.
+ * @param[in,out] cursor List cursor.
+ * @param[out] list
+ * @return next key or @b NULL if the deleted key was the last one.
+ */
+const void*
+piojo_skiplist_cursor_delete(piojo_skiplist_cursor_t *cursor,
+                             piojo_skiplist_t *list)
+{
+        PIOJO_ASSERT(list);
+        PIOJO_ASSERT(cursor && cursor->node);
+
+        piojo_skiplist_node_t *next = cursor->node->links[0].next;
+        piojo_skiplist_delete(cursor->node->key, list);
+        return cursor_key(next, cursor);
+}
+
 /** @}
  * Private functions.
  */
 
+/*
+ * Defines search_less_<suffix>(), comparing keys with 'cmp'.
+ * Returns the last node with a key less than @a key, or the list head.
+ * The last node visited at each level is stored in @a update and its
+ * position (head is 0) in @a ranks, both can be NULL.
+ */
+#define DEFINE_SEARCH_LESS(suffix, cmp)                                 \
+        static piojo_skiplist_node_t*                                   \
+        search_less_##suffix(const void *key,                           \
+                             const piojo_skiplist_t *list,              \
+                             piojo_skiplist_node_t **update,            \
+                             size_t *ranks)                             \
+        {                                                               \
+                piojo_skiplist_node_t *current = list->head;            \
+                size_t rank = 0;                                        \
+                for (int i = list->level; i >= 0; i--) {                \
+                        while (current->links[i].next != NULL &&        \
+                               cmp(key, current->links[i].next->key) > 0) { \
+                                if (ranks != NULL) {                    \
+                                        rank += current->links[i].width; \
+                                }                                       \
+                                current = current->links[i].next;       \
+                        }                                               \
+                        if (update != NULL) {                           \
+                                update[i] = current;                    \
+                        }                                               \
+                        if (ranks != NULL) {                            \
+                                ranks[i] = rank;                        \
+                        }                                               \
+                }                                                       \
+                return current;                                         \
+        }
+
+#define DEFINE_SEARCH_LESS_KEY(suffix, type)                            \
+        DEFINE_SEARCH_LESS(suffix, piojo_key_cmp_##suffix)
+
+DEFINE_SEARCH_LESS(cb, list->cmp_cb)
+PIOJO_KEYTYPE_EXPAND(DEFINE_SEARCH_LESS_KEY)
+
 static piojo_skiplist_node_t*
-init_node(const void *key, const void *data, const piojo_skiplist_t *list, size_t level)
+search_less(const void *key, const piojo_skiplist_t *list,
+            piojo_skiplist_node_t **update, size_t *ranks)
+{
+        switch (list->keytype){
+        case PIOJO_KEY_I32:
+                return search_less_i32(key, list, update, ranks);
+        case PIOJO_KEY_I64:
+                return search_less_i64(key, list, update, ranks);
+        case PIOJO_KEY_SIZ:
+                return search_less_siz(key, list, update, ranks);
+        default:
+                return search_less_cb(key, list, update, ranks);
+        }
+}
+
+/* Returns the number of keys less than (or equal to, if equal_p) key. */
+static size_t
+count_less(const void *key, bool equal_p, const piojo_skiplist_t *list)
+{
+        size_t ranks[MAX_LEVELS + 1];
+        piojo_skiplist_node_t *current = search_less(key, list, NULL, ranks);
+        current = current->links[0].next;
+        if (equal_p && current != NULL &&
+            key_cmp(key, current->key, list) == 0){
+                return ranks[0] + 1;
+        }
+        return ranks[0];
+}
+
+static int
+key_cmp(const void *k1, const void *k2, const piojo_skiplist_t *list)
+{
+        switch (list->keytype){
+        case PIOJO_KEY_I32:
+                return piojo_key_cmp_i32(k1, k2);
+        case PIOJO_KEY_I64:
+                return piojo_key_cmp_i64(k1, k2);
+        case PIOJO_KEY_SIZ:
+                return piojo_key_cmp_siz(k1, k2);
+        default:
+                return list->cmp_cb(k1, k2);
+        }
+}
+
+/* Keys of the *_i32k/i64k/sizk allocators are compared inline. */
+static piojo_keytype_t
+key_type(piojo_cmp_cb keycmp)
+{
+        if (keycmp == i32_cmp){
+                return PIOJO_KEY_I32;
+        }else if (keycmp == i64_cmp){
+                return PIOJO_KEY_I64;
+        }else if (keycmp == siz_cmp){
+                return PIOJO_KEY_SIZ;
+        }
+        return PIOJO_KEY_CB;
+}
+
+static const void*
+cursor_key(piojo_skiplist_node_t *node, piojo_skiplist_cursor_t *cursor)
+{
+        cursor->node = node;
+        return node != NULL ? node->key : NULL;
+}
+
+/* Returns NULL if key was inserted, or the node holding key. */
+static piojo_skiplist_node_t*
+insert_node(const void *key, const void *data, piojo_skiplist_t *list)
+{
+        piojo_skiplist_node_t *update[MAX_LEVELS + 1];
+        size_t ranks[MAX_LEVELS + 1], skipped;
+        piojo_skiplist_node_t *current = search_less(key, list, update, ranks);
+        current = current->links[0].next;
+        if (current != NULL && key_cmp(key, current->key, list) == 0) {
+                return current;
+        }
+
+        int new_level = node_level(list);
+        if (new_level > list->level) {
+                for (int i = list->level + 1; i <= new_level; i++) {
+                        update[i] = list->head;
+                        ranks[i] = 0;
+                        list->head->links[i].width = list->ecount + 1;
+                }
+                list->level = new_level;
+        }
+
+        piojo_skiplist_node_t *newnode = init_node(key, data, list, new_level);
+        for (int i = 0; i <= new_level; i++) {
+                /* Entries between update[i] and the new node. */
+                skipped = ranks[0] - ranks[i];
+                newnode->links[i].next = update[i]->links[i].next;
+                newnode->links[i].width = update[i]->links[i].width - skipped;
+                update[i]->links[i].next = newnode;
+                update[i]->links[i].width = skipped + 1;
+        }
+        for (int i = new_level + 1; i <= list->level; i++) {
+                ++update[i]->links[i].width;
+        }
+        return NULL;
+}
+
+static piojo_skiplist_node_t*
+init_node(const void *key, const void *data, piojo_skiplist_t *list,
+          int level)
 {
         bool null_p = TRUE;
+        piojo_skiplist_node_t *node = list->freelists[level];
         if (data == NULL){
                 data = &null_p;
         }
-        piojo_skiplist_node_t *node = alloc_node(list, level);
+        if (node != NULL){
+                list->freelists[level] = node->links[0].next;
+        }else{
+                node = alloc_node(list, level);
+        }
         memcpy(node->data, data, list->esize);
-        memcpy(node->key, key, list->eksize);
+        piojo_key_copy(node->key, key, list->eksize);
         return node;
 }
 
+/* Nodes go back to the free list of their level. */
 static void
-finish_node(const piojo_skiplist_node_t *node, const piojo_skiplist_t *list)
+finish_node(piojo_skiplist_node_t *node, piojo_skiplist_t *list)
 {
-        list->allocator.free_cb(node->data);
-        list->allocator.free_cb(node->key);
-        list->allocator.free_cb(node->nexts);
-        list->allocator.free_cb(node);
+        node->links[0].next = list->freelists[node->level];
+        list->freelists[node->level] = node;
 }
 
 static void
 finish_all(const piojo_skiplist_t *list)
 {
         piojo_skiplist_node_t *next, *node;
-        node = list->head;
-        while (node != NULL){
-                next = node->nexts[0];
-                finish_node(node, list);
-                node = next;
+        int i;
+        for (i = -1; i <= MAX_LEVELS; ++i){
+                node = (i < 0 ? list->head : list->freelists[i]);
+                while (node != NULL){
+                        next = node->links[0].next;
+                        list->allocator.free_cb(node);
+                        node = next;
+                }
         }
 }
 
+/* Allocates links, key and value in one block. */
 static piojo_skiplist_node_t*
-alloc_node(const piojo_skiplist_t *list, size_t level)
+alloc_node(const piojo_skiplist_t *list, int level)
 {
-        piojo_skiplist_node_t *node, **nexts;
-        void *ndata, *nkey;
+        piojo_skiplist_node_t *node;
+        size_t linksize, keysize;
         piojo_alloc_if ator = list->allocator;
 
-        ndata = ator.alloc_cb(list->esize);
-        PIOJO_ASSERT(ndata);
-
-        nkey = ator.alloc_cb(list->eksize);
-        PIOJO_ASSERT(nkey);
-
-        nexts = (piojo_skiplist_node_t**) ator.alloc_cb(sizeof(piojo_skiplist_node_t*) * (level + 1));
-        PIOJO_ASSERT(nexts);
-        memset(nexts, 0, sizeof(piojo_skiplist_node_t*) * (level + 1));
-
-        node = (piojo_skiplist_node_t*) ator.alloc_cb(sizeof(piojo_skiplist_node_t));
+        /* Values stay aligned as allocator blocks. */
+        linksize = sizeof(link_t) * (level + 1);
+        keysize = list->eksize + sizeof(void*) - 1;
+        keysize -= keysize % sizeof(void*);
+        PIOJO_ASSERT(piojo_safe_addsiz_p(keysize, list->esize));
+        PIOJO_ASSERT(piojo_safe_addsiz_p(sizeof(piojo_skiplist_node_t) +
+                                         linksize, keysize + list->esize));
+
+        node = ((piojo_skiplist_node_t*)
+                ator.alloc_cb(sizeof(piojo_skiplist_node_t) + linksize +
+                              keysize + list->esize));
         PIOJO_ASSERT(node);
+        memset(node->links, 0, linksize);
 
-        node->nexts = nexts;
         node->level = level;
-        node->data = ndata;
-        node->key = nkey;
+        node->key = (uint8_t*) node->links + linksize;
+        node->data = (uint8_t*) node->key + keysize;
 
         return node;
 }
@@ -27,9 +27,14 @@
  * @addtogroup piojotree Piojo Red-Black Tree
  * @{
  * Piojo Red-Black Tree implementation.
+ * Each node holds its key and value, nodes are carved from per-tree slabs.
+ * Persistent trees allocate nodes one by one and share them with their
+ * snapshots, writes copy the shared nodes on their path.
+ * Interval trees keep the max endpoint of each subtree in its root node.
  */
 
 #include <piojo/piojo_tree.h>
+#include <piojo/piojo_itree.h>
 #include <piojo_defs.h>
 
 typedef enum {
@@ -37,36 +42,127 @@ typedef enum {
         COLOR_RED
 } color_t;
 
-typedef struct {
-        void *key, *value;
-} kv_t;
-
+/*
+ * Key, max endpoint (interval trees only) and value follow the node in
+ * the same block. Parent and color describe the writable tree only,
+ * snapshots never read them. Refs counts the links to the node
+ * (persistent trees).
+ */
 typedef struct rbnode_t rbnode_t;
 struct rbnode_t {
-        kv_t *kv;
         rbnode_t *parent, *right, *left;
         color_t color;
+        size_t refs;
+};
+
+/* Nodes are carved from slabs, freed nodes are reused. */
+typedef struct slab_t slab_t;
+struct slab_t {
+        slab_t *next;
 };
 
 struct piojo_tree_t {
         rbnode_t *root, *nil;
         size_t eksize, evsize, ecount;
+        slab_t *slabs;
+        rbnode_t *freelist;
+        uint8_t *slabnext;
+        size_t nodesize, slabcnt, slabfree;
         piojo_cmp_cb cmp_cb;
+        piojo_keytype_t keytype;
+        /* Interval endpoints, keys are [low, high] pairs (epsize > 0). */
+        piojo_cmp_cb epcmp;
+        size_t epsize;
+        piojo_tree_mode_t mode;
+        bool snapshot_p;
         piojo_alloc_if allocator;
 };
 /** @hideinitializer Size of tree in bytes */
 const size_t piojo_tree_sizeof = sizeof(piojo_tree_t);
 
+struct piojo_itree_t {
+        piojo_tree_t tree;
+};
+/** @hideinitializer Size of interval tree in bytes */
+const size_t piojo_itree_sizeof = sizeof(piojo_itree_t);
+
+static const size_t SLAB_NODES_MIN = 16;
+static const size_t SLAB_NODES_MAX = 4096;
+
+static void
+init_tree(piojo_tree_mode_t mode, size_t evsize, piojo_cmp_cb keycmp,
+          size_t eksize, size_t epsize, piojo_alloc_if allocator,
+          piojo_tree_t *tree);
+
+static rbnode_t*
+alloc_rbnode(piojo_tree_t *tree);
+
+static void
+free_rbnode(rbnode_t *node, piojo_tree_t *tree);
+
+static void
+release_rbnode(rbnode_t *node, piojo_tree_t *tree);
+
 static rbnode_t*
-alloc_rbnode(const piojo_tree_t *tree);
+own_rbnode(rbnode_t *node, piojo_tree_t *tree);
+
+static rbnode_t*
+own_node(rbnode_t *node, piojo_tree_t *tree);
+
+static void
+own_successor(rbnode_t *node, piojo_tree_t *tree);
+
+static rbnode_t*
+search_adjacent(const void *key, bool next_p, const piojo_tree_t *tree);
+
+static void
+alloc_slab(piojo_tree_t *tree);
 
 static void
-free_rbnode(const rbnode_t *node, const piojo_tree_t *tree);
+free_slabs(piojo_tree_t *tree);
 
 static void
 init_rbnode(const void *key, const void *data, const rbnode_t *node,
             const piojo_tree_t *tree);
 
+static void*
+entry_key(const rbnode_t *node);
+
+static void*
+entry_val(const rbnode_t *node, const piojo_tree_t *tree);
+
+static void*
+entry_high(const rbnode_t *node, const piojo_tree_t *tree);
+
+static void*
+entry_max(const rbnode_t *node, const piojo_tree_t *tree);
+
+static void
+update_max(rbnode_t *node, const piojo_tree_t *tree);
+
+static void
+update_path(rbnode_t *node, const piojo_tree_t *tree);
+
+static int
+interval_cmp(const void *lo, const void *hi, const rbnode_t *node,
+             const piojo_tree_t *tree);
+
+static rbnode_t*
+insert_interval(const void *lo, const void *hi, const void *data,
+                piojo_tree_t *tree);
+
+static rbnode_t*
+search_interval(const void *lo, const void *hi, const piojo_tree_t *tree);
+
+static size_t
+visit_overlaps(const rbnode_t *node, const void *lo, const void *hi,
+               piojo_itree_visit_cb cb, void *state, bool *stop_p,
+               const piojo_tree_t *tree);
+
+static void
+link_rbnode(rbnode_t *node, rbnode_t *parent, bool left_p,
+            piojo_tree_t *tree);
+
 static void
 rotate_left(rbnode_t *node, piojo_tree_t *tree);
 
@@ -94,9 +190,28 @@ next_node(rbnode_t *node, const piojo_tree_t *tree);
 static rbnode_t*
 prev_node(rbnode_t *node, const piojo_tree_t *tree);
 
+static rbnode_t*
+search_lower(const void *key, const piojo_tree_t *tree);
+
+static int
+key_cmp(const void *k1, const void *k2, const piojo_tree_t *tree);
+
+static piojo_keytype_t
+key_type(piojo_cmp_cb keycmp);
+
 static bool
 delete_node(const void *key, piojo_tree_t *tree);
 
+static void
+delete_rbnode(rbnode_t *node, piojo_tree_t *tree);
+
+static void
+transplant(rbnode_t *node, rbnode_t *child, piojo_tree_t *tree);
+
+static const void*
+cursor_key(rbnode_t *node, piojo_tree_cursor_t *cursor,
+           const piojo_tree_t *tree);
+
 static void
 fix_delete(rbnode_t *node, piojo_tree_t *tree);
 
@@ -220,6 +335,72 @@ piojo_tree_t*
 piojo_tree_alloc_cb_cmp(size_t evsize,
                         piojo_cmp_cb keycmp, size_t eksize,
                         piojo_alloc_if allocator)
+{
+        return piojo_tree_alloc_mode_cmp(PIOJO_TREE_MODE_POOLED, evsize,
+                                         keycmp, eksize, allocator);
+}
+
+/**
+ * Allocates a new tree with the given node storage.
+ * Uses key size of @b int32_t.
+ * @param[in] mode Node storage.
+ * @param[in] evsize Entry value size in bytes.
+ * @param[in] allocator Allocator to be used.
+ * @return New tree.
+ */
+piojo_tree_t*
+piojo_tree_alloc_mode_i32k(piojo_tree_mode_t mode, size_t evsize,
+                           piojo_alloc_if allocator)
+{
+        return piojo_tree_alloc_mode_cmp(mode, evsize, i32_cmp,
+                                         sizeof(int32_t), allocator);
+}
+
+/**
+ * Allocates a new tree with the given node storage.
+ * Uses key size of @b int64_t.
+ * @param[in] mode Node storage.
+ * @param[in] evsize Entry value size in bytes.
+ * @param[in] allocator Allocator to be used.
+ * @return New tree.
+ */
+piojo_tree_t*
+piojo_tree_alloc_mode_i64k(piojo_tree_mode_t mode, size_t evsize,
+                           piojo_alloc_if allocator)
+{
+        return piojo_tree_alloc_mode_cmp(mode, evsize, i64_cmp,
+                                         sizeof(int64_t), allocator);
+}
+
+/**
+ * Allocates a new tree with the given node storage.
+ * Uses key size of @b size_t.
+ * @param[in] mode Node storage.
+ * @param[in] evsize Entry value size in bytes.
+ * @param[in] allocator Allocator to be used.
+ * @return New tree.
+ */
+piojo_tree_t*
+piojo_tree_alloc_mode_sizk(piojo_tree_mode_t mode, size_t evsize,
+                           piojo_alloc_if allocator)
+{
+        return piojo_tree_alloc_mode_cmp(mode, evsize, siz_cmp,
+                                         sizeof(size_t), allocator);
+}
+
+/**
+ * Allocates a new tree with the given node storage.
+ * @param[in] mode Node storage.
+ * @param[in] evsize Entry value size in bytes.
+ * @param[in] keycmp Entry key comparison function.
+ * @param[in] eksize Entry key size.
+ * @param[in] allocator Allocator to be used.
+ * @return New tree.
+ */
+piojo_tree_t*
+piojo_tree_alloc_mode_cmp(piojo_tree_mode_t mode, size_t evsize,
+                          piojo_cmp_cb keycmp, size_t eksize,
+                          piojo_alloc_if allocator)
 {
         piojo_tree_t * tree;
         PIOJO_ASSERT(evsize > 0 && eksize > 0);
@@ -227,15 +408,7 @@ piojo_tree_alloc_cb_cmp(size_t evsize,
         tree = (piojo_tree_t *) allocator.alloc_cb(sizeof(piojo_tree_t));
         PIOJO_ASSERT(tree);
 
-        tree->allocator = allocator;
-        tree->eksize = eksize;
-        tree->evsize = evsize;
-        tree->ecount = 0;
-        tree->cmp_cb = keycmp;
-        tree->nil = NULL;
-        tree->nil = alloc_rbnode(tree);
-        tree->root = tree->nil;
-
+        init_tree(mode, evsize, keycmp, eksize, 0, allocator, tree);
         return tree;
 }
 
@@ -248,23 +421,58 @@ piojo_tree_t*
 piojo_tree_copy(const piojo_tree_t *tree)
 {
         piojo_tree_t *newtree;
+        piojo_tree_cursor_t cursor;
         const void *key;
         void *data;
         PIOJO_ASSERT(tree);
 
-        newtree = piojo_tree_alloc_cb_cmp(tree->evsize,
-                                          tree->cmp_cb, tree->eksize,
-                                          tree->allocator);
+        newtree = piojo_tree_alloc_mode_cmp(tree->mode, tree->evsize,
+                                            tree->cmp_cb, tree->eksize,
+                                            tree->allocator);
         newtree->ecount = tree->ecount;
 
-        key = piojo_tree_first(tree, &data);
+        key = piojo_tree_cursor_first(tree, &cursor);
         while (key != NULL){
+                data = piojo_tree_cursor_value(&cursor, tree);
                 insert_node(key, data, newtree);
-                key = piojo_tree_next(key, tree, &data);
+                key = piojo_tree_cursor_next(&cursor, tree);
         }
         return newtree;
 }
 
+/**
+ * Takes a read-only snapshot of a persistent @a tree in O(1), nodes are
+ * shared until @a tree changes them. Writes to @a tree copy only the
+ * shared nodes on their path, and snapshot readers never wait for @a tree
+ * writers. Snapshot cursors search each step from the root when the
+ * next key is above them.
+ * While snapshots are alive, values of @a tree must be replaced with
+ * piojo_tree_set() instead of being written in place.
+ * Must not run concurrently with writes to @a tree.
+ * @param[in] tree Tree being read (allocated with
+ *                 @b PIOJO_TREE_MODE_PERSISTENT).
+ * @return New read-only tree (freed with piojo_tree_free()).
+ */
+piojo_tree_t*
+piojo_tree_snapshot(const piojo_tree_t *tree)
+{
+        piojo_tree_t *snapshot;
+        PIOJO_ASSERT(tree);
+        PIOJO_ASSERT(tree->mode == PIOJO_TREE_MODE_PERSISTENT);
+
+        snapshot = ((piojo_tree_t *)
+                    tree->allocator.alloc_cb(sizeof(piojo_tree_t)));
+        PIOJO_ASSERT(snapshot);
+
+        *snapshot = *tree;
+        snapshot->snapshot_p = TRUE;
+        if (tree->root != tree->nil){
+                PIOJO_ATOMIC_ADD(&tree->root->refs, 1);
+        }
+        PIOJO_ATOMIC_ADD(&tree->nil->refs, 1);
+        return snapshot;
+}
+
 /**
  * Frees @a tree and all its entries.
  * @param[in] tree Tree being freed.
@@ -276,8 +484,14 @@ piojo_tree_free(const piojo_tree_t *tree)
         PIOJO_ASSERT(tree);
 
         t = (piojo_tree_t*) tree;
-        piojo_tree_clear(t);
-        free_rbnode(t->nil, t);
+        if (t->mode == PIOJO_TREE_MODE_PERSISTENT){
+                release_rbnode(t->root, t);
+        }
+        free_slabs(t);
+        /* The sentinel is shared with snapshots. */
+        if (PIOJO_ATOMIC_ADD(&t->nil->refs, (size_t) -1) == 1){
+                t->allocator.free_cb(t->nil);
+        }
         t->allocator.free_cb(t);
 }
 
@@ -289,11 +503,14 @@ void
 piojo_tree_clear(piojo_tree_t *tree)
 {
         PIOJO_ASSERT(tree);
+        PIOJO_ASSERT(! tree->snapshot_p);
 
-        while (tree->ecount > 0){
-                delete_node(tree->root->kv->key, tree);
-                --tree->ecount;
+        if (tree->mode == PIOJO_TREE_MODE_PERSISTENT){
+                release_rbnode(tree->root, tree);
         }
+        free_slabs(tree);
+        tree->root = tree->nil;
+        tree->ecount = 0;
 }
 
 /**
@@ -321,6 +538,7 @@ piojo_tree_insert(const void *key, const void *data, piojo_tree_t *tree)
 {
         PIOJO_ASSERT(tree);
         PIOJO_ASSERT(key);
+        PIOJO_ASSERT(! tree->snapshot_p);
         PIOJO_ASSERT(tree->ecount < SIZE_MAX);
         PIOJO_ASSERT(data || tree->evsize == sizeof(bool));
 
@@ -345,6 +563,7 @@ piojo_tree_set(const void *key, const void *data, piojo_tree_t *tree)
         rbnode_t *node;
         PIOJO_ASSERT(tree);
         PIOJO_ASSERT(key);
+        PIOJO_ASSERT(! tree->snapshot_p);
         PIOJO_ASSERT(data || tree->evsize == sizeof(bool));
 
         node = insert_node(key, data, tree);
@@ -355,7 +574,7 @@ piojo_tree_set(const void *key, const void *data, piojo_tree_t *tree)
         }
 
         if (data != NULL){
-                memcpy(node->kv->value, data, tree->evsize);
+                memcpy(entry_val(node, tree), data, tree->evsize);
         }
         return FALSE;
 }
@@ -375,7 +594,7 @@ piojo_tree_search(const void *key, const piojo_tree_t *tree)
 
         node = search_node(key, tree);
         if (node != tree->nil){
-                return node->kv->value;
+                return entry_val(node, tree);
         }
         return NULL;
 }
@@ -391,6 +610,7 @@ piojo_tree_delete(const void *key, piojo_tree_t *tree)
 {
         PIOJO_ASSERT(tree);
         PIOJO_ASSERT(key);
+        PIOJO_ASSERT(! tree->snapshot_p);
 
         if (delete_node(key, tree)){
                 --tree->ecount;
@@ -408,15 +628,15 @@ piojo_tree_delete(const void *key, piojo_tree_t *tree)
 const void*
 piojo_tree_first(const piojo_tree_t *tree, void **data)
 {
-        kv_t *kv;
+        rbnode_t *node;
         PIOJO_ASSERT(tree);
 
         if (tree->ecount > 0){
-                kv = search_min(tree->root, tree)->kv;
+                node = search_min(tree->root, tree);
                 if (data != NULL){
-                        *data = kv->value;
+                        *data = entry_val(node, tree);
                 }
-                return kv->key;
+                return entry_key(node);
         }
         return NULL;
 }
@@ -430,15 +650,15 @@ piojo_tree_first(const piojo_tree_t *tree, void **data)
 const void*
 piojo_tree_last(const piojo_tree_t *tree, void **data)
 {
-        kv_t *kv;
+        rbnode_t *node;
         PIOJO_ASSERT(tree);
 
         if (tree->ecount > 0){
-                kv = search_max(tree->root, tree)->kv;
+                node = search_max(tree->root, tree);
                 if (data != NULL){
-                        *data = kv->value;
+                        *data = entry_val(node, tree);
                 }
-                return kv->key;
+                return entry_key(node);
         }
         return NULL;
 }
@@ -463,9 +683,9 @@ piojo_tree_next(const void *key, const piojo_tree_t *tree, void **data)
         rbnode = next_node(rbnode, tree);
         if (rbnode != tree->nil){
                 if (data != NULL){
-                        *data = rbnode->kv->value;
+                        *data = entry_val(rbnode, tree);
                 }
-                return rbnode->kv->key;
+                return entry_key(rbnode);
         }
         return NULL;
 }
@@ -490,146 +710,951 @@ piojo_tree_prev(const void *key, const piojo_tree_t *tree, void **data)
         rbnode = prev_node(rbnode, tree);
         if (rbnode != tree->nil){
                 if (data != NULL){
-                        *data = rbnode->kv->value;
+                        *data = entry_val(rbnode, tree);
                 }
-                return rbnode->kv->key;
+                return entry_key(rbnode);
         }
         return NULL;
 }
 
-/** @}
- * Private functions.
+/**
+ * Positions @a cursor at the first key (order given by @a keycmp function).
+ * @param[in] tree
+ * @param[out] cursor Tree cursor.
+ * @return first key or @b NULL if @a tree is empty.
  */
-
-static rbnode_t*
-alloc_rbnode(const piojo_tree_t *tree)
+const void*
+piojo_tree_cursor_first(const piojo_tree_t *tree,
+                        piojo_tree_cursor_t *cursor)
 {
-        piojo_alloc_if ator = tree->allocator;
-        rbnode_t *node;
-        kv_t *kv;
-
-        kv = (kv_t*) ator.alloc_cb(sizeof(kv_t) + tree->eksize + tree->evsize);
-        PIOJO_ASSERT(kv);
-
-        kv->key = (uint8_t*) kv + sizeof(kv_t);
-        kv->value = (uint8_t*) kv->key + tree->eksize;
-
-        node = (rbnode_t*) ator.alloc_cb(sizeof(rbnode_t));
-        PIOJO_ASSERT(node);
-
-        node->kv = kv;
-        node->left = tree->nil;
-        node->right = tree->nil;
-        node->parent = tree->nil;
-        node->color = COLOR_BLACK;
+        PIOJO_ASSERT(tree);
+        PIOJO_ASSERT(cursor);
 
-        return node;
+        if (tree->ecount == 0){
+                cursor->node = NULL;
+                return NULL;
+        }
+        return cursor_key(search_min(tree->root, tree), cursor, tree);
 }
 
-static void
-free_rbnode(const rbnode_t *node, const piojo_tree_t *tree)
+/**
+ * Positions @a cursor at the last key (order given by @a keycmp function).
+ * @param[in] tree
+ * @param[out] cursor Tree cursor.
+ * @return last key or @b NULL if @a tree is empty.
+ */
+const void*
+piojo_tree_cursor_last(const piojo_tree_t *tree,
+                       piojo_tree_cursor_t *cursor)
 {
-        tree->allocator.free_cb(node->kv);
-        tree->allocator.free_cb(node);
+        PIOJO_ASSERT(tree);
+        PIOJO_ASSERT(cursor);
+
+        if (tree->ecount == 0){
+                cursor->node = NULL;
+                return NULL;
+        }
+        return cursor_key(search_max(tree->root, tree), cursor, tree);
 }
 
-static void
-init_rbnode(const void *key, const void *data, const rbnode_t *node,
-            const piojo_tree_t *tree)
+/**
+ * Positions @a cursor at the first key not less than @a key.
+ * @param[in] key
+ * @param[in] tree
+ * @param[out] cursor Tree cursor.
+ * @return found key or @b NULL if all keys are less than @a key.
+ */
+const void*
+piojo_tree_cursor_seek(const void *key, const piojo_tree_t *tree,
+                       piojo_tree_cursor_t *cursor)
 {
-        bool null_p = TRUE;
-
-        if (data == NULL){
-                data = &null_p;
-        }
+        PIOJO_ASSERT(tree);
+        PIOJO_ASSERT(key);
+        PIOJO_ASSERT(cursor);
 
-        memcpy(node->kv->key, key, tree->eksize);
-        memcpy(node->kv->value, data, tree->evsize);
+        return cursor_key(search_lower(key, tree), cursor, tree);
 }
 
-static void
-rotate_left(rbnode_t *node, piojo_tree_t *tree)
+/**
+ * Moves @a cursor to the next key (order given by @a keycmp function).
+ * @param[in,out] cursor Tree cursor.
+ * @param[in] tree
+ * @return next key or @b NULL if @a cursor was at the last key.
+ */
+const void*
+piojo_tree_cursor_next(piojo_tree_cursor_t *cursor,
+                       const piojo_tree_t *tree)
 {
-        rbnode_t *y;
-        PIOJO_ASSERT(node->right != tree->nil);
+        PIOJO_ASSERT(tree);
+        PIOJO_ASSERT(cursor && cursor->node);
 
-        y = node->right;
-        node->right = y->left;
-        if (y->left != tree->nil){
-                y->left->parent = node;
-        }
+        return cursor_key(next_node((rbnode_t*) cursor->node, tree), cursor,
+                          tree);
+}
 
-        y->parent = node->parent;
-        if (node->parent == tree->nil){
-                tree->root = y;
-        }else if (node->parent->left == node){
-                node->parent->left = y;
-        }else{
-                node->parent->right = y;
-        }
+/**
+ * Moves @a cursor to the previous key (order given by @a keycmp function).
+ * @param[in,out] cursor Tree cursor.
+ * @param[in] tree
+ * @return previous key or @b NULL if @a cursor was at the first key.
+ */
+const void*
+piojo_tree_cursor_prev(piojo_tree_cursor_t *cursor,
+                       const piojo_tree_t *tree)
+{
+        PIOJO_ASSERT(tree);
+        PIOJO_ASSERT(cursor && cursor->node);
 
-        y->left = node;
-        node->parent = y;
+        return cursor_key(prev_node((rbnode_t*) cursor->node, tree), cursor,
+                          tree);
 }
 
-static void
-rotate_right(rbnode_t *node, piojo_tree_t *tree)
+/**
+ * Returns the entry value at @a cursor.
+ * @param[in] cursor Tree cursor.
+ * @param[in] tree
+ * @return Entry value.
+ */
+void*
+piojo_tree_cursor_value(const piojo_tree_cursor_t *cursor,
+                        const piojo_tree_t *tree)
 {
-        rbnode_t *x;
-        PIOJO_ASSERT(node->left != tree->nil);
+        PIOJO_ASSERT(tree);
+        PIOJO_ASSERT(cursor && cursor->node);
 
-        x = node->left;
-        node->left = x->right;
-        if (x->right != tree->nil){
-                x->right->parent = node;
-        }
+        return entry_val((rbnode_t*) cursor->node, tree);
+}
 
-        x->parent = node->parent;
-        if (node->parent == tree->nil){
-                tree->root = x;
-        }else if (node->parent->left == node){
-                node->parent->left = x;
-        }else{
-                node->parent->right = x;
+/**
+ * Deletes the entry at @a cursor and moves it to the next key.
+ * @param[in,out] cursor Tree cursor.
+ * @param[out] tree
+ * @return next key or @b NULL if the deleted key was the last one.
+ */
+const void*
+piojo_tree_cursor_delete(piojo_tree_cursor_t *cursor, piojo_tree_t *tree)
+{
+        rbnode_t *node, *next;
+        PIOJO_ASSERT(tree);
+        PIOJO_ASSERT(cursor && cursor->node);
+        PIOJO_ASSERT(! tree->snapshot_p);
+
+        /* Nodes keep their entries, the successor stays valid. */
+        node = (rbnode_t*) cursor->node;
+        if (tree->mode == PIOJO_TREE_MODE_PERSISTENT){
+                node = own_node(node, tree);
+                own_successor(node, tree);
         }
+        next = next_node(node, tree);
+        delete_rbnode(node, tree);
+        --tree->ecount;
 
-        x->right = node;
-        node->parent = x;
+        return cursor_key(next, cursor, tree);
 }
 
-static rbnode_t*
-insert_node(const void *key, const void *data, piojo_tree_t *tree)
+/**
+ * Allocates a new interval tree.
+ * Uses default allocator and endpoint size of @b int32_t.
+ * @param[in] evsize Entry value size in bytes.
+ * @return New interval tree.
+ */
+piojo_itree_t*
+piojo_itree_alloc_i32k(size_t evsize)
 {
-        int cmpval;
-        rbnode_t *newnode, *parent = tree->nil, *cur = tree->root;
-        while (cur != tree->nil){
-                parent = cur;
-                cmpval = tree->cmp_cb(key, cur->kv->key);
-                if (cmpval == 0){
-                        return cur;
-                }else if (cmpval < 0){
-                        cur = cur->left;
-                }else{
-                        cur = cur->right;
-                }
-        }
+        return piojo_itree_alloc_cb_i32k(evsize, piojo_alloc_default);
+}
 
-        newnode = alloc_rbnode(tree);
-        newnode->parent = parent;
-        if (parent == tree->nil){
-                tree->root = newnode;
-        }else{
-                cmpval = tree->cmp_cb(key, parent->kv->key);
-                if (cmpval < 0){
-                        parent->left = newnode;
-                }else{
-                        parent->right = newnode;
-                }
-        }
-        fix_insert(newnode, tree);
+/**
+ * Allocates a new interval tree.
+ * Uses default allocator and endpoint size of @b int64_t.
+ * @param[in] evsize Entry value size in bytes.
+ * @return New interval tree.
+ */
+piojo_itree_t*
+piojo_itree_alloc_i64k(size_t evsize)
+{
+        return piojo_itree_alloc_cb_i64k(evsize, piojo_alloc_default);
+}
 
-        init_rbnode(key, data, newnode, tree);
-        return tree->nil;
+/**
+ * Allocates a new interval tree.
+ * Uses default allocator and endpoint size of @b size_t.
+ * @param[in] evsize Entry value size in bytes.
+ * @return New interval tree.
+ */
+piojo_itree_t*
+piojo_itree_alloc_sizk(size_t evsize)
+{
+        return piojo_itree_alloc_cb_sizk(evsize, piojo_alloc_default);
+}
+
+/**
+ * Allocates a new interval tree.
+ * Uses endpoint size of @b int32_t.
+ * @param[in] evsize Entry value size in bytes.
+ * @param[in] allocator Allocator to be used.
+ * @return New interval tree.
+ */
+piojo_itree_t*
+piojo_itree_alloc_cb_i32k(size_t evsize, piojo_alloc_if allocator)
+{
+        return piojo_itree_alloc_cb_cmp(evsize, i32_cmp, sizeof(int32_t),
+                                        allocator);
+}
+
+/**
+ * Allocates a new interval tree.
+ * Uses endpoint size of @b int64_t.
+ * @param[in] evsize Entry value size in bytes.
+ * @param[in] allocator Allocator to be used.
+ * @return New interval tree.
+ */
+piojo_itree_t*
+piojo_itree_alloc_cb_i64k(size_t evsize, piojo_alloc_if allocator)
+{
+        return piojo_itree_alloc_cb_cmp(evsize, i64_cmp, sizeof(int64_t),
+                                        allocator);
+}
+
+/**
+ * Allocates a new interval tree.
+ * Uses endpoint size of @b size_t.
+ * @param[in] evsize Entry value size in bytes.
+ * @param[in] allocator Allocator to be used.
+ * @return New interval tree.
+ */
+piojo_itree_t*
+piojo_itree_alloc_cb_sizk(size_t evsize, piojo_alloc_if allocator)
+{
+        return piojo_itree_alloc_cb_cmp(evsize, siz_cmp, sizeof(size_t),
+                                        allocator);
+}
+
+/**
+ * Allocates a new interval tree.
+ * Uses default allocator.
+ * @param[in] evsize Entry value size in bytes.
+ * @param[in] epcmp Endpoint comparison function.
+ * @param[in] epsize Endpoint size.
+ * @return New interval tree.
+ */
+piojo_itree_t*
+piojo_itree_alloc_cmp(size_t evsize, piojo_cmp_cb epcmp, size_t epsize)
+{
+        return piojo_itree_alloc_cb_cmp(evsize, epcmp, epsize,
+                                        piojo_alloc_default);
+}
+
+/**
+ * Allocates a new interval tree.
+ * @param[in] evsize Entry value size in bytes.
+ * @param[in] epcmp Endpoint comparison function.
+ * @param[in] epsize Endpoint size.
+ * @param[in] allocator Allocator to be used.
+ * @return New interval tree.
+ */
+piojo_itree_t*
+piojo_itree_alloc_cb_cmp(size_t evsize, piojo_cmp_cb epcmp, size_t epsize,
+                         piojo_alloc_if allocator)
+{
+        piojo_itree_t *itree;
+        PIOJO_ASSERT(evsize > 0 && epsize > 0);
+        PIOJO_ASSERT(piojo_safe_mulsiz_p(epsize, 2));
+
+        itree = (piojo_itree_t *) allocator.alloc_cb(sizeof(piojo_itree_t));
+        PIOJO_ASSERT(itree);
+
+        init_tree(PIOJO_TREE_MODE_POOLED, evsize, epcmp, epsize * 2, epsize,
+                  allocator, &itree->tree);
+        return itree;
+}
+
+/**
+ * Copies @a itree and all its entries.
+ * @param[in] itree Interval tree being copied.
+ * @return New interval tree.
+ */
+piojo_itree_t*
+piojo_itree_copy(const piojo_itree_t *itree)
+{
+        piojo_itree_t *newtree;
+        const piojo_tree_t *tree;
+        piojo_tree_cursor_t cursor;
+        const void *key;
+        PIOJO_ASSERT(itree);
+
+        tree = &itree->tree;
+        newtree = piojo_itree_alloc_cb_cmp(tree->evsize, tree->epcmp,
+                                           tree->epsize, tree->allocator);
+        newtree->tree.ecount = tree->ecount;
+
+        key = piojo_tree_cursor_first(tree, &cursor);
+        while (key != NULL){
+                insert_interval(key, (uint8_t*) key + tree->epsize,
+                                piojo_tree_cursor_value(&cursor, tree),
+                                &newtree->tree);
+                key = piojo_tree_cursor_next(&cursor, tree);
+        }
+        return newtree;
+}
+
+/**
+ * Frees @a itree and all its entries.
+ * @param[in] itree Interval tree being freed.
+ */
+void
+piojo_itree_free(const piojo_itree_t *itree)
+{
+        PIOJO_ASSERT(itree);
+        piojo_tree_free(&itree->tree);
+}
+
+/**
+ * Deletes all entries in @a itree.
+ * @param[out] itree Interval tree being cleared.
+ */
+void
+piojo_itree_clear(piojo_itree_t *itree)
+{
+        PIOJO_ASSERT(itree);
+        piojo_tree_clear(&itree->tree);
+}
+
+/**
+ * Returns number of entries.
+ * @param[in] itree
+ * @return Number of entries in @a itree.
+ */
+size_t
+piojo_itree_size(const piojo_itree_t *itree)
+{
+        PIOJO_ASSERT(itree);
+        return itree->tree.ecount;
+}
+
+/**
+ * Inserts a new entry for the closed interval [@a lo, @a hi].
+ * If @a data is @b NULL, the value is replaced with @b TRUE (useful for sets).
+ * @param[in] lo Low endpoint.
+ * @param[in] hi High endpoint, not lower than @a lo.
+ * @param[in] data Entry value.
+ * @param[out] itree Interval tree being modified.
+ * @return @b TRUE if inserted, @b FALSE if the interval is duplicate.
+ */
+bool
+piojo_itree_insert(const void *lo, const void *hi, const void *data,
+                   piojo_itree_t *itree)
+{
+        piojo_tree_t *tree;
+        PIOJO_ASSERT(itree);
+        PIOJO_ASSERT(lo && hi);
+
+        tree = &itree->tree;
+        PIOJO_ASSERT(tree->epcmp(lo, hi) <= 0);
+        PIOJO_ASSERT(tree->ecount < SIZE_MAX);
+        PIOJO_ASSERT(data || tree->evsize == sizeof(bool));
+
+        if (insert_interval(lo, hi, data, tree) == tree->nil){
+                ++tree->ecount;
+                return TRUE;
+        }
+        return FALSE;
+}
+
+/**
+ * Replaces or inserts an entry for the closed interval [@a lo, @a hi].
+ * If @a data is @b NULL, the value is replaced with @b TRUE (useful for sets).
+ * @param[in] lo Low endpoint.
+ * @param[in] hi High endpoint, not lower than @a lo.
+ * @param[in] data Entry value.
+ * @param[out] itree Interval tree being modified.
+ * @return @b TRUE if the interval is new, @b FALSE otherwise.
+ */
+bool
+piojo_itree_set(const void *lo, const void *hi, const void *data,
+                piojo_itree_t *itree)
+{
+        rbnode_t *node;
+        piojo_tree_t *tree;
+        PIOJO_ASSERT(itree);
+        PIOJO_ASSERT(lo && hi);
+
+        tree = &itree->tree;
+        PIOJO_ASSERT(tree->epcmp(lo, hi) <= 0);
+        PIOJO_ASSERT(data || tree->evsize == sizeof(bool));
+
+        node = insert_interval(lo, hi, data, tree);
+        if (node == tree->nil){
+                PIOJO_ASSERT(tree->ecount < SIZE_MAX);
+                ++tree->ecount;
+                return TRUE;
+        }
+
+        if (data != NULL){
+                memcpy(entry_val(node, tree), data, tree->evsize);
+        }
+        return FALSE;
+}
+
+/**
+ * Searches an entry by interval.
+ * @param[in] lo Low endpoint.
+ * @param[in] hi High endpoint.
+ * @param[in] itree
+ * @return Entry value or @b NULL if the interval doesn't exist.
+ */
+void*
+piojo_itree_search(const void *lo, const void *hi,
+                   const piojo_itree_t *itree)
+{
+        rbnode_t *node;
+        PIOJO_ASSERT(itree);
+        PIOJO_ASSERT(lo && hi);
+
+        node = search_interval(lo, hi, &itree->tree);
+        if (node != itree->tree.nil){
+                return entry_val(node, &itree->tree);
+        }
+        return NULL;
+}
+
+/**
+ * Deletes an entry by interval.
+ * @param[in] lo Low endpoint.
+ * @param[in] hi High endpoint.
+ * @param[out] itree
+ * @return TRUE if deleted, FALSE if the interval doesn't exist.
+ */
+bool
+piojo_itree_delete(const void *lo, const void *hi, piojo_itree_t *itree)
+{
+        rbnode_t *node;
+        PIOJO_ASSERT(itree);
+        PIOJO_ASSERT(lo && hi);
+
+        node = search_interval(lo, hi, &itree->tree);
+        if (node == itree->tree.nil){
+                return FALSE;
+        }
+        delete_rbnode(node, &itree->tree);
+        --itree->tree.ecount;
+        return TRUE;
+}
+
+/**
+ * Visits the intervals containing @a point, ordered by low endpoint.
+ * Runs in O(log n + k) for k reported intervals.
+ * @param[in] point Queried point.
+ * @param[in] cb Called for each interval, returns @b FALSE to stop.
+ * @param[in] state Passed to @a cb, can be @b NULL.
+ * @param[in] itree
+ * @return Number of intervals visited.
+ */
+size_t
+piojo_itree_stab(const void *point, piojo_itree_visit_cb cb, void *state,
+                 const piojo_itree_t *itree)
+{
+        return piojo_itree_overlap(point, point, cb, state, itree);
+}
+
+/**
+ * Visits the intervals overlapping [@a lo, @a hi], ordered by low endpoint.
+ * Runs in O(log n + k) for k reported intervals.
+ * @param[in] lo Low endpoint.
+ * @param[in] hi High endpoint, not lower than @a lo.
+ * @param[in] cb Called for each interval, returns @b FALSE to stop.
+ * @param[in] state Passed to @a cb, can be @b NULL.
+ * @param[in] itree
+ * @return Number of intervals visited.
+ */
+size_t
+piojo_itree_overlap(const void *lo, const void *hi, piojo_itree_visit_cb cb,
+                    void *state, const piojo_itree_t *itree)
+{
+        bool stop_p = FALSE;
+        PIOJO_ASSERT(itree);
+        PIOJO_ASSERT(lo && hi && cb);
+        PIOJO_ASSERT(itree->tree.epcmp(lo, hi) <= 0);
+
+        return visit_overlaps(itree->tree.root, lo, hi, cb, state, &stop_p,
+                              &itree->tree);
+}
+
+/** @}
+ * Private functions.
+ */
+
+static const void*
+cursor_key(rbnode_t *node, piojo_tree_cursor_t *cursor,
+           const piojo_tree_t *tree)
+{
+        if (node == tree->nil){
+                cursor->node = NULL;
+                return NULL;
+        }
+        cursor->node = node;
+        return entry_key(node);
+}
+
+/*
+ * Sets up an empty tree, intervals have keys of two 'epsize' endpoints
+ * and 'keycmp' compares endpoints.
+ */
+static void
+init_tree(piojo_tree_mode_t mode, size_t evsize, piojo_cmp_cb keycmp,
+          size_t eksize, size_t epsize, piojo_alloc_if allocator,
+          piojo_tree_t *tree)
+{
+        tree->allocator = allocator;
+        tree->mode = mode;
+        tree->snapshot_p = FALSE;
+        tree->eksize = eksize;
+        tree->evsize = evsize;
+        tree->ecount = 0;
+        tree->cmp_cb = keycmp;
+        tree->keytype = (epsize > 0 ? PIOJO_KEY_CB : key_type(keycmp));
+        tree->slabs = NULL;
+        tree->freelist = NULL;
+        tree->slabnext = NULL;
+        tree->slabcnt = tree->slabfree = 0;
+        tree->epcmp = (epsize > 0 ? keycmp : NULL);
+        tree->epsize = epsize;
+
+        /* Keep slab nodes aligned for rbnode_t. */
+        PIOJO_ASSERT(piojo_safe_addsiz_p(eksize + epsize, evsize));
+        PIOJO_ASSERT(piojo_safe_addsiz_p(sizeof(rbnode_t) +
+                                         sizeof(rbnode_t*),
+                                         eksize + epsize + evsize));
+        tree->nodesize = sizeof(rbnode_t) + eksize + epsize + evsize;
+        tree->nodesize += sizeof(rbnode_t*) - 1;
+        tree->nodesize -= tree->nodesize % sizeof(rbnode_t*);
+
+        /* Sentinel has no entry, it's not carved from slabs. */
+        tree->nil = (rbnode_t*) allocator.alloc_cb(sizeof(rbnode_t));
+        PIOJO_ASSERT(tree->nil);
+        tree->nil->left = tree->nil->right = tree->nil->parent = tree->nil;
+        tree->nil->color = COLOR_BLACK;
+        tree->nil->refs = 1;
+        tree->root = tree->nil;
+}
+
+static rbnode_t*
+alloc_rbnode(piojo_tree_t *tree)
+{
+        rbnode_t *node;
+
+        if (tree->mode == PIOJO_TREE_MODE_PERSISTENT){
+                node = (rbnode_t*) tree->allocator.alloc_cb(tree->nodesize);
+                PIOJO_ASSERT(node);
+        }else if (tree->freelist != NULL){
+                node = tree->freelist;
+                tree->freelist = node->right;
+        }else{
+                if (tree->slabfree == 0){
+                        alloc_slab(tree);
+                }
+                node = (rbnode_t*) tree->slabnext;
+                tree->slabnext += tree->nodesize;
+                --tree->slabfree;
+        }
+
+        node->left = tree->nil;
+        node->right = tree->nil;
+        node->parent = tree->nil;
+        node->color = COLOR_BLACK;
+        node->refs = 1;
+
+        return node;
+}
+
+/* Freed nodes are linked through their right child. */
+static void
+free_rbnode(rbnode_t *node, piojo_tree_t *tree)
+{
+        if (tree->mode == PIOJO_TREE_MODE_PERSISTENT){
+                /* Only owned nodes are unlinked. */
+                tree->allocator.free_cb(node);
+                return;
+        }
+        node->right = tree->freelist;
+        tree->freelist = node;
+}
+
+/* Drops a link to a persistent node, freeing it with its last link. */
+static void
+release_rbnode(rbnode_t *node, piojo_tree_t *tree)
+{
+        rbnode_t *right;
+        while (node != tree->nil &&
+               PIOJO_ATOMIC_ADD(&node->refs, (size_t) -1) == 1){
+                release_rbnode(node->left, tree);
+                right = node->right;
+                tree->allocator.free_cb(node);
+                node = right;
+        }
+}
+
+/*
+ * Makes node private to the writable tree, copying it if snapshots share
+ * it. Its parent must be private already, so paths are owned top-down.
+ */
+static rbnode_t*
+own_rbnode(rbnode_t *node, piojo_tree_t *tree)
+{
+        rbnode_t *copy;
+        if (tree->mode != PIOJO_TREE_MODE_PERSISTENT || node == tree->nil ||
+            PIOJO_ATOMIC_LOAD(&node->refs) == 1){
+                return node;
+        }
+
+        copy = (rbnode_t*) tree->allocator.alloc_cb(tree->nodesize);
+        PIOJO_ASSERT(copy);
+        memcpy(entry_key(copy), entry_key(node),
+               tree->nodesize - sizeof(rbnode_t));
+        copy->parent = node->parent;
+        copy->left = node->left;
+        copy->right = node->right;
+        copy->color = node->color;
+        copy->refs = 1;
+
+        if (copy->left != tree->nil){
+                PIOJO_ATOMIC_ADD(&copy->left->refs, 1);
+                copy->left->parent = copy;
+        }
+        if (copy->right != tree->nil){
+                PIOJO_ATOMIC_ADD(&copy->right->refs, 1);
+                copy->right->parent = copy;
+        }
+        if (copy->parent == tree->nil){
+                tree->root = copy;
+        }else if (copy->parent->left == node){
+                copy->parent->left = copy;
+        }else{
+                copy->parent->right = copy;
+        }
+        release_rbnode(node, tree);
+        return copy;
+}
+
+/* Owns node and its ancestors (top-down), returns the owned node. */
+static rbnode_t*
+own_node(rbnode_t *node, piojo_tree_t *tree)
+{
+        if (node->parent != tree->nil){
+                own_node(node->parent, tree);
+        }
+        return own_rbnode(node, tree);
+}
+
+/* Owns the path from an owned node to its successor in its subtree. */
+static void
+own_successor(rbnode_t *node, piojo_tree_t *tree)
+{
+        if (node->right != tree->nil){
+                node = own_rbnode(node->right, tree);
+                while (node->left != tree->nil){
+                        node = own_rbnode(node->left, tree);
+                }
+        }
+}
+
+/* Slabs double in size from SLAB_NODES_MIN up to SLAB_NODES_MAX. */
+static void
+alloc_slab(piojo_tree_t *tree)
+{
+        slab_t *slab;
+        size_t cnt = SLAB_NODES_MIN;
+
+        if (tree->slabcnt > 0 && tree->slabcnt < SLAB_NODES_MAX){
+                cnt = tree->slabcnt * 2;
+        }else if (tree->slabcnt > 0){
+                cnt = SLAB_NODES_MAX;
+        }
+
+        PIOJO_ASSERT(piojo_safe_mulsiz_p(cnt, tree->nodesize));
+        PIOJO_ASSERT(piojo_safe_addsiz_p(sizeof(slab_t),
+                                         cnt * tree->nodesize));
+        slab = (slab_t*) tree->allocator.alloc_cb(sizeof(slab_t) +
+                                                  cnt * tree->nodesize);
+        PIOJO_ASSERT(slab);
+
+        slab->next = tree->slabs;
+        tree->slabs = slab;
+        tree->slabnext = (uint8_t*)slab + sizeof(slab_t);
+        tree->slabcnt = tree->slabfree = cnt;
+}
+
+static void
+free_slabs(piojo_tree_t *tree)
+{
+        slab_t *slab, *next;
+        slab = tree->slabs;
+        while (slab != NULL){
+                next = slab->next;
+                tree->allocator.free_cb(slab);
+                slab = next;
+        }
+        tree->slabs = NULL;
+        tree->freelist = NULL;
+        tree->slabnext = NULL;
+        tree->slabcnt = tree->slabfree = 0;
+}
+
+static void*
+entry_key(const rbnode_t *node)
+{
+        return (uint8_t*) node + sizeof(rbnode_t);
+}
+
+static void*
+entry_val(const rbnode_t *node, const piojo_tree_t *tree)
+{
+        return ((uint8_t*) node + sizeof(rbnode_t) + tree->eksize +
+                tree->epsize);
+}
+
+/* Interval keys are the low endpoint followed by the high one. */
+static void*
+entry_high(const rbnode_t *node, const piojo_tree_t *tree)
+{
+        return (uint8_t*) node + sizeof(rbnode_t) + tree->epsize;
+}
+
+/* Highest endpoint in the subtree of an interval node. */
+static void*
+entry_max(const rbnode_t *node, const piojo_tree_t *tree)
+{
+        return (uint8_t*) node + sizeof(rbnode_t) + tree->eksize;
+}
+
+static void
+update_max(rbnode_t *node, const piojo_tree_t *tree)
+{
+        void *max = entry_max(node, tree);
+
+        piojo_key_copy(max, entry_high(node, tree), tree->epsize);
+        if (node->left != tree->nil &&
+            tree->epcmp(entry_max(node->left, tree), max) > 0){
+                piojo_key_copy(max, entry_max(node->left, tree),
+                               tree->epsize);
+        }
+        if (node->right != tree->nil &&
+            tree->epcmp(entry_max(node->right, tree), max) > 0){
+                piojo_key_copy(max, entry_max(node->right, tree),
+                               tree->epsize);
+        }
+}
+
+/* Updates node and its ancestors. */
+static void
+update_path(rbnode_t *node, const piojo_tree_t *tree)
+{
+        for (; node != tree->nil; node = node->parent){
+                update_max(node, tree);
+        }
+}
+
+/* Intervals are ordered by low endpoint, then by high endpoint. */
+static int
+interval_cmp(const void *lo, const void *hi, const rbnode_t *node,
+             const piojo_tree_t *tree)
+{
+        int cmpval = tree->epcmp(lo, entry_key(node));
+        if (cmpval == 0){
+                cmpval = tree->epcmp(hi, entry_high(node, tree));
+        }
+        return cmpval;
+}
+
+static rbnode_t*
+search_interval(const void *lo, const void *hi, const piojo_tree_t *tree)
+{
+        int cmpval;
+        rbnode_t *cur = tree->root;
+        while (cur != tree->nil){
+                cmpval = interval_cmp(lo, hi, cur, tree);
+                if (cmpval == 0){
+                        return cur;
+                }else if (cmpval < 0){
+                        cur = cur->left;
+                }else{
+                        cur = cur->right;
+                }
+        }
+        return cur;
+}
+
+/*
+ * Visits intervals overlapping [lo, hi] in order. Subtrees ending before
+ * lo are skipped by their max endpoint, right subtrees starting after hi
+ * by their order.
+ */
+static size_t
+visit_overlaps(const rbnode_t *node, const void *lo, const void *hi,
+               piojo_itree_visit_cb cb, void *state, bool *stop_p,
+               const piojo_tree_t *tree)
+{
+        size_t cnt = 0;
+
+        while (node != tree->nil && ! *stop_p &&
+               tree->epcmp(entry_max(node, tree), lo) >= 0){
+                cnt += visit_overlaps(node->left, lo, hi, cb, state, stop_p,
+                                      tree);
+                if (*stop_p || tree->epcmp(entry_key(node), hi) > 0){
+                        break;
+                }
+                if (tree->epcmp(entry_high(node, tree), lo) >= 0){
+                        ++cnt;
+                        *stop_p = ! cb(entry_key(node),
+                                       entry_high(node, tree),
+                                       entry_val(node, tree), state);
+                }
+                node = node->right;
+        }
+        return cnt;
+}
+
+static void
+init_rbnode(const void *key, const void *data, const rbnode_t *node,
+            const piojo_tree_t *tree)
+{
+        bool null_p = TRUE;
+
+        if (data == NULL){
+                data = &null_p;
+        }
+
+        piojo_key_copy(entry_key(node), key, tree->eksize);
+        memcpy(entry_val(node, tree), data, tree->evsize);
+}
+
+static void
+rotate_left(rbnode_t *node, piojo_tree_t *tree)
+{
+        rbnode_t *y;
+        PIOJO_ASSERT(node->right != tree->nil);
+
+        y = node->right;
+        node->right = y->left;
+        if (y->left != tree->nil){
+                y->left->parent = node;
+        }
+
+        y->parent = node->parent;
+        if (node->parent == tree->nil){
+                tree->root = y;
+        }else if (node->parent->left == node){
+                node->parent->left = y;
+        }else{
+                node->parent->right = y;
+        }
+
+        y->left = node;
+        node->parent = y;
+        if (tree->epsize > 0){
+                update_max(node, tree);
+                update_max(y, tree);
+        }
+}
+
+static void
+rotate_right(rbnode_t *node, piojo_tree_t *tree)
+{
+        rbnode_t *x;
+        PIOJO_ASSERT(node->left != tree->nil);
+
+        x = node->left;
+        node->left = x->right;
+        if (x->right != tree->nil){
+                x->right->parent = node;
+        }
+
+        x->parent = node->parent;
+        if (node->parent == tree->nil){
+                tree->root = x;
+        }else if (node->parent->left == node){
+                node->parent->left = x;
+        }else{
+                node->parent->right = x;
+        }
+
+        x->right = node;
+        node->parent = x;
+        if (tree->epsize > 0){
+                update_max(node, tree);
+                update_max(x, tree);
+        }
+}
+
+static rbnode_t*
+insert_node(const void *key, const void *data, piojo_tree_t *tree)
+{
+        int cmpval = 0;
+        rbnode_t *newnode, *parent = tree->nil;
+        rbnode_t *cur = own_rbnode(tree->root, tree);
+        while (cur != tree->nil){
+                parent = cur;
+                cmpval = key_cmp(key, entry_key(cur), tree);
+                if (cmpval == 0){
+                        return cur;
+                }
+                cur = own_rbnode((cmpval < 0 ? cur->left : cur->right), tree);
+        }
+
+        newnode = alloc_rbnode(tree);
+        init_rbnode(key, data, newnode, tree);
+        link_rbnode(newnode, parent, cmpval < 0, tree);
+        return tree->nil;
+}
+
+/* Same as insert_node() for [lo, hi] keys. */
+static rbnode_t*
+insert_interval(const void *lo, const void *hi, const void *data,
+                piojo_tree_t *tree)
+{
+        int cmpval = 0;
+        bool null_p = TRUE;
+        rbnode_t *newnode, *parent = tree->nil, *cur = tree->root;
+        while (cur != tree->nil){
+                parent = cur;
+                cmpval = interval_cmp(lo, hi, cur, tree);
+                if (cmpval == 0){
+                        return cur;
+                }else if (cmpval < 0){
+                        cur = cur->left;
+                }else{
+                        cur = cur->right;
+                }
+        }
+
+        if (data == NULL){
+                data = &null_p;
+        }
+        newnode = alloc_rbnode(tree);
+        piojo_key_copy(entry_key(newnode), lo, tree->epsize);
+        piojo_key_copy(entry_high(newnode, tree), hi, tree->epsize);
+        memcpy(entry_val(newnode, tree), data, tree->evsize);
+        link_rbnode(newnode, parent, cmpval < 0, tree);
+        return tree->nil;
+}
+
+/* Links a new node below parent (or as root) and rebalances. */
+static void
+link_rbnode(rbnode_t *node, rbnode_t *parent, bool left_p,
+            piojo_tree_t *tree)
+{
+        node->parent = parent;
+        if (parent == tree->nil){
+                tree->root = node;
+        }else if (left_p){
+                parent->left = node;
+        }else{
+                parent->right = node;
+        }
+        if (tree->epsize > 0){
+                update_path(node, tree);
+        }
+        fix_insert(node, tree);
 }
 
 static void
@@ -675,22 +1700,90 @@ fix_insert(rbnode_t *node, piojo_tree_t *tree)
         tree->root->color = COLOR_BLACK;
 }
 
+/* Defines search_node_<suffix>(), a search comparing keys with 'cmp'. */
+#define DEFINE_SEARCH_NODE(suffix, cmp)                                 \
+        static rbnode_t*                                                \
+        search_node_##suffix(const void *key, const piojo_tree_t *tree) \
+        {                                                               \
+                int cmpval;                                             \
+                rbnode_t *cur = tree->root;                             \
+                while (cur != tree->nil){                               \
+                        cmpval = cmp(key, entry_key(cur));              \
+                        if (cmpval == 0){                               \
+                                return cur;                             \
+                        }else if (cmpval < 0){                          \
+                                cur = cur->left;                        \
+                        }else{                                          \
+                                cur = cur->right;                       \
+                        }                                               \
+                }                                                       \
+                return cur;                                             \
+        }
+
+#define DEFINE_SEARCH_NODE_KEY(suffix, type)                            \
+        DEFINE_SEARCH_NODE(suffix, piojo_key_cmp_##suffix)
+
+DEFINE_SEARCH_NODE(cb, tree->cmp_cb)
+PIOJO_KEYTYPE_EXPAND(DEFINE_SEARCH_NODE_KEY)
+
 static rbnode_t*
 search_node(const void *key, const piojo_tree_t *tree)
+{
+        switch (tree->keytype){
+        case PIOJO_KEY_I32:
+                return search_node_i32(key, tree);
+        case PIOJO_KEY_I64:
+                return search_node_i64(key, tree);
+        case PIOJO_KEY_SIZ:
+                return search_node_siz(key, tree);
+        default:
+                return search_node_cb(key, tree);
+        }
+}
+
+static rbnode_t*
+search_lower(const void *key, const piojo_tree_t *tree)
 {
         int cmpval;
-        rbnode_t *cur = tree->root;
+        rbnode_t *lower = tree->nil, *cur = tree->root;
         while (cur != tree->nil){
-                cmpval = tree->cmp_cb(key, cur->kv->key);
+                cmpval = key_cmp(key, entry_key(cur), tree);
                 if (cmpval == 0){
                         return cur;
                 }else if (cmpval < 0){
+                        lower = cur;
                         cur = cur->left;
                 }else{
                         cur = cur->right;
                 }
         }
-        return cur;
+        return lower;
+}
+
+/*
+ * Snapshots have no usable parents, the next (or previous) key is found
+ * from the root.
+ */
+static rbnode_t*
+search_adjacent(const void *key, bool next_p, const piojo_tree_t *tree)
+{
+        int cmpval;
+        rbnode_t *adj = tree->nil, *cur = tree->root;
+        while (cur != tree->nil){
+                cmpval = key_cmp(key, entry_key(cur), tree);
+                if (next_p && cmpval < 0){
+                        adj = cur;
+                        cur = cur->left;
+                }else if (next_p){
+                        cur = cur->right;
+                }else if (cmpval > 0){
+                        adj = cur;
+                        cur = cur->right;
+                }else{
+                        cur = cur->left;
+                }
+        }
+        return adj;
 }
 
 static rbnode_t*
@@ -717,6 +1810,8 @@ next_node(rbnode_t *node, const piojo_tree_t *tree)
         rbnode_t *y;
         if (node->right != tree->nil){
                 return search_min(node->right, tree);
+        }else if (tree->snapshot_p){
+                return search_adjacent(entry_key(node), TRUE, tree);
         }
 
         y = node->parent;
@@ -733,6 +1828,8 @@ prev_node(rbnode_t *node, const piojo_tree_t *tree)
         rbnode_t *y;
         if (node->left != tree->nil){
                 return search_max(node->left, tree);
+        }else if (tree->snapshot_p){
+                return search_adjacent(entry_key(node), FALSE, tree);
         }
 
         y = node->parent;
@@ -746,42 +1843,73 @@ prev_node(rbnode_t *node, const piojo_tree_t *tree)
 static bool
 delete_node(const void *key, piojo_tree_t *tree)
 {
-        kv_t *tmp;
-        rbnode_t *x, *y, *node = search_node(key, tree);
+        rbnode_t *node = search_node(key, tree);
         if (node == tree->nil){
                 return FALSE;
         }
-
-        if (node->left == tree->nil || node->right == tree->nil){
-                y = node;
-        }else{
-                y = next_node(node, tree);
-        }
-        if (y->left != tree->nil){
-                x = y->left;
-        }else{
-                x = y->right;
+        if (tree->mode == PIOJO_TREE_MODE_PERSISTENT){
+                node = own_node(node, tree);
+                own_successor(node, tree);
         }
+        delete_rbnode(node, tree);
+        return TRUE;
+}
 
-        x->parent = y->parent;
-        if (y->parent == tree->nil){
-                tree->root = x;
-        }else if (y == y->parent->left){
-                y->parent->left = x;
+/*
+ * A node with two children is replaced by its successor node, entries
+ * never move between nodes.
+ */
+static void
+delete_rbnode(rbnode_t *node, piojo_tree_t *tree)
+{
+        rbnode_t *x, *y = node;
+        color_t color = node->color;
+
+        if (node->left == tree->nil){
+                x = node->right;
+                transplant(node, x, tree);
+        }else if (node->right == tree->nil){
+                x = node->left;
+                transplant(node, x, tree);
         }else{
-                y->parent->right = x;
+                y = search_min(node->right, tree);
+                color = y->color;
+                x = y->right;
+                if (y->parent == node){
+                        x->parent = y;
+                }else{
+                        transplant(y, x, tree);
+                        y->right = node->right;
+                        y->right->parent = y;
+                }
+                transplant(node, y, tree);
+                y->left = node->left;
+                y->left->parent = y;
+                y->color = node->color;
         }
 
-        if (node != y){
-                tmp = y->kv;
-                y->kv = node->kv;
-                node->kv = tmp;
+        if (tree->epsize > 0){
+                /* Nodes above x lost an entry, rotations fix the rest. */
+                update_path(x->parent, tree);
         }
-        if (y->color == COLOR_BLACK){
+        if (color == COLOR_BLACK){
                 fix_delete(x, tree);
         }
-        free_rbnode(y, tree);
-        return TRUE;
+        free_rbnode(node, tree);
+}
+
+/* Puts child (can be nil) in place of node. */
+static void
+transplant(rbnode_t *node, rbnode_t *child, piojo_tree_t *tree)
+{
+        if (node->parent == tree->nil){
+                tree->root = child;
+        }else if (node == node->parent->left){
+                node->parent->left = child;
+        }else{
+                node->parent->right = child;
+        }
+        child->parent = node->parent;
 }
 
 static void
@@ -790,12 +1918,13 @@ fix_delete(rbnode_t *node, piojo_tree_t *tree)
         rbnode_t *y;
         while (node != tree->root && node->color == COLOR_BLACK){
                 if (node == node->parent->left){
-                        y = node->parent->right;
+                        /* Rotations change the sibling's children. */
+                        y = own_rbnode(node->parent->right, tree);
                         if (y->color == COLOR_RED){
                                 y->color = COLOR_BLACK;
                                 node->parent->color = COLOR_RED;
                                 rotate_left(node->parent, tree);
-                                y = node->parent->right;
+                                y = own_rbnode(node->parent->right, tree);
                         }
                         if (y->left->color == COLOR_BLACK &&
                             y->right->color == COLOR_BLACK){
@@ -803,6 +1932,7 @@ fix_delete(rbnode_t *node, piojo_tree_t *tree)
                                 node = node->parent;
                         }else{
                                 if (y->right->color == COLOR_BLACK){
+                                        own_rbnode(y->left, tree);
                                         y->left->color = COLOR_BLACK;
                                         y->color = COLOR_RED;
                                         rotate_right(y, tree);
@@ -815,12 +1945,12 @@ fix_delete(rbnode_t *node, piojo_tree_t *tree)
                                 node = tree->root;
                         }
                 }else{
-                        y = node->parent->left;
+                        y = own_rbnode(node->parent->left, tree);
                         if (y->color == COLOR_RED){
                                 y->color = COLOR_BLACK;
                                 node->parent->color = COLOR_RED;
                                 rotate_right(node->parent, tree);
-                                y = node->parent->left;
+                                y = own_rbnode(node->parent->left, tree);
                         }
                         if (y->left->color == COLOR_BLACK &&
                             y->right->color == COLOR_BLACK){
@@ -828,6 +1958,7 @@ fix_delete(rbnode_t *node, piojo_tree_t *tree)
                                 node = node->parent;
                         }else{
                                 if (y->left->color == COLOR_BLACK){
+                                        own_rbnode(y->right, tree);
                                         y->right->color = COLOR_BLACK;
                                         y->color = COLOR_RED;
                                         rotate_left(y, tree);
@@ -844,6 +1975,35 @@ fix_delete(rbnode_t *node, piojo_tree_t *tree)
         node->color = COLOR_BLACK;
 }
 
+static int
+key_cmp(const void *k1, const void *k2, const piojo_tree_t *tree)
+{
+        switch (tree->keytype){
+        case PIOJO_KEY_I32:
+                return piojo_key_cmp_i32(k1, k2);
+        case PIOJO_KEY_I64:
+                return piojo_key_cmp_i64(k1, k2);
+        case PIOJO_KEY_SIZ:
+                return piojo_key_cmp_siz(k1, k2);
+        default:
+                return tree->cmp_cb(k1, k2);
+        }
+}
+
+/* Keys of the *_i32k/i64k/sizk allocators are compared inline. */
+static piojo_keytype_t
+key_type(piojo_cmp_cb keycmp)
+{
+        if (keycmp == i32_cmp){
+                return PIOJO_KEY_I32;
+        }else if (keycmp == i64_cmp){
+                return PIOJO_KEY_I64;
+        }else if (keycmp == siz_cmp){
+                return PIOJO_KEY_SIZ;
+        }
+        return PIOJO_KEY_CB;
+}
+
 /*
  * Private compare functions.
  */
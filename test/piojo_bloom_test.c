@@ -164,6 +164,31 @@ void test_search(void)
         piojo_bloom_free(bloom);
 }
 
+static uint64_t
+my_hash(const void *key, size_t ksize, uint64_t seed)
+{
+        PIOJO_UNUSED(ksize);
+        return (uint64_t)*(const int*) key * 0x9e3779b97f4a7c15ull ^ seed;
+}
+
+void test_search_hash(void)
+{
+        piojo_bloom_t *bloom;
+        int i;
+
+        bloom = piojo_bloom_alloc_cb_hash(1000, 0.01f, my_hash, sizeof(int),
+                                          my_allocator);
+        for (i = 0; i < 100; ++i){
+                piojo_bloom_insert(&i, bloom);
+        }
+        for (i = 0; i < 100; ++i){
+                PIOJO_ASSERT(piojo_bloom_search(&i, bloom));
+        }
+
+        piojo_bloom_free(bloom);
+        assert_allocator_alloc(0);
+}
+
 void test_search32(void)
 {
         piojo_bloom_t *bloom;
@@ -259,6 +284,7 @@ int main(void)
         test_clear();
         test_insert();
         test_search();
+        test_search_hash();
         test_search32();
         test_search64();
         test_searchsiz();
@@ -24,6 +24,8 @@
  */
 
 #include <map>
+#include <limits.h>
+#include <pthread.h>
 #include <stdlib.h>
 #include <time.h>
 #include <piojo_test.h>
@@ -398,6 +400,69 @@ void test_last_prev(void)
         piojo_btree_free(tree);
 }
 
+void test_cursor(void)
+{
+        piojo_btree_t *tree;
+        piojo_btree_cursor_t cursor;
+        const int *key;
+        int i, j, cnt;
+
+        tree = piojo_btree_alloc_cb_i32k(4, sizeof(int), my_allocator);
+        PIOJO_ASSERT(piojo_btree_cursor_first(tree, &cursor) == NULL);
+        PIOJO_ASSERT(piojo_btree_cursor_last(tree, &cursor) == NULL);
+        for (i = 0; i < 1024; i += 2){
+                j = i * 10;
+                piojo_btree_insert(&i, &j, tree);
+        }
+
+        cnt = 0;
+        key = (const int*) piojo_btree_cursor_first(tree, &cursor);
+        while (key != NULL){
+                PIOJO_ASSERT(*key == cnt * 2);
+                PIOJO_ASSERT(*(int*) piojo_btree_cursor_value(&cursor, tree) ==
+                             *key * 10);
+                ++cnt;
+                key = (const int*) piojo_btree_cursor_next(&cursor, tree);
+        }
+        PIOJO_ASSERT(cnt == 512);
+
+        key = (const int*) piojo_btree_cursor_last(tree, &cursor);
+        while (key != NULL){
+                --cnt;
+                PIOJO_ASSERT(*key == cnt * 2);
+                key = (const int*) piojo_btree_cursor_prev(&cursor, tree);
+        }
+        PIOJO_ASSERT(cnt == 0);
+
+        i = 512;
+        key = (const int*) piojo_btree_cursor_seek(&i, tree, &cursor);
+        PIOJO_ASSERT(*key == 512);
+        i = 513;
+        key = (const int*) piojo_btree_cursor_seek(&i, tree, &cursor);
+        PIOJO_ASSERT(*key == 514);
+        i = 1023;
+        PIOJO_ASSERT(piojo_btree_cursor_seek(&i, tree, &cursor) == NULL);
+
+        key = (const int*) piojo_btree_cursor_first(tree, &cursor);
+        while (key != NULL){
+                if (*key % 4 == 0){
+                        key = (const int*) piojo_btree_cursor_delete(&cursor,
+                                                                       tree);
+                }else{
+                        key = (const int*) piojo_btree_cursor_next(&cursor,
+                                                                    tree);
+                }
+        }
+        PIOJO_ASSERT(piojo_btree_size(tree) == 256);
+        for (i = 0; i < 1024; i += 2){
+                PIOJO_ASSERT((piojo_btree_search(&i, tree) != NULL) ==
+                             (i % 4 != 0));
+        }
+
+        piojo_btree_free(tree);
+        assert_allocator_alloc(0);
+}
+
 void test_tree_expand(void)
 {
         piojo_btree_t *tree;
@@ -419,6 +484,598 @@ void test_tree_expand(void)
         piojo_btree_free(tree);
 }
 
+void test_signed_keys(void)
+{
+        piojo_btree_t *tree;
+        piojo_btree_cursor_t cursor;
+        const int64_t *key;
+        int64_t i, prev;
+        size_t cnt;
+
+        /* Inline comparisons must keep the signed order. */
+        tree = piojo_btree_alloc_cb_i64k(4, sizeof(int64_t), my_allocator);
+        for (i = 0; i < 2000; ++i){
+                prev = (i % 2 == 0) ? i : -i;
+                piojo_btree_insert(&prev, &i, tree);
+        }
+        cnt = 0;
+        prev = INT64_MIN;
+        key = (const int64_t*) piojo_btree_cursor_first(tree, &cursor);
+        while (key != NULL){
+                PIOJO_ASSERT(*key > prev);
+                prev = *key;
+                ++cnt;
+                key = (const int64_t*) piojo_btree_cursor_next(&cursor, tree);
+        }
+        PIOJO_ASSERT(cnt == 2000);
+        i = -1999;
+        PIOJO_ASSERT(piojo_btree_search(&i, tree) != NULL);
+        i = -2;
+        PIOJO_ASSERT(piojo_btree_search(&i, tree) == NULL);
+
+        piojo_btree_free(tree);
+        assert_allocator_alloc(0);
+}
+
+static bool
+count_visit(const void *key, void *data, void *state)
+{
+        PIOJO_UNUSED(key);
+        PIOJO_UNUSED(data);
+        PIOJO_UNUSED(state);
+        return TRUE;
+}
+
+void test_fanout(void)
+{
+        piojo_btree_t *tree;
+        piojo_btree_cursor_t cursor;
+        const int *key;
+        size_t fanouts[] = {0, 6, 512}, f;
+        int i, j, cnt = 20000;
+
+        for (f = 0; f < sizeof(fanouts) / sizeof(fanouts[0]); ++f){
+                tree = piojo_btree_alloc_cb_i32k(fanouts[f], sizeof(int),
+                                                 my_allocator);
+                for (i = 0; i < cnt; ++i){
+                        j = (i * 7919) % cnt;
+                        PIOJO_ASSERT(piojo_btree_insert(&j, &j, tree));
+                }
+                PIOJO_ASSERT(piojo_btree_size(tree) == (size_t) cnt);
+
+                i = 0;
+                key = (const int*) piojo_btree_cursor_first(tree, &cursor);
+                while (key != NULL){
+                        PIOJO_ASSERT(*key == i++);
+                        key = (const int*) piojo_btree_cursor_next(&cursor,
+                                                                    tree);
+                }
+                PIOJO_ASSERT(i == cnt);
+                i = 100;
+                j = 199;
+                PIOJO_ASSERT(piojo_btree_range(&i, &j, count_visit, &j,
+                                               tree) == 100);
+
+                for (i = 1; i < cnt; i += 2){
+                        PIOJO_ASSERT(piojo_btree_delete(&i, tree));
+                }
+                PIOJO_ASSERT(piojo_btree_size(tree) == (size_t) cnt / 2);
+                for (i = 0; i < cnt; ++i){
+                        PIOJO_ASSERT((piojo_btree_search(&i, tree) != NULL) ==
+                                     (i % 2 == 0));
+                }
+                piojo_btree_free(tree);
+                assert_allocator_alloc(0);
+        }
+}
+
+void test_node_search(void)
+{
+        piojo_btree_t *tree;
+        size_t fanouts[] = {0, 2048}, f;
+        int64_t i, j, cnt = 5000;
+        const int64_t *next;
+
+        /* Vectorized in-node search, with and without narrowing. */
+        for (f = 0; f < sizeof(fanouts) / sizeof(fanouts[0]); ++f){
+                tree = piojo_btree_alloc_cb_i64k(fanouts[f], sizeof(int64_t),
+                                                 my_allocator);
+                for (i = -cnt; i < cnt; i += 2){
+                        piojo_btree_insert(&i, &i, tree);
+                }
+                i = INT64_MIN;
+                piojo_btree_insert(&i, &i, tree);
+                i = INT64_MAX;
+                piojo_btree_insert(&i, &i, tree);
+
+                for (i = -cnt - 1; i <= cnt; ++i){
+                        PIOJO_ASSERT((piojo_btree_search(&i, tree) != NULL) ==
+                                     (i % 2 == 0 && i < cnt));
+                }
+                for (i = -cnt; i < cnt; i += 2){
+                        j = (i + 2 < cnt) ? i + 2 : INT64_MAX;
+                        next = (const int64_t*) piojo_btree_next(&i, tree,
+                                                                 NULL);
+                        PIOJO_ASSERT(*next == j);
+                }
+                piojo_btree_free(tree);
+                assert_allocator_alloc(0);
+        }
+}
+
+static bool
+next_pair(const void **key, const void **data, void *state)
+{
+        int *pair = (int*) state;
+        if (pair[0] >= pair[1]){
+                return FALSE;
+        }
+        pair[0] += 2;
+        *key = *data = &pair[0];
+        return TRUE;
+}
+
+static void
+check_build_sorted(piojo_btree_mode_t mode, size_t fanout, int n,
+                   float fill, const int *vals)
+{
+        piojo_btree_t *tree;
+        piojo_btree_cursor_t cursor;
+        const int *key;
+        int i;
+
+        tree = piojo_btree_alloc_mode_i32k(mode, fanout, sizeof(int),
+                                           my_allocator);
+        piojo_btree_build_sorted(vals, vals, n, fill, tree);
+        PIOJO_ASSERT(piojo_btree_size(tree) == (size_t) n);
+        for (i = -1; i < n * 2; ++i){
+                PIOJO_ASSERT((piojo_btree_search(&i, tree) != NULL) ==
+                             (i >= 0 && i % 2 == 0));
+        }
+        i = 0;
+        key = (const int*) piojo_btree_cursor_first(tree, &cursor);
+        while (key != NULL){
+                PIOJO_ASSERT(*key == vals[i++]);
+                key = (const int*) piojo_btree_cursor_next(&cursor, tree);
+        }
+        PIOJO_ASSERT(i == n);
+
+        /* Rebalancing asserts node occupancy. */
+        i = -1;
+        piojo_btree_insert(&i, &i, tree);
+        for (i = 0; i < n * 2; i += 2){
+                PIOJO_ASSERT(piojo_btree_delete(&i, tree));
+        }
+        i = -1;
+        PIOJO_ASSERT(piojo_btree_delete(&i, tree));
+        PIOJO_ASSERT(piojo_btree_size(tree) == 0);
+        piojo_btree_free(tree);
+        assert_allocator_alloc(0);
+}
+
+void test_build_sorted(void)
+{
+        piojo_btree_t *tree;
+        piojo_array_t *keys;
+        size_t fanouts[] = {4, 6, 0}, counts[] = {0, 1, 3, 7, 100, 5001};
+        float fills[] = {0.5f, 0.7f, 1.0f};
+        size_t f, c, l;
+        int i, j, *vals, pair[2];
+
+        vals = (int*) malloc(5001 * sizeof(int));
+        for (i = 0; i < 5001; ++i){
+                vals[i] = i * 2;
+        }
+        for (f = 0; f < 3; ++f){
+                for (c = 0; c < 6; ++c){
+                        for (l = 0; l < 3; ++l){
+                                check_build_sorted(PIOJO_BTREE_MODE_CLASSIC,
+                                                   fanouts[f], counts[c],
+                                                   fills[l], vals);
+                                check_build_sorted(PIOJO_BTREE_MODE_PLUS,
+                                                   fanouts[f], counts[c],
+                                                   fills[l], vals);
+                        }
+                }
+        }
+
+        tree = piojo_btree_alloc_cb_i32k(4, sizeof(int), my_allocator);
+        pair[0] = -2;
+        pair[1] = 2000;
+        piojo_btree_build_sorted_cb(next_pair, pair, 1.0f, tree);
+        PIOJO_ASSERT(piojo_btree_size(tree) == 1001);
+        i = *(const int*) piojo_btree_first(tree, NULL);
+        j = *(const int*) piojo_btree_last(tree, NULL);
+        PIOJO_ASSERT(i == 0 && j == 2000);
+        piojo_btree_free(tree);
+
+        keys = piojo_array_alloc_cb(sizeof(int), my_allocator);
+        for (i = 0; i < 1000; ++i){
+                piojo_array_push(&vals[i], keys);
+        }
+        tree = piojo_btree_alloc_cb_i32k(0, sizeof(bool), my_allocator);
+        piojo_btree_build_sorted_array(keys, NULL, 1.0f, tree);
+        PIOJO_ASSERT(piojo_btree_size(tree) == 1000);
+        for (i = 0; i < 1000; ++i){
+                PIOJO_ASSERT(*(bool*) piojo_btree_search(&vals[i], tree));
+        }
+        piojo_btree_free(tree);
+        piojo_array_free(keys);
+        assert_allocator_alloc(0);
+
+        free(vals);
+}
+
+static bool
+sum_visit(const void *key, void *data, void *state)
+{
+        int *sum = (int*) state;
+        PIOJO_ASSERT(*(const int*) key * 10 == *(int*) data);
+        *sum += *(const int*) key;
+        return *sum < 1000;
+}
+
+void test_plus_mode(void)
+{
+        piojo_btree_t *tree, *copy;
+        piojo_btree_cursor_t cursor;
+        std::map<int, int> ref;
+        std::map<int, int>::iterator it;
+        std::map<int, int>::reverse_iterator rit;
+        size_t fanouts[] = {4, 0}, f;
+        unsigned int seed = 7;
+        const int *key;
+        int i, j, k, lo, hi, sum;
+
+        for (f = 0; f < 2; ++f){
+                tree = piojo_btree_alloc_mode_i32k(PIOJO_BTREE_MODE_PLUS,
+                                                   fanouts[f], sizeof(int),
+                                                   my_allocator);
+                ref.clear();
+                for (i = 0; i < 30000; ++i){
+                        seed = seed * 1103515245 + 12345;
+                        k = (seed >> 8) % 3000;
+                        j = k * 10;
+                        if ((seed >> 4) % 3 == 0){
+                                PIOJO_ASSERT(piojo_btree_delete(&k, tree) ==
+                                             (ref.erase(k) == 1));
+                        }else{
+                                PIOJO_ASSERT(piojo_btree_set(&k, &j, tree) ==
+                                             (ref.count(k) == 0));
+                                ref[k] = j;
+                        }
+                        PIOJO_ASSERT(piojo_btree_size(tree) == ref.size());
+                }
+                for (k = -1; k <= 3000; ++k){
+                        PIOJO_ASSERT((piojo_btree_search(&k, tree) != NULL) ==
+                                     (ref.count(k) == 1));
+                }
+
+                /* Leaves are walked through their sibling links. */
+                copy = piojo_btree_copy(tree);
+                key = (const int*) piojo_btree_cursor_first(copy, &cursor);
+                for (it = ref.begin(); it != ref.end(); ++it){
+                        PIOJO_ASSERT(key != NULL && *key == it->first);
+                        key = (const int*) piojo_btree_cursor_next(&cursor,
+                                                                    copy);
+                }
+                PIOJO_ASSERT(key == NULL);
+                key = (const int*) piojo_btree_cursor_last(tree, &cursor);
+                for (rit = ref.rbegin(); rit != ref.rend(); ++rit){
+                        PIOJO_ASSERT(key != NULL && *key == rit->first);
+                        key = (const int*) piojo_btree_cursor_prev(&cursor,
+                                                                    tree);
+                }
+                PIOJO_ASSERT(key == NULL);
+                PIOJO_ASSERT(*(const int*) piojo_btree_first(tree, NULL) ==
+                             ref.begin()->first);
+                PIOJO_ASSERT(*(const int*) piojo_btree_last(tree, NULL) ==
+                             ref.rbegin()->first);
+                k = ref.begin()->first;
+                PIOJO_ASSERT(*(const int*) piojo_btree_next(&k, tree, NULL) ==
+                             (++ref.begin())->first);
+
+                lo = 1000;
+                hi = 1100;
+                sum = 0;
+                j = 0;
+                for (it = ref.lower_bound(lo); it != ref.upper_bound(hi);
+                     ++it){
+                        ++j;
+                }
+                PIOJO_ASSERT(piojo_btree_range(&lo, &hi, sum_visit, &sum,
+                                               tree) == 1);
+                sum = -1000000;
+                PIOJO_ASSERT(piojo_btree_range(&lo, &hi, sum_visit, &sum,
+                                               tree) == (size_t) j);
+
+                key = (const int*) piojo_btree_cursor_first(copy, &cursor);
+                while (key != NULL){
+                        if (*key % 2 == 0){
+                                key = (const int*) piojo_btree_cursor_delete(
+                                        &cursor, copy);
+                        }else{
+                                key = (const int*) piojo_btree_cursor_next(
+                                        &cursor, copy);
+                        }
+                }
+                for (it = ref.begin(); it != ref.end(); ++it){
+                        PIOJO_ASSERT((piojo_btree_search(&it->first, copy) !=
+                                      NULL) == (it->first % 2 != 0));
+                }
+                piojo_btree_free(copy);
+
+                piojo_btree_clear(tree);
+                PIOJO_ASSERT(piojo_btree_size(tree) == 0);
+                PIOJO_ASSERT(piojo_btree_cursor_first(tree, &cursor) == NULL);
+                for (i = 0; i < 5000; ++i){
+                        j = i * 10;
+                        ref[i] = j;
+                }
+                for (i = 0, it = ref.begin(); i < 5000; ++i, ++it){
+                        PIOJO_ASSERT(piojo_btree_insert(&it->first,
+                                                        &it->second, tree));
+                }
+                for (i = 4999; i >= 0; --i){
+                        PIOJO_ASSERT(piojo_btree_delete(&i, tree));
+                }
+                piojo_btree_free(tree);
+                assert_allocator_alloc(0);
+        }
+}
+
+static void
+check_order(const std::map<int, int>& ref, const piojo_btree_t *tree)
+{
+        std::map<int, int>::const_iterator it;
+        size_t i, below;
+        int k, lo, hi;
+        void *data;
+
+        for (i = 0, it = ref.begin(); it != ref.end(); ++i, ++it){
+                PIOJO_ASSERT(*(const int*) piojo_btree_select(i, tree, &data) ==
+                             it->first);
+                PIOJO_ASSERT(*(int*) data == it->second);
+                PIOJO_ASSERT(piojo_btree_rank(&it->first, tree) == i);
+                k = it->first + 1;
+                PIOJO_ASSERT(piojo_btree_rank(&k, tree) == i + 1);
+        }
+        k = INT_MAX;
+        PIOJO_ASSERT(piojo_btree_rank(&k, tree) == ref.size());
+        k = INT_MIN;
+        PIOJO_ASSERT(piojo_btree_rank(&k, tree) == 0);
+
+        for (lo = -10, hi = 5; hi < 3100; lo += 97, hi += 211){
+                below = std::distance(ref.begin(), ref.lower_bound(lo));
+                PIOJO_ASSERT(piojo_btree_count_range(&lo, &hi, tree) ==
+                             std::distance(ref.begin(),
+                                           ref.upper_bound(hi)) - below);
+                PIOJO_ASSERT(piojo_btree_count_range(&hi, &lo, tree) == 0);
+        }
+}
+
+void test_rank_select(void)
+{
+        piojo_btree_t *tree, *copy;
+        std::map<int, int> ref;
+        piojo_btree_mode_t modes[] = {PIOJO_BTREE_MODE_CLASSIC,
+                                      PIOJO_BTREE_MODE_PLUS};
+        size_t fanouts[] = {4, 6, 0}, f, m;
+        unsigned int seed = 11;
+        int i, j, k, *vals;
+
+        for (m = 0; m < 2; ++m){
+                for (f = 0; f < 3; ++f){
+                        tree = piojo_btree_alloc_mode_i32k(modes[m],
+                                                           fanouts[f],
+                                                           sizeof(int),
+                                                           my_allocator);
+                        ref.clear();
+                        for (i = 0; i < 20000; ++i){
+                                seed = seed * 1103515245 + 12345;
+                                k = (seed >> 8) % 3000;
+                                j = k * 10;
+                                if ((seed >> 4) % 3 == 0){
+                                        piojo_btree_delete(&k, tree);
+                                        ref.erase(k);
+                                }else{
+                                        piojo_btree_set(&k, &j, tree);
+                                        ref[k] = j;
+                                }
+                                if (i % 4000 == 0){
+                                        check_order(ref, tree);
+                                }
+                        }
+                        check_order(ref, tree);
+
+                        copy = piojo_btree_copy(tree);
+                        check_order(ref, copy);
+                        piojo_btree_free(copy);
+                        piojo_btree_free(tree);
+                }
+
+                /* Bulk loaded trees are counted too. */
+                vals = (int*) malloc(2000 * sizeof(int));
+                ref.clear();
+                for (i = 0; i < 2000; ++i){
+                        vals[i] = i * 2;
+                        ref[i * 2] = i * 2;
+                }
+                tree = piojo_btree_alloc_mode_i32k(modes[m], 4, sizeof(int),
+                                                   my_allocator);
+                piojo_btree_build_sorted(vals, vals, 2000, 0.7f, tree);
+                check_order(ref, tree);
+                piojo_btree_free(tree);
+                free(vals);
+                assert_allocator_alloc(0);
+        }
+}
+
+static void
+check_snapshot(const std::map<int, int>& ref, const piojo_btree_t *snap)
+{
+        std::map<int, int>::const_iterator it;
+        std::map<int, int>::const_reverse_iterator rit;
+        piojo_btree_cursor_t cursor;
+        const int *key;
+        int k, lo, hi;
+        size_t cnt;
+
+        PIOJO_ASSERT(piojo_btree_size(snap) == ref.size());
+        for (k = -1; k <= 3000; ++k){
+                it = ref.find(k);
+                PIOJO_ASSERT((piojo_btree_search(&k, snap) != NULL) ==
+                             (it != ref.end()));
+                if (it != ref.end()){
+                        PIOJO_ASSERT(*(int*) piojo_btree_search(&k, snap) ==
+                                     it->second);
+                }
+        }
+
+        key = (const int*) piojo_btree_cursor_first(snap, &cursor);
+        for (it = ref.begin(); it != ref.end(); ++it){
+                PIOJO_ASSERT(key != NULL && *key == it->first);
+                PIOJO_ASSERT(*(int*) piojo_btree_cursor_value(&cursor, snap) ==
+                             it->second);
+                key = (const int*) piojo_btree_cursor_next(&cursor, snap);
+        }
+        PIOJO_ASSERT(key == NULL);
+        key = (const int*) piojo_btree_cursor_last(snap, &cursor);
+        for (rit = ref.rbegin(); rit != ref.rend(); ++rit){
+                PIOJO_ASSERT(key != NULL && *key == rit->first);
+                key = (const int*) piojo_btree_cursor_prev(&cursor, snap);
+        }
+        PIOJO_ASSERT(key == NULL);
+
+        for (lo = -10; lo < 3000; lo += 250){
+                hi = lo + 100;
+                key = (const int*) piojo_btree_cursor_seek(&lo, snap, &cursor);
+                it = ref.lower_bound(lo);
+                PIOJO_ASSERT((key == NULL) == (it == ref.end()));
+                PIOJO_ASSERT(key == NULL || *key == it->first);
+                cnt = std::distance(it, ref.upper_bound(hi));
+                PIOJO_ASSERT(piojo_btree_range(&lo, &hi, count_visit, NULL,
+                                               snap) == cnt);
+        }
+        if (! ref.empty()){
+                check_order(ref, snap);
+        }
+}
+
+static void*
+read_snapshot(void *arg)
+{
+        const piojo_btree_t *snap = (const piojo_btree_t*) arg;
+        piojo_btree_cursor_t cursor;
+        const int *key;
+        int i, prev;
+
+        for (i = 0; i < 20; ++i){
+                prev = -1;
+                key = (const int*) piojo_btree_cursor_first(snap, &cursor);
+                while (key != NULL){
+                        PIOJO_ASSERT(*key == prev + 1);
+                        prev = *key;
+                        key = (const int*) piojo_btree_cursor_next(&cursor,
+                                                                    snap);
+                }
+                PIOJO_ASSERT(prev == 1999);
+        }
+        return NULL;
+}
+
+void test_snapshot(void)
+{
+        piojo_btree_t *tree, *snaps[8], *copy;
+        std::map<int, int> ref, refs[8];
+        piojo_btree_mode_t modes[] = {PIOJO_BTREE_MODE_CLASSIC,
+                                      PIOJO_BTREE_MODE_PLUS};
+        size_t fanouts[] = {4, 0}, f, m, s, scnt;
+        unsigned int seed = 13;
+        pthread_t reader;
+        int i, j, k, *vals;
+
+        for (m = 0; m < 2; ++m){
+                for (f = 0; f < 2; ++f){
+                        tree = piojo_btree_alloc_mode_i32k(modes[m],
+                                                           fanouts[f],
+                                                           sizeof(int),
+                                                           my_allocator);
+                        ref.clear();
+                        for (i = 0, scnt = 0; i < 20000; ++i){
+                                if (i % 2500 == 0){
+                                        snaps[scnt] = piojo_btree_snapshot(tree);
+                                        refs[scnt++] = ref;
+                                }
+                                seed = seed * 1103515245 + 12345;
+                                k = (seed >> 8) % 3000;
+                                j = k * 10 + i % 7;
+                                if ((seed >> 4) % 3 == 0){
+                                        piojo_btree_delete(&k, tree);
+                                        ref.erase(k);
+                                }else{
+                                        piojo_btree_set(&k, &j, tree);
+                                        ref[k] = j;
+                                }
+                        }
+                        check_snapshot(ref, tree);
+                        for (s = 0; s < scnt; ++s){
+                                check_snapshot(refs[s], snaps[s]);
+                        }
+
+                        /* Snapshots outlive their tree and its copies. */
+                        copy = piojo_btree_copy(snaps[scnt - 1]);
+                        check_snapshot(refs[scnt - 1], copy);
+                        for (s = 0; s < scnt; s += 2){
+                                piojo_btree_free(snaps[s]);
+                        }
+                        piojo_btree_clear(tree);
+                        PIOJO_ASSERT(piojo_btree_size(tree) == 0);
+                        check_snapshot(refs[1], snaps[1]);
+                        piojo_btree_free(tree);
+                        piojo_btree_free(copy);
+                        for (s = 1; s < scnt; s += 2){
+                                check_snapshot(refs[s], snaps[s]);
+                                piojo_btree_free(snaps[s]);
+                        }
+                        assert_allocator_alloc(0);
+                }
+
+                /* Bulk loading fills the (empty) shared root. */
+                vals = (int*) malloc(2000 * sizeof(int));
+                ref.clear();
+                for (i = 0; i < 2000; ++i){
+                        vals[i] = i;
+                        ref[i] = i;
+                }
+                tree = piojo_btree_alloc_mode_i32k(modes[m], 4, sizeof(int),
+                                                   my_allocator);
+                snaps[0] = piojo_btree_snapshot(tree);
+                piojo_btree_build_sorted(vals, vals, 2000, 1.0f, tree);
+                PIOJO_ASSERT(piojo_btree_size(snaps[0]) == 0);
+                PIOJO_ASSERT(piojo_btree_first(snaps[0], NULL) == NULL);
+                snaps[1] = piojo_btree_snapshot(tree);
+
+                /* Snapshot readers run while the tree is written. */
+                PIOJO_ASSERT(pthread_create(&reader, NULL, read_snapshot,
+                                            snaps[1]) == 0);
+                for (i = 0; i < 2000; i += 2){
+                        PIOJO_ASSERT(piojo_btree_delete(&i, tree));
+                        j = i + 5000;
+                        PIOJO_ASSERT(piojo_btree_insert(&j, &j, tree));
+                }
+                PIOJO_ASSERT(pthread_join(reader, NULL) == 0);
+                check_snapshot(ref, snaps[1]);
+                PIOJO_ASSERT(piojo_btree_size(tree) == 2000);
+
+                piojo_btree_free(tree);
+                piojo_btree_free(snaps[0]);
+                piojo_btree_free(snaps[1]);
+                free(vals);
+                assert_allocator_alloc(0);
+        }
+}
+
 void test_stress(void)
 {
         piojo_btree_t *tree, *copy;
@@ -658,6 +1315,14 @@ int main(void)
         test_delete();
         test_first_next();
         test_last_prev();
+        test_cursor();
+        test_signed_keys();
+        test_fanout();
+        test_node_search();
+        test_build_sorted();
+        test_plus_mode();
+        test_rank_select();
+        test_snapshot();
         test_tree_expand();
         test_stress();
         test_stress_rand_uniq();
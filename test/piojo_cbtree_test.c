@@ -0,0 +1,337 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2013 G. Elian Gidoni
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+
+/* Must be defined before any system header for pthreads. */
+#define _POSIX_C_SOURCE 200112L
+
+#include <pthread.h>
+#include <piojo_test.h>
+#include <piojo/piojo_cbtree.h>
+
+#define TEST_THREAD_KEYS 20000
+
+void test_alloc(void)
+{
+        piojo_cbtree_t *tree;
+
+        tree = piojo_cbtree_alloc_i32k(2);
+        PIOJO_ASSERT(tree);
+        PIOJO_ASSERT(piojo_cbtree_size(tree) == 0);
+        piojo_cbtree_free(tree);
+
+        tree = piojo_cbtree_alloc_i64k(2);
+        PIOJO_ASSERT(tree);
+        PIOJO_ASSERT(piojo_cbtree_size(tree) == 0);
+        piojo_cbtree_free(tree);
+
+        tree = piojo_cbtree_alloc_sizk(2);
+        PIOJO_ASSERT(tree);
+        PIOJO_ASSERT(piojo_cbtree_size(tree) == 0);
+        piojo_cbtree_free(tree);
+
+        tree = piojo_cbtree_alloc_cb_i32k(4, sizeof(int), my_allocator);
+        PIOJO_ASSERT(tree);
+        PIOJO_ASSERT(piojo_cbtree_size(tree) == 0);
+        piojo_cbtree_free(tree);
+}
+
+void test_insert_set_search(void)
+{
+        piojo_cbtree_t *tree;
+        int i, j;
+
+        tree = piojo_cbtree_alloc_cb_i32k(4, sizeof(int), my_allocator);
+        for (i = 0; i < 1000; ++i){
+                j = (i * 7919) % 1000;
+                PIOJO_ASSERT(piojo_cbtree_insert(&j, &j, tree));
+                PIOJO_ASSERT(! piojo_cbtree_insert(&j, &j, tree));
+        }
+        PIOJO_ASSERT(piojo_cbtree_size(tree) == 1000);
+
+        for (i = 0; i < 1000; ++i){
+                j = -1;
+                PIOJO_ASSERT(piojo_cbtree_search(&i, &j, tree));
+                PIOJO_ASSERT(i == j);
+                PIOJO_ASSERT(piojo_cbtree_search(&i, NULL, tree));
+        }
+        i = 1000;
+        PIOJO_ASSERT(! piojo_cbtree_search(&i, &j, tree));
+        i = -1;
+        PIOJO_ASSERT(! piojo_cbtree_search(&i, &j, tree));
+
+        i = 10;
+        j = 20;
+        PIOJO_ASSERT(! piojo_cbtree_set(&i, &j, tree));
+        j = 0;
+        PIOJO_ASSERT(piojo_cbtree_search(&i, &j, tree));
+        PIOJO_ASSERT(j == 20);
+        i = 1000;
+        PIOJO_ASSERT(piojo_cbtree_set(&i, &i, tree));
+        PIOJO_ASSERT(piojo_cbtree_size(tree) == 1001);
+
+        piojo_cbtree_free(tree);
+}
+
+void test_delete_clear(void)
+{
+        piojo_cbtree_t *tree;
+        int i;
+
+        tree = piojo_cbtree_alloc_cb_i32k(5, sizeof(bool), my_allocator);
+        for (i = 0; i < 1000; ++i){
+                piojo_cbtree_insert(&i, NULL, tree);
+        }
+        for (i = 0; i < 1000; i += 2){
+                PIOJO_ASSERT(piojo_cbtree_delete(&i, tree));
+                PIOJO_ASSERT(! piojo_cbtree_delete(&i, tree));
+        }
+        PIOJO_ASSERT(piojo_cbtree_size(tree) == 500);
+        for (i = 0; i < 1000; ++i){
+                PIOJO_ASSERT(piojo_cbtree_search(&i, NULL, tree) ==
+                             (i % 2 != 0));
+        }
+        for (i = 0; i < 1000; i += 2){
+                PIOJO_ASSERT(piojo_cbtree_insert(&i, NULL, tree));
+        }
+        PIOJO_ASSERT(piojo_cbtree_size(tree) == 1000);
+
+        piojo_cbtree_clear(tree);
+        PIOJO_ASSERT(piojo_cbtree_size(tree) == 0);
+        i = 1;
+        PIOJO_ASSERT(! piojo_cbtree_search(&i, NULL, tree));
+        PIOJO_ASSERT(piojo_cbtree_insert(&i, NULL, tree));
+
+        piojo_cbtree_free(tree);
+}
+
+void test_cmp(void)
+{
+        piojo_cbtree_t *tree;
+        int i, j;
+
+        tree = piojo_cbtree_alloc_cb_cmp(6, sizeof(int), test_rev_cmp,
+                                         sizeof(int), my_allocator);
+        for (i = 0; i < 1000; ++i){
+                PIOJO_ASSERT(piojo_cbtree_insert(&i, &i, tree));
+        }
+        for (i = 0; i < 1000; ++i){
+                PIOJO_ASSERT(piojo_cbtree_search(&i, &j, tree));
+                PIOJO_ASSERT(i == j);
+        }
+        piojo_cbtree_free(tree);
+}
+
+void test_first_next(void)
+{
+        piojo_cbtree_t *tree;
+        int i, j, k;
+
+        tree = piojo_cbtree_alloc_cb_i32k(4, sizeof(int), my_allocator);
+        PIOJO_ASSERT(! piojo_cbtree_first(&i, &j, tree));
+        for (i = 0; i < 1000; ++i){
+                j = (i * 7919) % 1000;
+                PIOJO_ASSERT(piojo_cbtree_insert(&j, &j, tree));
+        }
+        /* Empty leaves are skipped. */
+        for (i = 0; i < 1000; ++i){
+                if (i % 100 >= 10){
+                        PIOJO_ASSERT(piojo_cbtree_delete(&i, tree));
+                }
+        }
+        PIOJO_ASSERT(piojo_cbtree_first(&i, &j, tree));
+        PIOJO_ASSERT(i == 0 && j == 0);
+        for (k = 1; k < 100; ++k){
+                PIOJO_ASSERT(piojo_cbtree_next(&i, &i, &j, tree));
+                PIOJO_ASSERT(i == (k / 10) * 100 + k % 10 && i == j);
+        }
+        PIOJO_ASSERT(! piojo_cbtree_next(&i, &j, NULL, tree));
+
+        /* Keys don't need to exist. */
+        i = 55;
+        PIOJO_ASSERT(piojo_cbtree_next(&i, &j, NULL, tree) && j == 100);
+        i = -5;
+        PIOJO_ASSERT(piojo_cbtree_next(&i, &j, NULL, tree) && j == 0);
+        piojo_cbtree_free(tree);
+
+        tree = piojo_cbtree_alloc_cb_cmp(6, sizeof(int), test_rev_cmp,
+                                         sizeof(int), my_allocator);
+        for (i = 0; i < 1000; ++i){
+                PIOJO_ASSERT(piojo_cbtree_insert(&i, &i, tree));
+        }
+        PIOJO_ASSERT(piojo_cbtree_first(&i, NULL, tree) && i == 999);
+        for (k = 998; k >= 0; --k){
+                PIOJO_ASSERT(piojo_cbtree_next(&i, &i, NULL, tree));
+                PIOJO_ASSERT(i == k);
+        }
+        PIOJO_ASSERT(! piojo_cbtree_next(&i, &i, NULL, tree));
+        piojo_cbtree_free(tree);
+}
+
+static void*
+stress_worker(void *arg)
+{
+        test_worker_t *worker = (test_worker_t*) arg;
+        piojo_cbtree_t *tree = (piojo_cbtree_t*) worker->data;
+        int i, j, last = worker->first + TEST_THREAD_KEYS;
+
+        for (i = worker->first; i < last; ++i){
+                PIOJO_ASSERT(piojo_cbtree_insert(&i, &i, tree));
+        }
+        for (i = worker->first; i < last; ++i){
+                PIOJO_ASSERT(piojo_cbtree_search(&i, &j, tree));
+                PIOJO_ASSERT(i == j);
+                j = i * 2;
+                PIOJO_ASSERT(! piojo_cbtree_set(&i, &j, tree));
+        }
+        for (i = worker->first; i < last; i += 2){
+                PIOJO_ASSERT(piojo_cbtree_delete(&i, tree));
+        }
+        for (i = worker->first; i < last; ++i){
+                PIOJO_ASSERT(piojo_cbtree_search(&i, &j, tree) ==
+                             (i % 2 != 0));
+        }
+        return NULL;
+}
+
+/* Interleaved key ranges make workers split the same nodes. */
+static void*
+interleave_worker(void *arg)
+{
+        test_worker_t *worker = (test_worker_t*) arg;
+        piojo_cbtree_t *tree = (piojo_cbtree_t*) worker->data;
+        int i, j, last = TEST_THREAD_COUNT * TEST_THREAD_KEYS;
+
+        for (i = worker->first; i < last; i += TEST_THREAD_COUNT){
+                PIOJO_ASSERT(piojo_cbtree_insert(&i, &i, tree));
+                PIOJO_ASSERT(piojo_cbtree_search(&i, &j, tree));
+                PIOJO_ASSERT(i == j);
+        }
+        return NULL;
+}
+
+/* Keys multiple of 3 stay in the tree, the others come and go. */
+static void*
+churn_worker(void *arg)
+{
+        test_worker_t *worker = (test_worker_t*) arg;
+        piojo_cbtree_t *tree = (piojo_cbtree_t*) worker->data;
+        int i, round, last = worker->first + TEST_THREAD_KEYS;
+
+        for (round = 0; round < 4; ++round){
+                for (i = worker->first; i < last; ++i){
+                        if (i % 3 != 0){
+                                piojo_cbtree_insert(&i, &i, tree);
+                        }
+                }
+                for (i = worker->first; i < last; ++i){
+                        if (i % 3 != 0){
+                                piojo_cbtree_delete(&i, tree);
+                        }
+                }
+        }
+        return NULL;
+}
+
+static void*
+scan_worker(void *arg)
+{
+        test_worker_t *worker = (test_worker_t*) arg;
+        piojo_cbtree_t *tree = (piojo_cbtree_t*) worker->data;
+        int i, j, prev, round, cnt;
+
+        for (round = 0; round < 20; ++round){
+                cnt = 0;
+                PIOJO_ASSERT(piojo_cbtree_first(&i, &j, tree));
+                do {
+                        PIOJO_ASSERT(i == j);
+                        if (cnt > 0){
+                                PIOJO_ASSERT(i > prev);
+                        }
+                        cnt += (i % 3 == 0);
+                        prev = i;
+                } while (piojo_cbtree_next(&i, &i, &j, tree));
+                PIOJO_ASSERT(cnt ==
+                             (TEST_THREAD_COUNT * TEST_THREAD_KEYS + 2) / 3);
+        }
+        return NULL;
+}
+
+void test_threads(void)
+{
+        piojo_cbtree_t *tree;
+        pthread_t scan;
+        test_worker_t scanner;
+        int i, j;
+
+        tree = piojo_cbtree_alloc_cb_i32k(8, sizeof(int),
+                                          piojo_alloc_default);
+        test_run_workers(stress_worker, TEST_THREAD_KEYS, tree);
+        PIOJO_ASSERT(piojo_cbtree_size(tree) ==
+                     TEST_THREAD_COUNT * TEST_THREAD_KEYS / 2);
+        for (i = 1; i < TEST_THREAD_COUNT * TEST_THREAD_KEYS; i += 2){
+                PIOJO_ASSERT(piojo_cbtree_search(&i, &j, tree));
+                PIOJO_ASSERT(j == i * 2);
+        }
+        piojo_cbtree_free(tree);
+
+        tree = piojo_cbtree_alloc_i32k(sizeof(int));
+        test_run_workers(interleave_worker, 1, tree);
+        PIOJO_ASSERT(piojo_cbtree_size(tree) ==
+                     TEST_THREAD_COUNT * TEST_THREAD_KEYS);
+        for (i = 0; i < TEST_THREAD_COUNT * TEST_THREAD_KEYS; ++i){
+                PIOJO_ASSERT(piojo_cbtree_search(&i, &j, tree));
+                PIOJO_ASSERT(i == j);
+        }
+        piojo_cbtree_free(tree);
+
+        /* Scans see every stable key once, in order. */
+        tree = piojo_cbtree_alloc_cb_i32k(8, sizeof(int),
+                                          piojo_alloc_default);
+        for (i = 0; i < TEST_THREAD_COUNT * TEST_THREAD_KEYS; i += 3){
+                PIOJO_ASSERT(piojo_cbtree_insert(&i, &i, tree));
+        }
+        scanner.data = tree;
+        scanner.first = 0;
+        PIOJO_ASSERT(pthread_create(&scan, NULL, scan_worker,
+                                    &scanner) == 0);
+        test_run_workers(churn_worker, TEST_THREAD_KEYS, tree);
+        PIOJO_ASSERT(pthread_join(scan, NULL) == 0);
+        piojo_cbtree_free(tree);
+}
+
+int main(void)
+{
+        test_alloc();
+        test_insert_set_search();
+        test_delete_clear();
+        test_cmp();
+        test_first_next();
+        test_threads();
+
+        assert_allocator_init(0);
+        assert_allocator_alloc(0);
+
+        return 0;
+}
@@ -0,0 +1,171 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2013 G. Elian Gidoni
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+
+#include <piojo_test.h>
+#include <piojo/piojo_chash.h>
+
+#define TEST_THREAD_KEYS 20000
+
+void test_alloc(void)
+{
+        piojo_chash_t *chash;
+
+        chash = piojo_chash_alloc_i32k(2);
+        PIOJO_ASSERT(chash);
+        PIOJO_ASSERT(piojo_chash_size(chash) == 0);
+        piojo_chash_free(chash);
+
+        chash = piojo_chash_alloc_i64k(2);
+        PIOJO_ASSERT(chash);
+        PIOJO_ASSERT(piojo_chash_size(chash) == 0);
+        piojo_chash_free(chash);
+
+        chash = piojo_chash_alloc_sizk(2);
+        PIOJO_ASSERT(chash);
+        PIOJO_ASSERT(piojo_chash_size(chash) == 0);
+        piojo_chash_free(chash);
+
+        chash = piojo_chash_alloc_cb_i32k(3, sizeof(int), my_allocator);
+        PIOJO_ASSERT(chash);
+        PIOJO_ASSERT(piojo_chash_size(chash) == 0);
+        piojo_chash_free(chash);
+}
+
+void test_insert_set_search(void)
+{
+        piojo_chash_t *chash;
+        int i, j;
+
+        chash = piojo_chash_alloc_cb_i32k(4, sizeof(int), my_allocator);
+        for (i = 0; i < 1000; ++i){
+                PIOJO_ASSERT(piojo_chash_insert(&i, &i, chash));
+                PIOJO_ASSERT(! piojo_chash_insert(&i, &i, chash));
+        }
+        PIOJO_ASSERT(piojo_chash_size(chash) == 1000);
+
+        for (i = 0; i < 1000; ++i){
+                j = -1;
+                PIOJO_ASSERT(piojo_chash_search(&i, &j, chash));
+                PIOJO_ASSERT(i == j);
+                PIOJO_ASSERT(piojo_chash_search(&i, NULL, chash));
+        }
+        i = 1000;
+        PIOJO_ASSERT(! piojo_chash_search(&i, &j, chash));
+
+        i = 10;
+        j = 20;
+        PIOJO_ASSERT(! piojo_chash_set(&i, &j, chash));
+        j = 0;
+        PIOJO_ASSERT(piojo_chash_search(&i, &j, chash));
+        PIOJO_ASSERT(j == 20);
+        i = 1000;
+        PIOJO_ASSERT(piojo_chash_set(&i, &i, chash));
+        PIOJO_ASSERT(piojo_chash_size(chash) == 1001);
+
+        piojo_chash_free(chash);
+}
+
+void test_delete_clear(void)
+{
+        piojo_chash_t *chash;
+        int i;
+
+        chash = piojo_chash_alloc_cb_i32k(8, sizeof(int), my_allocator);
+        for (i = 0; i < 1000; ++i){
+                piojo_chash_insert(&i, &i, chash);
+        }
+        for (i = 0; i < 1000; i += 2){
+                PIOJO_ASSERT(piojo_chash_delete(&i, chash));
+                PIOJO_ASSERT(! piojo_chash_delete(&i, chash));
+        }
+        PIOJO_ASSERT(piojo_chash_size(chash) == 500);
+        for (i = 0; i < 1000; ++i){
+                PIOJO_ASSERT(piojo_chash_search(&i, NULL, chash) ==
+                             (i % 2 != 0));
+        }
+
+        piojo_chash_clear(chash);
+        PIOJO_ASSERT(piojo_chash_size(chash) == 0);
+        i = 1;
+        PIOJO_ASSERT(! piojo_chash_search(&i, NULL, chash));
+        PIOJO_ASSERT(piojo_chash_insert(&i, &i, chash));
+
+        piojo_chash_free(chash);
+}
+
+static void*
+stress_worker(void *arg)
+{
+        test_worker_t *worker = (test_worker_t*) arg;
+        piojo_chash_t *chash = (piojo_chash_t*) worker->data;
+        int i, j, last = worker->first + TEST_THREAD_KEYS;
+
+        for (i = worker->first; i < last; ++i){
+                PIOJO_ASSERT(piojo_chash_insert(&i, &i, chash));
+        }
+        for (i = worker->first; i < last; ++i){
+                PIOJO_ASSERT(piojo_chash_search(&i, &j, chash));
+                PIOJO_ASSERT(i == j);
+                j = i * 2;
+                PIOJO_ASSERT(! piojo_chash_set(&i, &j, chash));
+        }
+        for (i = worker->first; i < last; i += 2){
+                PIOJO_ASSERT(piojo_chash_delete(&i, chash));
+        }
+        for (i = worker->first; i < last; ++i){
+                PIOJO_ASSERT(piojo_chash_search(&i, &j, chash) ==
+                             (i % 2 != 0));
+        }
+        return NULL;
+}
+
+void test_threads(void)
+{
+        piojo_chash_t *chash;
+        int i, j;
+
+        chash = piojo_chash_alloc_i32k(sizeof(int));
+        test_run_workers(stress_worker, TEST_THREAD_KEYS, chash);
+        PIOJO_ASSERT(piojo_chash_size(chash) ==
+                     TEST_THREAD_COUNT * TEST_THREAD_KEYS / 2);
+        for (i = 1; i < TEST_THREAD_COUNT * TEST_THREAD_KEYS; i += 2){
+                PIOJO_ASSERT(piojo_chash_search(&i, &j, chash));
+                PIOJO_ASSERT(j == i * 2);
+        }
+        piojo_chash_free(chash);
+}
+
+int main(void)
+{
+        test_alloc();
+        test_insert_set_search();
+        test_delete_clear();
+        test_threads();
+
+        assert_allocator_init(0);
+        assert_allocator_alloc(0);
+
+        return 0;
+}
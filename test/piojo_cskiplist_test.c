@@ -0,0 +1,336 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2013 G. Elian Gidoni
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+
+#include <piojo_test.h>
+#include <piojo/piojo_cskiplist.h>
+
+#define TEST_THREAD_KEYS 20000
+#define TEST_SHARED_KEYS 64
+
+void test_alloc(void)
+{
+        piojo_cskiplist_t *list;
+
+        list = piojo_cskiplist_alloc_i32k(2);
+        PIOJO_ASSERT(list);
+        PIOJO_ASSERT(piojo_cskiplist_size(list) == 0);
+        piojo_cskiplist_free(list);
+
+        list = piojo_cskiplist_alloc_i64k(2);
+        PIOJO_ASSERT(list);
+        PIOJO_ASSERT(piojo_cskiplist_size(list) == 0);
+        piojo_cskiplist_free(list);
+
+        list = piojo_cskiplist_alloc_sizk(2);
+        PIOJO_ASSERT(list);
+        PIOJO_ASSERT(piojo_cskiplist_size(list) == 0);
+        piojo_cskiplist_free(list);
+
+        list = piojo_cskiplist_alloc_cb_i32k(sizeof(int), my_allocator);
+        PIOJO_ASSERT(list);
+        PIOJO_ASSERT(piojo_cskiplist_size(list) == 0);
+        piojo_cskiplist_free(list);
+}
+
+void test_insert_set_search(void)
+{
+        piojo_cskiplist_t *list;
+        piojo_cskiplist_thread_t *thread;
+        int i, j;
+
+        list = piojo_cskiplist_alloc_cb_i32k(sizeof(int), my_allocator);
+        thread = piojo_cskiplist_register(list);
+        for (i = 0; i < 1000; ++i){
+                j = (i * 7919) % 1000;
+                PIOJO_ASSERT(piojo_cskiplist_insert(&j, &j, thread, list));
+                PIOJO_ASSERT(! piojo_cskiplist_insert(&j, &j, thread, list));
+        }
+        PIOJO_ASSERT(piojo_cskiplist_size(list) == 1000);
+
+        for (i = 0; i < 1000; ++i){
+                j = -1;
+                PIOJO_ASSERT(piojo_cskiplist_search(&i, &j, thread, list));
+                PIOJO_ASSERT(i == j);
+                PIOJO_ASSERT(piojo_cskiplist_search(&i, NULL, thread, list));
+        }
+        i = 1000;
+        PIOJO_ASSERT(! piojo_cskiplist_search(&i, &j, thread, list));
+        i = -1;
+        PIOJO_ASSERT(! piojo_cskiplist_search(&i, &j, thread, list));
+
+        i = 10;
+        j = 20;
+        PIOJO_ASSERT(! piojo_cskiplist_set(&i, &j, thread, list));
+        j = 0;
+        PIOJO_ASSERT(piojo_cskiplist_search(&i, &j, thread, list));
+        PIOJO_ASSERT(j == 20);
+        i = 1000;
+        PIOJO_ASSERT(piojo_cskiplist_set(&i, &i, thread, list));
+        PIOJO_ASSERT(piojo_cskiplist_size(list) == 1001);
+
+        piojo_cskiplist_unregister(thread, list);
+        piojo_cskiplist_free(list);
+        PIOJO_ASSERT(alloc_cnt == 0);
+}
+
+void test_delete_clear(void)
+{
+        piojo_cskiplist_t *list;
+        piojo_cskiplist_thread_t *thread;
+        int i;
+
+        list = piojo_cskiplist_alloc_cb_i32k(sizeof(bool), my_allocator);
+        thread = piojo_cskiplist_register(list);
+        for (i = 0; i < 1000; ++i){
+                piojo_cskiplist_insert(&i, NULL, thread, list);
+        }
+        for (i = 0; i < 1000; i += 2){
+                PIOJO_ASSERT(piojo_cskiplist_delete(&i, thread, list));
+                PIOJO_ASSERT(! piojo_cskiplist_delete(&i, thread, list));
+        }
+        PIOJO_ASSERT(piojo_cskiplist_size(list) == 500);
+        for (i = 0; i < 1000; ++i){
+                PIOJO_ASSERT(piojo_cskiplist_search(&i, NULL, thread, list) ==
+                             (i % 2 != 0));
+        }
+
+        /* No other thread is inside the list, every deleted node goes. */
+        piojo_cskiplist_reclaim(thread, list);
+        PIOJO_ASSERT(alloc_cnt == 2 + 1 + 500);
+
+        for (i = 0; i < 1000; i += 2){
+                PIOJO_ASSERT(piojo_cskiplist_insert(&i, NULL, thread, list));
+        }
+        PIOJO_ASSERT(piojo_cskiplist_size(list) == 1000);
+
+        piojo_cskiplist_clear(list);
+        PIOJO_ASSERT(piojo_cskiplist_size(list) == 0);
+        i = 1;
+        PIOJO_ASSERT(! piojo_cskiplist_search(&i, NULL, thread, list));
+        PIOJO_ASSERT(piojo_cskiplist_insert(&i, NULL, thread, list));
+
+        piojo_cskiplist_unregister(thread, list);
+        piojo_cskiplist_free(list);
+        PIOJO_ASSERT(alloc_cnt == 0);
+}
+
+void test_first_next(void)
+{
+        piojo_cskiplist_t *list;
+        piojo_cskiplist_thread_t *thread;
+        int i, key, val;
+
+        list = piojo_cskiplist_alloc_cb_cmp(sizeof(int), test_rev_cmp,
+                                            sizeof(int), my_allocator);
+        thread = piojo_cskiplist_register(list);
+        PIOJO_ASSERT(! piojo_cskiplist_first(&key, &val, thread, list));
+        for (i = 0; i < 100; ++i){
+                val = i * 2;
+                PIOJO_ASSERT(piojo_cskiplist_insert(&i, &val, thread, list));
+        }
+
+        PIOJO_ASSERT(piojo_cskiplist_first(&key, &val, thread, list));
+        PIOJO_ASSERT(key == 99 && val == 198);
+        i = 99;
+        while (piojo_cskiplist_next(&key, &key, &val, thread, list)){
+                --i;
+                PIOJO_ASSERT(key == i && val == i * 2);
+        }
+        PIOJO_ASSERT(i == 0);
+
+        /* Iterations continue from keys that aren't there anymore. */
+        i = 50;
+        PIOJO_ASSERT(piojo_cskiplist_delete(&i, thread, list));
+        PIOJO_ASSERT(piojo_cskiplist_next(&i, &key, NULL, thread, list));
+        PIOJO_ASSERT(key == 49);
+
+        piojo_cskiplist_unregister(thread, list);
+        piojo_cskiplist_free(list);
+        PIOJO_ASSERT(alloc_cnt == 0);
+}
+
+static void*
+stress_worker(void *arg)
+{
+        test_worker_t *worker = (test_worker_t*) arg;
+        piojo_cskiplist_t *list = (piojo_cskiplist_t*) worker->data;
+        piojo_cskiplist_thread_t *thread;
+        int i, j, last = worker->first + TEST_THREAD_KEYS;
+
+        thread = piojo_cskiplist_register(list);
+        for (i = worker->first; i < last; ++i){
+                PIOJO_ASSERT(piojo_cskiplist_insert(&i, &i, thread, list));
+        }
+        for (i = worker->first; i < last; ++i){
+                PIOJO_ASSERT(piojo_cskiplist_search(&i, &j, thread, list));
+                PIOJO_ASSERT(i == j);
+                j = i * 2;
+                PIOJO_ASSERT(! piojo_cskiplist_set(&i, &j, thread, list));
+        }
+        for (i = worker->first; i < last; i += 2){
+                PIOJO_ASSERT(piojo_cskiplist_delete(&i, thread, list));
+        }
+        for (i = worker->first; i < last; ++i){
+                PIOJO_ASSERT(piojo_cskiplist_search(&i, &j, thread, list) ==
+                             (i % 2 != 0));
+        }
+        piojo_cskiplist_unregister(thread, list);
+        return NULL;
+}
+
+/*
+ * Every worker inserts and deletes the same few keys, while walking the
+ * list in order. Values always match their keys.
+ */
+static void*
+contend_worker(void *arg)
+{
+        test_worker_t *worker = (test_worker_t*) arg;
+        piojo_cskiplist_t *list = (piojo_cskiplist_t*) worker->data;
+        piojo_cskiplist_thread_t *thread;
+        int i, key, prev, val;
+
+        thread = piojo_cskiplist_register(list);
+        for (i = 0; i < TEST_THREAD_KEYS; ++i){
+                key = (i * 31 + worker->first) % TEST_SHARED_KEYS;
+                if (i % 2 == 0){
+                        piojo_cskiplist_set(&key, &key, thread, list);
+                }else{
+                        piojo_cskiplist_delete(&key, thread, list);
+                }
+                if (piojo_cskiplist_search(&key, &val, thread, list)){
+                        PIOJO_ASSERT(val == key);
+                }
+                if (i % 64 == 0 &&
+                    piojo_cskiplist_first(&key, &val, thread, list)){
+                        prev = -1;
+                        do {
+                                PIOJO_ASSERT(val == key && key > prev);
+                                prev = key;
+                        } while (piojo_cskiplist_next(&prev, &key, &val,
+                                                      thread, list));
+                }
+        }
+        piojo_cskiplist_unregister(thread, list);
+        return NULL;
+}
+
+/*
+ * Even workers insert and delete one key, freeing every deleted node
+ * right away. Odd ones search and walk the keys past it.
+ */
+static void*
+hot_worker(void *arg)
+{
+        test_worker_t *worker = (test_worker_t*) arg;
+        piojo_cskiplist_t *list = (piojo_cskiplist_t*) worker->data;
+        piojo_cskiplist_thread_t *thread;
+        int i, key, prev, val, hot = TEST_SHARED_KEYS / 2;
+
+        thread = piojo_cskiplist_register(list);
+        for (i = 0; i < TEST_THREAD_KEYS; ++i){
+                if (worker->first % 2 == 0){
+                        piojo_cskiplist_insert(&hot, &hot, thread, list);
+                        piojo_cskiplist_delete(&hot, thread, list);
+                        piojo_cskiplist_reclaim(thread, list);
+                        continue;
+                }
+                key = hot + 1 + i % (TEST_SHARED_KEYS - hot - 1);
+                PIOJO_ASSERT(piojo_cskiplist_search(&key, &val, thread, list));
+                PIOJO_ASSERT(val == key);
+                prev = hot - 1;
+                while (piojo_cskiplist_next(&prev, &key, &val, thread, list)){
+                        PIOJO_ASSERT(val == key && key > prev);
+                        prev = key;
+                }
+                PIOJO_ASSERT(prev == TEST_SHARED_KEYS - 1);
+        }
+        piojo_cskiplist_unregister(thread, list);
+        return NULL;
+}
+
+void test_threads(void)
+{
+        piojo_cskiplist_t *list;
+        piojo_cskiplist_thread_t *thread;
+        int i, j, prev;
+        size_t cnt;
+
+        list = piojo_cskiplist_alloc_i32k(sizeof(int));
+        test_run_workers(stress_worker, TEST_THREAD_KEYS, list);
+        PIOJO_ASSERT(piojo_cskiplist_size(list) ==
+                     TEST_THREAD_COUNT * TEST_THREAD_KEYS / 2);
+        thread = piojo_cskiplist_register(list);
+        for (i = 1; i < TEST_THREAD_COUNT * TEST_THREAD_KEYS; i += 2){
+                PIOJO_ASSERT(piojo_cskiplist_search(&i, &j, thread, list));
+                PIOJO_ASSERT(j == i * 2);
+        }
+        piojo_cskiplist_unregister(thread, list);
+        piojo_cskiplist_free(list);
+
+        list = piojo_cskiplist_alloc_i32k(sizeof(int));
+        test_run_workers(contend_worker, 1, list);
+        thread = piojo_cskiplist_register(list);
+        cnt = 0;
+        if (piojo_cskiplist_first(&i, &j, thread, list)){
+                do {
+                        PIOJO_ASSERT(i == j && i < TEST_SHARED_KEYS);
+                        prev = i;
+                        ++cnt;
+                } while (piojo_cskiplist_next(&prev, &i, &j, thread, list));
+        }
+        PIOJO_ASSERT(cnt == piojo_cskiplist_size(list));
+        piojo_cskiplist_unregister(thread, list);
+        piojo_cskiplist_free(list);
+
+        list = piojo_cskiplist_alloc_i32k(sizeof(int));
+        thread = piojo_cskiplist_register(list);
+        for (i = 0; i < TEST_SHARED_KEYS; ++i){
+                if (i != TEST_SHARED_KEYS / 2){
+                        PIOJO_ASSERT(piojo_cskiplist_insert(&i, &i, thread,
+                                                            list));
+                }
+        }
+        test_run_workers(hot_worker, 1, list);
+        i = TEST_SHARED_KEYS / 2;
+        PIOJO_ASSERT(! piojo_cskiplist_search(&i, NULL, thread, list));
+        PIOJO_ASSERT(piojo_cskiplist_size(list) == TEST_SHARED_KEYS - 1);
+        piojo_cskiplist_unregister(thread, list);
+        piojo_cskiplist_free(list);
+}
+
+int main(void)
+{
+        test_alloc();
+        test_insert_set_search();
+        test_delete_clear();
+        test_first_next();
+        test_threads();
+
+        assert_allocator_init(0);
+        assert_allocator_alloc(0);
+
+        return 0;
+}
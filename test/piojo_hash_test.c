@@ -23,9 +23,12 @@
  *
  */
 
+#include <stdio.h>
 #include <piojo_test.h>
 #include <piojo/piojo_hash.h>
 
+#define TEST_SNAPSHOT_PATH "piojo_hash_test.snapshot"
+
 void test_alloc(void)
 {
         piojo_hash_t *hash;
@@ -240,6 +243,44 @@ void test_search(void)
         piojo_hash_free(hash);
 }
 
+static uint64_t
+my_hash(const void *key, size_t ksize, uint64_t seed)
+{
+        PIOJO_UNUSED(ksize);
+        /* Poor hash, forces collisions. */
+        return (uint64_t)(*(const int*) key % 8) ^ seed;
+}
+
+void test_search_hash(void)
+{
+        piojo_hash_t *hash;
+        piojo_hasher_if hasher = { my_hash, my_eq };
+        int i, j;
+
+        hash = piojo_hash_alloc_mode_hash(PIOJO_HASH_MODE_CHAIN, sizeof(int),
+                                          hasher, sizeof(int), my_allocator);
+        for (i = 0; i < 256; ++i){
+                j = i * 10;
+                PIOJO_ASSERT(piojo_hash_insert(&i, &j, hash) == TRUE);
+        }
+        for (i = 0; i < 256; ++i){
+                PIOJO_ASSERT(*(int*) piojo_hash_search(&i, hash) == i * 10);
+        }
+        piojo_hash_free(hash);
+
+        hash = piojo_hash_alloc_mode_hash(PIOJO_HASH_MODE_FLAT, sizeof(int),
+                                          hasher, sizeof(int), my_allocator);
+        for (i = 0; i < 256; ++i){
+                j = i * 10;
+                PIOJO_ASSERT(piojo_hash_insert(&i, &j, hash) == TRUE);
+        }
+        for (i = 0; i < 256; ++i){
+                PIOJO_ASSERT(*(int*) piojo_hash_search(&i, hash) == i * 10);
+        }
+        piojo_hash_free(hash);
+        assert_allocator_alloc(0);
+}
+
 void test_search32(void)
 {
         piojo_hash_t *hash;
@@ -420,6 +461,392 @@ void test_stress(void)
         piojo_hash_free(hash);
 }
 
+void test_flat(void)
+{
+        piojo_hash_t *hash, *copy;
+        int i, j, cnt;
+        const int *key;
+        int *val;
+
+        hash = piojo_hash_alloc_mode_i32k(PIOJO_HASH_MODE_FLAT, sizeof(int),
+                                          my_allocator);
+        PIOJO_ASSERT(piojo_hash_first(hash, NULL) == NULL);
+        for (i = 0; i < 1024; ++i){
+                j = i * 10;
+                PIOJO_ASSERT(piojo_hash_insert(&i, &j, hash) == TRUE);
+                PIOJO_ASSERT(piojo_hash_insert(&i, &j, hash) == FALSE);
+        }
+        PIOJO_ASSERT(piojo_hash_size(hash) == 1024);
+
+        i = 10;
+        j = 11;
+        PIOJO_ASSERT(piojo_hash_set(&i, &j, hash) == FALSE);
+        PIOJO_ASSERT(*(int*) piojo_hash_search(&i, hash) == 11);
+        j = 100;
+        PIOJO_ASSERT(piojo_hash_set(&i, &j, hash) == FALSE);
+
+        for (i = 0; i < 1024; i += 2){
+                PIOJO_ASSERT(piojo_hash_delete(&i, hash) == TRUE);
+                PIOJO_ASSERT(piojo_hash_delete(&i, hash) == FALSE);
+                PIOJO_ASSERT(piojo_hash_search(&i, hash) == NULL);
+        }
+        PIOJO_ASSERT(piojo_hash_size(hash) == 512);
+
+        copy = piojo_hash_copy(hash);
+        piojo_hash_free(hash);
+
+        cnt = 0;
+        key = (const int*) piojo_hash_first(copy, (void**)&val);
+        while (key != NULL){
+                PIOJO_ASSERT(*key % 2 == 1);
+                PIOJO_ASSERT(*val == *key * 10);
+                ++cnt;
+                key = (const int*) piojo_hash_next(key, copy, (void**)&val);
+        }
+        PIOJO_ASSERT(cnt == 512);
+
+        piojo_hash_clear(copy);
+        PIOJO_ASSERT(piojo_hash_size(copy) == 0);
+        PIOJO_ASSERT(piojo_hash_first(copy, NULL) == NULL);
+
+        piojo_hash_free(copy);
+        assert_allocator_alloc(0);
+}
+
+void test_flat_stress(void)
+{
+        piojo_hash_t *hash;
+        int i, j;
+
+        hash = piojo_hash_alloc_mode_i32k(PIOJO_HASH_MODE_FLAT, sizeof(int),
+                                          piojo_alloc_default);
+        for (i = TEST_STRESS_COUNT; i > 0; --i){
+                j = i * 10;
+                piojo_hash_insert(&i, &j, hash);
+        }
+        PIOJO_ASSERT(piojo_hash_size(hash) == TEST_STRESS_COUNT);
+
+        /* Churn to exercise tombstone reuse. */
+        for (i = 1; i <= TEST_STRESS_COUNT; ++i){
+                PIOJO_ASSERT(piojo_hash_delete(&i, hash) == TRUE);
+                j = -i;
+                PIOJO_ASSERT(piojo_hash_insert(&j, &i, hash) == TRUE);
+        }
+        PIOJO_ASSERT(piojo_hash_size(hash) == TEST_STRESS_COUNT);
+
+        for (i = 1; i <= TEST_STRESS_COUNT; ++i){
+                j = -i;
+                PIOJO_ASSERT(piojo_hash_search(&i, hash) == NULL);
+                PIOJO_ASSERT(*(int*) piojo_hash_search(&j, hash) == i);
+        }
+
+        piojo_hash_free(hash);
+}
+
+void test_incr(void)
+{
+        piojo_hash_t *hash, *copy;
+        const int *key;
+        int i, j, cnt;
+        bool rehash_p = FALSE;
+
+        hash = piojo_hash_alloc_mode_i32k(PIOJO_HASH_MODE_INCR, sizeof(int),
+                                          my_allocator);
+        for (i = 0; i < TEST_STRESS_COUNT; ++i){
+                j = i * 10;
+                PIOJO_ASSERT(piojo_hash_insert(&i, &j, hash) == TRUE);
+                PIOJO_ASSERT(piojo_hash_insert(&i, &j, hash) == FALSE);
+                j = i / 2;
+                PIOJO_ASSERT(*(int*) piojo_hash_search(&j, hash) == j * 10);
+        }
+        PIOJO_ASSERT(piojo_hash_size(hash) == TEST_STRESS_COUNT);
+
+        /* Grow until a migration is pending, then check both tables. */
+        while (! rehash_p){
+                j = i * 10;
+                piojo_hash_insert(&i, &j, hash);
+                ++i;
+                rehash_p = piojo_hash_rehash_step(0, hash);
+        }
+        cnt = 0;
+        key = (const int*) piojo_hash_first(hash, NULL);
+        while (key != NULL){
+                ++cnt;
+                key = (const int*) piojo_hash_next(key, hash, NULL);
+        }
+        PIOJO_ASSERT(cnt == i);
+
+        copy = piojo_hash_copy(hash);
+        for (j = 0; j < i; ++j){
+                PIOJO_ASSERT(*(int*) piojo_hash_search(&j, copy) == j * 10);
+                PIOJO_ASSERT(piojo_hash_delete(&j, copy) == TRUE);
+        }
+        PIOJO_ASSERT(piojo_hash_size(copy) == 0);
+        piojo_hash_free(copy);
+
+        while (piojo_hash_rehash_step(1, hash)){
+                ;
+        }
+        for (j = 0; j < i; ++j){
+                PIOJO_ASSERT(*(int*) piojo_hash_search(&j, hash) == j * 10);
+        }
+
+        piojo_hash_free(hash);
+        assert_allocator_alloc(0);
+}
+
+void test_entry_reuse(void)
+{
+        piojo_hash_t *hash;
+        int i, j, round;
+
+        hash = piojo_hash_alloc_cb_i32k(sizeof(int), my_allocator);
+        for (round = 0; round < 3; ++round){
+                for (i = 0; i < 1000; ++i){
+                        j = i + round;
+                        PIOJO_ASSERT(piojo_hash_insert(&i, &j, hash) == TRUE);
+                }
+                for (i = 0; i < 1000; ++i){
+                        PIOJO_ASSERT(*(int*) piojo_hash_search(&i, hash) ==
+                                     i + round);
+                        PIOJO_ASSERT(piojo_hash_delete(&i, hash) == TRUE);
+                }
+                PIOJO_ASSERT(piojo_hash_size(hash) == 0);
+        }
+        piojo_hash_clear(hash);
+        i = 1;
+        PIOJO_ASSERT(piojo_hash_insert(&i, &i, hash) == TRUE);
+        PIOJO_ASSERT(*(int*) piojo_hash_search(&i, hash) == 1);
+
+        piojo_hash_free(hash);
+        assert_allocator_alloc(0);
+}
+
+static void
+test_batch_mode(piojo_hash_mode_t mode)
+{
+        piojo_hash_t *hash;
+        int keys[1000], vals[1000], i;
+        void *found[1000];
+
+        hash = piojo_hash_alloc_mode_i32k(mode, sizeof(int), my_allocator);
+        for (i = 0; i < 1000; ++i){
+                keys[i] = i % 500;
+                vals[i] = i * 10;
+        }
+        PIOJO_ASSERT(piojo_hash_insert_batch(keys, vals, 1000, hash) == 500);
+        PIOJO_ASSERT(piojo_hash_size(hash) == 500);
+
+        for (i = 0; i < 1000; ++i){
+                keys[i] = i;
+        }
+        PIOJO_ASSERT(piojo_hash_search_batch(keys, 1000, found, hash) == 500);
+        for (i = 0; i < 1000; ++i){
+                if (i < 500){
+                        PIOJO_ASSERT(*(int*) found[i] == i * 10);
+                }else{
+                        PIOJO_ASSERT(found[i] == NULL);
+                }
+        }
+        PIOJO_ASSERT(piojo_hash_search_batch(keys, 0, found, hash) == 0);
+
+        piojo_hash_free(hash);
+        assert_allocator_alloc(0);
+}
+
+void test_batch(void)
+{
+        test_batch_mode(PIOJO_HASH_MODE_CHAIN);
+        test_batch_mode(PIOJO_HASH_MODE_FLAT);
+        test_batch_mode(PIOJO_HASH_MODE_INCR);
+}
+
+static void
+test_cursor_mode(piojo_hash_mode_t mode)
+{
+        piojo_hash_t *hash;
+        piojo_hash_cursor_t cursor;
+        const int *key;
+        int i, j, cnt;
+
+        hash = piojo_hash_alloc_mode_i32k(mode, sizeof(int), my_allocator);
+        PIOJO_ASSERT(piojo_hash_cursor_first(hash, &cursor) == NULL);
+        PIOJO_ASSERT(piojo_hash_cursor_last(hash, &cursor) == NULL);
+        for (i = 0; i < 1024; ++i){
+                j = i * 10;
+                piojo_hash_insert(&i, &j, hash);
+        }
+
+        cnt = 0;
+        key = (const int*) piojo_hash_cursor_first(hash, &cursor);
+        while (key != NULL){
+                PIOJO_ASSERT(*(int*) piojo_hash_cursor_value(&cursor, hash) ==
+                             *key * 10);
+                ++cnt;
+                key = (const int*) piojo_hash_cursor_next(&cursor, hash);
+        }
+        PIOJO_ASSERT(cnt == 1024);
+
+        cnt = 0;
+        key = (const int*) piojo_hash_cursor_last(hash, &cursor);
+        while (key != NULL){
+                ++cnt;
+                key = (const int*) piojo_hash_cursor_prev(&cursor, hash);
+        }
+        PIOJO_ASSERT(cnt == 1024);
+
+        i = 512;
+        key = (const int*) piojo_hash_cursor_seek(&i, hash, &cursor);
+        PIOJO_ASSERT(*key == i);
+        i = 1024;
+        PIOJO_ASSERT(piojo_hash_cursor_seek(&i, hash, &cursor) == NULL);
+
+        key = (const int*) piojo_hash_cursor_first(hash, &cursor);
+        while (key != NULL){
+                if (*key % 2 == 0){
+                        key = (const int*) piojo_hash_cursor_delete(&cursor,
+                                                                     hash);
+                }else{
+                        key = (const int*) piojo_hash_cursor_next(&cursor,
+                                                                   hash);
+                }
+        }
+        PIOJO_ASSERT(piojo_hash_size(hash) == 512);
+        for (i = 0; i < 1024; ++i){
+                PIOJO_ASSERT((piojo_hash_search(&i, hash) != NULL) == (i % 2));
+        }
+
+        piojo_hash_free(hash);
+        assert_allocator_alloc(0);
+}
+
+void test_cursor(void)
+{
+        test_cursor_mode(PIOJO_HASH_MODE_CHAIN);
+        test_cursor_mode(PIOJO_HASH_MODE_FLAT);
+        test_cursor_mode(PIOJO_HASH_MODE_INCR);
+}
+
+static void
+test_snapshot_mode(piojo_hash_mode_t mode)
+{
+        piojo_hash_t *hash, *mapped, *copy;
+        piojo_hash_cursor_t cursor;
+        const int *key;
+        int i, j, cnt;
+
+        hash = piojo_hash_alloc_mode_i32k(mode, sizeof(int), my_allocator);
+        for (i = 0; i < 10000; ++i){
+                j = i * 10;
+                piojo_hash_insert(&i, &j, hash);
+        }
+        for (i = 0; i < 10000; i += 3){
+                piojo_hash_delete(&i, hash);
+        }
+        PIOJO_ASSERT(piojo_hash_save(TEST_SNAPSHOT_PATH, hash));
+
+        mapped = piojo_hash_open_mapped(TEST_SNAPSHOT_PATH);
+        PIOJO_ASSERT(mapped);
+        PIOJO_ASSERT(piojo_hash_size(mapped) == piojo_hash_size(hash));
+        for (i = 0; i < 10000; ++i){
+                if (i % 3 == 0){
+                        PIOJO_ASSERT(piojo_hash_search(&i, mapped) == NULL);
+                }else{
+                        PIOJO_ASSERT(*(int*) piojo_hash_search(&i, mapped) ==
+                                     i * 10);
+                }
+        }
+        cnt = 0;
+        key = (const int*) piojo_hash_cursor_first(mapped, &cursor);
+        while (key != NULL){
+                ++cnt;
+                key = (const int*) piojo_hash_cursor_next(&cursor, mapped);
+        }
+        PIOJO_ASSERT(cnt == (int) piojo_hash_size(hash));
+
+        copy = piojo_hash_copy(mapped);
+        i = 0;
+        PIOJO_ASSERT(piojo_hash_insert(&i, &i, copy));
+        PIOJO_ASSERT(piojo_hash_size(copy) == piojo_hash_size(hash) + 1);
+        piojo_hash_free(copy);
+
+        /* Promoted tables are writable and can grow out of the mapping. */
+        piojo_hash_promote(mapped);
+        for (i = 0; i < 10000; ++i){
+                j = i * 10;
+                piojo_hash_set(&i, &j, mapped);
+        }
+        for (i = 10000; i < 40000; ++i){
+                PIOJO_ASSERT(piojo_hash_insert(&i, &i, mapped));
+        }
+        PIOJO_ASSERT(piojo_hash_size(mapped) == 40000);
+        i = 3;
+        PIOJO_ASSERT(*(int*) piojo_hash_search(&i, mapped) == 30);
+        piojo_hash_free(mapped);
+
+        /* The file wasn't modified. */
+        mapped = piojo_hash_open_mapped(TEST_SNAPSHOT_PATH);
+        PIOJO_ASSERT(mapped);
+        PIOJO_ASSERT(piojo_hash_size(mapped) == piojo_hash_size(hash));
+        i = 3;
+        PIOJO_ASSERT(piojo_hash_search(&i, mapped) == NULL);
+        piojo_hash_free(mapped);
+
+        piojo_hash_free(hash);
+        remove(TEST_SNAPSHOT_PATH);
+}
+
+void test_snapshot(void)
+{
+        piojo_hash_t *hash, *mapped;
+        piojo_hasher_if hasher = { my_hash, my_eq };
+        FILE *file;
+        int i, j;
+
+        test_snapshot_mode(PIOJO_HASH_MODE_CHAIN);
+        test_snapshot_mode(PIOJO_HASH_MODE_FLAT);
+        test_snapshot_mode(PIOJO_HASH_MODE_INCR);
+
+        hash = piojo_hash_alloc_mode_hash(PIOJO_HASH_MODE_FLAT, sizeof(int),
+                                          hasher, sizeof(int), my_allocator);
+        for (i = 0; i < 256; ++i){
+                j = i * 10;
+                piojo_hash_insert(&i, &j, hash);
+        }
+        PIOJO_ASSERT(piojo_hash_save(TEST_SNAPSHOT_PATH, hash));
+        piojo_hash_free(hash);
+
+        /* Custom keys need their hasher. */
+        PIOJO_ASSERT(piojo_hash_open_mapped(TEST_SNAPSHOT_PATH) == NULL);
+        mapped = piojo_hash_open_mapped_hash(TEST_SNAPSHOT_PATH, hasher,
+                                             my_allocator);
+        PIOJO_ASSERT(mapped);
+        for (i = 0; i < 256; ++i){
+                PIOJO_ASSERT(*(int*) piojo_hash_search(&i, mapped) == i * 10);
+        }
+
+        /* Saving over a mapped file leaves the mapping readable. */
+        hash = piojo_hash_alloc_mode_i32k(PIOJO_HASH_MODE_FLAT, sizeof(int),
+                                          my_allocator);
+        PIOJO_ASSERT(piojo_hash_save(TEST_SNAPSHOT_PATH, hash));
+        piojo_hash_free(hash);
+        for (i = 0; i < 256; ++i){
+                PIOJO_ASSERT(*(int*) piojo_hash_search(&i, mapped) == i * 10);
+        }
+        piojo_hash_free(mapped);
+        mapped = piojo_hash_open_mapped(TEST_SNAPSHOT_PATH);
+        PIOJO_ASSERT(mapped && piojo_hash_size(mapped) == 0);
+        piojo_hash_free(mapped);
+
+        file = fopen(TEST_SNAPSHOT_PATH, "wb");
+        PIOJO_ASSERT(file);
+        fputs("not a snapshot", file);
+        fclose(file);
+        PIOJO_ASSERT(piojo_hash_open_mapped(TEST_SNAPSHOT_PATH) == NULL);
+        remove(TEST_SNAPSHOT_PATH);
+        PIOJO_ASSERT(piojo_hash_open_mapped(TEST_SNAPSHOT_PATH) == NULL);
+}
+
 int main(void)
 {
         test_alloc();
@@ -432,6 +859,7 @@ int main(void)
         test_insertset();
         test_set();
         test_search();
+        test_search_hash();
         test_search32();
         test_search64();
         test_searchsiz();
@@ -439,6 +867,13 @@ int main(void)
         test_first_next();
         test_hash_expand();
         test_stress();
+        test_flat();
+        test_flat_stress();
+        test_incr();
+        test_entry_reuse();
+        test_batch();
+        test_cursor();
+        test_snapshot();
 
         assert_allocator_init(0);
         assert_allocator_alloc(0);
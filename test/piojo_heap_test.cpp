@@ -24,6 +24,8 @@
  */
 
 #include <map>
+#include <set>
+#include <vector>
 #include <time.h>
 #include <piojo_test.h>
 #include <piojo/piojo_heap.h>
@@ -357,6 +359,102 @@ void test_heap_contain_p(void)
         assert_allocator_init(0);
 }
 
+void test_heap_handles(void)
+{
+        piojo_heap_t *heap, *copy;
+        piojo_heap_handle_t h[5], h2;
+        struct entry entries[5] = {{1,10},{2,30},{3,8},{4,20},{5,80}};
+        struct entry*e;
+        unsigned int j;
+
+        heap = piojo_heap_alloc_mode(PIOJO_HEAP_MODE_HANDLE, entry_leq,
+                                     my_allocator);
+        for (j=0; j<5; ++j){
+                h[j] = piojo_heap_push_handle((piojo_opaque_t)&entries[j],
+                                              heap);
+                PIOJO_ASSERT(h[j] == j);
+                PIOJO_ASSERT(piojo_heap_contain_handle_p(h[j], heap));
+        }
+        PIOJO_ASSERT(! piojo_heap_contain_handle_p(5, heap));
+
+        e = (struct entry*) piojo_heap_peek(heap);
+        PIOJO_ASSERT(3 == e->i);
+
+        entries[4].key = 1;
+        piojo_heap_decrease_handle(h[4], heap);
+        e = (struct entry*) piojo_heap_peek(heap);
+        PIOJO_ASSERT(5 == e->i);
+
+        piojo_heap_remove_handle(h[4], heap);
+        PIOJO_ASSERT(! piojo_heap_contain_handle_p(h[4], heap));
+        PIOJO_ASSERT(piojo_heap_size(heap) == 4);
+        e = (struct entry*) piojo_heap_peek(heap);
+        PIOJO_ASSERT(3 == e->i);
+
+        /* Same value twice, removed handle is reused. */
+        h2 = piojo_heap_push_handle((piojo_opaque_t)&entries[2], heap);
+        PIOJO_ASSERT(h2 == h[4]);
+        piojo_heap_pop(heap);
+        e = (struct entry*) piojo_heap_peek(heap);
+        PIOJO_ASSERT(3 == e->i);
+
+        copy = piojo_heap_copy(heap);
+        piojo_heap_clear(heap);
+        PIOJO_ASSERT(! piojo_heap_contain_handle_p(h[0], heap));
+        PIOJO_ASSERT(piojo_heap_push_handle((piojo_opaque_t)&entries[0],
+                                            heap) == 0);
+        piojo_heap_free(heap);
+
+        PIOJO_ASSERT(piojo_heap_size(copy) == 4);
+        piojo_heap_remove_handle(h[1], copy);
+        for (j=0; j<3; ++j){
+                e = (struct entry*) piojo_heap_peek(copy);
+                PIOJO_ASSERT(e->i == (j == 0 ? 3 : (j == 1 ? 1 : 4)));
+                piojo_heap_pop(copy);
+        }
+        piojo_heap_free(copy);
+
+        assert_allocator_alloc(0);
+        assert_allocator_init(0);
+}
+
+void test_handles_stress(void)
+{
+        piojo_heap_t *heap;
+        std::multiset<int> keys;
+        std::vector<piojo_heap_handle_t> handles;
+        piojo_heap_handle_t h;
+        int i,j,k;
+
+        heap = piojo_heap_alloc_mode(PIOJO_HEAP_MODE_HANDLE, int_leq,
+                                     piojo_alloc_default);
+        for (i = 0; i < TEST_STRESS_COUNT; ++i){
+                j = rand() % 1000;
+                h = piojo_heap_push_handle((piojo_opaque_t)j, heap);
+                if (h >= handles.size()){
+                        handles.resize(h + 1);
+                }
+                handles[h] = j;
+                keys.insert(j);
+                if (i % 3 == 0){
+                        k = rand() % handles.size();
+                        if (piojo_heap_contain_handle_p(k, heap)){
+                                keys.erase(keys.find(handles[k]));
+                                piojo_heap_remove_handle(k, heap);
+                        }
+                }
+        }
+        PIOJO_ASSERT(piojo_heap_size(heap) == keys.size());
+
+        while (! keys.empty()){
+                j = (int) piojo_heap_peek(heap);
+                PIOJO_ASSERT(j == *keys.begin());
+                keys.erase(keys.begin());
+                piojo_heap_pop(heap);
+        }
+        piojo_heap_free(heap);
+}
+
 int main(void)
 {
         test_alloc();
@@ -371,7 +469,9 @@ int main(void)
         test_heap_expand();
         test_heap_decr();
         test_heap_contain_p();
+        test_heap_handles();
         test_stress();
+        test_handles_stress();
 
         assert_allocator_init(0);
         assert_allocator_alloc(0);
@@ -0,0 +1,228 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2013 G. Elian Gidoni
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+
+#include <vector>
+#include <utility>
+#include <algorithm>
+#include <stdlib.h>
+#include <time.h>
+#include <piojo_test.h>
+#include <piojo/piojo_itree.h>
+
+typedef std::pair<int,int> interval_t;
+
+static bool
+collect_visit(const void *lo, const void *hi, void *data, void *state)
+{
+        std::vector<interval_t> *v = (std::vector<interval_t>*) state;
+        PIOJO_ASSERT(*(int*) data == *(int*) lo * 10 + *(int*) hi);
+        v->push_back(interval_t(*(int*) lo, *(int*) hi));
+        return TRUE;
+}
+
+static bool
+first_visit(const void *lo, const void *hi, void *data, void *state)
+{
+        PIOJO_UNUSED(hi);
+        PIOJO_UNUSED(data);
+        *(int*) state = *(int*) lo;
+        return FALSE;
+}
+
+void test_alloc()
+{
+        piojo_itree_t *itree;
+
+        itree = piojo_itree_alloc_i32k(2);
+        PIOJO_ASSERT(itree);
+        PIOJO_ASSERT(piojo_itree_size(itree) == 0);
+        piojo_itree_free(itree);
+
+        itree = piojo_itree_alloc_i64k(2);
+        PIOJO_ASSERT(itree);
+        PIOJO_ASSERT(piojo_itree_size(itree) == 0);
+        piojo_itree_free(itree);
+
+        itree = piojo_itree_alloc_sizk(2);
+        PIOJO_ASSERT(itree);
+        PIOJO_ASSERT(piojo_itree_size(itree) == 0);
+        piojo_itree_free(itree);
+}
+
+void test_insert_delete()
+{
+        piojo_itree_t *itree;
+        int lo=1, hi=5, j=10;
+
+        itree = piojo_itree_alloc_cb_i32k(sizeof(int), my_allocator);
+        PIOJO_ASSERT(piojo_itree_insert(&lo, &hi, &j, itree) == TRUE);
+        PIOJO_ASSERT(piojo_itree_insert(&lo, &hi, &j, itree) == FALSE);
+        PIOJO_ASSERT(piojo_itree_size(itree) == 1);
+
+        /* Same low endpoint, different interval. */
+        ++hi;
+        PIOJO_ASSERT(piojo_itree_insert(&lo, &hi, &j, itree) == TRUE);
+        PIOJO_ASSERT(piojo_itree_size(itree) == 2);
+
+        ++j;
+        PIOJO_ASSERT(piojo_itree_set(&lo, &hi, &j, itree) == FALSE);
+        PIOJO_ASSERT(*(int*) piojo_itree_search(&lo, &hi, itree) == j);
+
+        PIOJO_ASSERT(piojo_itree_delete(&lo, &hi, itree) == TRUE);
+        PIOJO_ASSERT(piojo_itree_delete(&lo, &hi, itree) == FALSE);
+        PIOJO_ASSERT(piojo_itree_search(&lo, &hi, itree) == NULL);
+        PIOJO_ASSERT(piojo_itree_size(itree) == 1);
+
+        piojo_itree_clear(itree);
+        PIOJO_ASSERT(piojo_itree_size(itree) == 0);
+
+        piojo_itree_free(itree);
+        assert_allocator_alloc(0);
+        assert_allocator_init(0);
+}
+
+void test_copy()
+{
+        piojo_itree_t *itree, *copy;
+        std::vector<interval_t> found;
+        int i, lo, hi, j, p=15;
+
+        itree = piojo_itree_alloc_cb_i32k(sizeof(int), my_allocator);
+        for (i = 0; i < 20; ++i){
+                lo = i;
+                hi = i + 3;
+                j = lo * 10 + hi;
+                piojo_itree_insert(&lo, &hi, &j, itree);
+        }
+
+        copy = piojo_itree_copy(itree);
+        piojo_itree_free(itree);
+        PIOJO_ASSERT(piojo_itree_size(copy) == 20);
+
+        PIOJO_ASSERT(piojo_itree_stab(&p, collect_visit, &found, copy) == 4);
+        PIOJO_ASSERT(found.size() == 4);
+        for (i = 0; i < 4; ++i){
+                PIOJO_ASSERT(found[i].first == 12 + i);
+        }
+
+        piojo_itree_free(copy);
+        assert_allocator_alloc(0);
+        assert_allocator_init(0);
+}
+
+void test_stop()
+{
+        piojo_itree_t *itree;
+        int i, lo, hi, first = -1;
+
+        itree = piojo_itree_alloc_i32k(sizeof(bool));
+        for (i = 0; i < 10; ++i){
+                lo = i;
+                hi = 100;
+                piojo_itree_insert(&lo, &hi, NULL, itree);
+        }
+
+        lo = 50;
+        PIOJO_ASSERT(piojo_itree_stab(&lo, first_visit, &first, itree) == 1);
+        PIOJO_ASSERT(first == 0);
+
+        piojo_itree_free(itree);
+}
+
+void test_stress_rand()
+{
+        piojo_itree_t *itree;
+        std::vector<interval_t> ivs, found, expected;
+        const int range = 1000;
+        int i, k, lo, hi, j;
+        size_t n, cnt;
+
+        itree = piojo_itree_alloc_i32k(sizeof(int));
+        for (n = 0; n < 3000; ++n){
+                lo = rand() % range;
+                hi = lo + rand() % 50;
+                j = lo * 10 + hi;
+                if (piojo_itree_insert(&lo, &hi, &j, itree)){
+                        ivs.push_back(interval_t(lo, hi));
+                }
+        }
+
+        for (k = 0; k < 4; ++k){
+                for (n = 0; n < 200; ++n){
+                        lo = rand() % range;
+                        hi = lo + rand() % 30;
+                        expected.clear();
+                        for (i = 0; i < (int) ivs.size(); ++i){
+                                if (ivs[i].first <= hi && ivs[i].second >= lo){
+                                        expected.push_back(ivs[i]);
+                                }
+                        }
+                        std::sort(expected.begin(), expected.end());
+
+                        found.clear();
+                        cnt = piojo_itree_overlap(&lo, &hi, collect_visit,
+                                                  &found, itree);
+                        PIOJO_ASSERT(cnt == expected.size());
+                        PIOJO_ASSERT(found == expected);
+
+                        found.clear();
+                        cnt = piojo_itree_stab(&lo, collect_visit, &found,
+                                               itree);
+                        PIOJO_ASSERT(cnt == found.size());
+                        for (i = 0; i < (int) found.size(); ++i){
+                                PIOJO_ASSERT(found[i].first <= lo &&
+                                             found[i].second >= lo);
+                        }
+                }
+
+                /* Delete half, max endpoints must follow. */
+                std::random_shuffle(ivs.begin(), ivs.end());
+                for (n = ivs.size() / 2; n > 0; --n){
+                        PIOJO_ASSERT(piojo_itree_delete(&ivs.back().first,
+                                                        &ivs.back().second,
+                                                        itree));
+                        ivs.pop_back();
+                }
+                PIOJO_ASSERT(piojo_itree_size(itree) == ivs.size());
+        }
+
+        piojo_itree_free(itree);
+}
+
+int main()
+{
+        srand(time(NULL));
+
+        test_alloc();
+        test_insert_delete();
+        test_copy();
+        test_stop();
+        test_stress_rand();
+
+        assert_allocator_init(0);
+        assert_allocator_alloc(0);
+
+        return 0;
+}
@@ -0,0 +1,391 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2013 G. Elian Gidoni
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+
+/* Must be defined before any system header for truncate()/setrlimit(). */
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <piojo_test.h>
+#include <piojo/piojo_pbtree.h>
+
+#define TEST_TREE_PATH "piojo_pbtree_test.db"
+#define TEST_PAGE_SIZE 4096
+#define TEST_KEYS 20000
+
+static long
+file_size(const char *path)
+{
+        FILE *file = fopen(path, "rb");
+        long size;
+
+        PIOJO_ASSERT(file);
+        fseek(file, 0, SEEK_END);
+        size = ftell(file);
+        fclose(file);
+        return size;
+}
+
+void test_open(void)
+{
+        piojo_pbtree_t *tree;
+        FILE *file;
+        int i = 1;
+
+        remove(TEST_TREE_PATH);
+        tree = piojo_pbtree_open_i32k(TEST_TREE_PATH, sizeof(int));
+        PIOJO_ASSERT(tree);
+        PIOJO_ASSERT(piojo_pbtree_size(tree) == 0);
+        PIOJO_ASSERT(! piojo_pbtree_first(NULL, NULL, tree));
+        PIOJO_ASSERT(! piojo_pbtree_search(&i, NULL, tree));
+        PIOJO_ASSERT(piojo_pbtree_insert(&i, &i, tree));
+        PIOJO_ASSERT(piojo_pbtree_commit(tree));
+        piojo_pbtree_close(tree);
+
+        /* Key and value sizes must match. */
+        PIOJO_ASSERT(piojo_pbtree_open_i64k(TEST_TREE_PATH,
+                                            sizeof(int)) == NULL);
+        PIOJO_ASSERT(piojo_pbtree_open_i32k(TEST_TREE_PATH, 8) == NULL);
+        tree = piojo_pbtree_open_cb_i32k(TEST_TREE_PATH, 8, sizeof(int),
+                                         my_allocator);
+        PIOJO_ASSERT(tree);
+        PIOJO_ASSERT(piojo_pbtree_size(tree) == 1);
+        piojo_pbtree_close(tree);
+        remove(TEST_TREE_PATH);
+
+        file = fopen(TEST_TREE_PATH, "wb");
+        fputs("not a tree", file);
+        fclose(file);
+        PIOJO_ASSERT(piojo_pbtree_open_i32k(TEST_TREE_PATH,
+                                            sizeof(int)) == NULL);
+        remove(TEST_TREE_PATH);
+}
+
+void test_insert_search_delete(void)
+{
+        piojo_pbtree_t *tree;
+        int i, j, k;
+
+        remove(TEST_TREE_PATH);
+        /* A small pool evicts and writes back pages all the time. */
+        tree = piojo_pbtree_open_cb_i32k(TEST_TREE_PATH, 8, sizeof(int),
+                                         my_allocator);
+        for (i = 0; i < TEST_KEYS; ++i){
+                j = (i * 7919) % TEST_KEYS;
+                PIOJO_ASSERT(piojo_pbtree_insert(&j, &j, tree));
+                PIOJO_ASSERT(! piojo_pbtree_insert(&j, &j, tree));
+        }
+        PIOJO_ASSERT(piojo_pbtree_size(tree) == TEST_KEYS);
+        for (i = 0; i < TEST_KEYS; ++i){
+                j = -1;
+                PIOJO_ASSERT(piojo_pbtree_search(&i, &j, tree));
+                PIOJO_ASSERT(i == j);
+        }
+        i = TEST_KEYS;
+        PIOJO_ASSERT(! piojo_pbtree_search(&i, &j, tree));
+
+        i = 10;
+        j = 20;
+        PIOJO_ASSERT(! piojo_pbtree_set(&i, &j, tree));
+        PIOJO_ASSERT(piojo_pbtree_search(&i, &k, tree) && k == 20);
+        PIOJO_ASSERT(piojo_pbtree_set(&i, &i, tree) == FALSE);
+        PIOJO_ASSERT(piojo_pbtree_commit(tree));
+
+        for (i = 0; i < TEST_KEYS; i += 2){
+                PIOJO_ASSERT(piojo_pbtree_delete(&i, tree));
+                PIOJO_ASSERT(! piojo_pbtree_delete(&i, tree));
+        }
+        PIOJO_ASSERT(piojo_pbtree_size(tree) == TEST_KEYS / 2);
+        PIOJO_ASSERT(piojo_pbtree_commit(tree));
+        piojo_pbtree_close(tree);
+
+        tree = piojo_pbtree_open_cb_i32k(TEST_TREE_PATH, 8, sizeof(int),
+                                         my_allocator);
+        PIOJO_ASSERT(piojo_pbtree_size(tree) == TEST_KEYS / 2);
+        for (i = 0; i < TEST_KEYS; ++i){
+                PIOJO_ASSERT(piojo_pbtree_search(&i, &j, tree) ==
+                             (i % 2 != 0));
+                PIOJO_ASSERT(i % 2 == 0 || i == j);
+        }
+        for (i = 1; i < TEST_KEYS; i += 2){
+                PIOJO_ASSERT(piojo_pbtree_delete(&i, tree));
+        }
+        PIOJO_ASSERT(piojo_pbtree_size(tree) == 0);
+        PIOJO_ASSERT(! piojo_pbtree_first(NULL, NULL, tree));
+        PIOJO_ASSERT(piojo_pbtree_insert(&i, &i, tree));
+        PIOJO_ASSERT(piojo_pbtree_commit(tree));
+        piojo_pbtree_close(tree);
+        remove(TEST_TREE_PATH);
+}
+
+void test_iterate(void)
+{
+        piojo_pbtree_t *tree;
+        int i, j, k, cnt;
+
+        remove(TEST_TREE_PATH);
+        tree = piojo_pbtree_open_cb_cmp(TEST_TREE_PATH, 16, sizeof(int),
+                                        test_rev_cmp, sizeof(int),
+                                        my_allocator);
+        for (i = 0; i < TEST_KEYS; i += 3){
+                PIOJO_ASSERT(piojo_pbtree_insert(&i, &i, tree));
+        }
+        /* Keys are in descending order. */
+        PIOJO_ASSERT(piojo_pbtree_first(&i, &j, tree));
+        PIOJO_ASSERT(i == TEST_KEYS - 2 && j == i);
+        PIOJO_ASSERT(piojo_pbtree_last(&i, NULL, tree) && i == 0);
+
+        cnt = 1;
+        PIOJO_ASSERT(piojo_pbtree_first(&i, NULL, tree));
+        while (piojo_pbtree_next(&i, &k, &j, tree)){
+                PIOJO_ASSERT(k == i - 3 && j == k);
+                i = k;
+                ++cnt;
+        }
+        PIOJO_ASSERT(cnt == (TEST_KEYS + 2) / 3);
+        PIOJO_ASSERT(piojo_pbtree_last(&i, NULL, tree));
+        while (piojo_pbtree_prev(&i, &k, NULL, tree)){
+                PIOJO_ASSERT(k == i + 3);
+                i = k;
+                --cnt;
+        }
+        PIOJO_ASSERT(cnt == 1);
+
+        /* Keys between entries. */
+        i = 4;
+        PIOJO_ASSERT(piojo_pbtree_next(&i, &k, NULL, tree) && k == 3);
+        PIOJO_ASSERT(piojo_pbtree_prev(&i, &k, NULL, tree) && k == 6);
+        i = -1;
+        PIOJO_ASSERT(! piojo_pbtree_next(&i, &k, NULL, tree));
+        i = TEST_KEYS;
+        PIOJO_ASSERT(! piojo_pbtree_prev(&i, &k, NULL, tree));
+        piojo_pbtree_close(tree);
+        remove(TEST_TREE_PATH);
+}
+
+void test_crash(void)
+{
+        piojo_pbtree_t *tree;
+        FILE *file;
+        int i, j;
+
+        remove(TEST_TREE_PATH);
+        tree = piojo_pbtree_open_cb_i32k(TEST_TREE_PATH, 8, sizeof(int),
+                                         my_allocator);
+        for (i = 0; i < TEST_KEYS; ++i){
+                piojo_pbtree_insert(&i, &i, tree);
+        }
+        PIOJO_ASSERT(piojo_pbtree_commit(tree));
+
+        /* Uncommitted pages reach the file, the meta page doesn't. */
+        for (i = 0; i < TEST_KEYS; ++i){
+                j = -i;
+                piojo_pbtree_set(&i, &j, tree);
+        }
+        piojo_pbtree_close(tree);
+        tree = piojo_pbtree_open_cb_i32k(TEST_TREE_PATH, 8, sizeof(int),
+                                         my_allocator);
+        for (i = 0; i < TEST_KEYS; ++i){
+                PIOJO_ASSERT(piojo_pbtree_search(&i, &j, tree) && i == j);
+                j = -i;
+                piojo_pbtree_set(&i, &j, tree);
+        }
+        PIOJO_ASSERT(piojo_pbtree_commit(tree));
+        piojo_pbtree_close(tree);
+
+        /* A torn meta page falls back to the previous commit. */
+        file = fopen(TEST_TREE_PATH, "r+b");
+        fseek(file, (long) (3 % 2) * TEST_PAGE_SIZE, SEEK_SET);
+        fputs("torn", file);
+        fclose(file);
+        tree = piojo_pbtree_open_cb_i32k(TEST_TREE_PATH, 8, sizeof(int),
+                                         my_allocator);
+        PIOJO_ASSERT(tree);
+        PIOJO_ASSERT(piojo_pbtree_size(tree) == TEST_KEYS);
+        for (i = 0; i < TEST_KEYS; ++i){
+                PIOJO_ASSERT(piojo_pbtree_search(&i, &j, tree) && i == j);
+        }
+        piojo_pbtree_close(tree);
+        remove(TEST_TREE_PATH);
+}
+
+void test_page_reuse(void)
+{
+        piojo_pbtree_t *tree;
+        long size = 0;
+        int i, round;
+
+        remove(TEST_TREE_PATH);
+        tree = piojo_pbtree_open_cb_i32k(TEST_TREE_PATH, 32, sizeof(int),
+                                         my_allocator);
+        for (round = 0; round < 10; ++round){
+                for (i = 0; i < TEST_KEYS; ++i){
+                        PIOJO_ASSERT(piojo_pbtree_insert(&i, &i, tree));
+                }
+                PIOJO_ASSERT(piojo_pbtree_commit(tree));
+                for (i = 0; i < TEST_KEYS; ++i){
+                        PIOJO_ASSERT(piojo_pbtree_delete(&i, tree));
+                }
+                PIOJO_ASSERT(piojo_pbtree_commit(tree));
+                if (round == 1){
+                        size = file_size(TEST_TREE_PATH);
+                }
+        }
+        /* Pages freed by each commit are reused by the next ones. */
+        PIOJO_ASSERT(file_size(TEST_TREE_PATH) == size);
+        piojo_pbtree_close(tree);
+
+        /* Free pages are found again when reopening. */
+        tree = piojo_pbtree_open_cb_i32k(TEST_TREE_PATH, 32, sizeof(int),
+                                         my_allocator);
+        for (i = 0; i < TEST_KEYS; ++i){
+                PIOJO_ASSERT(piojo_pbtree_insert(&i, &i, tree));
+        }
+        PIOJO_ASSERT(piojo_pbtree_commit(tree));
+        PIOJO_ASSERT(file_size(TEST_TREE_PATH) == size);
+        piojo_pbtree_close(tree);
+        remove(TEST_TREE_PATH);
+}
+
+void test_io_error(void)
+{
+        piojo_pbtree_t *tree;
+        struct rlimit limit, small;
+        int i, j;
+
+        remove(TEST_TREE_PATH);
+        tree = piojo_pbtree_open_cb_i32k(TEST_TREE_PATH, 8, sizeof(int),
+                                         my_allocator);
+        for (i = 0; i < TEST_KEYS; ++i){
+                PIOJO_ASSERT(piojo_pbtree_insert(&i, &i, tree));
+        }
+        PIOJO_ASSERT(piojo_pbtree_commit(tree));
+
+        /* Evicted dirty pages can't grow the file. */
+        signal(SIGXFSZ, SIG_IGN);
+        PIOJO_ASSERT(getrlimit(RLIMIT_FSIZE, &limit) == 0);
+        small = limit;
+        small.rlim_cur = (rlim_t) file_size(TEST_TREE_PATH);
+        PIOJO_ASSERT(setrlimit(RLIMIT_FSIZE, &small) == 0);
+        for (i = TEST_KEYS; i < 2 * TEST_KEYS; ++i){
+                if (! piojo_pbtree_insert(&i, &i, tree)){
+                        break;
+                }
+        }
+        PIOJO_ASSERT(setrlimit(RLIMIT_FSIZE, &limit) == 0);
+        PIOJO_ASSERT(i < 2 * TEST_KEYS);
+        PIOJO_ASSERT(piojo_pbtree_failed_p(tree));
+        PIOJO_ASSERT(! piojo_pbtree_search(&i, &j, tree));
+        /* Committed keys aren't read from the pool either. */
+        j = 0;
+        PIOJO_ASSERT(! piojo_pbtree_search(&j, NULL, tree));
+        PIOJO_ASSERT(! piojo_pbtree_first(&j, NULL, tree));
+        PIOJO_ASSERT(! piojo_pbtree_commit(tree));
+        piojo_pbtree_close(tree);
+
+        tree = piojo_pbtree_open_cb_i32k(TEST_TREE_PATH, 8, sizeof(int),
+                                         my_allocator);
+        PIOJO_ASSERT(tree);
+        PIOJO_ASSERT(! piojo_pbtree_failed_p(tree));
+        PIOJO_ASSERT(piojo_pbtree_size(tree) == TEST_KEYS);
+        for (i = 0; i < TEST_KEYS; ++i){
+                PIOJO_ASSERT(piojo_pbtree_search(&i, &j, tree) && i == j);
+        }
+        piojo_pbtree_close(tree);
+
+        /* Leaves aren't read on open, a short read fails the search. */
+        tree = piojo_pbtree_open_cb_i32k(TEST_TREE_PATH, 8, sizeof(int),
+                                         my_allocator);
+        PIOJO_ASSERT(truncate(TEST_TREE_PATH, 2 * TEST_PAGE_SIZE) == 0);
+        i = 0;
+        PIOJO_ASSERT(! piojo_pbtree_search(&i, &j, tree));
+        PIOJO_ASSERT(piojo_pbtree_failed_p(tree));
+        PIOJO_ASSERT(! piojo_pbtree_delete(&i, tree));
+        piojo_pbtree_close(tree);
+        PIOJO_ASSERT(piojo_pbtree_open_cb_i32k(TEST_TREE_PATH, 8,
+                                               sizeof(int),
+                                               my_allocator) == NULL);
+        remove(TEST_TREE_PATH);
+}
+
+/* Enough keys for inner pages to split and to be emptied. */
+void test_stress(void)
+{
+        piojo_pbtree_t *tree;
+        int64_t i, j, cnt = 400000, prime = 1000003;
+
+        remove(TEST_TREE_PATH);
+        tree = piojo_pbtree_open_cb_i64k(TEST_TREE_PATH, 64, sizeof(int64_t),
+                                         my_allocator);
+        for (i = 0; i < cnt; ++i){
+                j = (i * prime) % cnt;
+                PIOJO_ASSERT(piojo_pbtree_insert(&j, &i, tree));
+        }
+        PIOJO_ASSERT(piojo_pbtree_commit(tree));
+        for (i = 0; i < cnt; ++i){
+                j = (i * prime) % cnt;
+                if (j % 3 != 0 || j > cnt / 2){
+                        PIOJO_ASSERT(piojo_pbtree_delete(&j, tree));
+                }
+        }
+        piojo_pbtree_close(tree);
+
+        tree = piojo_pbtree_open_cb_i64k(TEST_TREE_PATH, 64, sizeof(int64_t),
+                                         my_allocator);
+        PIOJO_ASSERT(piojo_pbtree_size(tree) == (size_t) cnt);
+        for (i = 0; i < cnt; ++i){
+                j = (i * prime) % cnt;
+                if (j % 3 != 0 || j > cnt / 2){
+                        PIOJO_ASSERT(piojo_pbtree_delete(&j, tree));
+                }
+        }
+        PIOJO_ASSERT(piojo_pbtree_commit(tree));
+        PIOJO_ASSERT(piojo_pbtree_first(&j, NULL, tree) && j == 0);
+        for (i = 0; piojo_pbtree_next(&i, &j, NULL, tree); i = j){
+                PIOJO_ASSERT(j == i + 3);
+        }
+        PIOJO_ASSERT(piojo_pbtree_size(tree) == (size_t) (cnt / 2 / 3 + 1));
+        PIOJO_ASSERT(i == cnt / 2 / 3 * 3);
+        piojo_pbtree_close(tree);
+        remove(TEST_TREE_PATH);
+}
+
+int main(void)
+{
+        test_open();
+        test_insert_search_delete();
+        test_iterate();
+        test_crash();
+        test_page_reuse();
+        test_io_error();
+        test_stress();
+
+        assert_allocator_init(0);
+        assert_allocator_alloc(0);
+
+        return 0;
+}
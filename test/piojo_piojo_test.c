@@ -227,10 +227,50 @@ void test_clampint(void)
         PIOJO_ASSERT(piojo_clampint(5, -10, 0) == 0);
 }
 
+void test_bytes_hash(void)
+{
+        unsigned char buf[128];
+        size_t i;
+
+        for (i = 0; i < sizeof(buf); ++i){
+                buf[i] = (unsigned char) i;
+        }
+        for (i = 0; i <= sizeof(buf); ++i){
+                PIOJO_ASSERT(piojo_bytes_hash(buf, i, 1) ==
+                             piojo_bytes_hash(buf, i, 1));
+                PIOJO_ASSERT(piojo_bytes_hash(buf, i, 1) !=
+                             piojo_bytes_hash(buf, i, 2));
+        }
+        for (i = 1; i < sizeof(buf); ++i){
+                PIOJO_ASSERT(piojo_bytes_hash(buf, i, 1) !=
+                             piojo_bytes_hash(buf, i + 1, 1));
+        }
+}
+
+void test_int_hash(void)
+{
+        int32_t i1 = 1, i2 = 2;
+        int64_t l1 = 1, l2 = 2;
+        size_t s1 = 1, s2 = 2;
+
+        PIOJO_ASSERT(piojo_i32_hash(&i1, sizeof(i1), 0) ==
+                     piojo_i32_hash(&i1, sizeof(i1), 0));
+        PIOJO_ASSERT(piojo_i32_hash(&i1, sizeof(i1), 0) !=
+                     piojo_i32_hash(&i2, sizeof(i2), 0));
+        PIOJO_ASSERT(piojo_i32_hash(&i1, sizeof(i1), 0) !=
+                     piojo_i32_hash(&i1, sizeof(i1), 1));
+        PIOJO_ASSERT(piojo_i64_hash(&l1, sizeof(l1), 0) !=
+                     piojo_i64_hash(&l2, sizeof(l2), 0));
+        PIOJO_ASSERT(piojo_siz_hash(&s1, sizeof(s1), 0) !=
+                     piojo_siz_hash(&s2, sizeof(s2), 0));
+}
+
 void test_piojo(void)
 {
         test_opaque_eq();
         test_id_eq();
+        test_bytes_hash();
+        test_int_hash();
         test_safe_adduint_p();
         test_safe_addsiz_p();
         test_safe_addint_p();
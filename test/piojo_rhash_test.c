@@ -0,0 +1,221 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2013 G. Elian Gidoni
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+
+/* Must be defined before any system header for pthreads. */
+#define _POSIX_C_SOURCE 200112L
+
+#include <pthread.h>
+#include <piojo_test.h>
+#include <piojo/piojo_rhash.h>
+
+#define TEST_READER_COUNT 4
+#define TEST_STABLE_KEYS 1000
+#define TEST_WRITE_ROUNDS 20
+
+typedef struct {
+        piojo_rhash_t *rhash;
+        volatile int *done;
+} worker_t;
+
+void test_alloc(void)
+{
+        piojo_rhash_t *rhash;
+
+        rhash = piojo_rhash_alloc_i32k(2);
+        PIOJO_ASSERT(rhash);
+        PIOJO_ASSERT(piojo_rhash_size(rhash) == 0);
+        piojo_rhash_free(rhash);
+
+        rhash = piojo_rhash_alloc_i64k(2);
+        PIOJO_ASSERT(rhash);
+        PIOJO_ASSERT(piojo_rhash_size(rhash) == 0);
+        piojo_rhash_free(rhash);
+
+        rhash = piojo_rhash_alloc_sizk(2);
+        PIOJO_ASSERT(rhash);
+        PIOJO_ASSERT(piojo_rhash_size(rhash) == 0);
+        piojo_rhash_free(rhash);
+}
+
+void test_insert_set_search(void)
+{
+        piojo_rhash_t *rhash;
+        piojo_rhash_reader_t *reader;
+        int i, j;
+
+        rhash = piojo_rhash_alloc_cb_i32k(sizeof(int), my_allocator);
+        reader = piojo_rhash_register(rhash);
+        for (i = 0; i < 1000; ++i){
+                PIOJO_ASSERT(piojo_rhash_insert(&i, &i, rhash));
+                PIOJO_ASSERT(! piojo_rhash_insert(&i, &i, rhash));
+        }
+        PIOJO_ASSERT(piojo_rhash_size(rhash) == 1000);
+
+        for (i = 0; i < 1000; ++i){
+                j = -1;
+                PIOJO_ASSERT(piojo_rhash_search(&i, &j, reader, rhash));
+                PIOJO_ASSERT(i == j);
+                PIOJO_ASSERT(piojo_rhash_search(&i, NULL, reader, rhash));
+        }
+        i = 1000;
+        PIOJO_ASSERT(! piojo_rhash_search(&i, &j, reader, rhash));
+
+        i = 10;
+        j = 20;
+        PIOJO_ASSERT(! piojo_rhash_set(&i, &j, rhash));
+        j = 0;
+        PIOJO_ASSERT(piojo_rhash_search(&i, &j, reader, rhash));
+        PIOJO_ASSERT(j == 20);
+        i = 1000;
+        PIOJO_ASSERT(piojo_rhash_set(&i, &i, rhash));
+        PIOJO_ASSERT(piojo_rhash_size(rhash) == 1001);
+
+        piojo_rhash_unregister(reader, rhash);
+        piojo_rhash_free(rhash);
+}
+
+void test_delete_clear(void)
+{
+        piojo_rhash_t *rhash;
+        piojo_rhash_reader_t *reader;
+        int i;
+
+        rhash = piojo_rhash_alloc_cb_i32k(sizeof(int), my_allocator);
+        reader = piojo_rhash_register(rhash);
+        for (i = 0; i < 1000; ++i){
+                piojo_rhash_insert(&i, &i, rhash);
+        }
+        for (i = 0; i < 1000; i += 2){
+                PIOJO_ASSERT(piojo_rhash_delete(&i, rhash));
+                PIOJO_ASSERT(! piojo_rhash_delete(&i, rhash));
+        }
+        PIOJO_ASSERT(piojo_rhash_size(rhash) == 500);
+        for (i = 0; i < 1000; ++i){
+                PIOJO_ASSERT(piojo_rhash_search(&i, NULL, reader, rhash) ==
+                             (i % 2 != 0));
+        }
+
+        piojo_rhash_clear(rhash);
+        PIOJO_ASSERT(piojo_rhash_size(rhash) == 0);
+        i = 1;
+        PIOJO_ASSERT(! piojo_rhash_search(&i, NULL, reader, rhash));
+        PIOJO_ASSERT(piojo_rhash_insert(&i, &i, rhash));
+        piojo_rhash_reclaim(rhash);
+
+        piojo_rhash_free(rhash);
+}
+
+void test_register(void)
+{
+        piojo_rhash_t *rhash;
+        piojo_rhash_reader_t *r1, *r2, *r3;
+
+        rhash = piojo_rhash_alloc_cb_i32k(sizeof(int), my_allocator);
+        r1 = piojo_rhash_register(rhash);
+        r2 = piojo_rhash_register(rhash);
+        PIOJO_ASSERT(r1 != r2);
+
+        piojo_rhash_unregister(r1, rhash);
+        r3 = piojo_rhash_register(rhash);
+        PIOJO_ASSERT(r3 == r1);
+
+        piojo_rhash_free(rhash);
+}
+
+static void*
+reader_worker(void *arg)
+{
+        worker_t *worker = (worker_t*) arg;
+        piojo_rhash_reader_t *reader;
+        int i, j;
+
+        reader = piojo_rhash_register(worker->rhash);
+        while (! *worker->done){
+                for (i = 0; i < TEST_STABLE_KEYS; ++i){
+                        PIOJO_ASSERT(piojo_rhash_search(&i, &j, reader,
+                                                        worker->rhash));
+                        PIOJO_ASSERT(j == i || j == -i);
+                }
+        }
+        piojo_rhash_unregister(reader, worker->rhash);
+        return NULL;
+}
+
+void test_threads(void)
+{
+        pthread_t threads[TEST_READER_COUNT];
+        worker_t worker;
+        piojo_rhash_t *rhash;
+        volatile int done = FALSE;
+        int i, j, round, ret;
+
+        rhash = piojo_rhash_alloc_i32k(sizeof(int));
+        for (i = 0; i < TEST_STABLE_KEYS; ++i){
+                piojo_rhash_insert(&i, &i, rhash);
+        }
+        worker.rhash = rhash;
+        worker.done = &done;
+        for (i = 0; i < TEST_READER_COUNT; ++i){
+                ret = pthread_create(&threads[i], NULL, reader_worker,
+                                     &worker);
+                PIOJO_ASSERT(ret == 0);
+        }
+
+        /* Keep growing, clearing and replacing while readers run. */
+        for (round = 0; round < TEST_WRITE_ROUNDS; ++round){
+                for (i = 0; i < TEST_STABLE_KEYS; ++i){
+                        j = (round % 2 == 0) ? -i : i;
+                        PIOJO_ASSERT(! piojo_rhash_set(&i, &j, rhash));
+                }
+                for (i = TEST_STABLE_KEYS; i < 20 * TEST_STABLE_KEYS; ++i){
+                        PIOJO_ASSERT(piojo_rhash_insert(&i, &i, rhash));
+                }
+                for (i = TEST_STABLE_KEYS; i < 20 * TEST_STABLE_KEYS; ++i){
+                        PIOJO_ASSERT(piojo_rhash_delete(&i, rhash));
+                }
+        }
+        done = TRUE;
+
+        for (i = 0; i < TEST_READER_COUNT; ++i){
+                ret = pthread_join(threads[i], NULL);
+                PIOJO_ASSERT(ret == 0);
+        }
+        PIOJO_ASSERT(piojo_rhash_size(rhash) == TEST_STABLE_KEYS);
+        piojo_rhash_free(rhash);
+}
+
+int main(void)
+{
+        test_alloc();
+        test_insert_set_search();
+        test_delete_clear();
+        test_register();
+        test_threads();
+
+        assert_allocator_init(0);
+        assert_allocator_alloc(0);
+
+        return 0;
+}
@@ -366,6 +366,199 @@ void test_search(void)
         piojo_skiplist_free(list);
 }
 
+void test_cursor(void)
+{
+        piojo_skiplist_t *list;
+        piojo_skiplist_cursor_t cursor;
+        const int *key;
+        int i, j, cnt;
+
+        list = piojo_skiplist_alloc_cb_i32k(sizeof(int), my_allocator);
+        PIOJO_ASSERT(piojo_skiplist_cursor_first(list, &cursor) == NULL);
+        PIOJO_ASSERT(piojo_skiplist_cursor_last(list, &cursor) == NULL);
+        for (i = 0; i < 1024; i += 2){
+                j = i * 10;
+                piojo_skiplist_insert(&i, &j, list);
+        }
+
+        cnt = 0;
+        key = (const int*) piojo_skiplist_cursor_first(list, &cursor);
+        while (key != NULL){
+                PIOJO_ASSERT(*key == cnt * 2);
+                PIOJO_ASSERT(*(int*) piojo_skiplist_cursor_value(&cursor, list) ==
+                             *key * 10);
+                ++cnt;
+                key = (const int*) piojo_skiplist_cursor_next(&cursor, list);
+        }
+        PIOJO_ASSERT(cnt == 512);
+
+        key = (const int*) piojo_skiplist_cursor_last(list, &cursor);
+        while (key != NULL){
+                --cnt;
+                PIOJO_ASSERT(*key == cnt * 2);
+                key = (const int*) piojo_skiplist_cursor_prev(&cursor, list);
+        }
+        PIOJO_ASSERT(cnt == 0);
+
+        i = 512;
+        key = (const int*) piojo_skiplist_cursor_seek(&i, list, &cursor);
+        PIOJO_ASSERT(*key == 512);
+        i = 513;
+        key = (const int*) piojo_skiplist_cursor_seek(&i, list, &cursor);
+        PIOJO_ASSERT(*key == 514);
+        i = 1023;
+        PIOJO_ASSERT(piojo_skiplist_cursor_seek(&i, list, &cursor) == NULL);
+
+        key = (const int*) piojo_skiplist_cursor_first(list, &cursor);
+        while (key != NULL){
+                if (*key % 4 == 0){
+                        key = (const int*) piojo_skiplist_cursor_delete(&cursor,
+                                                                         list);
+                }else{
+                        key = (const int*) piojo_skiplist_cursor_next(&cursor,
+                                                                       list);
+                }
+        }
+        PIOJO_ASSERT(piojo_skiplist_size(list) == 256);
+        for (i = 0; i < 1024; i += 2){
+                PIOJO_ASSERT((piojo_skiplist_search(&i, list) != NULL) ==
+                             (i % 4 != 0));
+        }
+
+        piojo_skiplist_free(list);
+        assert_allocator_alloc(0);
+}
+
+void test_signed_keys(void)
+{
+        piojo_skiplist_t *list;
+        piojo_skiplist_cursor_t cursor;
+        const int64_t *key;
+        int64_t i, prev;
+        size_t cnt;
+
+        /* Inline comparisons must keep the signed order. */
+        list = piojo_skiplist_alloc_cb_i64k(sizeof(int64_t), my_allocator);
+        for (i = 0; i < 2000; ++i){
+                prev = (i % 2 == 0) ? i : -i;
+                piojo_skiplist_insert(&prev, &i, list);
+        }
+        cnt = 0;
+        prev = INT64_MIN;
+        key = (const int64_t*) piojo_skiplist_cursor_first(list, &cursor);
+        while (key != NULL){
+                PIOJO_ASSERT(*key > prev);
+                prev = *key;
+                ++cnt;
+                key = (const int64_t*) piojo_skiplist_cursor_next(&cursor, list);
+        }
+        PIOJO_ASSERT(cnt == 2000);
+        i = -1999;
+        PIOJO_ASSERT(piojo_skiplist_search(&i, list) != NULL);
+        i = -2;
+        PIOJO_ASSERT(piojo_skiplist_search(&i, list) == NULL);
+
+        piojo_skiplist_free(list);
+        assert_allocator_alloc(0);
+}
+
+void test_node_reuse(void)
+{
+        piojo_skiplist_t *list;
+        int i, j, cnt, base = alloc_cnt;
+
+        list = piojo_skiplist_alloc_cb_i32k(sizeof(int), my_allocator);
+        for (i = 0; i < 1000; ++i){
+                cnt = alloc_cnt;
+                j = i * 10;
+                PIOJO_ASSERT(piojo_skiplist_insert(&i, &j, list));
+                PIOJO_ASSERT(alloc_cnt - cnt <= 1);
+        }
+
+        /* Deleted nodes go to the pool, reinserts take them back. */
+        cnt = alloc_cnt;
+        for (i = 0; i < 1000; ++i){
+                PIOJO_ASSERT(piojo_skiplist_delete(&i, list));
+        }
+        PIOJO_ASSERT(alloc_cnt == cnt);
+        for (i = 0; i < 1000; ++i){
+                cnt = alloc_cnt;
+                PIOJO_ASSERT(piojo_skiplist_set(&i, &i, list));
+                PIOJO_ASSERT(piojo_skiplist_set(&i, &i, list) == FALSE);
+                PIOJO_ASSERT(alloc_cnt - cnt <= 1);
+        }
+        for (i = 0; i < 1000; ++i){
+                PIOJO_ASSERT(*(int*) piojo_skiplist_search(&i, list) == i);
+        }
+
+        piojo_skiplist_clear(list);
+        PIOJO_ASSERT(piojo_skiplist_first(list, NULL) == NULL);
+        piojo_skiplist_free(list);
+        PIOJO_ASSERT(alloc_cnt == base);
+}
+
+void test_rank(void)
+{
+        piojo_skiplist_t *list;
+        bool present[2000];
+        int i, j, key, lo, hi, *data;
+        size_t cnt;
+
+        memset(present, 0, sizeof(present));
+        list = piojo_skiplist_alloc_cb_i32k(sizeof(int), my_allocator);
+        PIOJO_ASSERT(piojo_skiplist_at(0, list, NULL) == NULL);
+        for (i = 0; i < 1000; ++i){
+                key = (i * 7919) % 2000;
+                j = key * 10;
+                piojo_skiplist_insert(&key, &j, list);
+                present[key] = TRUE;
+        }
+        /* Deletions and reinserts keep link widths right. */
+        for (i = 0; i < 2000; i += 3){
+                if (present[i]){
+                        PIOJO_ASSERT(piojo_skiplist_delete(&i, list));
+                        present[i] = FALSE;
+                }else{
+                        PIOJO_ASSERT(piojo_skiplist_insert(&i, &i, list));
+                        present[i] = TRUE;
+                }
+        }
+
+        cnt = 0;
+        for (i = 0; i < 2000; ++i){
+                PIOJO_ASSERT(piojo_skiplist_rank(&i, list) == cnt);
+                if (present[i]){
+                        key = *(const int*) piojo_skiplist_at(cnt, list,
+                                                              (void**) &data);
+                        PIOJO_ASSERT(key == i);
+                        PIOJO_ASSERT(*data == (i % 3 == 0 ? i : i * 10));
+                        ++cnt;
+                }
+        }
+        PIOJO_ASSERT(cnt == piojo_skiplist_size(list));
+        PIOJO_ASSERT(piojo_skiplist_at(cnt, list, NULL) == NULL);
+        i = 5000;
+        PIOJO_ASSERT(piojo_skiplist_rank(&i, list) == cnt);
+
+        for (lo = -10; lo < 2010; lo += 37){
+                for (hi = lo - 5; hi < 2010; hi += 101){
+                        cnt = 0;
+                        for (i = lo; i <= hi; ++i){
+                                cnt += (i >= 0 && i < 2000 && present[i]);
+                        }
+                        PIOJO_ASSERT(piojo_skiplist_count_range(&lo, &hi,
+                                                                list) == cnt);
+                }
+        }
+
+        piojo_skiplist_clear(list);
+        i = 1;
+        PIOJO_ASSERT(piojo_skiplist_rank(&i, list) == 0);
+        PIOJO_ASSERT(piojo_skiplist_insert(&i, &i, list));
+        PIOJO_ASSERT(*(const int*) piojo_skiplist_at(0, list, NULL) == 1);
+        piojo_skiplist_free(list);
+}
+
 void test_stress(void)
 {
         piojo_skiplist_t *list;
@@ -445,6 +638,10 @@ int main(void)
         test_first_last();
         test_next_prev();
         test_search();
+        test_cursor();
+        test_signed_keys();
+        test_node_reuse();
+        test_rank();
         test_stress();
         test_stress_rand();
         test_stress_set_rand();
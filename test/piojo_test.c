@@ -23,6 +23,10 @@
  *
  */
 
+/* Must be defined before any system header for pthreads. */
+#define _POSIX_C_SOURCE 200112L
+
+#include <pthread.h>
 #include <piojo_test.h>
 
 int alloc_cnt = 0;
@@ -51,3 +55,34 @@ piojo_alloc_if my_allocator = {
         my_realloc,
         my_free,
 };
+
+/* Reverse order of int keys. */
+int test_rev_cmp(const void *e1, const void *e2)
+{
+        int v1 = *(int*) e1;
+        int v2 = *(int*) e2;
+        return (v2 > v1) - (v2 < v1);
+}
+
+/*
+ * Runs TEST_THREAD_COUNT threads on @a data until they finish, thread i
+ * gets i * @a first_step as its first key.
+ */
+void test_run_workers(void* (*worker_cb)(void*), int first_step, void *data)
+{
+        pthread_t threads[TEST_THREAD_COUNT];
+        test_worker_t workers[TEST_THREAD_COUNT];
+        int i, ret;
+
+        for (i = 0; i < TEST_THREAD_COUNT; ++i){
+                workers[i].data = data;
+                workers[i].first = i * first_step;
+                ret = pthread_create(&threads[i], NULL, worker_cb,
+                                     &workers[i]);
+                PIOJO_ASSERT(ret == 0);
+        }
+        for (i = 0; i < TEST_THREAD_COUNT; ++i){
+                ret = pthread_join(threads[i], NULL);
+                PIOJO_ASSERT(ret == 0);
+        }
+}
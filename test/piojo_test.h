@@ -36,10 +36,17 @@
 #define PIOJO_ASSERT(cond) do{ assert(cond); } while(0)
 #define PIOJO_FAIL_IF(cond) do{ assert(! (cond)); } while(0)
 #define TEST_STRESS_COUNT 1000000
+#define TEST_THREAD_COUNT 8
 
 #define assert_allocator_init(val)
 #define assert_allocator_alloc(val)
 
+/* Argument of the threads started by test_run_workers(). */
+typedef struct {
+        void *data;
+        int first;
+} test_worker_t;
+
 extern piojo_alloc_if my_allocator;
 extern int alloc_cnt;
 extern int init_cnt;
@@ -48,4 +55,7 @@ void* my_alloc(size_t size);
 void* my_realloc(const void *ptr, size_t size);
 void my_free(const void *ptr);
 
+int test_rev_cmp(const void *e1, const void *e2);
+void test_run_workers(void* (*worker_cb)(void*), int first_step, void *data);
+
 #endif
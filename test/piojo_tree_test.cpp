@@ -26,6 +26,7 @@
 #include <map>
 #include <stdlib.h>
 #include <time.h>
+#include <pthread.h>
 #include <piojo_test.h>
 #include <piojo/piojo_tree.h>
 
@@ -397,6 +398,287 @@ void test_last_prev()
         piojo_tree_free(tree);
 }
 
+void test_cursor()
+{
+        piojo_tree_t *tree;
+        piojo_tree_cursor_t cursor;
+        const int *key;
+        int i, j, cnt;
+
+        tree = piojo_tree_alloc_cb_i32k(sizeof(int), my_allocator);
+        PIOJO_ASSERT(piojo_tree_cursor_first(tree, &cursor) == NULL);
+        PIOJO_ASSERT(piojo_tree_cursor_last(tree, &cursor) == NULL);
+        for (i = 0; i < 1024; i += 2){
+                j = i * 10;
+                piojo_tree_insert(&i, &j, tree);
+        }
+
+        cnt = 0;
+        key = (const int*) piojo_tree_cursor_first(tree, &cursor);
+        while (key != NULL){
+                PIOJO_ASSERT(*key == cnt * 2);
+                PIOJO_ASSERT(*(int*) piojo_tree_cursor_value(&cursor, tree) ==
+                             *key * 10);
+                ++cnt;
+                key = (const int*) piojo_tree_cursor_next(&cursor, tree);
+        }
+        PIOJO_ASSERT(cnt == 512);
+
+        key = (const int*) piojo_tree_cursor_last(tree, &cursor);
+        while (key != NULL){
+                --cnt;
+                PIOJO_ASSERT(*key == cnt * 2);
+                key = (const int*) piojo_tree_cursor_prev(&cursor, tree);
+        }
+        PIOJO_ASSERT(cnt == 0);
+
+        i = 512;
+        key = (const int*) piojo_tree_cursor_seek(&i, tree, &cursor);
+        PIOJO_ASSERT(*key == 512);
+        i = 513;
+        key = (const int*) piojo_tree_cursor_seek(&i, tree, &cursor);
+        PIOJO_ASSERT(*key == 514);
+        i = 1023;
+        PIOJO_ASSERT(piojo_tree_cursor_seek(&i, tree, &cursor) == NULL);
+
+        key = (const int*) piojo_tree_cursor_first(tree, &cursor);
+        while (key != NULL){
+                if (*key % 4 == 0){
+                        key = (const int*) piojo_tree_cursor_delete(&cursor,
+                                                                     tree);
+                }else{
+                        key = (const int*) piojo_tree_cursor_next(&cursor,
+                                                                   tree);
+                }
+        }
+        PIOJO_ASSERT(piojo_tree_size(tree) == 256);
+        for (i = 0; i < 1024; i += 2){
+                PIOJO_ASSERT((piojo_tree_search(&i, tree) != NULL) ==
+                             (i % 4 != 0));
+        }
+
+        piojo_tree_free(tree);
+        assert_allocator_alloc(0);
+}
+
+void test_node_reuse()
+{
+        piojo_tree_t *tree;
+        int i, j, *val;
+
+        tree = piojo_tree_alloc_cb_i32k(sizeof(int), my_allocator);
+        for (i = 0; i < 1000; ++i){
+                j = i * 10;
+                PIOJO_ASSERT(piojo_tree_insert(&i, &j, tree));
+        }
+
+        /* Entries don't move when other keys are deleted. */
+        i = 500;
+        val = (int*) piojo_tree_search(&i, tree);
+        for (i = 0; i < 1000; ++i){
+                if (i != 500){
+                        PIOJO_ASSERT(piojo_tree_delete(&i, tree));
+                }
+        }
+        i = 500;
+        PIOJO_ASSERT(piojo_tree_search(&i, tree) == val && *val == 5000);
+
+        /* Freed and cleared nodes are reused. */
+        for (i = 0; i < 1000; ++i){
+                j = i;
+                piojo_tree_set(&i, &j, tree);
+        }
+        piojo_tree_clear(tree);
+        PIOJO_ASSERT(piojo_tree_size(tree) == 0);
+        PIOJO_ASSERT(piojo_tree_first(tree, NULL) == NULL);
+        for (i = 999; i >= 0; --i){
+                PIOJO_ASSERT(piojo_tree_insert(&i, &i, tree));
+        }
+        for (i = 0; i < 1000; ++i){
+                PIOJO_ASSERT(*(int*) piojo_tree_search(&i, tree) == i);
+        }
+        piojo_tree_free(tree);
+        assert_allocator_alloc(0);
+}
+
+static void
+check_snapshot(const std::map<int, int>& ref, const piojo_tree_t *snap)
+{
+        std::map<int, int>::const_iterator it;
+        std::map<int, int>::const_reverse_iterator rit;
+        piojo_tree_cursor_t cursor;
+        const int *key;
+        void *data;
+        int k;
+
+        PIOJO_ASSERT(piojo_tree_size(snap) == ref.size());
+        for (k = -1; k <= 3000; ++k){
+                it = ref.find(k);
+                PIOJO_ASSERT((piojo_tree_search(&k, snap) != NULL) ==
+                             (it != ref.end()));
+                if (it != ref.end()){
+                        PIOJO_ASSERT(*(int*) piojo_tree_search(&k, snap) ==
+                                     it->second);
+                }
+        }
+
+        key = (const int*) piojo_tree_cursor_first(snap, &cursor);
+        for (it = ref.begin(); it != ref.end(); ++it){
+                PIOJO_ASSERT(key != NULL && *key == it->first);
+                PIOJO_ASSERT(*(int*) piojo_tree_cursor_value(&cursor, snap) ==
+                             it->second);
+                key = (const int*) piojo_tree_cursor_next(&cursor, snap);
+        }
+        PIOJO_ASSERT(key == NULL);
+        key = (const int*) piojo_tree_cursor_last(snap, &cursor);
+        for (rit = ref.rbegin(); rit != ref.rend(); ++rit){
+                PIOJO_ASSERT(key != NULL && *key == rit->first);
+                key = (const int*) piojo_tree_cursor_prev(&cursor, snap);
+        }
+        PIOJO_ASSERT(key == NULL);
+
+        key = (const int*) piojo_tree_first(snap, &data);
+        for (it = ref.begin(); it != ref.end(); ++it){
+                PIOJO_ASSERT(key != NULL && *key == it->first);
+                PIOJO_ASSERT(*(int*) data == it->second);
+                key = (const int*) piojo_tree_next(key, snap, &data);
+        }
+        PIOJO_ASSERT(key == NULL);
+        key = (const int*) piojo_tree_last(snap, NULL);
+        for (rit = ref.rbegin(); rit != ref.rend(); ++rit){
+                PIOJO_ASSERT(key != NULL && *key == rit->first);
+                key = (const int*) piojo_tree_prev(key, snap, NULL);
+        }
+        PIOJO_ASSERT(key == NULL);
+
+        for (k = -10; k < 3000; k += 250){
+                key = (const int*) piojo_tree_cursor_seek(&k, snap, &cursor);
+                it = ref.lower_bound(k);
+                PIOJO_ASSERT((key == NULL) == (it == ref.end()));
+                PIOJO_ASSERT(key == NULL || *key == it->first);
+        }
+}
+
+static void*
+read_snapshot(void *arg)
+{
+        const piojo_tree_t *snap = (const piojo_tree_t*) arg;
+        piojo_tree_cursor_t cursor;
+        const int *key;
+        int i, prev;
+
+        for (i = 0; i < 20; ++i){
+                prev = -1;
+                key = (const int*) piojo_tree_cursor_first(snap, &cursor);
+                while (key != NULL){
+                        PIOJO_ASSERT(*key == prev + 1);
+                        prev = *key;
+                        key = (const int*) piojo_tree_cursor_next(&cursor,
+                                                                   snap);
+                }
+                PIOJO_ASSERT(prev == 1999);
+        }
+        return NULL;
+}
+
+void test_snapshot()
+{
+        piojo_tree_t *tree, *snaps[9], *copy;
+        std::map<int, int> ref, refs[9];
+        piojo_tree_cursor_t cursor;
+        size_t s, scnt;
+        unsigned int seed = 13;
+        pthread_t reader;
+        const int *key;
+        int i, j, k;
+
+        tree = piojo_tree_alloc_mode_i32k(PIOJO_TREE_MODE_PERSISTENT,
+                                          sizeof(int), my_allocator);
+        for (i = 0, scnt = 0; i < 20000; ++i){
+                if (i % 2500 == 0){
+                        snaps[scnt] = piojo_tree_snapshot(tree);
+                        refs[scnt++] = ref;
+                }
+                seed = seed * 1103515245 + 12345;
+                k = (seed >> 8) % 3000;
+                j = k * 10 + i % 7;
+                if ((seed >> 4) % 3 == 0){
+                        piojo_tree_delete(&k, tree);
+                        ref.erase(k);
+                }else{
+                        piojo_tree_set(&k, &j, tree);
+                        ref[k] = j;
+                }
+        }
+        check_snapshot(ref, tree);
+        for (s = 0; s < scnt; ++s){
+                check_snapshot(refs[s], snaps[s]);
+        }
+
+        /* Cursor deletes copy the shared path too. */
+        snaps[scnt] = piojo_tree_snapshot(tree);
+        refs[scnt++] = ref;
+        key = (const int*) piojo_tree_cursor_first(tree, &cursor);
+        while (key != NULL){
+                k = *key;
+                if (k % 2 == 0){
+                        key = (const int*) piojo_tree_cursor_delete(&cursor,
+                                                                   tree);
+                        ref.erase(k);
+                }else{
+                        key = (const int*) piojo_tree_cursor_next(&cursor,
+                                                                 tree);
+                }
+        }
+        check_snapshot(ref, tree);
+        check_snapshot(refs[scnt - 1], snaps[scnt - 1]);
+
+        /* Snapshots outlive their tree and its copies. */
+        copy = piojo_tree_copy(snaps[scnt - 1]);
+        check_snapshot(refs[scnt - 1], copy);
+        for (s = 0; s < scnt; s += 2){
+                piojo_tree_free(snaps[s]);
+        }
+        piojo_tree_clear(tree);
+        PIOJO_ASSERT(piojo_tree_size(tree) == 0);
+        check_snapshot(refs[1], snaps[1]);
+        piojo_tree_free(tree);
+        piojo_tree_free(copy);
+        for (s = 1; s < scnt; s += 2){
+                check_snapshot(refs[s], snaps[s]);
+                piojo_tree_free(snaps[s]);
+        }
+        assert_allocator_alloc(0);
+
+        tree = piojo_tree_alloc_mode_i32k(PIOJO_TREE_MODE_PERSISTENT,
+                                          sizeof(int), my_allocator);
+        snaps[0] = piojo_tree_snapshot(tree);
+        ref.clear();
+        for (i = 0; i < 2000; ++i){
+                piojo_tree_insert(&i, &i, tree);
+                ref[i] = i;
+        }
+        PIOJO_ASSERT(piojo_tree_first(snaps[0], NULL) == NULL);
+        snaps[1] = piojo_tree_snapshot(tree);
+
+        /* Snapshot readers run while the tree is written. */
+        PIOJO_ASSERT(pthread_create(&reader, NULL, read_snapshot,
+                                    snaps[1]) == 0);
+        for (i = 0; i < 2000; i += 2){
+                PIOJO_ASSERT(piojo_tree_delete(&i, tree));
+                j = i + 5000;
+                PIOJO_ASSERT(piojo_tree_insert(&j, &j, tree));
+        }
+        PIOJO_ASSERT(pthread_join(reader, NULL) == 0);
+        check_snapshot(ref, snaps[1]);
+        PIOJO_ASSERT(piojo_tree_size(tree) == 2000);
+
+        piojo_tree_free(tree);
+        piojo_tree_free(snaps[0]);
+        piojo_tree_free(snaps[1]);
+        assert_allocator_alloc(0);
+}
+
 void test_tree_expand()
 {
         piojo_tree_t *tree;
@@ -657,6 +939,9 @@ int main()
         test_delete();
         test_first_next();
         test_last_prev();
+        test_cursor();
+        test_node_reuse();
+        test_snapshot();
         test_tree_expand();
         test_stress();
         test_stress_rand_uniq();